@@ -0,0 +1,106 @@
+//
+//  NullBackend.cpp
+//  Metal Playground Benchmark
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include "NullBackend.hpp"
+#include <cassert>
+#include "Profiler.hpp"
+
+NullBackend::NullBackend(DrawRecorder& recorder)
+: recorder(recorder)
+{
+    atlasTriInstanceBuffer.resize((size_t)recorder.atlasMaxInstanceCount * maxBuffersInFlight);
+    primitiveTriInstanceBuffer.resize((size_t)recorder.primitiveMaxInstanceCount * maxBuffersInFlight);
+    textTriVertexBuffer.resize((size_t)recorder.textMaxVertexCount * maxBuffersInFlight);
+}
+
+void NullBackend::beginFrame()
+{
+    triBufferIndex = (triBufferIndex + 1) % maxBuffersInFlight;
+    ++frameIndex;
+    recorder.beginFrame(atlasTriInstanceBuffer.data() + (size_t)recorder.atlasMaxInstanceCount * triBufferIndex,
+                        primitiveTriInstanceBuffer.data() + (size_t)recorder.primitiveMaxInstanceCount * triBufferIndex,
+                        textTriVertexBuffer.data() + (size_t)recorder.textMaxVertexCount * triBufferIndex);
+}
+
+NullFrameResult NullBackend::endFrame()
+{
+    NullFrameResult result;
+    result.batchCount = recorder.drawBatchCount;
+
+    // Same place the Renderer does it, between recording and encoding.
+    const uint64_t groupStartNs = Profiler::nowNs();
+    recorder.groupPrimitivesByShape();
+    recorder.cullOccludedDraws();
+    recorder.separateOpaqueDraws();
+    result.groupNs = Profiler::nowNs() - groupStartNs;
+    result.mixedPrimitiveInstanceCount = recorder.mixedPrimitiveInstanceCount;
+    result.opaqueInstanceCount = recorder.opaqueInstanceCount;
+    result.occludedInstanceCount = recorder.occludedInstanceCount;
+
+    for (int iBatch = 0; iBatch < recorder.drawBatchCount; ++iBatch) {
+        const DrawRecorder::DrawBatch batch = recorder.drawBatchesArr[iBatch];
+        assert(batch.count > 0);
+        assert(batch.startIndex >= 0);
+        switch (batch.type) {
+            case DrawRecorder::drawbatchtype_none:
+            case DrawRecorder::drawbatchtype_count: {
+                __builtin_printf("Draw Batch with invalid type %d\n", (int)batch.type);
+                assert(false);
+            } break;
+            case DrawRecorder::drawbatchtype_atlas:
+            case DrawRecorder::drawbatchtype_primitive:
+            case DrawRecorder::drawbatchtype_text: {
+                if (!batch.layer) {
+                    // Opaque batches are written twice, in draw order and the back to front copy the opaque pass reads.
+                    const size_t copyCount = batch.isOpaque ? 2 : 1;
+                    result.bytesWritten += copyCount * batch.count * recorder.strideSizesPtr[batch.type];
+                } else {
+                    result.bytesWritten += uploadLayer(*batch.layer);
+                }
+                ++result.drawCallCount;
+                // A panel is rendered into its texture, every batch of it, on the frame its layer was rebuilt.
+                if (batch.panel) {
+                    const size_t panelBytes = uploadLayer(batch.panel->layer);
+                    result.bytesWritten += panelBytes;
+                    if (panelBytes > 0) result.drawCallCount += (int)batch.panel->layer.batches.size();
+                }
+            } break;
+        }
+    }
+    return result;
+}
+
+size_t NullBackend::uploadLayer(const DrawRecorder::Layer& layer)
+{
+    UploadedLayer& uploaded = uploadedLayers[&layer];
+    if (uploaded.lastDrawnFrame == frameIndex) return 0; // with the layer's first batch this frame
+    uploaded.lastDrawnFrame = frameIndex;
+
+    if (uploaded.generation != layer.generation) {
+        // The whole layer, then later frames read the persistent copy.
+        uploaded.generation = layer.generation;
+        uploaded.copyIndex = 0;
+        for (size_t& size : uploaded.recentUpdateSizes) size = 0;
+        const int atlasCopyCount = layer.isUpdatedInPlace ? maxBuffersInFlight : 1;
+        return sizeof(AtlasInstanceData) * layer.atlasInstances.size() * atlasCopyCount
+            + sizeof(PrimitiveInstanceData) * layer.primitiveInstances.size()
+            + sizeof(TextVertex) * layer.textVertices.size();
+    }
+    if (!layer.isUpdatedInPlace) return 0;
+
+    // Same as the Renderer, the next copy catches up on every update since it was last written.
+    uploaded.copyIndex = (uploaded.copyIndex + 1) % maxBuffersInFlight;
+    std::vector<DrawRecorder::InstanceUpdate> updates;
+    recorder.collectInstanceUpdates(layer, updates);
+    size_t updateSize = 0;
+    for (const DrawRecorder::InstanceUpdate& update : updates) updateSize += DrawRecorder::instanceUpdateSize(update);
+    uploaded.recentUpdateSizes[uploaded.copyIndex] = updateSize;
+
+    size_t bytesWritten = 0;
+    for (size_t size : uploaded.recentUpdateSizes) bytesWritten += size;
+    return bytesWritten;
+}
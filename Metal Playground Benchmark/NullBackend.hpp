@@ -0,0 +1,58 @@
+//
+//  NullBackend.hpp
+//  Metal Playground Benchmark
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef NullBackend_hpp
+#define NullBackend_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+#include "DrawRecorder.hpp"
+
+struct NullFrameResult {
+    int batchCount = 0; // as recorded, before shape grouping
+    int drawCallCount = 0; // batches that would have hit drawPrimitives
+    size_t bytesWritten = 0; // layers count once, on the frame they're uploaded
+    uint64_t groupNs = 0; // DrawRecorder::groupPrimitivesByShape, cullOccludedDraws and separateOpaqueDraws
+    int mixedPrimitiveInstanceCount = 0; // left on the generic primitive pipeline
+    int opaqueInstanceCount = 0; // drawn in the opaque pass, front to back
+    int occludedInstanceCount = 0; // dropped, hidden behind later opaque draws
+};
+
+// Stands in for Renderer: same tri-buffered instance memory and the same walk over the batches at encode time, but the
+// buffers are plain host memory and encoding only tallies what would have been submitted.
+class NullBackend
+{
+public:
+    static const int maxBuffersInFlight = 3;
+
+    explicit NullBackend(DrawRecorder& recorder);
+
+    void beginFrame();
+    NullFrameResult endFrame();
+
+private:
+    DrawRecorder& recorder;
+    int triBufferIndex = 0;
+    std::vector<AtlasInstanceData> atlasTriInstanceBuffer;
+    std::vector<PrimitiveInstanceData> primitiveTriInstanceBuffer;
+    std::vector<TextVertex> textTriVertexBuffer;
+    int frameIndex = 0;
+
+    // Renderer::retainedLayerBuffers, only what it takes to count the bytes uploaded.
+    struct UploadedLayer {
+        uint64_t generation = 0;
+        int lastDrawnFrame = -1;
+        int copyIndex = 0;
+        size_t recentUpdateSizes[maxBuffersInFlight] = {}; // per copy, bytes of the updates it was last written for
+    };
+    std::map<const DrawRecorder::Layer*, UploadedLayer> uploadedLayers;
+    size_t uploadLayer(const DrawRecorder::Layer& layer);
+};
+
+#endif /* NullBackend_hpp */
@@ -0,0 +1,106 @@
+//
+//  DamageTrackerTests.cpp
+//  Metal Playground Benchmark
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+// DamageTracker on frames of small rects placed in the middle of chosen tiles: a frame the same as the last damages
+// nothing, a moved rect damages the tiles it left and the ones it moved to, and more than maxRectCount changed areas
+// collapse into their bounding box.
+
+#include <algorithm>
+#include <vector>
+#include "DamageTracker.hpp"
+#include "ShaderTypes.h"
+#include "TestCheck.hpp"
+
+static const int screenWidth = 1024; // 16 x 12 tiles
+static const int screenHeight = 768;
+static const simd_float4 clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+struct TileCoord {
+    int x, y;
+};
+
+struct RecorderMemory {
+    std::vector<AtlasInstanceData> atlasInstances;
+    std::vector<PrimitiveInstanceData> primitiveInstances;
+    std::vector<TextVertex> textVertices;
+
+    explicit RecorderMemory(const DrawRecorder& recorder)
+        : atlasInstances(recorder.atlasMaxInstanceCount), primitiveInstances(recorder.primitiveMaxInstanceCount), textVertices(recorder.textMaxVertexCount) {}
+    void beginFrame(DrawRecorder& recorder) { recorder.beginFrame(atlasInstances.data(), primitiveInstances.data(), textVertices.data()); }
+};
+
+// A 16 unit rect in the middle of each tile (tiles are counted from the top left like DamageRect), the camera at rest
+// so a unit is a pixel. Then what the tracker sees of the frame.
+static void updateWithRects(DrawRecorder& recorder, RecorderMemory& memory, DamageTracker& tracker, const std::vector<TileCoord>& tiles)
+{
+    memory.beginFrame(recorder);
+    for (const TileCoord& tile : tiles) {
+        const float centerX = tile.x * DamageTracker::tileSize + DamageTracker::tileSize * 0.5f - screenWidth * 0.5f;
+        const float centerY = screenHeight * 0.5f - (tile.y * DamageTracker::tileSize + DamageTracker::tileSize * 0.5f);
+        recorder.drawPrimitiveRect(centerX - 8.0f, centerY - 8.0f, 16.0f, 16.0f, 255, 255, 255, 255);
+    }
+    recorder.groupPrimitivesByShape();
+    tracker.update(recorder, screenWidth, screenHeight, clearColor);
+}
+
+static bool isTileRect(const DamageRect& rect, int tileX, int tileY, int tileCountX, int tileCountY)
+{
+    return rect.x == tileX * DamageTracker::tileSize && rect.y == tileY * DamageTracker::tileSize
+        && rect.width == tileCountX * DamageTracker::tileSize && rect.height == tileCountY * DamageTracker::tileSize;
+}
+
+int main()
+{
+    DrawRecorder recorder;
+    recorder.setScreenSize((CGSize){ (double)screenWidth, (double)screenHeight });
+    RecorderMemory memory(recorder);
+
+    // The first frame has nothing to compare with.
+    DamageTracker tracker;
+    updateWithRects(recorder, memory, tracker, { { 2, 2 } });
+    CHECK(tracker.isFullDamage());
+    CHECK(tracker.damagedFraction() == 1.0);
+
+    // Static: the same frame again damages nothing and can be skipped.
+    updateWithRects(recorder, memory, tracker, { { 2, 2 } });
+    CHECK(tracker.rects().empty());
+    CHECK(!tracker.isFullDamage());
+    CHECK(tracker.damagedPixelCount() == 0);
+    CHECK(tracker.isFrameUnchanged(recorder));
+
+    // One rect moved along the row: the tile it left and the one it's in now, nothing between them.
+    updateWithRects(recorder, memory, tracker, { { 5, 2 } });
+    std::vector<DamageRect> rects = tracker.rects();
+    std::sort(rects.begin(), rects.end(), [](const DamageRect& a, const DamageRect& b) { return a.x < b.x; });
+    CHECK(!tracker.isFullDamage());
+    CHECK(rects.size() == 2);
+    if (rects.size() == 2) {
+        CHECK(isTileRect(rects[0], 2, 2, 1, 1));
+        CHECK(isTileRect(rects[1], 5, 2, 1, 1));
+    }
+    CHECK(tracker.damagedPixelCount() == 2 * DamageTracker::tileSize * DamageTracker::tileSize);
+    CHECK(!tracker.isFrameUnchanged(recorder));
+
+    // After an empty frame, rects in the tiles of a diagonal damage a disjoint rect each. Past maxRectCount they're one
+    // rect over all of them, still short of full damage.
+    std::vector<TileCoord> diagonal;
+    for (int i = 0; i <= DamageTracker::maxRectCount; ++i) diagonal.push_back((TileCoord){ i, i });
+    updateWithRects(recorder, memory, tracker, {});
+    updateWithRects(recorder, memory, tracker, diagonal);
+    const int diagonalSize = DamageTracker::maxRectCount + 1;
+    CHECK(!tracker.isFullDamage());
+    CHECK(tracker.rects().size() == 1);
+    if (tracker.rects().size() == 1) CHECK(isTileRect(tracker.rects()[0], 0, 0, diagonalSize, diagonalSize));
+
+    // maxRectCount of them stay separate.
+    diagonal.pop_back();
+    updateWithRects(recorder, memory, tracker, {});
+    updateWithRects(recorder, memory, tracker, diagonal);
+    CHECK((int)tracker.rects().size() == DamageTracker::maxRectCount);
+
+    return testResult("damage_tracker");
+}
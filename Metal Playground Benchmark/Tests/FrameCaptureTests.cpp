@@ -0,0 +1,191 @@
+//
+//  FrameCaptureTests.cpp
+//  Metal Playground Benchmark
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+// FrameCapture write / load / replay and load's rejection of truncated and corrupt files. The capture → replay → image
+// round trip against the golden images is the replay_* tests in CMakeLists.txt.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "FrameCapture.hpp"
+#include "ShaderTypes.h"
+#include "TestCheck.hpp"
+
+static const char* capturePath = "frame_capture_tests.mpfc";
+static const char* corruptPath = "frame_capture_tests_corrupt.mpfc";
+
+struct RecorderMemory {
+    std::vector<AtlasInstanceData> atlasInstances;
+    std::vector<PrimitiveInstanceData> primitiveInstances;
+    std::vector<TextVertex> textVertices;
+
+    explicit RecorderMemory(const DrawRecorder& recorder)
+        : atlasInstances(recorder.atlasMaxInstanceCount), primitiveInstances(recorder.primitiveMaxInstanceCount), textVertices(recorder.textMaxVertexCount) {}
+    void beginFrame(DrawRecorder& recorder) { recorder.beginFrame(atlasInstances.data(), primitiveInstances.data(), textVertices.data()); }
+};
+
+// Primitives only, no assets needed: an unclipped rect, then a clipped circle and outline.
+static void recordFrame(DrawRecorder& recorder)
+{
+    recorder.drawPrimitiveRect(-200.0f, -100.0f, 400.0f, 200.0f, 40, 40, 60, 255);
+    recorder.pushClipRect(-50.0f, -50.0f, 100.0f, 100.0f);
+    recorder.drawPrimitiveCircle(0.0f, 0.0f, 60.0f, 200, 80, 40, 255);
+    recorder.drawPrimitiveCircleLines(10.0f, 10.0f, 30.0f, 4.0f, 255, 255, 255, 128);
+    recorder.popClipRect();
+}
+
+static std::vector<uint8_t> readFile(const char* path)
+{
+    std::vector<uint8_t> bytes;
+    FILE* file = fopen(path, "rb");
+    if (!file) return bytes;
+    uint8_t buffer[4096];
+    for (size_t readCount; (readCount = fread(buffer, 1, sizeof(buffer), file)) > 0;) bytes.insert(bytes.end(), buffer, buffer + readCount);
+    fclose(file);
+    return bytes;
+}
+
+static bool writeFile(const char* path, const uint8_t* bytes, size_t size)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    const bool isWritten = fwrite(bytes, 1, size, file) == size;
+    return fclose(file) == 0 && isWritten;
+}
+
+static bool loadsCorrupted(const std::vector<uint8_t>& bytes, const DrawRecorder& recorder)
+{
+    std::vector<CapturedFrame> frames;
+    CHECK(writeFile(corruptPath, bytes.data(), bytes.size()));
+    return FrameCapture::load(corruptPath, recorder, frames);
+}
+
+int main()
+{
+    DrawRecorder recorder;
+    recorder.setScreenSize((CGSize){ 320.0, 240.0 });
+    RecorderMemory memory(recorder);
+    memory.beginFrame(recorder);
+    recordFrame(recorder);
+
+    CapturedFrame captured;
+    FrameCapture::capture(recorder, 7, captured);
+    CHECK(captured.batches.size() == 1 && captured.batches[0].count == 3);
+    CHECK(captured.clipRects.size() == 2);
+    {
+        FrameCaptureWriter writer(capturePath);
+        CHECK(writer.isOpen());
+        CHECK(writer.write(captured) && writer.write(captured));
+        CHECK(writer.close());
+    }
+
+    // Loads back exactly as captured.
+    std::vector<CapturedFrame> frames;
+    CHECK(FrameCapture::load(capturePath, recorder, frames));
+    CHECK(frames.size() == 2);
+    for (const CapturedFrame& frame : frames) {
+        CHECK(memcmp(&frame.header, &captured.header, sizeof(frame.header)) == 0);
+        CHECK(frame.batches.size() == captured.batches.size()
+              && memcmp(frame.batches.data(), captured.batches.data(), frame.batches.size() * sizeof(FrameCaptureBatch)) == 0);
+        CHECK(frame.clipRects.size() == captured.clipRects.size()
+              && memcmp(frame.clipRects.data(), captured.clipRects.data(), frame.clipRects.size() * sizeof(simd_float4)) == 0);
+        CHECK(frame.payload == captured.payload);
+    }
+
+    // Replayed into a fresh recorder, the frame records the same instances and clip rects.
+    if (!frames.empty()) {
+        DrawRecorder replayRecorder;
+        RecorderMemory replayMemory(replayRecorder);
+        replayMemory.beginFrame(replayRecorder);
+        FrameCapture::replay(frames[0], replayRecorder);
+        CHECK(replayRecorder.primitiveInstanceCount == recorder.primitiveInstanceCount);
+        CHECK(replayRecorder.drawBatchCount == recorder.drawBatchCount);
+        CHECK(replayRecorder.screenSize.width == 320.0 && replayRecorder.screenSize.height == 240.0);
+        CHECK(replayRecorder.clipRects.size() == recorder.clipRects.size());
+        CHECK(memcmp(replayMemory.primitiveInstances.data(), memory.primitiveInstances.data(),
+                     sizeof(PrimitiveInstanceData) * recorder.primitiveInstanceCount) == 0);
+    }
+
+    // Offsets into the file of the first frame's parts.
+    const std::vector<uint8_t> bytes = readFile(capturePath);
+    const size_t frameHeaderOffset = sizeof(FrameCaptureFileHeader);
+    const size_t batchesOffset = frameHeaderOffset + sizeof(FrameCaptureFrameHeader);
+    const size_t clipRectsOffset = batchesOffset + captured.batches.size() * sizeof(FrameCaptureBatch);
+    const size_t payloadOffset = clipRectsOffset + captured.clipRects.size() * sizeof(simd_float4);
+    const size_t frameSize = payloadOffset + captured.payload.size() - frameHeaderOffset;
+    CHECK(bytes.size() == sizeof(FrameCaptureFileHeader) + 2 * frameSize);
+    CHECK(loadsCorrupted(bytes, recorder));
+
+    // Truncated anywhere, file header to the last payload byte.
+    const size_t truncatedSizes[] = {
+        0, 4, sizeof(FrameCaptureFileHeader) - 1, sizeof(FrameCaptureFileHeader), batchesOffset - 1, clipRectsOffset - 1,
+        payloadOffset - 1, payloadOffset + sizeof(PrimitiveInstanceData), frameHeaderOffset + frameSize, bytes.size() - 1
+    };
+    for (const size_t size : truncatedSizes) {
+        CHECK(!loadsCorrupted(std::vector<uint8_t>(bytes.begin(), bytes.begin() + size), recorder));
+    }
+
+    // The second primitive (the clipped circle) pointed past the clip rect table, in the first frame and the last.
+    for (const size_t frameOffset : { (size_t)0, frameSize }) {
+        for (const uint32_t clipIndex : { (uint32_t)captured.clipRects.size(), (uint32_t)DrawRecorder::clipRectMaxCount, UINT32_MAX }) {
+            std::vector<uint8_t> corrupt = bytes;
+            memcpy(&corrupt[frameOffset + payloadOffset + sizeof(PrimitiveInstanceData) + offsetof(PrimitiveInstanceData, clipIndex)], &clipIndex, sizeof(clipIndex));
+            CHECK(!loadsCorrupted(corrupt, recorder));
+        }
+    }
+    // The last in range index still loads.
+    {
+        std::vector<uint8_t> corrupt = bytes;
+        const uint32_t clipIndex = (uint32_t)captured.clipRects.size() - 1;
+        memcpy(&corrupt[payloadOffset + offsetof(PrimitiveInstanceData, clipIndex)], &clipIndex, sizeof(clipIndex));
+        CHECK(loadsCorrupted(corrupt, recorder));
+    }
+
+    // Shape types the shaders don't have.
+    for (const int32_t shapeType : { (int32_t)-1, (int32_t)DrawRecorder::primitiveShapeTypeCount, INT32_MAX }) {
+        std::vector<uint8_t> corrupt = bytes;
+        memcpy(&corrupt[payloadOffset + offsetof(PrimitiveInstanceData, shapeType)], &shapeType, sizeof(shapeType));
+        CHECK(!loadsCorrupted(corrupt, recorder));
+    }
+
+    // Zero, negative, NaN and oversized screens.
+    for (const double size : { 0.0, -320.0, (double)NAN, frameCaptureMaxScreenSize * 2.0 }) {
+        for (const size_t field : { offsetof(FrameCaptureFrameHeader, screenWidth), offsetof(FrameCaptureFrameHeader, screenHeight) }) {
+            std::vector<uint8_t> corrupt = bytes;
+            memcpy(&corrupt[frameHeaderOffset + field], &size, sizeof(size));
+            CHECK(!loadsCorrupted(corrupt, recorder));
+        }
+    }
+
+    // Batch type and screen space flag out of range, and counts that don't match the payload.
+    {
+        std::vector<uint8_t> corrupt = bytes;
+        const uint32_t type = DrawRecorder::drawbatchtype_count;
+        memcpy(&corrupt[batchesOffset + offsetof(FrameCaptureBatch, type)], &type, sizeof(type));
+        CHECK(!loadsCorrupted(corrupt, recorder));
+        corrupt = bytes;
+        const uint32_t count = 2;
+        memcpy(&corrupt[batchesOffset + offsetof(FrameCaptureBatch, count)], &count, sizeof(count));
+        CHECK(!loadsCorrupted(corrupt, recorder));
+        corrupt = bytes;
+        const uint32_t isScreenSpace = 2;
+        memcpy(&corrupt[batchesOffset + offsetof(FrameCaptureBatch, isScreenSpace)], &isScreenSpace, sizeof(isScreenSpace));
+        CHECK(!loadsCorrupted(corrupt, recorder));
+        corrupt = bytes;
+        const uint32_t frameCount = 3;
+        memcpy(&corrupt[offsetof(FrameCaptureFileHeader, frameCount)], &frameCount, sizeof(frameCount));
+        CHECK(!loadsCorrupted(corrupt, recorder));
+    }
+
+    remove(capturePath);
+    remove(corruptPath);
+    return testResult("frame_capture");
+}
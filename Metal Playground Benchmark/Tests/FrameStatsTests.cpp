@@ -0,0 +1,176 @@
+//
+//  FrameStatsTests.cpp
+//  Metal Playground Benchmark
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+// FrameTimeHistogram's buckets, percentiles, reset and clamping of values past maxValueUs, and ResolutionScaler
+// stepping down over budget, back up under it, waiting settleFrameCount frames between changes and staying inside its
+// min and max scale.
+
+#include <cstdint>
+#include "FrameStats.hpp"
+#include "TestCheck.hpp"
+
+static const uint64_t frameBudgetNs = 16666667; // 60Hz, 15ms of it with ResolutionScaler's headroom
+
+static float scaleForSteps(int steps)
+{
+    return (float)steps / ResolutionScaler::scaleStepCount;
+}
+
+// The scale after count frames of the same times.
+static float addFrames(ResolutionScaler& scaler, int count, uint64_t gpuNs, uint64_t cpuNs)
+{
+    float scale = scaler.scale();
+    for (int i = 0; i < count; ++i) scale = scaler.addFrame(gpuNs, cpuNs);
+    return scale;
+}
+
+static void testHistogramBuckets()
+{
+    // Every value lands in a bucket that holds it, and the buckets tile the range without gaps.
+    for (int i = 0; i + 1 < FrameTimeHistogram::bucketCount; ++i) {
+        CHECK(FrameTimeHistogram::bucketUpperBound(i) == FrameTimeHistogram::bucketLowerBound(i + 1));
+    }
+    for (const uint64_t value : { (uint64_t)0, (uint64_t)127, (uint64_t)128, (uint64_t)1000, (uint64_t)16667, (uint64_t)999999, FrameTimeHistogram::maxValueUs }) {
+        const int index = FrameTimeHistogram::bucketIndex(value);
+        CHECK(FrameTimeHistogram::bucketLowerBound(index) <= value && value < FrameTimeHistogram::bucketUpperBound(index));
+    }
+    // Exact below subBucketCount, within 1 / subBucketHalfCount above it.
+    CHECK(FrameTimeHistogram::bucketUpperBound(FrameTimeHistogram::bucketIndex(100)) - FrameTimeHistogram::bucketLowerBound(FrameTimeHistogram::bucketIndex(100)) == 1);
+    const int index = FrameTimeHistogram::bucketIndex(16667);
+    CHECK((FrameTimeHistogram::bucketUpperBound(index) - FrameTimeHistogram::bucketLowerBound(index)) * FrameTimeHistogram::subBucketHalfCount <= 16667);
+}
+
+static void testHistogramPercentiles()
+{
+    FrameTimeHistogram histogram;
+    CHECK(histogram.totalCount() == 0 && histogram.percentileUs(50) == 0 && histogram.minUs() == 0 && histogram.meanUs() == 0.0);
+
+    for (uint64_t value = 1; value <= 100; ++value) histogram.record(value);
+    CHECK(histogram.totalCount() == 100);
+    CHECK(histogram.minUs() == 1 && histogram.maxUs() == 100);
+    CHECK(histogram.meanUs() == 50.5);
+    CHECK(histogram.percentileUs(0) == 1);
+    CHECK(histogram.percentileUs(50) == 50);
+    CHECK(histogram.percentileUs(99) == 99);
+    CHECK(histogram.percentileUs(100) == 100);
+    CHECK(histogram.percentileUs(-5) == 1 && histogram.percentileUs(250) == 100); // clamped to [0, 100]
+
+    // One slow frame in a hundred is the p100 and nothing below it, to within its bucket.
+    histogram.reset();
+    for (int i = 0; i < 99; ++i) histogram.record(16667);
+    histogram.record(50000);
+    const uint64_t p50 = histogram.percentileUs(50);
+    const uint64_t p100 = histogram.percentileUs(100);
+    CHECK(p50 >= 16667 - 16667 / FrameTimeHistogram::subBucketHalfCount && p50 <= 16667 + 16667 / FrameTimeHistogram::subBucketHalfCount);
+    CHECK(histogram.percentileUs(99) == p50);
+    CHECK(p100 >= 50000 - 50000 / FrameTimeHistogram::subBucketHalfCount && p100 <= 50000);
+}
+
+static void testHistogramReset()
+{
+    FrameTimeHistogram histogram;
+    for (uint64_t value = 1000; value < 2000; value += 10) histogram.record(value);
+    histogram.reset();
+    CHECK(histogram.totalCount() == 0);
+    CHECK(histogram.percentileUs(50) == 0);
+    CHECK(histogram.minUs() == 0 && histogram.maxUs() == 0 && histogram.meanUs() == 0.0);
+
+    // Nothing of what came before is left in the buckets.
+    histogram.record(5);
+    CHECK(histogram.totalCount() == 1);
+    CHECK(histogram.percentileUs(0) == 5 && histogram.percentileUs(100) == 5);
+}
+
+static void testHistogramOverflow()
+{
+    // Past maxValueUs everything shares the last bucket, nothing is written past it.
+    const int lastIndex = FrameTimeHistogram::bucketCount - 1;
+    CHECK(FrameTimeHistogram::bucketIndex(FrameTimeHistogram::maxValueUs) == lastIndex);
+    CHECK(FrameTimeHistogram::bucketIndex(FrameTimeHistogram::maxValueUs + 1) == lastIndex);
+    CHECK(FrameTimeHistogram::bucketIndex(UINT64_MAX) == lastIndex);
+    CHECK(FrameTimeHistogram::bucketUpperBound(lastIndex) == FrameTimeHistogram::maxValueUs + 1);
+
+    FrameTimeHistogram histogram;
+    histogram.record(100);
+    histogram.record(FrameTimeHistogram::maxValueUs * 4);
+    CHECK(histogram.totalCount() == 2);
+    CHECK(histogram.maxUs() == FrameTimeHistogram::maxValueUs * 4); // the recorded value, only its bucket is clamped
+    CHECK(histogram.percentileUs(100) >= FrameTimeHistogram::bucketLowerBound(lastIndex));
+    CHECK(histogram.percentileUs(100) < FrameTimeHistogram::bucketUpperBound(lastIndex));
+    CHECK(histogram.percentileUs(50) == 100);
+}
+
+static void testScalerStepsDownOverBudget()
+{
+    ResolutionScaler scaler;
+    scaler.setFrameBudget(frameBudgetNs);
+    CHECK(scaler.scale() == 1.0f);
+
+    // GPU bound at twice the budget: nothing until it settles, then straight to the scale that should fit, 20 * sqrt(1 / 2)
+    // steps rounded down.
+    CHECK(addFrames(scaler, ResolutionScaler::settleFrameCount - 1, 30000000, 5000000) == 1.0f);
+    CHECK(scaler.addFrame(30000000, 5000000) == scaleForSteps(14));
+
+    // Hysteresis: still over budget, but it waits settleFrameCount frames for times at the new scale.
+    CHECK(addFrames(scaler, ResolutionScaler::settleFrameCount - 1, 30000000, 5000000) == scaleForSteps(14));
+    CHECK(scaler.addFrame(30000000, 5000000) < scaleForSteps(14));
+
+    // Unknown GPU times don't count as frames.
+    const float scale = scaler.scale();
+    CHECK(addFrames(scaler, ResolutionScaler::settleFrameCount * 4, 0, 5000000) == scale);
+}
+
+static void testScalerIgnoresCpuBound()
+{
+    // Lowering the resolution doesn't help when the CPU is the slower one.
+    ResolutionScaler scaler;
+    scaler.setFrameBudget(frameBudgetNs);
+    CHECK(addFrames(scaler, ResolutionScaler::settleFrameCount * 4, 30000000, 40000000) == 1.0f);
+}
+
+static void testScalerClampsAndStepsUp()
+{
+    ResolutionScaler scaler;
+    scaler.setFrameBudget(frameBudgetNs);
+
+    // Far over budget, it stops at the minimum scale however long it lasts.
+    CHECK(addFrames(scaler, ResolutionScaler::settleFrameCount, 1000000000, 5000000) == scaleForSteps(ResolutionScaler::minScaleSteps));
+    CHECK(addFrames(scaler, ResolutionScaler::settleFrameCount * 4, 1000000000, 5000000) == scaleForSteps(ResolutionScaler::minScaleSteps));
+
+    // Well under budget, back up one step at a time once the average catches up, settleFrameCount frames apart.
+    int frameCount = 0;
+    while (scaler.addFrame(2000000, 1000000) == scaleForSteps(ResolutionScaler::minScaleSteps) && frameCount < 1000) ++frameCount;
+    CHECK(scaler.scale() == scaleForSteps(ResolutionScaler::minScaleSteps + 1));
+    CHECK(addFrames(scaler, ResolutionScaler::settleFrameCount - 1, 2000000, 1000000) == scaleForSteps(ResolutionScaler::minScaleSteps + 1));
+    CHECK(scaler.addFrame(2000000, 1000000) == scaleForSteps(ResolutionScaler::minScaleSteps + 2));
+
+    // And no further than full resolution.
+    const int remainingSteps = ResolutionScaler::scaleStepCount - (ResolutionScaler::minScaleSteps + 2);
+    CHECK(addFrames(scaler, ResolutionScaler::settleFrameCount * remainingSteps, 2000000, 1000000) == 1.0f);
+    CHECK(addFrames(scaler, ResolutionScaler::settleFrameCount * 4, 2000000, 1000000) == 1.0f);
+
+    // Just under budget, the next step up wouldn't fit, it stays.
+    ResolutionScaler nearBudgetScaler;
+    nearBudgetScaler.setFrameBudget(frameBudgetNs);
+    CHECK(addFrames(nearBudgetScaler, ResolutionScaler::settleFrameCount, 18000000, 5000000) < 1.0f);
+    const float settledScale = nearBudgetScaler.scale();
+    const double stepGrowth = (double)(settledScale * ResolutionScaler::scaleStepCount + 1) / (settledScale * ResolutionScaler::scaleStepCount);
+    const uint64_t nearBudgetNs = (uint64_t)(frameBudgetNs * ResolutionScaler::budgetHeadroom / (stepGrowth * stepGrowth)) + 100000;
+    CHECK(addFrames(nearBudgetScaler, ResolutionScaler::settleFrameCount * 8, nearBudgetNs, 5000000) == settledScale);
+}
+
+int main()
+{
+    testHistogramBuckets();
+    testHistogramPercentiles();
+    testHistogramReset();
+    testHistogramOverflow();
+    testScalerStepsDownOverBudget();
+    testScalerIgnoresCpuBound();
+    testScalerClampsAndStepsUp();
+    return testResult("frame_stats");
+}
@@ -0,0 +1,157 @@
+//
+//  KTX2Tests.cpp
+//  Metal Playground Benchmark
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+// parseKTX2 against files built in memory: a minimal valid one, then the same file broken one way at a time.
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include "KTX2.hpp"
+#include "TestCheck.hpp"
+
+static const size_t headerSize = 80;
+static const size_t levelIndexSize = 24;
+
+static void writeU32(std::vector<uint8_t>& file, size_t offset, uint32_t value) { memcpy(file.data() + offset, &value, sizeof(value)); }
+static void writeU64(std::vector<uint8_t>& file, size_t offset, uint64_t value) { memcpy(file.data() + offset, &value, sizeof(value)); }
+
+// 8x8 BC1 with both of its levels (8x8: 2x2 blocks, 4x4: 1 block), no data format descriptor.
+static std::vector<uint8_t> makeMinimalFile()
+{
+    const size_t level0Length = 4 * 8;
+    const size_t level1Length = 8;
+    const size_t level0Offset = headerSize + levelIndexSize * 2; // 128, a multiple of 8 already
+    const size_t level1Offset = level0Offset + level0Length;
+    std::vector<uint8_t> file(level1Offset + level1Length, 0);
+
+    static const uint8_t identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+    memcpy(file.data(), identifier, sizeof(identifier));
+    writeU32(file, 12, ktx2format_bc1_rgba_unorm);
+    writeU32(file, 16, 1); // typeSize
+    writeU32(file, 20, 8); // pixelWidth
+    writeU32(file, 24, 8); // pixelHeight
+    writeU32(file, 36, 1); // faceCount
+    writeU32(file, 40, 2); // levelCount
+
+    writeU64(file, headerSize, level0Offset);
+    writeU64(file, headerSize + 8, level0Length);
+    writeU64(file, headerSize + 16, level0Length);
+    writeU64(file, headerSize + levelIndexSize, level1Offset);
+    writeU64(file, headerSize + levelIndexSize + 8, level1Length);
+    writeU64(file, headerSize + levelIndexSize + 16, level1Length);
+    for (size_t i = level0Offset; i < file.size(); ++i) file[i] = (uint8_t)i;
+    return file;
+}
+
+static bool parses(const std::vector<uint8_t>& file, size_t size, std::string* outError = nullptr)
+{
+    KTX2Image image;
+    return parseKTX2(file.data(), size, image, outError);
+}
+
+static void testValidMinimalFile()
+{
+    const std::vector<uint8_t> file = makeMinimalFile();
+    KTX2Image image;
+    std::string error;
+    CHECK(parseKTX2(file.data(), file.size(), image, &error));
+    CHECK(error.empty());
+    CHECK(image.format == ktx2format_bc1_rgba_unorm);
+    CHECK(image.width == 8 && image.height == 8);
+    CHECK(!image.isPremultiplied);
+    CHECK(image.levels.size() == 2);
+    if (image.levels.size() == 2) {
+        CHECK(image.levels[0].width == 8 && image.levels[0].height == 8);
+        CHECK(image.levels[0].offset == 128 && image.levels[0].length == 32 && image.levels[0].bytesPerRow == 16);
+        CHECK(image.levels[1].width == 4 && image.levels[1].height == 4);
+        CHECK(image.levels[1].offset == 160 && image.levels[1].length == 8 && image.levels[1].bytesPerRow == 8);
+    }
+}
+
+static void testTruncation()
+{
+    const std::vector<uint8_t> file = makeMinimalFile();
+    std::string error;
+    CHECK(!parses(file, 0, &error));
+    CHECK(!parses(file, headerSize - 1, &error));
+    CHECK(error == "File too small for a KTX2 header");
+    CHECK(!parses(file, headerSize + levelIndexSize, &error)); // second level's index is cut off
+    CHECK(error == "Truncated level index");
+    CHECK(!parses(file, file.size() - 1, &error)); // last level's data is one byte short
+    CHECK(error == "Level data out of bounds");
+    KTX2Image image;
+    CHECK(!parseKTX2(nullptr, file.size(), image, nullptr));
+}
+
+static void testBadIdentifier()
+{
+    for (size_t iByte = 0; iByte < 12; ++iByte) {
+        std::vector<uint8_t> file = makeMinimalFile();
+        file[iByte] ^= 0xFF;
+        std::string error;
+        CHECK(!parses(file, file.size(), &error));
+        CHECK(error == "Missing KTX2 identifier");
+    }
+}
+
+static void testLevelOutOfBounds()
+{
+    std::string error;
+    {
+        std::vector<uint8_t> file = makeMinimalFile();
+        writeU64(file, headerSize + levelIndexSize, file.size()); // starts right at the end, aligned
+        CHECK(!parses(file, file.size(), &error));
+        CHECK(error == "Level data out of bounds");
+    }
+    {
+        std::vector<uint8_t> file = makeMinimalFile();
+        writeU64(file, headerSize, 1ull << 62); // far past the end, and past anything size_t math could wrap back into
+        CHECK(!parses(file, file.size(), &error));
+        CHECK(error == "Level data out of bounds");
+    }
+    {
+        // Lengths have to match the level's dimensions, so a length running past the end is caught either way.
+        std::vector<uint8_t> file = makeMinimalFile();
+        writeU64(file, headerSize + levelIndexSize + 8, 1ull << 40);
+        writeU64(file, headerSize + levelIndexSize + 16, 1ull << 40);
+        CHECK(!parses(file, file.size(), &error));
+    }
+}
+
+static void testUnsupportedFormat()
+{
+    std::vector<uint8_t> file = makeMinimalFile();
+    writeU32(file, 12, 109); // VK_FORMAT_R32G32B32A32_SFLOAT
+    std::string error;
+    CHECK(!parses(file, file.size(), &error));
+    CHECK(error == "Unsupported vkFormat");
+    writeU32(file, 12, ktx2format_undefined);
+    CHECK(!parses(file, file.size(), &error));
+    CHECK(error == "Unsupported vkFormat");
+}
+
+static void testSupercompression()
+{
+    for (uint32_t scheme = 1; scheme <= 3; ++scheme) { // BasisLZ, zstd, zlib
+        std::vector<uint8_t> file = makeMinimalFile();
+        writeU32(file, 44, scheme);
+        std::string error;
+        CHECK(!parses(file, file.size(), &error));
+        CHECK(error == "Supercompressed (BasisLZ / zstd) data is not supported");
+    }
+}
+
+int main()
+{
+    testValidMinimalFile();
+    testTruncation();
+    testBadIdentifier();
+    testLevelOutOfBounds();
+    testUnsupportedFormat();
+    testSupercompression();
+    return testResult("KTX2Tests");
+}
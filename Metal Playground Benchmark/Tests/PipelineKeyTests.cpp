@@ -0,0 +1,180 @@
+//
+//  PipelineKeyTests.cpp
+//  Metal Playground Benchmark
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+// PipelineKey hashing / equality and PipelineTable, no device needed. Enum values are raw numbers standing in for the
+// MTL ones.
+
+#include "PipelineKey.hpp"
+#include "TestCheck.hpp"
+
+static PipelineKey makeBlendedKey()
+{
+    PipelineKey key;
+    key.vertexFunction = "vertex_primitive";
+    key.fragmentFunction = "fragment_primitive";
+    key.colorPixelFormat = 80; // BGRA8Unorm
+    key.blendingEnabled = true;
+    key.rgbBlendOperation = 0;
+    key.alphaBlendOperation = 0;
+    key.sourceRGBBlendFactor = 4;
+    key.destinationRGBBlendFactor = 5;
+    key.sourceAlphaBlendFactor = 1;
+    key.destinationAlphaBlendFactor = 5;
+    key.addFunctionConstant(0, 53, 1); // Bool
+    key.addFunctionConstant(2, 29, 3); // Int
+    key.addVertexAttribute(30, 0, 0);
+    key.vertexStride = 16;
+    return key;
+}
+
+static void testHashAndEqualityAreStable()
+{
+    const PipelineKey a = makeBlendedKey();
+    const PipelineKey b = makeBlendedKey();
+    CHECK(a == b);
+    CHECK(hashPipelineKey(a) == hashPipelineKey(b));
+    CHECK(hashPipelineKey(a) == hashPipelineKey(a));
+    const PipelineKey copy = a;
+    CHECK(copy == a && hashPipelineKey(copy) == hashPipelineKey(a));
+
+    // Every field is part of the key.
+    PipelineKey other = makeBlendedKey();
+    other.fragmentFunction = "fragment_atlas";
+    CHECK(!(other == a) && hashPipelineKey(other) != hashPipelineKey(a));
+    other = makeBlendedKey();
+    other.blendingEnabled = false;
+    CHECK(!(other == a) && hashPipelineKey(other) != hashPipelineKey(a));
+    other = makeBlendedKey();
+    other.destinationAlphaBlendFactor = 1;
+    CHECK(!(other == a) && hashPipelineKey(other) != hashPipelineKey(a));
+    other = makeBlendedKey();
+    other.addFunctionConstant(1, 53, 0);
+    CHECK(!(other == a) && hashPipelineKey(other) != hashPipelineKey(a));
+    other = makeBlendedKey();
+    other.vertexStride = 32;
+    CHECK(!(other == a) && hashPipelineKey(other) != hashPipelineKey(a));
+
+    // Strings are length prefixed, moving a character from one name to the other is a different key.
+    PipelineKey shifted = makeBlendedKey();
+    shifted.vertexFunction = "vertex_primitivef";
+    shifted.fragmentFunction = "ragment_primitive";
+    CHECK(!(shifted == a) && hashPipelineKey(shifted) != hashPipelineKey(a));
+}
+
+static void testFunctionConstantOrder()
+{
+    PipelineKey forward;
+    forward.vertexFunction = "vertex_atlas";
+    forward.fragmentFunction = "fragment_atlas";
+    forward.addFunctionConstant(0, 53, 1);
+    forward.addFunctionConstant(1, 53, 0);
+    forward.addFunctionConstant(3, 29, 7);
+
+    PipelineKey backward;
+    backward.vertexFunction = "vertex_atlas";
+    backward.fragmentFunction = "fragment_atlas";
+    backward.addFunctionConstant(3, 29, 7);
+    backward.addFunctionConstant(1, 53, 0);
+    backward.addFunctionConstant(0, 53, 1);
+
+    CHECK(forward == backward);
+    CHECK(hashPipelineKey(forward) == hashPipelineKey(backward));
+    for (int i = 1; i < backward.functionConstantCount; ++i) CHECK(backward.functionConstants[i - 1].index < backward.functionConstants[i].index);
+
+    // Same values on different indices is still a different key.
+    PipelineKey swapped;
+    swapped.vertexFunction = "vertex_atlas";
+    swapped.fragmentFunction = "fragment_atlas";
+    swapped.addFunctionConstant(0, 53, 0);
+    swapped.addFunctionConstant(1, 53, 1);
+    swapped.addFunctionConstant(3, 29, 7);
+    CHECK(!(swapped == forward) && hashPipelineKey(swapped) != hashPipelineKey(forward));
+}
+
+static void testDepthPixelFormat()
+{
+    const PipelineKey noDepth = makeBlendedKey();
+    PipelineKey depth = makeBlendedKey();
+    depth.depthPixelFormat = 252; // Depth32Float
+    CHECK(!(noDepth == depth));
+    CHECK(hashPipelineKey(noDepth) != hashPipelineKey(depth));
+
+    PipelineKey otherDepth = makeBlendedKey();
+    otherDepth.depthPixelFormat = 260; // Depth32Float_Stencil8
+    CHECK(!(otherDepth == depth));
+    CHECK(hashPipelineKey(otherDepth) != hashPipelineKey(depth));
+
+    PipelineKey sameDepth = makeBlendedKey();
+    sameDepth.depthPixelFormat = 252;
+    CHECK(sameDepth == depth && hashPipelineKey(sameDepth) == hashPipelineKey(depth));
+}
+
+static void testPipelineTable()
+{
+    int states[2] = {};
+    PipelineTable<int> table;
+    const PipelineKey key = makeBlendedKey();
+    const uint64_t keyHash = hashPipelineKey(key);
+    CHECK(table.find(key, keyHash) == nullptr);
+    CHECK(table.insert(key, keyHash, &states[0]));
+    CHECK(!table.insert(key, keyHash, &states[1])); // first one stays
+    CHECK(table.find(key, keyHash) == &states[0]);
+    CHECK(table.count() == 1);
+
+    // A colliding hash with a different key is a miss, never the other key's state.
+    PipelineKey other = makeBlendedKey();
+    other.depthPixelFormat = 252;
+    CHECK(table.find(other, keyHash) == nullptr);
+    CHECK(table.hitCount == 1 && table.missCount == 2);
+
+    int visited = 0;
+    table.forEach([&](int* state) { visited += state == &states[0] ? 1 : 100; });
+    CHECK(visited == 1);
+}
+
+// Two keys forced onto one hash, each going through PipelineCache::pipelineState's find, compile, insert, find again.
+static void testPipelineTableCollision()
+{
+    int states[2] = {};
+    PipelineTable<int> table;
+    PipelineKey keys[2] = { makeBlendedKey(), makeBlendedKey() };
+    keys[1].depthPixelFormat = 252;
+    const uint64_t keyHash = 42;
+    int* found[2] = {};
+    for (int i = 0; i < 2; ++i) {
+        CHECK(table.find(keys[i], keyHash) == nullptr);
+        int* compiled = &states[i];
+        if (!table.insert(keys[i], keyHash, compiled)) compiled = table.find(keys[i], keyHash);
+        found[i] = compiled;
+    }
+    CHECK(table.count() == 2);
+    for (int i = 0; i < 2; ++i) {
+        CHECK(found[i] == &states[i]);
+        CHECK(table.find(keys[i], keyHash) == &states[i]);
+    }
+    CHECK(found[0] && found[1] && found[0] != found[1]);
+
+    // The same key again is refused and finds the first state.
+    int duplicate = 0;
+    CHECK(!table.insert(keys[1], keyHash, &duplicate));
+    CHECK(table.find(keys[1], keyHash) == &states[1]);
+    CHECK(table.count() == 2);
+
+    int visited = 0;
+    table.forEach([&](int* state) { visited += state == &states[0] ? 1 : state == &states[1] ? 10 : 100; });
+    CHECK(visited == 11);
+}
+
+int main()
+{
+    testHashAndEqualityAreStable();
+    testFunctionConstantOrder();
+    testDepthPixelFormat();
+    testPipelineTable();
+    testPipelineTableCollision();
+    return testResult("PipelineKeyTests");
+}
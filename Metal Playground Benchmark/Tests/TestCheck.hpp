@@ -0,0 +1,32 @@
+//
+//  TestCheck.hpp
+//  Metal Playground Benchmark
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef TestCheck_hpp
+#define TestCheck_hpp
+
+#include <cstdio>
+
+// Just enough of a test harness for ctest: CHECK reports the failed expression and carries on, the test's main returns
+// testResult(), non zero when anything failed.
+static int testFailureCount = 0;
+
+#define CHECK(expression) \
+    do { \
+        if (!(expression)) { \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #expression); \
+            ++testFailureCount; \
+        } \
+    } while (0)
+
+static inline int testResult(const char* testName)
+{
+    if (testFailureCount > 0) fprintf(stderr, "%s: %d check(s) failed\n", testName, testFailureCount);
+    else printf("%s: passed\n", testName);
+    return testFailureCount > 0 ? 1 : 0;
+}
+
+#endif /* TestCheck_hpp */
@@ -0,0 +1,1097 @@
+//
+//  main.cpp
+//  Metal Playground Benchmark
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+// Headless benchmark of the draw recording hot path (draw* calls, batching, text meshing) against NullBackend.
+// Usage: metal_playground_benchmark [--scene name] [--count n] [--frames n] [--warmup n] [--resources dir] [--out file.json]
+//                                   [--capture file.mpfc] [--replay file.mpfc] [--raster] [--threads n] [--image file.ppm]
+//                                   [--overdraw heatmap.ppm] [--no-group] [--no-fit] [--no-opaque] [--no-cull]
+//                                   [--partial] [--on-demand] [--size WxH] [--golden file.ppm] [--tolerance n] [--diff file.ppm]
+// Results go to stdout as JSON unless --out is given. --capture writes the measured frames of the scenes run, --replay
+// runs a capture (from here or the app) in place of the scenes. --raster also draws every frame with the software
+// rasterizer and times it, --image writes its last frame. --overdraw adds the fill cost of each scene's last frame to
+// the results and writes its overdraw heatmap. --no-group turns off primitive shape grouping, to compare its cost
+// (groupUsPerFrame) against the draw calls it adds (drawCallsPerFrame vs batchesPerFrame). --no-fit draws every primitive
+// with its full quad, to compare the fitted meshes' fill cost with --overdraw. --no-opaque blends every draw, no opaque
+// pass (opaqueInstancesPerFrame, and the overdraw's hiddenFragments it would reject). --no-cull keeps instances hidden
+// behind later opaque draws, which are otherwise dropped (occludedInstancesPerFrame). --partial rasterizes with partial
+// redraw, only the tiles each frame damaged, and reports how much of the screen that was. --on-demand reports how many
+// frames Renderer::renderOnDemand would skip, and doesn't rasterize those. --size sets the screen size (1920x1080).
+// --golden compares the rasterizer's last frame with a golden image (written by --image with the same arguments) and
+// fails when any channel is off by more than --tolerance (2), --diff writes where.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "DamageTracker.hpp"
+#include "DrawRecorder.hpp"
+#include "FrameCapture.hpp"
+#include "FrameStats.hpp"
+#include "NullBackend.hpp"
+#include "OverdrawAnalyzer.hpp"
+#include "Profiler.hpp"
+#include "SoftwareRasterizer.hpp"
+#include "TextureMips.hpp"
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#ifndef BENCHMARK_RESOURCE_DIR
+#define BENCHMARK_RESOURCE_DIR "."
+#endif
+
+// Returns how many draw* calls the scene made this frame.
+typedef int (*SceneFunction)(DrawRecorder& recorder, int count, int frame);
+
+struct Scene {
+    const char* name;
+    int defaultCount;
+    SceneFunction record;
+};
+
+static const char* spriteNames[] = {
+    "Circle_Blue", "Circle_SkyBlue", "Circle_Maroon", "Circle_Violet", "Circle_White", "player_1", "player_2",
+};
+static const int spriteNameCount = sizeof(spriteNames) / sizeof(spriteNames[0]);
+
+// xorshift, the scenes only need cheap deterministic positions.
+static inline uint32_t nextRandom(uint32_t& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static inline float randomRange(uint32_t& state, float min, float max)
+{
+    return min + (max - min) * ((nextRandom(state) & 0xffffff) / (float)0xffffff);
+}
+
+// MARK: - Scenes
+static int sceneCircles(DrawRecorder& recorder, int count, int frame)
+{
+    // The 100k circle stress test the app runs every frame, count is fixed inside it.
+    (void)count;
+    recorder.time = frame / 60.0f;
+    recorder.testDrawPrimitives();
+    return recorder.primitiveInstanceCount;
+}
+
+static int sceneSpriteStorm(DrawRecorder& recorder, int count, int frame)
+{
+    uint32_t rng = 0x9e3779b9u ^ (uint32_t)frame;
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    for (int i = 0; i < count; ++i) {
+        const float size = randomRange(rng, 16.0f, 96.0f);
+        recorder.drawSprite(spriteNames[i % spriteNameCount],
+                            randomRange(rng, -halfWidth, halfWidth), randomRange(rng, -halfHeight, halfHeight),
+                            size, size,
+                            simd_make_float4(randomRange(rng, 0.0f, 1.0f), randomRange(rng, 0.0f, 1.0f), randomRange(rng, 0.0f, 1.0f), 1.0f),
+                            randomRange(rng, 0.0f, 6.2831853f));
+    }
+    return count;
+}
+
+static int sceneCameraSweep(DrawRecorder& recorder, int count, int frame)
+{
+    // sprite_storm's sprites, but the world stays put (same seed every frame) and the camera pans, zooms and turns over
+    // it. Nothing about the instances changes from frame to frame, only the view uniform.
+    uint32_t rng = 0x9e3779b9u;
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    const float t = frame / 60.0f;
+    recorder.setCamera((DrawRecorder::Camera){
+        .position = { 200.0f * sinf(t * 0.7f), 120.0f * cosf(t * 0.5f) },
+        .zoom = 1.25f + 0.5f * sinf(t * 0.9f),
+        .rotationRadians = 0.3f * sinf(t * 0.4f),
+    });
+    for (int i = 0; i < count; ++i) {
+        const float size = randomRange(rng, 16.0f, 96.0f);
+        recorder.drawSprite(spriteNames[i % spriteNameCount],
+                            randomRange(rng, -halfWidth, halfWidth), randomRange(rng, -halfHeight, halfHeight),
+                            size, size,
+                            simd_make_float4(randomRange(rng, 0.0f, 1.0f), randomRange(rng, 0.0f, 1.0f), randomRange(rng, 0.0f, 1.0f), 1.0f),
+                            randomRange(rng, 0.0f, 6.2831853f));
+    }
+    return count;
+}
+
+static int sceneTextWall(DrawRecorder& recorder, int count, int frame)
+{
+    const float fontSize = 18.0f;
+    const float left = 8.0f - (float)recorder.screenSize.width / 2.0f;
+    const float top = (float)recorder.screenSize.height / 2.0f - 8.0f;
+    char line[64];
+    for (int i = 0; i < count; ++i) {
+        snprintf(line, sizeof(line), "Line %04d frame %06d: The quick brown fox jumps", i, frame);
+        recorder.drawText(line, left, top - i * fontSize, fontSize, simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f));
+    }
+    return count;
+}
+
+static int sceneInterleaved(DrawRecorder& recorder, int count, int frame)
+{
+    // Worst case for batching, every draw switches type so every draw is its own batch (and its own alignment gap).
+    uint32_t rng = 0x85ebca6bu ^ (uint32_t)frame;
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    const simd_float4 white = simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f);
+    for (int i = 0; i < count; ++i) {
+        const float x = randomRange(rng, -halfWidth, halfWidth);
+        const float y = randomRange(rng, -halfHeight, halfHeight);
+        recorder.drawSprite(spriteNames[i % spriteNameCount], x, y, 64.0f, 64.0f, white, 0.0f);
+        recorder.drawPrimitiveCircle(x, y, 24.0f, white);
+        recorder.drawText("Hi!", x, y, 24.0f, white);
+    }
+    return count * 3;
+}
+
+static int sceneMixedShapes(DrawRecorder& recorder, int count, int frame)
+{
+    // Every primitive shape in one batch, in random order. Worst case for the generic fragment_primitive, how many
+    // shape runs it splits into depends on how much the shapes overlap (raise --count to pack them tighter).
+    uint32_t rng = 0xc2b2ae35u ^ (uint32_t)frame;
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    for (int i = 0; i < count; ++i) {
+        const float x = randomRange(rng, -halfWidth, halfWidth);
+        const float y = randomRange(rng, -halfHeight, halfHeight);
+        const float size = randomRange(rng, 8.0f, 32.0f);
+        const simd_float4 color = simd_make_float4(randomRange(rng, 0.0f, 1.0f), randomRange(rng, 0.0f, 1.0f), randomRange(rng, 0.0f, 1.0f), 0.8f);
+        switch (nextRandom(rng) % 5) {
+            case 0: recorder.drawPrimitiveRect(x, y, size, size, color); break;
+            case 1: recorder.drawPrimitiveRoundedRect(x, y, size * 1.5f, size, size * 0.25f, color); break;
+            case 2: recorder.drawPrimitiveRectLines(x, y, size * 1.5f, size, 2.0f, color); break;
+            case 3: recorder.drawPrimitiveCircle(x, y, size * 0.5f, color); break;
+            case 4: recorder.drawPrimitiveCircleLines(x, y, size * 0.5f, 2.0f, color); break;
+        }
+    }
+    return count;
+}
+
+// count points of noisy graph lines, one line per 1000 points. Shared by the two line scenes so they draw the same
+// segments.
+static const int graphPointsPerLine = 1000;
+
+static void buildGraphLine(std::vector<simd_float2>& outPoints, int lineIndex, int pointCount, int frame, const DrawRecorder& recorder)
+{
+    uint32_t rng = 0x27d4eb2fu ^ (uint32_t)(lineIndex * 7919 + frame);
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    const float baseY = randomRange(rng, -halfHeight * 0.8f, halfHeight * 0.8f);
+    outPoints.resize(pointCount);
+    for (int i = 0; i < pointCount; ++i) {
+        const float x = -halfWidth + 2.0f * halfWidth * i / (float)std::max(pointCount - 1, 1);
+        const float y = baseY + 80.0f * sinf(x * 0.01f + frame * 0.05f + lineIndex) + randomRange(rng, -2.0f, 2.0f);
+        outPoints[i] = (simd_float2){ x, y };
+    }
+}
+
+static int scenePolylines(DrawRecorder& recorder, int count, int frame)
+{
+    std::vector<simd_float2> points;
+    int drawCount = 0;
+    for (int lineIndex = 0; lineIndex * graphPointsPerLine < count; ++lineIndex) {
+        buildGraphLine(points, lineIndex, std::min(graphPointsPerLine, count - lineIndex * graphPointsPerLine), frame, recorder);
+        const simd_float4 color = simd_make_float4(0.2f + 0.8f * (lineIndex % 3 == 0), 0.2f + 0.8f * (lineIndex % 3 == 1), 0.2f + 0.8f * (lineIndex % 3 == 2), 1.0f);
+        recorder.drawPrimitivePolyline(points.data(), (int)points.size(), 3.0f, color, DrawRecorder::linejoin_miter, DrawRecorder::linecap_round);
+        ++drawCount;
+    }
+    return drawCount;
+}
+
+static int sceneLineSegments(DrawRecorder& recorder, int count, int frame)
+{
+    // Same graph lines as polylines, one drawPrimitiveLine per segment and no joins, to compare against.
+    std::vector<simd_float2> points;
+    int drawCount = 0;
+    for (int lineIndex = 0; lineIndex * graphPointsPerLine < count; ++lineIndex) {
+        buildGraphLine(points, lineIndex, std::min(graphPointsPerLine, count - lineIndex * graphPointsPerLine), frame, recorder);
+        const simd_float4 color = simd_make_float4(0.2f + 0.8f * (lineIndex % 3 == 0), 0.2f + 0.8f * (lineIndex % 3 == 1), 0.2f + 0.8f * (lineIndex % 3 == 2), 1.0f);
+        for (size_t i = 0; i + 1 < points.size(); ++i) {
+            recorder.drawPrimitiveLine(points[i].x, points[i].y, points[i + 1].x, points[i + 1].y, 3.0f, color);
+            ++drawCount;
+        }
+    }
+    return drawCount;
+}
+
+static int sceneScrollPanels(DrawRecorder& recorder, int count, int frame)
+{
+    // A 4 x 3 grid of scrolling list panels, count rows each. Every row is a background rect, an icon and a label, and
+    // the label column is a nested clip rect. Most rows are scrolled out of their panel, so this times the record time
+    // culling, and clipped rows still share one batch per type with everything else.
+    const int columnCount = 4, rowCount = 3;
+    const float rowHeight = 28.0f;
+    const float margin = 12.0f;
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    const float panelWidth = (2.0f * halfWidth - margin * (columnCount + 1)) / columnCount;
+    const float panelHeight = (2.0f * halfHeight - margin * (rowCount + 1)) / rowCount;
+    const simd_float4 white = simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f);
+    char label[64]; // "Panel ", " row " and the suffix around two ints of up to 11 characters
+    int drawCount = 0;
+    for (int iPanel = 0; iPanel < columnCount * rowCount; ++iPanel) {
+        const float panelX = -halfWidth + margin + (iPanel % columnCount) * (panelWidth + margin);
+        const float panelY = -halfHeight + margin + (iPanel / columnCount) * (panelHeight + margin);
+        // Every panel scrolls at its own speed, and wraps around once the last row has gone past.
+        const float scrollRange = std::max(count * rowHeight - panelHeight, 1.0f);
+        const float scroll = fmodf(frame * (2.0f + iPanel), scrollRange);
+
+        recorder.drawPrimitiveRect(panelX, panelY, panelWidth, panelHeight, simd_make_float4(0.12f, 0.12f, 0.14f, 1.0f));
+        recorder.pushClipRect(panelX, panelY, panelWidth, panelHeight);
+        // One pass per draw type like a UI would batch it, so each panel adds a primitive, an atlas and a text batch.
+        for (int iRow = 0; iRow < count; ++iRow) {
+            const float rowY = panelY + panelHeight - (iRow + 1) * rowHeight + scroll;
+            const simd_float4 rowColor = (iRow & 1) ? simd_make_float4(0.2f, 0.2f, 0.24f, 1.0f) : simd_make_float4(0.16f, 0.16f, 0.2f, 1.0f);
+            recorder.drawPrimitiveRoundedRect(panelX + 2.0f, rowY + 2.0f, panelWidth - 4.0f, rowHeight - 4.0f, 4.0f, rowColor);
+        }
+        for (int iRow = 0; iRow < count; ++iRow) {
+            const float rowY = panelY + panelHeight - (iRow + 1) * rowHeight + scroll;
+            recorder.drawSprite(spriteNames[iRow % spriteNameCount], panelX + rowHeight * 0.5f + 2.0f, rowY + rowHeight * 0.5f, rowHeight - 8.0f, rowHeight - 8.0f, white, 0.0f);
+        }
+        for (int iRow = 0; iRow < count; ++iRow) {
+            const float rowY = panelY + panelHeight - (iRow + 1) * rowHeight + scroll;
+            recorder.pushClipRect(panelX + rowHeight + 4.0f, rowY, panelWidth * 0.5f, rowHeight);
+            snprintf(label, sizeof(label), "Panel %02d row %04d with a long label", iPanel, iRow);
+            recorder.drawText(label, panelX + rowHeight + 4.0f, rowY + rowHeight - 6.0f, 16.0f, white); // y is the top of the line
+            recorder.popClipRect();
+        }
+        drawCount += count * 3;
+        recorder.popClipRect();
+        ++drawCount;
+    }
+    return drawCount;
+}
+
+// A tile map of count tiles under a slowly panning camera: a sprite and a border per tile, row labels and a frame
+// around it, none of it changing. A few hundred units move on top every frame. static_map records the map once into a
+// retained layer and draws the layer after that, static_map_immediate records all of it every frame to compare.
+static int drawTileMap(DrawRecorder& recorder, int count)
+{
+    const float tileSize = 24.0f;
+    const int columnCount = std::max(1, (int)sqrtf(count * 16.0f / 9.0f));
+    const int rowCount = (count + columnCount - 1) / columnCount;
+    const float left = -columnCount * tileSize * 0.5f;
+    const float bottom = -rowCount * tileSize * 0.5f;
+    const float mapWidth = columnCount * tileSize, mapHeight = rowCount * tileSize;
+    char label[32]; // two ints of up to 11 characters and the comma
+    int drawCount = 0;
+
+    recorder.drawPrimitiveRect(left - 8.0f, bottom - 8.0f, mapWidth + 16.0f, mapHeight + 16.0f, simd_make_float4(0.1f, 0.1f, 0.12f, 1.0f));
+    recorder.pushClipRect(left, bottom, mapWidth, mapHeight);
+    uint32_t rng = 0x2545f491u;
+    for (int i = 0; i < count; ++i) {
+        const float x = left + (i % columnCount + 0.5f) * tileSize;
+        const float y = bottom + (i / columnCount + 0.5f) * tileSize;
+        const float shade = randomRange(rng, 0.5f, 1.0f);
+        recorder.drawSprite(spriteNames[i % spriteNameCount], x, y, tileSize, tileSize, simd_make_float4(shade, shade, shade, 1.0f), 0.0f);
+    }
+    for (int i = 0; i < count; ++i) {
+        const float x = left + (i % columnCount) * tileSize;
+        const float y = bottom + (i / columnCount) * tileSize;
+        recorder.drawPrimitiveRectLines(x, y, tileSize, tileSize, 1.0f, simd_make_float4(0.0f, 0.0f, 0.0f, 0.5f));
+    }
+    // Coordinates on every 8th tile, like a debug overlay.
+    for (int iRow = 0; iRow < rowCount; iRow += 8) {
+        for (int iColumn = 0; iColumn < columnCount; iColumn += 8) {
+            snprintf(label, sizeof(label), "%d,%d", iColumn, iRow);
+            recorder.drawText(label, left + iColumn * tileSize + 2.0f, bottom + (iRow + 1) * tileSize - 2.0f, 12.0f, simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f)); // y is the top of the line
+            ++drawCount;
+        }
+    }
+    recorder.popClipRect();
+    return drawCount + 2 * count + 1;
+}
+
+static int drawTileMapUnits(DrawRecorder& recorder, int frame)
+{
+    const int unitCount = 300;
+    uint32_t rng = 0x68e31da4u;
+    const float t = frame / 60.0f;
+    for (int i = 0; i < unitCount; ++i) {
+        const float radius = randomRange(rng, 50.0f, 400.0f);
+        const float angle = randomRange(rng, 0.0f, 6.2831853f) + t * randomRange(rng, 0.2f, 1.0f);
+        recorder.drawPrimitiveCircle(radius * cosf(angle), radius * sinf(angle), 8.0f, simd_make_float4(1.0f, 0.6f, 0.1f, 1.0f));
+    }
+    return unitCount;
+}
+
+static void setTileMapCamera(DrawRecorder& recorder, int frame)
+{
+    const float t = frame / 60.0f;
+    recorder.setCamera((DrawRecorder::Camera){
+        .position = { 150.0f * sinf(t * 0.3f), 80.0f * cosf(t * 0.2f) },
+        .zoom = 1.0f,
+        .rotationRadians = 0.0f,
+    });
+}
+
+static int sceneStaticMap(DrawRecorder& recorder, int count, int frame)
+{
+    static DrawRecorder::Layer tileMapLayer;
+    static int tileMapLayerCount = -1;
+    if (tileMapLayerCount != count) tileMapLayer.isDirty = true;
+
+    setTileMapCamera(recorder, frame);
+    if (tileMapLayer.isDirty) {
+        recorder.beginLayer(tileMapLayer);
+        drawTileMap(recorder, count);
+        recorder.endLayer();
+        tileMapLayerCount = count;
+    }
+    recorder.drawLayer(tileMapLayer);
+    return 1 + drawTileMapUnits(recorder, frame); // drawLayer counts as one draw
+}
+
+static int sceneStaticMapImmediate(DrawRecorder& recorder, int count, int frame)
+{
+    setTileMapCamera(recorder, frame);
+    const int drawCount = drawTileMap(recorder, count);
+    return drawCount + drawTileMapUnits(recorder, frame);
+}
+
+// count units over the screen, a tenth of them walking at any time and the rest idle, with a few respawning somewhere
+// else every frame. idle_units keeps them in a SpritePool and only moves the walking ones, idle_units_immediate draws
+// every unit every frame to compare. Pool order changes as units respawn, so the two don't blend overlaps the same.
+struct IdleUnit {
+    simd_float2 position;
+    simd_float2 velocity;
+    float size;
+    int spriteIndex;
+    DrawRecorder::SpriteHandle handle; // idle_units only
+};
+static std::vector<IdleUnit> idleUnits;
+static DrawRecorder::SpritePool idleUnitPool;
+
+static IdleUnit spawnIdleUnit(DrawRecorder& recorder, uint32_t& rng, bool usePool)
+{
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    IdleUnit unit = {
+        .position = { randomRange(rng, -halfWidth, halfWidth), randomRange(rng, -halfHeight, halfHeight) },
+        .velocity = { randomRange(rng, -2.0f, 2.0f), randomRange(rng, -2.0f, 2.0f) },
+        .size = randomRange(rng, 12.0f, 32.0f),
+        .spriteIndex = (int)(nextRandom(rng) % spriteNameCount),
+        .handle = {},
+    };
+    if (usePool) {
+        unit.handle = recorder.createSprite(idleUnitPool, spriteNames[unit.spriteIndex], unit.position.x, unit.position.y, unit.size, unit.size,
+                                            simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f), 0.0f);
+    }
+    return unit;
+}
+
+// Returns how many units changed.
+static int stepIdleUnits(DrawRecorder& recorder, int count, int frame, bool usePool)
+{
+    if (frame == 0) {
+        idleUnits.clear();
+        idleUnitPool = DrawRecorder::SpritePool();
+        uint32_t rng = 0x7f4a7c15u;
+        for (int i = 0; i < count; ++i) idleUnits.push_back(spawnIdleUnit(recorder, rng, usePool));
+        return count;
+    }
+
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    int changedCount = 0;
+    // Which tenth walks changes every second.
+    for (int i = (frame / 60) % 10; i < count; i += 10) {
+        IdleUnit& unit = idleUnits[i];
+        unit.position = unit.position + unit.velocity;
+        if (fabsf(unit.position.x) > halfWidth) unit.velocity.x = -unit.velocity.x;
+        if (fabsf(unit.position.y) > halfHeight) unit.velocity.y = -unit.velocity.y;
+        if (usePool) recorder.moveSprite(idleUnitPool, unit.handle, unit.position.x, unit.position.y);
+        ++changedCount;
+    }
+    uint32_t rng = 0x7f4a7c15u ^ (uint32_t)frame;
+    for (int iRespawn = 0; iRespawn < count / 1000 + 1; ++iRespawn) {
+        IdleUnit& unit = idleUnits[nextRandom(rng) % count];
+        if (usePool) recorder.destroySprite(idleUnitPool, unit.handle);
+        unit = spawnIdleUnit(recorder, rng, usePool);
+        ++changedCount;
+    }
+    return changedCount;
+}
+
+static int sceneIdleUnits(DrawRecorder& recorder, int count, int frame)
+{
+    const int changedCount = stepIdleUnits(recorder, count, frame, true);
+    recorder.drawSpritePool(idleUnitPool);
+    return changedCount + 1;
+}
+
+static int sceneIdleUnitsImmediate(DrawRecorder& recorder, int count, int frame)
+{
+    stepIdleUnits(recorder, count, frame, false);
+    for (const IdleUnit& unit : idleUnits) {
+        recorder.drawSprite(spriteNames[unit.spriteIndex], unit.position.x, unit.position.y, unit.size, unit.size, simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f), 0.0f);
+    }
+    return count;
+}
+
+// Four HUD windows in the screen corners over a busy scene, count cells between them: a rounded cell background, an
+// item icon, and a stack count on every 4th. The windows only change when the first one's numbers do, once a second.
+// hud_panels caches every window as a CachedPanel and composites it, hud_panels_immediate records every cell every
+// frame to compare. The camera pans and zooms over the scene, the windows are screen space and stay put.
+static const int hudPanelCount = 4;
+static DrawRecorder::CachedPanel hudPanels[hudPanelCount];
+
+static simd_float4 hudPanelRect(const DrawRecorder& recorder, int iPanel)
+{
+    const float width = 360.0f, height = 240.0f, margin = 16.0f;
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    const float x = (iPanel & 1) ? halfWidth - margin - width : margin - halfWidth;
+    const float y = (iPanel & 2) ? margin - halfHeight : halfHeight - margin - height;
+    return simd_make_float4(x, y, x + width, y + height);
+}
+
+static int drawHudPanel(DrawRecorder& recorder, int iPanel, int cellCount, int frame)
+{
+    const simd_float4 rect = hudPanelRect(recorder, iPanel);
+    const float width = rect.z - rect.x, height = rect.w - rect.y;
+    const float titleHeight = 24.0f, cellSize = 22.0f, padding = 6.0f;
+    char text[32];
+    int drawCount = 0;
+
+    recorder.drawPrimitiveRoundedRect(rect.x, rect.y, width, height, 8.0f, simd_make_float4(0.08f, 0.09f, 0.12f, 0.85f));
+    recorder.drawPrimitiveRectLines(rect.x, rect.y, width, height, 2.0f, simd_make_float4(0.6f, 0.65f, 0.8f, 1.0f));
+    if (iPanel == 0) {
+        snprintf(text, sizeof(text), "Gold %d  Wave %d", 100 + 7 * (frame / 60), 1 + frame / 600);
+    } else {
+        snprintf(text, sizeof(text), "Window %d", iPanel);
+    }
+    recorder.drawText(text, rect.x + padding, rect.w - 4.0f, 16.0f, simd_make_float4(1.0f, 0.9f, 0.6f, 1.0f));
+    drawCount += 3;
+
+    // Cells past the bottom of the window are scrolled out, the clip rect hides them. One pass per draw type, the way a
+    // UI keeps its batch count down.
+    const float gridTop = rect.w - titleHeight;
+    const int columnCount = std::max(1, (int)((width - padding * 2.0f) / cellSize));
+    recorder.pushClipRect(rect.x + padding, rect.y + padding, width - padding * 2.0f, gridTop - rect.y - padding);
+    for (int i = 0; i < cellCount; ++i) {
+        const float x = rect.x + padding + (i % columnCount) * cellSize;
+        const float y = gridTop - (i / columnCount + 1) * cellSize;
+        recorder.drawPrimitiveRoundedRect(x + 1.0f, y + 1.0f, cellSize - 2.0f, cellSize - 2.0f, 4.0f, simd_make_float4(0.2f, 0.22f, 0.28f, 1.0f));
+    }
+    uint32_t rng = 0x1b873593u ^ (uint32_t)iPanel;
+    for (int i = 0; i < cellCount; ++i) {
+        const float x = rect.x + padding + (i % columnCount + 0.5f) * cellSize;
+        const float y = gridTop - (i / columnCount + 0.5f) * cellSize;
+        recorder.drawSprite(spriteNames[nextRandom(rng) % spriteNameCount], x, y, cellSize - 6.0f, cellSize - 6.0f, simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f), 0.0f);
+    }
+    for (int i = 0; i < cellCount; i += 4) {
+        snprintf(text, sizeof(text), "%d", (int)(nextRandom(rng) % 99) + 1);
+        recorder.drawText(text, rect.x + padding + (i % columnCount) * cellSize + 2.0f, gridTop - (i / columnCount) * cellSize - 1.0f, 9.0f,
+                          simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f)); // y is the top of the line
+        ++drawCount;
+    }
+    recorder.popClipRect();
+    drawCount += cellCount * 2;
+    return drawCount;
+}
+
+// What the HUD sits on, a few hundred circles that move every frame under a drifting camera.
+static int drawHudBackground(DrawRecorder& recorder, int frame)
+{
+    const int circleCount = 400;
+    uint32_t rng = 0x85ebca6bu;
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    const float t = frame / 60.0f;
+    recorder.setCamera((DrawRecorder::Camera){
+        .position = { 60.0f + 100.0f * sinf(t * 0.3f), 40.0f * cosf(t * 0.2f) },
+        .zoom = 1.5f + 0.25f * sinf(t * 0.5f),
+        .rotationRadians = 0.0f,
+    });
+    for (int i = 0; i < circleCount; ++i) {
+        const float x = randomRange(rng, -halfWidth, halfWidth) + 40.0f * sinf(t + i);
+        const float y = randomRange(rng, -halfHeight, halfHeight) + 40.0f * cosf(t * 0.7f + i);
+        recorder.drawPrimitiveCircle(x, y, randomRange(rng, 6.0f, 20.0f), simd_make_float4(0.2f, 0.5f, 0.9f, 1.0f));
+    }
+    return circleCount;
+}
+
+static int sceneHudPanels(DrawRecorder& recorder, int count, int frame)
+{
+    static int hudPanelCellCount = -1;
+    int drawCount = drawHudBackground(recorder, frame);
+    for (int iPanel = 0; iPanel < hudPanelCount; ++iPanel) {
+        DrawRecorder::CachedPanel& panel = hudPanels[iPanel];
+        if (hudPanelCellCount != count || frame == 0 || (iPanel == 0 && frame % 60 == 0)) panel.layer.isDirty = true;
+        if (panel.layer.isDirty) {
+            const simd_float4 rect = hudPanelRect(recorder, iPanel);
+            recorder.beginCachedPanel(panel, rect.x, rect.y, rect.z - rect.x, rect.w - rect.y);
+            drawHudPanel(recorder, iPanel, count / hudPanelCount, frame);
+            recorder.endCachedPanel();
+        }
+        recorder.drawCachedPanel(panel);
+        ++drawCount;
+    }
+    hudPanelCellCount = count;
+    return drawCount;
+}
+
+static int sceneHudPanelsImmediate(DrawRecorder& recorder, int count, int frame)
+{
+    int drawCount = drawHudBackground(recorder, frame);
+    recorder.beginScreenSpace();
+    for (int iPanel = 0; iPanel < hudPanelCount; ++iPanel) drawCount += drawHudPanel(recorder, iPanel, count / hudPanelCount, frame);
+    recorder.endScreenSpace();
+    return drawCount;
+}
+
+// An editor style screen recorded from scratch every frame, nearly all of it the same as the last: a sidebar of count
+// property rows, a canvas of shapes on a grid, a status bar. Only a blinking text cursor, a spinner and one live value
+// change, the case partial redraw (--partial) and on demand rendering (--on-demand) are for.
+static int sceneToolUI(DrawRecorder& recorder, int count, int frame)
+{
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    const float sidebarWidth = 360.0f, statusHeight = 28.0f, rowHeight = 24.0f;
+    const simd_float4 white = simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f);
+    const simd_float4 dimText = simd_make_float4(0.7f, 0.72f, 0.78f, 1.0f);
+    char text[64];
+    int drawCount = 0;
+
+    // Canvas: a grid and a few hundred shapes that don't move.
+    const float canvasLeft = -halfWidth + sidebarWidth, canvasBottom = -halfHeight + statusHeight;
+    recorder.drawPrimitiveRect(canvasLeft, canvasBottom, halfWidth * 2.0f - sidebarWidth, halfHeight * 2.0f - statusHeight, simd_make_float4(0.1f, 0.1f, 0.11f, 1.0f));
+    for (float x = canvasLeft; x < halfWidth; x += 64.0f) {
+        recorder.drawPrimitiveRect(x, canvasBottom, 1.0f, halfHeight * 2.0f - statusHeight, simd_make_float4(0.18f, 0.18f, 0.2f, 1.0f));
+        ++drawCount;
+    }
+    uint32_t rng = 0x27d4eb2fu;
+    for (int i = 0; i < 300; ++i) {
+        const float x = randomRange(rng, canvasLeft + 40.0f, halfWidth - 40.0f);
+        const float y = randomRange(rng, canvasBottom + 40.0f, halfHeight - 40.0f);
+        recorder.drawPrimitiveRoundedRect(x, y, randomRange(rng, 20.0f, 80.0f), randomRange(rng, 20.0f, 60.0f), 6.0f, simd_make_float4(0.3f, 0.45f, 0.7f, 0.9f));
+    }
+    drawCount += 301;
+
+    // Sidebar, one pass per draw type. The selected row's value is live, it changes twice a second.
+    recorder.drawPrimitiveRect(-halfWidth, canvasBottom, sidebarWidth, halfHeight * 2.0f - statusHeight, simd_make_float4(0.14f, 0.14f, 0.16f, 1.0f));
+    const int rowCount = std::min(count, (int)((halfHeight * 2.0f - statusHeight) / rowHeight));
+    for (int iRow = 0; iRow < rowCount; ++iRow) {
+        const float y = halfHeight - (iRow + 1) * rowHeight;
+        const simd_float4 rowColor = iRow == 3 ? simd_make_float4(0.25f, 0.32f, 0.5f, 1.0f) : simd_make_float4(0.18f, 0.18f, 0.21f, 1.0f);
+        recorder.drawPrimitiveRoundedRect(-halfWidth + 4.0f, y + 2.0f, sidebarWidth - 8.0f, rowHeight - 4.0f, 4.0f, rowColor);
+    }
+    for (int iRow = 0; iRow < rowCount; ++iRow) {
+        const float y = halfHeight - (iRow + 0.5f) * rowHeight;
+        recorder.drawSprite(spriteNames[iRow % spriteNameCount], -halfWidth + 18.0f, y, 14.0f, 14.0f, white, 0.0f);
+    }
+    for (int iRow = 0; iRow < rowCount; ++iRow) {
+        const float top = halfHeight - iRow * rowHeight - 4.0f;
+        snprintf(text, sizeof(text), "Property %02d", iRow);
+        recorder.drawText(text, -halfWidth + 32.0f, top, 14.0f, white); // y is the top of the line
+        snprintf(text, sizeof(text), "%d", iRow == 3 ? frame / 30 : iRow * 17);
+        recorder.drawText(text, -halfWidth + 240.0f, top, 14.0f, dimText);
+    }
+    drawCount += 1 + rowCount * 4;
+
+    // Status bar, with a text cursor blinking once a second and a spinner stepping an eighth of a turn every 8 frames.
+    recorder.drawPrimitiveRect(-halfWidth, -halfHeight, halfWidth * 2.0f, statusHeight, simd_make_float4(0.2f, 0.2f, 0.24f, 1.0f));
+    recorder.drawText("Ready  Search: layer", -halfWidth + 8.0f, -halfHeight + statusHeight - 6.0f, 14.0f, white);
+    const float cursorX = -halfWidth + 8.0f + recorder.measureTextBounds("Ready  Search: layer", 14.0f).first + 2.0f;
+    if ((frame / 30) % 2 == 0) recorder.drawPrimitiveRect(cursorX, -halfHeight + 6.0f, 2.0f, statusHeight - 12.0f, white);
+    recorder.drawSprite("Circle_White", halfWidth - 20.0f, -halfHeight + statusHeight * 0.5f, 16.0f, 16.0f, white, (frame / 8) * 0.7853982f);
+    drawCount += 4;
+    return drawCount;
+}
+
+static int sceneInventory(DrawRecorder& recorder, int count, int frame)
+{
+    // A game world under an opaque inventory screen covering two thirds of it, most of the world is never seen.
+    uint32_t rng = 0x165667b1u ^ (uint32_t)frame;
+    const float halfWidth = (float)recorder.screenSize.width / 2.0f;
+    const float halfHeight = (float)recorder.screenSize.height / 2.0f;
+    const simd_float4 white = simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f);
+    for (int i = 0; i < count / 2; ++i) {
+        recorder.drawPrimitiveCircle(randomRange(rng, -halfWidth, halfWidth), randomRange(rng, -halfHeight, halfHeight), 12.0f, simd_make_float4(0.4f, 0.8f, 0.5f, 0.8f));
+    }
+    for (int i = count / 2; i < count; ++i) {
+        recorder.drawSprite(spriteNames[i % spriteNameCount], randomRange(rng, -halfWidth, halfWidth), randomRange(rng, -halfHeight, halfHeight),
+                            32.0f, 32.0f, white, randomRange(rng, 0.0f, 6.2831853f));
+    }
+
+    // The screen's right two thirds, a grid of item slots with an icon in each.
+    const float panelLeft = -halfWidth / 3.0f;
+    recorder.drawPrimitiveRect(panelLeft, -halfHeight, halfWidth - panelLeft, halfHeight * 2.0f, simd_make_float4(0.12f, 0.1f, 0.08f, 1.0f));
+    const float slotSize = 72.0f, slotStep = 80.0f;
+    const int columnCount = (int)((halfWidth - panelLeft - 80.0f) / slotStep);
+    const int rowCount = (int)((halfHeight * 2.0f - 160.0f) / slotStep);
+    for (int iSlot = 0; iSlot < columnCount * rowCount; ++iSlot) {
+        const float x = panelLeft + 40.0f + (iSlot % columnCount) * slotStep;
+        const float y = halfHeight - 120.0f - (iSlot / columnCount) * slotStep - slotSize;
+        recorder.drawPrimitiveRoundedRect(x, y, slotSize, slotSize, 6.0f, simd_make_float4(0.22f, 0.19f, 0.15f, 1.0f));
+    }
+    for (int iSlot = 0; iSlot < columnCount * rowCount; ++iSlot) {
+        const float x = panelLeft + 40.0f + (iSlot % columnCount) * slotStep + slotSize * 0.5f;
+        const float y = halfHeight - 120.0f - (iSlot / columnCount) * slotStep - slotSize * 0.5f;
+        recorder.drawSprite(spriteNames[iSlot % spriteNameCount], x, y, 48.0f, 48.0f, white, 0.0f);
+    }
+    recorder.drawText("Inventory", panelLeft + 40.0f, halfHeight - 40.0f, 32.0f, white); // y is the top of the line
+    return count + 1 + columnCount * rowCount * 2 + 1;
+}
+
+static int sceneDemo(DrawRecorder& recorder, int count, int frame)
+{
+    // Everything the app records in a frame.
+    (void)count;
+    recorder.time = frame / 60.0f;
+    recorder.testDrawPrimitives();
+    recorder.testDrawAtlasSprites();
+    recorder.testDrawTextWithBounds();
+    recorder.testDrawInterleavedTypes();
+    return recorder.atlasInstanceCount + recorder.primitiveInstanceCount + recorder.drawBatchCount;
+}
+
+// Loops over the frames of --replay, count is unused. Draws are the instances replayed (glyph quads for text), the
+// original draw calls aren't in the capture.
+static std::vector<CapturedFrame> replayFrames;
+static int sceneReplay(DrawRecorder& recorder, int count, int frame)
+{
+    (void)count;
+    FrameCapture::replay(replayFrames[frame % replayFrames.size()], recorder);
+    return recorder.atlasInstanceCount + recorder.primitiveInstanceCount + recorder.textVertexCount / 6;
+}
+static const Scene replayScene = { "replay", 0, sceneReplay };
+
+// NOTE: Counts are kept under the recorder limits, drawBatchMaxCount (1024) caps interleaved and textMaxVertexCount
+// (4096 glyphs) caps the text wall.
+static const Scene scenes[] = {
+    { "circles", 100000, sceneCircles },
+    { "sprite_storm", 100000, sceneSpriteStorm },
+    { "camera_sweep", 100000, sceneCameraSweep },
+    { "text_wall", 80, sceneTextWall },
+    { "interleaved", 300, sceneInterleaved },
+    { "mixed_shapes", 2000, sceneMixedShapes },
+    { "polylines", 50000, scenePolylines },
+    { "line_segments", 50000, sceneLineSegments },
+    { "scroll_panels", 200, sceneScrollPanels },
+    { "static_map", 20000, sceneStaticMap },
+    { "static_map_immediate", 20000, sceneStaticMapImmediate },
+    { "idle_units", 100000, sceneIdleUnits },
+    { "idle_units_immediate", 100000, sceneIdleUnitsImmediate },
+    { "hud_panels", 1200, sceneHudPanels },
+    { "hud_panels_immediate", 1200, sceneHudPanelsImmediate },
+    { "tool_ui", 60, sceneToolUI },
+    { "inventory", 20000, sceneInventory },
+    { "demo", 0, sceneDemo },
+};
+static const int sceneCount = sizeof(scenes) / sizeof(scenes[0]);
+
+struct SceneResult {
+    const Scene* scene;
+    int count;
+    int frames;
+    uint64_t draws;
+    uint64_t batches;
+    uint64_t drawCalls;
+    uint64_t mixedPrimitives;
+    uint64_t opaqueInstances;
+    uint64_t occludedInstances;
+    uint64_t groupNs;
+    uint64_t bytesWritten;
+    uint64_t recordNs;
+    FrameTimeHistogram recordTimes; // per frame, us
+    FrameTimeHistogram groupTimes; // per frame, us
+    FrameTimeHistogram rasterTimes; // per frame, us, only with --raster
+    bool isPartialRedraw;
+    double damagedFraction; // summed per frame, only with --partial
+    bool isOnDemand;
+    uint64_t skippedFrames; // only with --on-demand
+    OverdrawReport overdraw; // last measured frame, only with --overdraw
+};
+
+struct SceneRunContext {
+    DrawRecorder& recorder;
+    NullBackend& backend;
+    FrameCaptureWriter* captureWriter; // optional
+    SoftwareRasterizer* rasterizer; // optional
+    OverdrawAnalyzer* overdrawAnalyzer; // optional
+    bool isPartialRedraw; // rasterizer only
+    DamageTracker* onDemandTracker; // optional
+};
+
+static void runScene(const Scene& scene, int count, int warmupFrames, int frames, SceneRunContext& context, SceneResult& outResult)
+{
+    DrawRecorder& recorder = context.recorder;
+    NullBackend& backend = context.backend;
+    FrameCaptureWriter* captureWriter = context.captureWriter;
+    CapturedFrame capturedFrame;
+    outResult.scene = &scene;
+    outResult.count = count;
+    outResult.frames = frames;
+    outResult.isPartialRedraw = context.isPartialRedraw;
+    outResult.isOnDemand = context.onDemandTracker != nullptr;
+    const simd_float4 clearColor = simd_make_float4(0.0f, 0.0f, 0.0f, 1.0f); // the app's
+    recorder.setCamera((DrawRecorder::Camera){ .position = {0.0f, 0.0f}, .zoom = 1.0f, .rotationRadians = 0.0f }); // undo the last scene's
+
+    for (int frame = 0; frame < warmupFrames + frames; ++frame) {
+        backend.beginFrame();
+        const uint64_t startNs = Profiler::nowNs();
+        const int draws = scene.record(recorder, count, frame);
+        const uint64_t recordNs = Profiler::nowNs() - startNs;
+        const NullFrameResult frameResult = backend.endFrame();
+        bool isSkipped = false;
+        if (context.onDemandTracker) {
+            context.onDemandTracker->update(recorder, (int)recorder.screenSize.width, (int)recorder.screenSize.height, clearColor);
+            isSkipped = context.onDemandTracker->isFrameUnchanged(recorder);
+        }
+        uint64_t rasterNs = 0;
+        if (context.rasterizer && !isSkipped) {
+            const uint64_t rasterStartNs = Profiler::nowNs();
+            context.rasterizer->render(recorder, clearColor);
+            rasterNs = Profiler::nowNs() - rasterStartNs;
+        }
+
+        if (frame < warmupFrames) continue;
+        if (captureWriter) {
+            FrameCapture::capture(recorder, captureWriter->frameCount, capturedFrame);
+            captureWriter->write(capturedFrame);
+        }
+        outResult.draws += (uint64_t)draws;
+        outResult.batches += (uint64_t)frameResult.batchCount;
+        outResult.drawCalls += (uint64_t)frameResult.drawCallCount;
+        outResult.mixedPrimitives += (uint64_t)frameResult.mixedPrimitiveInstanceCount;
+        outResult.opaqueInstances += (uint64_t)frameResult.opaqueInstanceCount;
+        outResult.occludedInstances += (uint64_t)frameResult.occludedInstanceCount;
+        outResult.groupNs += frameResult.groupNs;
+        outResult.groupTimes.record(frameResult.groupNs / 1000);
+        outResult.bytesWritten += frameResult.bytesWritten;
+        outResult.recordNs += recordNs;
+        outResult.recordTimes.record(recordNs / 1000);
+        if (context.rasterizer) outResult.rasterTimes.record(rasterNs / 1000);
+        if (context.isPartialRedraw && !isSkipped) outResult.damagedFraction += context.rasterizer->damage().damagedFraction();
+        if (isSkipped) ++outResult.skippedFrames;
+        if (context.overdrawAnalyzer && frame == warmupFrames + frames - 1) context.overdrawAnalyzer->analyze(recorder, outResult.overdraw);
+    }
+}
+
+static const char* batchTypeNames[DrawRecorder::drawbatchtype_count] = { "none", "atlas", "primitive", "text" };
+
+static void writeResults(FILE* file, const std::vector<SceneResult>& results)
+{
+    fprintf(file, "{\n  \"scenes\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const SceneResult& r = results[i];
+        const double frames = r.frames > 0 ? (double)r.frames : 1.0;
+        fprintf(file,
+                "    {\"name\": \"%s\", \"count\": %d, \"frames\": %d, \"drawsPerFrame\": %.1f, \"nsPerDraw\": %.2f, "
+                "\"batchesPerFrame\": %.1f, \"bytesWrittenPerFrame\": %.0f, "
+                "\"recordUsPerFrame\": {\"mean\": %.1f, \"p50\": %llu, \"p99\": %llu, \"max\": %llu}",
+                r.scene->name, r.count, r.frames,
+                r.draws / frames,
+                r.draws > 0 ? (double)r.recordNs / r.draws : 0.0,
+                r.batches / frames,
+                r.bytesWritten / frames,
+                r.recordTimes.meanUs(),
+                (unsigned long long)r.recordTimes.percentileUs(50),
+                (unsigned long long)r.recordTimes.percentileUs(99),
+                (unsigned long long)r.recordTimes.maxUs());
+        fprintf(file, ", \"drawCallsPerFrame\": %.1f, \"mixedPrimitivesPerFrame\": %.1f, \"opaqueInstancesPerFrame\": %.1f, \"occludedInstancesPerFrame\": %.1f, "
+                "\"groupUsPerFrame\": {\"mean\": %.1f, \"p99\": %llu, \"max\": %llu}",
+                r.drawCalls / frames,
+                r.mixedPrimitives / frames,
+                r.opaqueInstances / frames,
+                r.occludedInstances / frames,
+                r.groupNs / frames / 1000.0,
+                (unsigned long long)r.groupTimes.percentileUs(99),
+                (unsigned long long)r.groupTimes.maxUs());
+        if (r.rasterTimes.totalCount() > 0) {
+            fprintf(file, ", \"rasterUsPerFrame\": {\"mean\": %.1f, \"p50\": %llu, \"p99\": %llu, \"max\": %llu}",
+                    r.rasterTimes.meanUs(),
+                    (unsigned long long)r.rasterTimes.percentileUs(50),
+                    (unsigned long long)r.rasterTimes.percentileUs(99),
+                    (unsigned long long)r.rasterTimes.maxUs());
+        }
+        if (r.isPartialRedraw) {
+            fprintf(file, ", \"damagedPercentPerFrame\": %.1f", 100.0 * r.damagedFraction / frames);
+        }
+        if (r.isOnDemand) {
+            fprintf(file, ", \"skippedFramesPercent\": %.1f", 100.0 * r.skippedFrames / frames);
+        }
+        if (r.overdraw.width > 0) {
+            const OverdrawReport& o = r.overdraw;
+            fprintf(file, ", \"overdraw\": {\"fragments\": %llu, \"transparentFragments\": %llu, \"hiddenFragments\": %llu, \"coveredPixels\": %llu, "
+                    "\"averageOverdraw\": %.2f, \"maxOverdraw\": %u, \"fragmentsByType\": {\"atlas\": %llu, \"primitive\": %llu, \"text\": %llu}, "
+                    "\"worstDraws\": [",
+                    (unsigned long long)o.fragmentCount,
+                    (unsigned long long)o.transparentFragmentCount,
+                    (unsigned long long)o.hiddenFragmentCount,
+                    (unsigned long long)o.coveredPixelCount,
+                    o.averageOverdraw(),
+                    o.maxOverdraw,
+                    (unsigned long long)o.fragmentCountForType[DrawRecorder::drawbatchtype_atlas],
+                    (unsigned long long)o.fragmentCountForType[DrawRecorder::drawbatchtype_primitive],
+                    (unsigned long long)o.fragmentCountForType[DrawRecorder::drawbatchtype_text]);
+            for (size_t iDraw = 0; iDraw < o.worstDraws.size(); ++iDraw) {
+                const OverdrawDraw& draw = o.worstDraws[iDraw];
+                fprintf(file, "%s{\"batch\": %d, \"type\": \"%s\", \"index\": %d, \"fragments\": %llu, \"transparentFragments\": %llu}",
+                        iDraw > 0 ? ", " : "", draw.batchIndex, batchTypeNames[draw.type], draw.instanceIndex,
+                        (unsigned long long)draw.fragmentCount, (unsigned long long)draw.transparentFragmentCount);
+            }
+            fprintf(file, "]}");
+        }
+        fprintf(file, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+static bool loadMipChain(const std::string& imagePath, const std::vector<TextureRegion>& regions, bool premultiply, MipChain& outChain)
+{
+    int width = 0;
+    int height = 0;
+    int channelCount = 0;
+    unsigned char* imageData = stbi_load(imagePath.c_str(), &width, &height, &channelCount, 4);
+    if (!imageData) {
+        fprintf(stderr, "Can't load %s\n", imagePath.c_str());
+        return false;
+    }
+    // Same preparation as the Renderer's loadTexture.
+    if (premultiply) premultiplyAlpha(imageData, (size_t)width * height);
+    generateMipChain(imageData, width, height, regions, outChain);
+    stbi_image_free(imageData);
+    return true;
+}
+
+// Binary PPMs as writePPM writes them, 8 bit, whitespace separated header without comments. RGB, top row first.
+static bool readPPM(const char* path, int& outWidth, int& outHeight, std::vector<uint8_t>& outRGB)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+    int maxValue = 0;
+    bool isRead = fscanf(file, "P6 %d %d %d", &outWidth, &outHeight, &maxValue) == 3 && maxValue == 255
+        && outWidth > 0 && outHeight > 0 && fgetc(file) != EOF; // the single whitespace before the pixels
+    if (isRead) {
+        outRGB.resize((size_t)outWidth * outHeight * 3);
+        isRead = fread(outRGB.data(), 1, outRGB.size(), file) == outRGB.size();
+    }
+    fclose(file);
+    return isRead;
+}
+
+// Binary PPM from RGBA8, alpha dropped. The rasterizer cleared to opaque black like the app and heatmaps are opaque,
+// so nothing is lost.
+static bool writePPM(const char* path, int width, int height, const uint8_t* rgbaPixels)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file) return false;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    const size_t pixelCount = (size_t)width * height;
+    std::vector<uint8_t> rgb(pixelCount * 3);
+    for (size_t i = 0; i < pixelCount; ++i) memcpy(&rgb[i * 3], rgbaPixels + i * 4, 3);
+    const bool isWritten = fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+    return fclose(file) == 0 && isWritten;
+}
+
+// Pixels with any channel more than tolerance away from the golden image's. -1 when the golden can't be read or its size
+// doesn't match. diffPath (optional) gets the golden dimmed to grey with those pixels in red.
+static int64_t compareWithGolden(const SoftwareRasterizer& rasterizer, const char* goldenPath, int tolerance, const char* diffPath, int& outMaxDelta)
+{
+    int goldenWidth = 0;
+    int goldenHeight = 0;
+    std::vector<uint8_t> golden;
+    if (!readPPM(goldenPath, goldenWidth, goldenHeight, golden)) {
+        fprintf(stderr, "Can't read golden image %s\n", goldenPath);
+        return -1;
+    }
+    if (goldenWidth != rasterizer.width() || goldenHeight != rasterizer.height()) {
+        fprintf(stderr, "Golden image %s is %dx%d, the frame is %dx%d\n", goldenPath, goldenWidth, goldenHeight, rasterizer.width(), rasterizer.height());
+        return -1;
+    }
+
+    const size_t pixelCount = (size_t)goldenWidth * goldenHeight;
+    std::vector<uint8_t> diff(pixelCount * 4);
+    int64_t differentCount = 0;
+    outMaxDelta = 0;
+    for (size_t i = 0; i < pixelCount; ++i) {
+        const uint8_t* expected = &golden[i * 3];
+        const uint8_t* actual = rasterizer.pixels() + i * 4;
+        int delta = 0;
+        for (int iChannel = 0; iChannel < 3; ++iChannel) delta = std::max(delta, std::abs((int)expected[iChannel] - (int)actual[iChannel]));
+        outMaxDelta = std::max(outMaxDelta, delta);
+        const uint8_t grey = (uint8_t)((expected[0] + expected[1] + expected[2]) / 12);
+        const bool isDifferent = delta > tolerance;
+        differentCount += isDifferent ? 1 : 0;
+        diff[i * 4 + 0] = isDifferent ? 255 : grey;
+        diff[i * 4 + 1] = isDifferent ? 0 : grey;
+        diff[i * 4 + 2] = isDifferent ? 0 : grey;
+        diff[i * 4 + 3] = 255;
+    }
+    if (differentCount > 0 && diffPath && !writePPM(diffPath, goldenWidth, goldenHeight, diff.data())) {
+        fprintf(stderr, "Failed writing %s\n", diffPath);
+    }
+    return differentCount;
+}
+
+int main(int argc, const char* argv[])
+{
+    const char* sceneName = nullptr;
+    int countOverride = -1;
+    int frames = 200;
+    int warmupFrames = 20;
+    std::string resourceDir = BENCHMARK_RESOURCE_DIR;
+    const char* outPath = nullptr;
+    const char* capturePath = nullptr;
+    const char* replayPath = nullptr;
+    bool isRasterEnabled = false;
+    int rasterThreadCount = 0;
+    const char* imagePath = nullptr;
+    const char* overdrawPath = nullptr;
+    bool isShapeGroupingEnabled = true;
+    bool isGeometryFittingEnabled = true;
+    bool isOpaquePassEnabled = true;
+    bool isOcclusionCullingEnabled = true;
+    bool isPartialRedraw = false;
+    bool isOnDemand = false;
+    int screenWidth = 1920;
+    int screenHeight = 1080;
+    const char* goldenPath = nullptr;
+    int goldenTolerance = 2;
+    const char* diffPath = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        const bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--scene") && hasValue) sceneName = argv[++i];
+        else if (!strcmp(argv[i], "--count") && hasValue) countOverride = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--frames") && hasValue) frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--warmup") && hasValue) warmupFrames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--resources") && hasValue) resourceDir = argv[++i];
+        else if (!strcmp(argv[i], "--out") && hasValue) outPath = argv[++i];
+        else if (!strcmp(argv[i], "--capture") && hasValue) capturePath = argv[++i];
+        else if (!strcmp(argv[i], "--replay") && hasValue) replayPath = argv[++i];
+        else if (!strcmp(argv[i], "--raster")) isRasterEnabled = true;
+        else if (!strcmp(argv[i], "--threads") && hasValue) rasterThreadCount = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--image") && hasValue) { imagePath = argv[++i]; isRasterEnabled = true; }
+        else if (!strcmp(argv[i], "--overdraw") && hasValue) overdrawPath = argv[++i];
+        else if (!strcmp(argv[i], "--no-group")) isShapeGroupingEnabled = false;
+        else if (!strcmp(argv[i], "--no-fit")) isGeometryFittingEnabled = false;
+        else if (!strcmp(argv[i], "--no-opaque")) isOpaquePassEnabled = false;
+        else if (!strcmp(argv[i], "--no-cull")) isOcclusionCullingEnabled = false;
+        else if (!strcmp(argv[i], "--partial")) { isPartialRedraw = true; isRasterEnabled = true; }
+        else if (!strcmp(argv[i], "--on-demand")) isOnDemand = true;
+        else if (!strcmp(argv[i], "--size") && hasValue && sscanf(argv[i + 1], "%dx%d", &screenWidth, &screenHeight) == 2 && screenWidth > 0 && screenHeight > 0) ++i;
+        else if (!strcmp(argv[i], "--golden") && hasValue) { goldenPath = argv[++i]; isRasterEnabled = true; }
+        else if (!strcmp(argv[i], "--tolerance") && hasValue) goldenTolerance = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--diff") && hasValue) diffPath = argv[++i];
+        else {
+            fprintf(stderr, "Usage: %s [--scene name] [--count n] [--frames n] [--warmup n] [--resources dir] [--out file.json]"
+                    " [--capture file.mpfc] [--replay file.mpfc] [--raster] [--threads n] [--image file.ppm]"
+                    " [--overdraw heatmap.ppm] [--no-group] [--no-fit] [--no-opaque] [--no-cull] [--partial] [--on-demand]"
+                    " [--size WxH] [--golden file.ppm] [--tolerance n] [--diff file.ppm]\n", argv[0]);
+            fprintf(stderr, "Scenes:");
+            for (int iScene = 0; iScene < sceneCount; ++iScene) fprintf(stderr, " %s", scenes[iScene].name);
+            fprintf(stderr, "\n");
+            return 1;
+        }
+    }
+
+    Profiler::enabled = false; // the test scenes have zones, keep them out of the numbers
+
+    DrawRecorder recorder;
+    recorder.setScreenSize((CGSize){ (double)screenWidth, (double)screenHeight });
+    recorder.groupPrimitiveShapes = isShapeGroupingEnabled;
+    recorder.fitPrimitiveGeometry = isGeometryFittingEnabled;
+    recorder.separateOpaqueInstances = isOpaquePassEnabled;
+    recorder.cullOccludedInstances = isOcclusionCullingEnabled;
+    std::vector<TextureRegion> spriteRegions;
+    std::vector<TextureRegion> glyphRegions;
+    recorder.loadAtlasUVs(resourceDir + "/main_atlas.txt", 256, 256, spriteRegions);
+    recorder.loadFontInfo(resourceDir + "/roboto.json", glyphRegions);
+    NullBackend backend(recorder);
+
+    SoftwareRasterizer* rasterizer = nullptr;
+    MipChain atlasTexture;
+    MipChain fontTexture;
+    // Always loaded, which sprites are opaque comes from its texels.
+    if (!loadMipChain(resourceDir + "/main_atlas.png", spriteRegions, DrawRecorder::premultipliedAlpha, atlasTexture)) return 1;
+    recorder.markOpaqueSprites(atlasTexture);
+    if (isRasterEnabled) {
+        if (!loadMipChain(resourceDir + "/roboto.png", glyphRegions, false, fontTexture)) return 1; // MSDF channels are distances, never premultiplied
+        rasterizer = new SoftwareRasterizer((int)recorder.screenSize.width, (int)recorder.screenSize.height, rasterThreadCount);
+        rasterizer->setAtlasTexture(&atlasTexture);
+        rasterizer->setFontTexture(&fontTexture);
+        rasterizer->setPartialRedraw(isPartialRedraw);
+    }
+
+    FrameCaptureWriter* captureWriter = nullptr;
+    if (capturePath) {
+        captureWriter = new FrameCaptureWriter(capturePath);
+        if (!captureWriter->isOpen()) return 1;
+    }
+
+    OverdrawAnalyzer* overdrawAnalyzer = nullptr;
+    if (overdrawPath) overdrawAnalyzer = new OverdrawAnalyzer((int)recorder.screenSize.width, (int)recorder.screenSize.height);
+
+    DamageTracker onDemandTracker;
+    SceneRunContext context = { recorder, backend, captureWriter, rasterizer, overdrawAnalyzer, isPartialRedraw, isOnDemand ? &onDemandTracker : nullptr };
+    std::vector<SceneResult> results;
+    if (replayPath) {
+        if (!FrameCapture::load(replayPath, recorder, replayFrames) || replayFrames.empty()) return 1;
+        results.push_back(SceneResult());
+        runScene(replayScene, (int)replayFrames.size(), warmupFrames, frames, context, results.back());
+    }
+    for (int iScene = 0; iScene < sceneCount && !replayPath; ++iScene) {
+        const Scene& scene = scenes[iScene];
+        if (sceneName && strcmp(sceneName, scene.name) != 0) continue;
+        results.push_back(SceneResult());
+        runScene(scene, countOverride >= 0 ? countOverride : scene.defaultCount, warmupFrames, frames, context, results.back());
+    }
+    if (captureWriter && !captureWriter->close()) {
+        fprintf(stderr, "Failed writing %s\n", capturePath);
+        return 1;
+    }
+    delete captureWriter;
+    if (imagePath && !writePPM(imagePath, rasterizer->width(), rasterizer->height(), rasterizer->pixels())) {
+        fprintf(stderr, "Failed writing %s\n", imagePath);
+        return 1;
+    }
+    if (goldenPath) {
+        int maxDelta = 0;
+        const int64_t differentCount = compareWithGolden(*rasterizer, goldenPath, goldenTolerance, diffPath, maxDelta);
+        if (differentCount != 0) {
+            if (differentCount > 0) {
+                fprintf(stderr, "%lld of %d pixels differ from %s by more than %d (max %d)%s%s\n", (long long)differentCount,
+                        rasterizer->width() * rasterizer->height(), goldenPath, goldenTolerance, maxDelta, diffPath ? ", see " : "", diffPath ? diffPath : "");
+            }
+            return 1;
+        }
+    }
+    delete rasterizer;
+    if (overdrawAnalyzer) {
+        // Counts are still the last scene's last frame.
+        std::vector<uint8_t> heatmap;
+        overdrawAnalyzer->writeHeatmap(heatmap);
+        if (!writePPM(overdrawPath, overdrawAnalyzer->width(), overdrawAnalyzer->height(), heatmap.data())) {
+            fprintf(stderr, "Failed writing %s\n", overdrawPath);
+            return 1;
+        }
+    }
+    delete overdrawAnalyzer;
+    if (results.empty()) {
+        fprintf(stderr, "Unknown scene %s\n", sceneName);
+        return 1;
+    }
+
+    FILE* file = outPath ? fopen(outPath, "w") : stdout;
+    if (!file) {
+        fprintf(stderr, "Can't open %s\n", outPath);
+        return 1;
+    }
+    writeResults(file, results);
+    if (outPath) fclose(file);
+    return 0;
+}
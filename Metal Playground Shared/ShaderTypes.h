@@ -16,9 +16,13 @@ typedef metal::int32_t EnumBackingType;
 #import <Foundation/Foundation.h>
 typedef NSInteger EnumBackingType;
 // C++ (metal-cpp)
-#else
+#elif defined(__clang__)
 #define NS_ENUM(_type, _name) enum _name : _type _name; enum _name : _type
 typedef int32_t EnumBackingType;
+// C++ (GCC, the Linux benchmark) can't typedef an opaque enum, the named type is just the backing integer there.
+#else
+#define NS_ENUM(_type, _name) _type _name; enum : _type
+typedef int32_t EnumBackingType;
 #endif
 typedef NS_ENUM(EnumBackingType, ShapeType) {
     ShapeTypeNone = 0,
@@ -29,10 +33,18 @@ typedef NS_ENUM(EnumBackingType, ShapeType) {
     ShapeTypeCircleLines = 5,
 };
 
+typedef NS_ENUM(EnumBackingType, FunctionConstantIndex) {
+    FunctionConstantIndexPremultipliedAlpha = 0,
+    FunctionConstantIndexPrimitiveShapeType = 1,
+    FunctionConstantIndexClipRects = 2,
+    FunctionConstantIndexWorldSpaceInstances = 3,
+};
+
 typedef NS_ENUM(EnumBackingType, BufferIndex) {
     BufferIndexVertices = 0,
     BufferIndexInstances = 1,
     BufferIndexUniforms = 2,
+    BufferIndexClipRects = 3,
 };
 typedef NS_ENUM(EnumBackingType, TextBufferIndex) {
     TextBufferIndexVertices = 0,
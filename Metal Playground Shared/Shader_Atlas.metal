@@ -11,6 +11,14 @@
 #include "ShaderTypes.h"
 using namespace metal;
 
+/// Set by the metal-cpp renderer, instances then clip against clipRects[clipIndex]. Left undefined nothing is clipped.
+constant bool clipRectsEnabled [[function_constant(FunctionConstantIndexClipRects)]];
+constant bool useClipRects = is_function_constant_defined(clipRectsEnabled) && clipRectsEnabled;
+/// Set by the metal-cpp renderer, instance transforms are then world space and uniforms take them to clip space. Left
+/// undefined the transforms already have the projection in them.
+constant bool worldSpaceInstancesEnabled [[function_constant(FunctionConstantIndexWorldSpaceInstances)]];
+constant bool useWorldSpaceInstances = is_function_constant_defined(worldSpaceInstancesEnabled) && worldSpaceInstancesEnabled;
+
 struct AtlasVertex {
     float2 position [[attribute(AtlasVertAttrPosition)]];
     float2 uv [[attribute(AtlasVertAttrUV)]];
@@ -21,27 +29,48 @@ struct AtlasInstanceData {
     float4 color;
     float2 atlasUVMin;
     float2 atlasUVMax;
-    uint32_t __padding[8];
+    uint32_t clipIndex;
+    uint32_t isOpaque; // CPU side only, which pass draws it
+    uint32_t __padding[6];
+};
+
+struct AtlasUniforms {
+    float4x4 viewProjectionMatrix;
 };
 
 struct AtlasVOut {
     float4 position [[position]];
+    float clipDistance [[clip_distance]] [4];
     float2 uv;
     float4 color;
 };
 
 vertex AtlasVOut vertex_atlas(AtlasVertex in [[stage_in]],
                          uint instanceId [[instance_id]],
-                         const constant AtlasInstanceData* instances [[buffer(BufferIndexInstances)]])
+                         const constant AtlasInstanceData* instances [[buffer(BufferIndexInstances)]],
+                         const constant AtlasUniforms& uniforms [[buffer(BufferIndexUniforms)]],
+                         const constant float4* clipRects [[buffer(BufferIndexClipRects)]])
 {
     const AtlasInstanceData inst = instances[instanceId];
     
     AtlasVOut out;
     float4 pos = float4(in.position, 0.0, 1.0);
-    out.position = instances[instanceId].transform * pos;
+    float4 worldPos = inst.transform * pos;
+    out.position = useWorldSpaceInstances ? uniforms.viewProjectionMatrix * worldPos : worldPos;
     out.uv = mix(inst.atlasUVMin, inst.atlasUVMax, in.uv); // mix is lerp
     out.color = instances[instanceId].color;
     
+    /// Same as vertex_primitive, world space min / max and distances >= 0 inside. Only set together with world space instances.
+    if (useClipRects) {
+        float4 clip = clipRects[inst.clipIndex];
+        out.clipDistance[0] = worldPos.x - clip.x;
+        out.clipDistance[1] = worldPos.y - clip.y;
+        out.clipDistance[2] = clip.z - worldPos.x;
+        out.clipDistance[3] = clip.w - worldPos.y;
+    } else {
+        for (int i = 0; i < 4; ++i) out.clipDistance[i] = 1.0;
+    }
+    
     return out;
 }
 
@@ -49,6 +78,8 @@ fragment float4 fragment_atlas(AtlasVOut in [[stage_in]],
                               texture2d<float> tex [[texture(0)]],
                               sampler samp [[sampler(0)]]) {
     float4 texColor = tex.sample(samp, in.uv);
+    /// Works for both blend modes, in premultiplied mode both the texels and the instance color are premultiplied.
+    /// An instance color with alpha 0 then makes the sprite additive.
     return texColor * in.color;
 }
 
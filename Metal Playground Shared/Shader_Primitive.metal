@@ -9,35 +9,69 @@
 #include "ShaderTypes.h"
 using namespace metal;
 
+constant bool premultipliedAlpha [[function_constant(FunctionConstantIndexPremultipliedAlpha)]];
+constant bool usePremultipliedAlpha = is_function_constant_defined(premultipliedAlpha) && premultipliedAlpha;
+/// Set for batches of a single shape, the other branches are compiled out. Left undefined for mixed batches.
+constant int specialisedShapeType [[function_constant(FunctionConstantIndexPrimitiveShapeType)]];
+constant bool isShapeSpecialised = is_function_constant_defined(specialisedShapeType);
+/// Set by the metal-cpp renderer, instances then clip against clipRects[clipIndex]. Left undefined nothing is clipped.
+constant bool clipRectsEnabled [[function_constant(FunctionConstantIndexClipRects)]];
+constant bool useClipRects = is_function_constant_defined(clipRectsEnabled) && clipRectsEnabled;
+
 struct PrimitiveVertex {
     float2 position;
 };
 
+/// Fitted meshes, positions are worked out per instance in vertex_primitive_fitted.
+struct PrimitiveFitVertex {
+    float2 corner; // quadrant, (+-1, +-1)
+    float isXEdge; // outer octagon vertices: 1 sits on the quad's x = +-0.5 edge, 0 on its y edge
+    float isInner; // 1: inner edge of a ring / frame strip
+};
+
 struct PrimitiveUniforms {
-    float4x4 projectionMatrix;
+    float4x4 viewProjectionMatrix; /// instance transforms are world space
 };
 
 struct PrimitiveInstanceData {
     float4x4 transform;
     float4 color;
     int shapeType;
+    uint32_t clipIndex;
     float4 sdfParams;
     uint32_t __padding[4];
 };
 
 struct PrimitiveVOut {
     float4 position [[position]];
+    float clipDistance [[clip_distance]] [4];
     float2 localPos;
     float4 color;
     int shapeType;
     float4 sdfParams;
 };
 
+/// Clip rects are world space min / max, distances are >= 0 inside. Done by the rasterizer, no fragment is shaded outside.
+/// Distances are linear in world space so the rect stays exact under any camera.
+static void writeClipDistances(thread PrimitiveVOut& out, float4 worldPos, const constant float4* clipRects, uint clipIndex)
+{
+    if (!useClipRects) {
+        for (int i = 0; i < 4; ++i) out.clipDistance[i] = 1.0;
+        return;
+    }
+    float4 clip = clipRects[clipIndex];
+    out.clipDistance[0] = worldPos.x - clip.x;
+    out.clipDistance[1] = worldPos.y - clip.y;
+    out.clipDistance[2] = clip.z - worldPos.x;
+    out.clipDistance[3] = clip.w - worldPos.y;
+}
+
 vertex PrimitiveVOut vertex_primitive(uint vertexId [[vertex_id]],
                                       uint instanceId [[instance_id]],
                                       const constant PrimitiveVertex* vertices [[buffer(BufferIndexVertices)]],
                                       const constant PrimitiveInstanceData *instances [[buffer(BufferIndexInstances)]],
-                                      const constant PrimitiveUniforms& uniforms [[buffer(BufferIndexUniforms)]])
+                                      const constant PrimitiveUniforms& uniforms [[buffer(BufferIndexUniforms)]],
+                                      const constant float4* clipRects [[buffer(BufferIndexClipRects)]])
 {
     const PrimitiveVertex v = vertices[vertexId];
     const PrimitiveInstanceData inst = instances[instanceId];
@@ -46,21 +80,71 @@ vertex PrimitiveVOut vertex_primitive(uint vertexId [[vertex_id]],
     out.localPos = v.position; // Keep for SDF evaluation
     
     float4 worldPos = inst.transform * float4(v.position, 0.0, 1.0);
-    out.position = uniforms.projectionMatrix * worldPos;
+    out.position = uniforms.viewProjectionMatrix * worldPos;
     
     out.color = inst.color;
     out.shapeType = inst.shapeType;
     out.sdfParams = inst.sdfParams;
+    writeClipDistances(out, worldPos, clipRects, inst.clipIndex);
     
     return out;
 }
 
+/// Only built specialised (see fragment_primitive) for ShapeTypeCircle, ShapeTypeCircleLines and ShapeTypeRectLines.
+/// Every fitted mesh stays inside the instance quad and only leaves out fragments fragment_primitive returns at zero
+/// alpha for, so the result matches the quad exactly.
+vertex PrimitiveVOut vertex_primitive_fitted(uint vertexId [[vertex_id]],
+                                             uint instanceId [[instance_id]],
+                                             const constant PrimitiveFitVertex* vertices [[buffer(BufferIndexVertices)]],
+                                             const constant PrimitiveInstanceData *instances [[buffer(BufferIndexInstances)]],
+                                             const constant PrimitiveUniforms& uniforms [[buffer(BufferIndexUniforms)]],
+                                             const constant float4* clipRects [[buffer(BufferIndexClipRects)]])
+{
+    const PrimitiveFitVertex v = vertices[vertexId];
+    const PrimitiveInstanceData inst = instances[instanceId];
+    
+    float2 localPos;
+    if (specialisedShapeType == ShapeTypeRectLines) {
+        /// Frame strip, the hole is where the outline's dist <= -0.5.
+        float2 halfSize = float2(inst.sdfParams.x, inst.sdfParams.y);
+        float thickness = max(inst.sdfParams.z, 1.0);
+        float2 innerHalfSize = max((halfSize - thickness - 0.5) / max(halfSize * 2.0, 1e-6), 0.0);
+        localPos = v.corner * (v.isInner > 0.5 ? innerHalfSize : float2(0.5));
+    } else {
+        /// Octagon around the radius + edge softness, where alpha reaches zero, clipped to the quad.
+        float radius = max(inst.sdfParams.x, 1e-6);
+        float edge = max(inst.sdfParams.y, 0.5);
+        float outerRadius = 0.5 + edge / (radius * 2.0); // quad space, the quad is [-0.5, 0.5]
+        float cut = min(outerRadius * M_SQRT2_F - 0.5, 0.5); // where the diagonal edges meet the quad's edges
+        if (v.isInner > 0.5) {
+            /// Ring strip, the inner octagon is inscribed in the hole (dist <= -2 * halfThickness - edge).
+            float halfThickness = max(inst.sdfParams.z, 1.0);
+            float innerRadius = max((radius - 2.0 * halfThickness - edge) / (radius * 2.0), 0.0);
+            float2 direction = v.isXEdge > 0.5 ? float2(0.92387953, 0.38268343) : float2(0.38268343, 0.92387953); // 22.5 / 67.5 degrees
+            localPos = v.corner * direction * innerRadius;
+        } else {
+            localPos = v.corner * (v.isXEdge > 0.5 ? float2(0.5, cut) : float2(cut, 0.5));
+        }
+    }
+    
+    PrimitiveVOut out;
+    out.localPos = localPos;
+    float4 worldPos = inst.transform * float4(localPos, 0.0, 1.0);
+    out.position = uniforms.viewProjectionMatrix * worldPos;
+    out.color = inst.color;
+    out.shapeType = inst.shapeType;
+    out.sdfParams = inst.sdfParams;
+    writeClipDistances(out, worldPos, clipRects, inst.clipIndex);
+    return out;
+}
+
 fragment float4 fragment_primitive(PrimitiveVOut in [[stage_in]]) {
     float2 uv = in.localPos;
     float alpha = 0.0;
+    const int shapeType = isShapeSpecialised ? specialisedShapeType : in.shapeType;
 
     // SDF is super useful here: https://iquilezles.org/articles/distfunctions2d/
-    if (in.shapeType == ShapeTypeNone) {
+    if (shapeType == ShapeTypeNone) {
         alpha = 1.0;
         in.color.r = 1.0;
         in.color.g = 0.0;
@@ -68,10 +152,10 @@ fragment float4 fragment_primitive(PrimitiveVOut in [[stage_in]]) {
         in.color.a = 1.0;
         /// Magenta full alpha to show unset shape type.
     }
-    else if (in.shapeType == ShapeTypeRect) {
+    else if (shapeType == ShapeTypeRect) {
         alpha = 1.0;
         /// Nothing special needed here. If you want blurring / smoothing then add smoothstep on rect SDF
-    } else if (in.shapeType == ShapeTypeRoundedRect) {
+    } else if (shapeType == ShapeTypeRoundedRect) {
         float2 halfSize = float2(in.sdfParams.x, in.sdfParams.y);
         float radius = min(in.sdfParams.z, min(halfSize.x, halfSize.y)); // Nice capsule if cornerRadius > width/height
         
@@ -80,7 +164,7 @@ fragment float4 fragment_primitive(PrimitiveVOut in [[stage_in]]) {
         float2 d = abs(pixelPos) - size; // if d is -ve, means pixel is inside full rect area, no chance of corner radius.
         float dist = length(max(d, 0.0)) - radius;
         alpha = smoothstep(0.5, -0.5, dist);
-    } else if (in.shapeType == ShapeTypeRectLines) {
+    } else if (shapeType == ShapeTypeRectLines) {
         float2 halfSize = float2(in.sdfParams.x, in.sdfParams.y);
         float thickness = max(in.sdfParams.z, 1.0); // min thickness is 1
         
@@ -88,7 +172,7 @@ fragment float4 fragment_primitive(PrimitiveVOut in [[stage_in]]) {
         float2 d = abs(pixelPos) - halfSize + float2(thickness);
         float dist = length(max(d, 0.0)) + min(max(d.x, d.y), 0.0);
         alpha = smoothstep(-0.5, 0.5, dist);
-    } else if (in.shapeType == ShapeTypeCircle) {
+    } else if (shapeType == ShapeTypeCircle) {
         float radius = in.sdfParams.x;
         float edge = max(in.sdfParams.y, 0.5);
         
@@ -98,7 +182,7 @@ fragment float4 fragment_primitive(PrimitiveVOut in [[stage_in]]) {
         /// If want smoothing quite a bit of blur kind of smoothing, consider doing
         /// smoothstep(radius, radius - edge, dist); you won't blur beyond the rect
         /// BUT you will loose some accuracy towards the edge (circle will look smaller than radius)
-    } else if (in.shapeType == ShapeTypeCircleLines) {
+    } else if (shapeType == ShapeTypeCircleLines) {
         float radius = in.sdfParams.x;
         float edge = max(in.sdfParams.y, 0.5);
         float halfThickness = max(in.sdfParams.z, 1.0); // Half thickness to keep it inside stroke style.
@@ -113,6 +197,9 @@ fragment float4 fragment_primitive(PrimitiveVOut in [[stage_in]]) {
     }
 
 
+    if (usePremultipliedAlpha) {
+        return in.color * alpha; /// color is already premultiplied on the CPU
+    }
     return float4(in.color.rgb, in.color.a * alpha);
 }
 
@@ -9,6 +9,9 @@
 using namespace metal;
 #include "ShaderTypes.h"
 
+constant bool premultipliedAlpha [[function_constant(FunctionConstantIndexPremultipliedAlpha)]];
+constant bool usePremultipliedAlpha = is_function_constant_defined(premultipliedAlpha) && premultipliedAlpha;
+
 struct TextFragmentUniforms {
     float distanceRange;
 };
@@ -50,6 +53,9 @@ fragment float4 fragment_text(VertexOut in [[stage_in]],
     float bias = -0.00;
     
     float alpha = smoothstep(0.5 + bias - edgeOffset, 0.5 + bias + edgeOffset, sd);
+    if (usePremultipliedAlpha) {
+        return in.textCol * alpha; /// textCol is already premultiplied on the CPU
+    }
     return float4(in.textCol.rgb, in.textCol.a * alpha);
     
     
@@ -0,0 +1,237 @@
+//
+//  DamageTracker.cpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include "DamageTracker.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include "Profiler.hpp"
+
+static const uint64_t emptyTileHash = 0xcbf29ce484222325ull;
+
+// A word at a time, every instance is hashed every frame and hashBytes' byte loop is too slow for that. size has to be a
+// multiple of 8.
+static inline uint64_t hashWords(const void* data, size_t size, uint64_t hash)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        hash = (hash ^ word) * 0x9e3779b97f4a7c15ull;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+static inline uint64_t hashValue(uint64_t value, uint64_t hash)
+{
+    return hashWords(&value, sizeof(value), hash);
+}
+
+// Fields that reach the screen only. Padding is left out, the compiler doesn't have to copy it, and so is clipIndex,
+// its rect is hashed instead so a clip rect pushed earlier in the frame doesn't damage every draw after it.
+static_assert(offsetof(AtlasInstanceData, clipIndex) % sizeof(uint64_t) == 0, "hashed a word at a time");
+static_assert(offsetof(PrimitiveInstanceData, shapeType) % sizeof(uint64_t) == 0, "hashed a word at a time");
+static_assert(sizeof(TextVertex) % sizeof(uint64_t) == 0, "hashed a word at a time");
+
+static inline uint64_t hashInstance(const AtlasInstanceData& instance, uint64_t hash)
+{
+    return hashWords(&instance, offsetof(AtlasInstanceData, clipIndex), hash);
+}
+
+static inline uint64_t hashInstance(const PrimitiveInstanceData& instance, uint64_t hash)
+{
+    hash = hashWords(&instance, offsetof(PrimitiveInstanceData, shapeType), hash);
+    hash = hashValue((uint64_t)(uint32_t)instance.shapeType, hash);
+    return hashWords(&instance.sdfParams, sizeof(instance.sdfParams), hash);
+}
+
+void DamageTracker::update(const DrawRecorder& recorder, int width, int height, simd_float4 clearColor)
+{
+    PROFILE_ZONE("Damage Tracking");
+    assert(width > 0 && height > 0);
+
+    uint64_t newFrameHash = hashValue(((uint64_t)width << 32) | (uint32_t)height, emptyTileHash);
+    newFrameHash = hashWords(&recorder.viewProjectionMatrix, sizeof(recorder.viewProjectionMatrix), newFrameHash);
+    newFrameHash = hashWords(&recorder.projectionMatrix, sizeof(recorder.projectionMatrix), newFrameHash);
+    newFrameHash = hashWords(&clearColor, sizeof(clearColor), newFrameHash);
+    const bool isEverythingDamaged = isInvalidated || newFrameHash != frameHash || width != trackerWidth || height != trackerHeight;
+    frameHash = newFrameHash;
+    isInvalidated = false;
+
+    if (width != trackerWidth || height != trackerHeight) {
+        trackerWidth = width;
+        trackerHeight = height;
+        tileCountX = (width + tileSize - 1) / tileSize;
+        tileCountY = (height + tileSize - 1) / tileSize;
+    }
+    std::swap(tileHashes, previousTileHashes);
+    tileHashes.assign((size_t)tileCountX * tileCountY, emptyTileHash);
+
+    DrawRecorder::clipRectPixelBounds(recorder.clipRects, recorder.viewProjectionMatrix, width, height, clipBounds);
+    DrawRecorder::clipRectPixelBounds(recorder.clipRects, recorder.projectionMatrix, width, height, screenClipBounds);
+    const DrawRecorder::Layer* boundsLayer = nullptr;
+    bool isBoundsLayerScreenSpace = false;
+
+    for (int iBatch = 0; iBatch < recorder.drawBatchCount; ++iBatch) {
+        const DrawRecorder::DrawBatch batch = recorder.drawBatchesArr[iBatch];
+        const int endIndex = batch.startIndex + batch.count;
+        const simd_float4x4& batchProjection = recorder.batchViewProjection(batch);
+        if (batch.layer && (batch.layer != boundsLayer || batch.isScreenSpace != isBoundsLayerScreenSpace)) {
+            DrawRecorder::clipRectPixelBounds(batch.layer->clipRects, batchProjection, width, height, layerClipBounds);
+            boundsLayer = batch.layer;
+            isBoundsLayerScreenSpace = batch.isScreenSpace;
+        }
+        const std::vector<simd_float4>& batchBounds = batch.layer ? layerClipBounds : batch.isScreenSpace ? screenClipBounds : clipBounds;
+        const std::vector<simd_float4>& batchRects = recorder.batchClipRects(batch);
+
+        // Same instance, other pipeline (a fitted mesh, a rebuilt panel texture) can still come out different.
+        uint64_t batchHash = hashValue(((uint64_t)batch.isScreenSpace << 48) | ((uint64_t)batch.type << 40) | ((uint64_t)batch.isFitted << 32) | (uint32_t)batch.shapeType, emptyTileHash);
+        if (batch.panel) batchHash = hashValue(batch.panel->layer.generation, batchHash);
+
+        switch (batch.type) {
+            case DrawRecorder::drawbatchtype_atlas: {
+                const AtlasInstanceData* instances = recorder.batchAtlasInstances(batch);
+                for (int i = batch.startIndex; i < endIndex; ++i) {
+                    const AtlasInstanceData& instance = instances[i];
+                    const uint64_t hash = hashWords(&batchRects[instance.clipIndex], sizeof(simd_float4), hashInstance(instance, batchHash));
+                    addQuad(simd_mul(batchProjection, instance.transform), batchBounds[instance.clipIndex], hash);
+                }
+            } break;
+            case DrawRecorder::drawbatchtype_primitive: {
+                const PrimitiveInstanceData* instances = recorder.batchPrimitiveInstances(batch);
+                for (int i = batch.startIndex; i < endIndex; ++i) {
+                    const PrimitiveInstanceData& instance = instances[i];
+                    const uint64_t hash = hashWords(&batchRects[instance.clipIndex], sizeof(simd_float4), hashInstance(instance, batchHash));
+                    addQuad(simd_mul(batchProjection, instance.transform), batchBounds[instance.clipIndex], hash);
+                }
+            } break;
+            case DrawRecorder::drawbatchtype_text: {
+                const TextVertex* vertices = recorder.batchTextVertices(batch);
+                for (int i = batch.startIndex; i + 2 < endIndex; i += 3) {
+                    addTriangle(vertices + i, batchProjection, hashWords(vertices + i, sizeof(TextVertex) * 3, batchHash));
+                }
+            } break;
+            case DrawRecorder::drawbatchtype_none:
+            case DrawRecorder::drawbatchtype_count: {
+                __builtin_printf("Draw Batch with invalid type %d\n", (int)batch.type);
+                assert(false);
+            } break;
+        }
+    }
+
+    if (isEverythingDamaged || previousTileHashes.size() != tileHashes.size()) {
+        damageRects.assign(1, (DamageRect){ 0, 0, width, height });
+        isFull = true;
+        damagedPixels = (uint64_t)width * height;
+        return;
+    }
+    buildRects();
+}
+
+void DamageTracker::addQuad(simd_float4x4 clipTransform, simd_float4 clip, uint64_t hash)
+{
+    const simd_float4 bounds = DrawRecorder::quadPixelMapping(clipTransform, trackerWidth, trackerHeight).bounds;
+    addPixelBounds(std::max(bounds.x, clip.x), std::max(bounds.y, clip.y), std::min(bounds.z, clip.z), std::min(bounds.w, clip.w), hash);
+}
+
+void DamageTracker::addTriangle(const TextVertex* vertices, simd_float4x4 projection, uint64_t hash)
+{
+    float sx[3], sy[3];
+    for (int iVertex = 0; iVertex < 3; ++iVertex) {
+        const simd_float4 clip = simd_mul(projection, simd_make_float4(vertices[iVertex].position.x, vertices[iVertex].position.y, 0.0f, 1.0f));
+        sx[iVertex] = (clip.x + 1.0f) * trackerWidth * 0.5f;
+        sy[iVertex] = (1.0f - clip.y) * trackerHeight * 0.5f;
+    }
+    addPixelBounds(std::min({ sx[0], sx[1], sx[2] }), std::min({ sy[0], sy[1], sy[2] }),
+                   std::max({ sx[0], sx[1], sx[2] }), std::max({ sy[0], sy[1], sy[2] }), hash);
+}
+
+void DamageTracker::addPixelBounds(float minX, float minY, float maxX, float maxY, uint64_t hash)
+{
+    if (!(minX < maxX && minY < maxY)) return; // clipped away or degenerate, nothing reaches the screen
+    // A pixel over so edge pixels the rasterizer rounds into the neighbouring tile still count.
+    minX -= 1.0f;
+    minY -= 1.0f;
+    maxX += 1.0f;
+    maxY += 1.0f;
+    if (maxX < 0.0f || maxY < 0.0f || minX >= trackerWidth || minY >= trackerHeight) return;
+    const int tileMinX = (int)std::max(minX, 0.0f) / tileSize;
+    const int tileMinY = (int)std::max(minY, 0.0f) / tileSize;
+    const int tileMaxX = (int)std::min(maxX, (float)trackerWidth - 1.0f) / tileSize;
+    const int tileMaxY = (int)std::min(maxY, (float)trackerHeight - 1.0f) / tileSize;
+
+    for (int tileY = tileMinY; tileY <= tileMaxY; ++tileY) {
+        uint64_t* row = tileHashes.data() + (size_t)tileY * tileCountX;
+        for (int tileX = tileMinX; tileX <= tileMaxX; ++tileX) {
+            // Order dependent, drawing the same things in another order damages the tile.
+            row[tileX] = (row[tileX] ^ hash) * 0x100000001b3ull;
+            row[tileX] ^= row[tileX] >> 29;
+        }
+    }
+}
+
+void DamageTracker::buildRects()
+{
+    // Runs of changed tiles per row, a run continues a rect from the row above when it spans exactly the same tiles.
+    // Rects never overlap, no pixel is redrawn twice.
+    struct TileRect { int minX, minY, maxX, maxY; }; // tiles, max exclusive
+    std::vector<TileRect> tileRects; // closed, the rows below didn't continue them
+    std::vector<TileRect> openRects; // reaching the previous row
+    std::vector<TileRect> rowRects;
+    for (int tileY = 0; tileY < tileCountY; ++tileY) {
+        rowRects.clear();
+        const uint64_t* row = tileHashes.data() + (size_t)tileY * tileCountX;
+        const uint64_t* previousRow = previousTileHashes.data() + (size_t)tileY * tileCountX;
+        for (int tileX = 0; tileX < tileCountX;) {
+            if (row[tileX] == previousRow[tileX]) {
+                ++tileX;
+                continue;
+            }
+            const int runStart = tileX;
+            while (tileX < tileCountX && row[tileX] != previousRow[tileX]) ++tileX;
+
+            TileRect rect = { runStart, tileY, tileX, tileY + 1 };
+            for (size_t iOpen = 0; iOpen < openRects.size(); ++iOpen) {
+                if (openRects[iOpen].minX != runStart || openRects[iOpen].maxX != tileX) continue;
+                rect.minY = openRects[iOpen].minY;
+                openRects.erase(openRects.begin() + iOpen);
+                break;
+            }
+            rowRects.push_back(rect);
+        }
+        tileRects.insert(tileRects.end(), openRects.begin(), openRects.end());
+        std::swap(openRects, rowRects);
+    }
+    tileRects.insert(tileRects.end(), openRects.begin(), openRects.end());
+
+    if ((int)tileRects.size() > maxRectCount) {
+        TileRect bounds = tileRects[0];
+        for (const TileRect& rect : tileRects) {
+            bounds = (TileRect){ std::min(bounds.minX, rect.minX), std::min(bounds.minY, rect.minY), std::max(bounds.maxX, rect.maxX), std::max(bounds.maxY, rect.maxY) };
+        }
+        tileRects.assign(1, bounds);
+    }
+
+    damageRects.clear();
+    damagedPixels = 0;
+    for (const TileRect& rect : tileRects) {
+        const int x = rect.minX * tileSize;
+        const int y = rect.minY * tileSize;
+        const DamageRect damage = { x, y, std::min(rect.maxX * tileSize, trackerWidth) - x, std::min(rect.maxY * tileSize, trackerHeight) - y };
+        damageRects.push_back(damage);
+        damagedPixels += (uint64_t)damage.width * damage.height;
+    }
+
+    isFull = damagedPixels > fullDamageCoverage * ((uint64_t)trackerWidth * trackerHeight);
+    if (isFull) {
+        damageRects.assign(1, (DamageRect){ 0, 0, trackerWidth, trackerHeight });
+        damagedPixels = (uint64_t)trackerWidth * trackerHeight;
+    }
+}
@@ -0,0 +1,70 @@
+//
+//  DamageTracker.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef DamageTracker_hpp
+#define DamageTracker_hpp
+
+#include <cstdint>
+#include <vector>
+#include "DrawRecorder.hpp"
+
+// Framebuffer pixels, top row first. Tile aligned, except where clamped to the framebuffer's edge.
+struct DamageRect {
+    int x, y, width, height;
+};
+
+// What a recorded frame changes on screen since the previous one, for backends that keep their framebuffer between
+// frames and only redraw the damaged parts. Every draw (instance, or text triangle) is hashed together with its clip
+// rect and batch state into each tile its pixel bounds touch, in draw order, so a tile's hash changes whenever
+// something over it is added, removed, moved, restyled or drawn in another order. Changed tiles are merged into a few
+// disjoint rects. A new size, camera or clear color damages everything.
+class DamageTracker
+{
+public:
+    static const int tileSize = 64; // same as SoftwareRasterizer's, so its tiles are either damaged or not
+    // Every rect is another scissored pass over the frame's batches, past this they're merged into their bounding box.
+    static const int maxRectCount = 8;
+    // Damage covering more of the framebuffer than this is redrawn whole, unscissored.
+    constexpr static const float fullDamageCoverage = 0.6f;
+
+    // NOTE: Call after groupPrimitivesByShape, with what the backend is about to draw.
+    void update(const DrawRecorder& recorder, int width, int height, simd_float4 clearColor);
+    // The next update damages everything, for when the backend lost what it drew (resized, recreated its target).
+    void invalidate() { isInvalidated = true; }
+
+    const std::vector<DamageRect>& rects() const { return damageRects; } // empty when nothing changed
+    bool isFullDamage() const { return isFull; }
+    uint64_t damagedPixelCount() const { return damagedPixels; }
+    double damagedFraction() const { return trackerWidth > 0 ? (double)damagedPixels / ((uint64_t)trackerWidth * trackerHeight) : 0.0; }
+    // True when the frame can be skipped whole, nothing drawn or presented: no damage, and no in place layer updates
+    // handed over (a backend that never sees them would fall behind, even when the sprites moved off screen).
+    bool isFrameUnchanged(const DrawRecorder& recorder) const { return damageRects.empty() && recorder.layerUpdates.empty(); }
+
+private:
+    int trackerWidth = 0;
+    int trackerHeight = 0;
+    int tileCountX = 0;
+    int tileCountY = 0;
+    uint64_t frameHash = 0; // size, camera and clear color
+    bool isInvalidated = true;
+    std::vector<uint64_t> tileHashes;
+    std::vector<uint64_t> previousTileHashes;
+    std::vector<simd_float4> clipBounds; // DrawRecorder::clipRects in pixels, per update()
+    std::vector<simd_float4> screenClipBounds; // same for isScreenSpace batches
+    std::vector<simd_float4> layerClipBounds; // same for the layer being hashed
+
+    std::vector<DamageRect> damageRects;
+    bool isFull = false;
+    uint64_t damagedPixels = 0;
+
+    void addQuad(simd_float4x4 clipTransform, simd_float4 clip, uint64_t hash);
+    void addTriangle(const TextVertex* vertices, simd_float4x4 projection, uint64_t hash);
+    void addPixelBounds(float minX, float minY, float maxX, float maxY, uint64_t hash);
+    void buildRects();
+};
+
+#endif /* DamageTracker_hpp */
@@ -0,0 +1,1825 @@
+//
+//  DrawRecorder.cpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include "DrawRecorder.hpp"
+#include "ShaderTypes.h"
+#include "Profiler.hpp"
+#include "ii_random.h"
+#include "json.hpp"
+using json = nlohmann::json;
+
+// JSON mapping
+void from_json(const json& j, Bounds& b) {
+    j.at("left").get_to(b.left);
+    j.at("bottom").get_to(b.bottom);
+    j.at("right").get_to(b.right);
+    j.at("top").get_to(b.top);
+}
+
+void from_json(const json& j, Glyph& g) {
+    j.at("unicode").get_to(g.unicode);
+    j.at("advance").get_to(g.advance);
+    
+    if (j.contains("planeBounds") && !j["planeBounds"].is_null()) {
+        g.planeBounds = j["planeBounds"].get<Bounds>();
+    } else {
+        g.planeBounds = std::nullopt;
+    }
+    
+    if (j.contains("atlasBounds") && !j["atlasBounds"].is_null()) {
+        g.atlasBounds = j["atlasBounds"].get<Bounds>();
+    } else {
+        g.atlasBounds = std::nullopt;
+    }
+}
+
+void from_json(const json& j, Kerning& k) {
+    j.at("unicode1").get_to(k.unicode1);
+    j.at("unicode2").get_to(k.unicode2);
+    j.at("advance").get_to(k.advance);
+}
+
+void from_json(const json& j, AtlasMetrics& a) {
+    j.at("type").get_to(a.type);
+    j.at("distanceRange").get_to(a.distanceRange);
+    j.at("size").get_to(a.size);
+    j.at("width").get_to(a.width);
+    j.at("height").get_to(a.height);
+    j.at("yOrigin").get_to(a.yOrigin);
+}
+
+void from_json(const json& j, FontMetrics& m) {
+    j.at("emSize").get_to(m.emSize);
+    j.at("lineHeight").get_to(m.lineHeight);
+    j.at("ascender").get_to(m.ascender);
+    j.at("descender").get_to(m.descender);
+    j.at("underlineY").get_to(m.underlineY);
+    j.at("underlineThickness").get_to(m.underlineThickness);
+}
+
+void from_json(const json& j, FontAtlas& f) {
+    j.at("atlas").get_to(f.atlas);
+    j.at("metrics").get_to(f.metrics);
+    j.at("glyphs").get_to(f.glyphs);
+    j.at("kerning").get_to(f.kerning);
+}
+
+
+// MARK: - Math Helpers
+static inline simd_float4x4 makeTranslate(float tx, float ty)
+{
+    simd_float4x4 m = matrix_identity_float4x4;
+    m.columns[3].x = tx;
+    m.columns[3].y = ty;
+    return m;
+}
+
+static inline simd_float4x4 makeScale(float sx, float sy)
+{
+    simd_float4x4 m = matrix_identity_float4x4;
+    m.columns[0].x = sx;
+    m.columns[1].y = sy;
+    m.columns[2].z = 1.0f;
+    return m;
+}
+
+static inline simd_float4x4 makeScale(float sXY)
+{
+    simd_float4x4 m = matrix_identity_float4x4;
+    m.columns[0].x = sXY;
+    m.columns[1].y = sXY;
+    m.columns[2].z = 1.0f;
+    return m;
+}
+
+static inline simd_float4x4 makeRotationZ(float angle)
+{
+    simd_float4x4 m = matrix_identity_float4x4;
+    float c = std::cos(angle);
+    float s = std::sin(angle);
+    
+    m.columns[0].x =  c;
+    m.columns[0].y =  s;
+    m.columns[1].x = -s;
+    m.columns[1].y =  c;
+    return m;
+}
+
+// Quad x along from -> to, y across it with the given width. The rotation comes straight from the unit direction,
+// no atan2 / cos / sin or matrix products.
+static inline simd_float4x4 makeSegmentTransform(simd_float2 from, simd_float2 to, simd_float2 direction, float width)
+{
+    simd_float4x4 m = matrix_identity_float4x4;
+    m.columns[0].x = to.x - from.x;
+    m.columns[0].y = to.y - from.y;
+    m.columns[1].x = -direction.y * width;
+    m.columns[1].y = direction.x * width;
+    m.columns[3].x = (from.x + to.x) * 0.5f;
+    m.columns[3].y = (from.y + to.y) * 0.5f;
+    return m;
+}
+
+// Clip rect slot 0, far enough out that nothing on screen is ever clipped by it.
+static const simd_float4 unclippedRect = { -1e30f, -1e30f, 1e30f, 1e30f };
+
+static inline simd_float4x4 pixelSpaceProjection(float screenWidth, float screenHeight)
+{
+    float scaleX = 2.0f / screenWidth;
+    float scaleY = 2.0f / screenHeight;
+    
+    return simd_float4x4{
+        simd_float4{ scaleX, 0.0f,   0.0f, 0.0f },
+        simd_float4{ 0.0f,   scaleY, 0.0f, 0.0f },
+        simd_float4{ 0.0f,   0.0f,   1.0f, 0.0f },
+        simd_float4{ 0.0f,   0.0f,   0.0f, 1.0f }
+    };
+}
+
+
+DrawRecorder::DrawRecorder()
+{
+    // TODO: Figure out how to assert the padding and stride of the shader structs too!
+    static_assert(sizeof(AtlasInstanceData) == 128, "AtlasInstanceData must match the shader");
+    static_assert(sizeof(PrimitiveInstanceData) == 128, "PrimitiveInstanceData must match the shader");
+    static_assert(sizeof(TextVertex) == 32, "TextVertex must match the shader");
+    
+    drawBatchesArr = new DrawBatch[drawBatchMaxCount];
+    groupedBatchesArr = new DrawBatch[drawBatchMaxCount];
+    // TODO: Check but I think nextStartIndexForTypePtr and strideSizesPtr are already created via definition.
+    for (int i = 0; i < drawbatchtype_count; ++i) nextStartIndexForTypePtr[i] = 0;
+    for (int i = 0; i < drawbatchtype_count; ++i) strideSizesPtr[i] = 0;
+    strideSizesPtr[drawbatchtype_atlas] = sizeof(AtlasInstanceData);
+    strideSizesPtr[drawbatchtype_primitive] = sizeof(PrimitiveInstanceData);
+    strideSizesPtr[drawbatchtype_text] = sizeof(TextVertex);
+    
+    textTempVertexBuffer = new TextVertex[textMaxSingleDrawVertCount];
+    clipRects.reserve(clipRectMaxCount);
+    clipRects.assign(1, unclippedRect);
+}
+
+DrawRecorder::~DrawRecorder()
+{
+    delete[] drawBatchesArr;
+    drawBatchesArr = nullptr;
+    delete[] groupedBatchesArr;
+    groupedBatchesArr = nullptr;
+    delete[] textTempVertexBuffer;
+    textTempVertexBuffer = nullptr;
+}
+
+void DrawRecorder::beginFrame(AtlasInstanceData* atlasInstances, PrimitiveInstanceData* primitiveInstances, TextVertex* textVertices)
+{
+    atlasInstancesPtr = atlasInstances;
+    primitiveInstancesPtr = primitiveInstances;
+    textVertexBufferPtr = textVertices;
+    
+    drawBatchCount = 0;
+    for (int iBatchType = 0; iBatchType < drawbatchtype_count; ++iBatchType) { nextStartIndexForTypePtr[iBatchType] = 0; }
+    curDrawBatchType = drawbatchtype_none;
+    atlasInstanceCount = 0;
+    primitiveInstanceCount = 0;
+    textVertexCount = 0;
+    mixedPrimitiveInstanceCount = 0;
+    
+    assert(!layerRecording.layer); // every beginLayer needs its endLayer within the frame
+    assert(clipIndexStack.empty()); // every pushClipRect needs its popClipRect within the frame
+    assert(!isRecordingScreenSpace); // every beginScreenSpace needs its endScreenSpace within the frame
+    clipIndexStack.clear();
+    isRecordingScreenSpace = false;
+    clipRects.assign(1, unclippedRect);
+    currentClipIndex = 0;
+    instanceUpdates.clear();
+    layerUpdates.clear();
+}
+
+void DrawRecorder::setScreenSize(CGSize size)
+{
+    screenSize = size;
+    projectionMatrix = pixelSpaceProjection((float)size.width, (float)size.height);
+    viewProjectionMatrix = simd_mul(projectionMatrix, viewMatrix);
+}
+
+void DrawRecorder::setCamera(const Camera& newCamera)
+{
+    assert(newCamera.zoom > 0.0f);
+    camera = newCamera;
+    // Move the camera's position to the origin, then turn the world the opposite way to the camera and scale it.
+    viewMatrix = simd_mul(makeScale(camera.zoom), simd_mul(makeRotationZ(-camera.rotationRadians), makeTranslate(-camera.position.x, -camera.position.y)));
+    viewProjectionMatrix = simd_mul(projectionMatrix, viewMatrix);
+}
+
+void DrawRecorder::beginScreenSpace()
+{
+    assert(!isRecordingScreenSpace);
+    assert(!layerRecording.layer);
+    isRecordingScreenSpace = true;
+    // Draws from here on can't extend a batch drawn under the camera, and the other way around in endScreenSpace.
+    curDrawBatchType = drawbatchtype_none;
+}
+
+void DrawRecorder::endScreenSpace()
+{
+    assert(isRecordingScreenSpace);
+    isRecordingScreenSpace = false;
+    curDrawBatchType = drawbatchtype_none;
+}
+
+void DrawRecorder::loadAtlasUVs(const std::string& uvFileUrl, int textureWidth, int textureHeight, std::vector<TextureRegion>& outSpriteRegions)
+{
+    using namespace std;
+    
+    ifstream file(uvFileUrl);
+    assert(file.is_open());
+    string line;
+    
+    // Skip the first line (count line)
+    getline(file, line);
+    while (std::getline(file, line)) {
+        if (line.empty()) continue;
+        
+        std::istringstream iss(line);
+        std::string name;
+        float x, y, w, h;
+        
+        if (iss >> name >> x >> y >> w >> h) {
+            simd::float2 minUV = {x / textureWidth, y / textureHeight};
+            simd::float2 maxUV = {(x + w) / textureWidth, (y + h) / textureHeight};
+            
+            mainAtlasUVRects[name] = {minUV, maxUV};
+            // Sprite rects, used to keep the mip filtering from bleeding across sprites.
+            outSpriteRegions.push_back((TextureRegion){ (int)x, (int)y, (int)w, (int)h });
+        }
+    }
+    file.close();
+}
+
+void DrawRecorder::loadFontInfo(const std::string& jsonFileUrl, std::vector<TextureRegion>& outGlyphRegions)
+{
+    using namespace std;
+    
+    { // Load JSON file
+        ifstream file(jsonFileUrl);
+        assert(file.is_open());
+        
+        json j;
+        file >> j;
+        fontAtlas = j.get<FontAtlas>();
+        
+        file.close();
+        
+        for (const auto& glyph : fontAtlas.glyphs) {
+            fontGlyphs[(uint32_t)glyph.unicode] = glyph;
+        }
+        
+        for (const auto& kern : fontAtlas.kerning) {
+            uint64_t key = ((uint64_t)kern.unicode1 << 32) | (uint64_t)kern.unicode2;
+            fontKerning[key] = kern;
+        }
+    }
+    
+    // Glyph rects, atlasBounds are bottom-left origin so flip into image rows.
+    const int fontTextureHeight = fontAtlas.atlas.height;
+    for (const auto& glyph : fontAtlas.glyphs) {
+        if (!glyph.atlasBounds) continue;
+        const Bounds& bounds = *glyph.atlasBounds;
+        const int left = (int)floorf(bounds.left);
+        const int top = fontTextureHeight - (int)ceilf(bounds.top);
+        outGlyphRegions.push_back((TextureRegion){
+            .x = left,
+            .y = top,
+            .width = (int)ceilf(bounds.right) - left,
+            .height = fontTextureHeight - (int)floorf(bounds.bottom) - top
+        });
+    }
+}
+
+
+// MARK: - Test functions
+void DrawRecorder::testDrawPrimitives() {
+    PROFILE_ZONE("Record Primitives");
+    const int circleCount = 100000;
+    RNG rng = {U32(time * 1000000)};
+    simd_float4 color = {};
+    
+    for (int iCircle = 0; iCircle < circleCount; ++iCircle) {
+        const float x = RandomRangeF32(&rng, -screenSize.width, screenSize.width);
+        const float y = RandomRangeF32(&rng, -screenSize.height, screenSize.height);
+        const float radius = RandomRangeF32(&rng, 5, 25);
+        
+        color.x = RandomF01(&rng);
+        color.y = RandomF01(&rng);
+        color.z = RandomF01(&rng);
+        color.w = 1.0;
+        
+        drawPrimitiveCircle(x, y, radius, color);
+    }
+    
+//    drawPrimitiveCircle(0, 0, 50, 0, 255, 255, 255);
+//    drawPrimitiveCircle(0, 0, 800.0, 255, 255, 255, 64);
+//    drawPrimitiveCircle(0, 0, 512.0, 0, 255, 255, 64);
+//    drawPrimitiveCircle(0, 0, 256.0, 255, 0, 255, 64);
+//    drawPrimitiveCircle(256, 256, 128.0, 255, 0, 0, 64);
+//    drawPrimitiveCircle(0, 0, 128.0, 0, 255, 0, 64);
+//    drawPrimitiveCircle(-256, -256, 128.0, 0, 0, 255, 64);
+//    drawPrimitiveLine(-800, -600, 800, 600, 10, 200, 100, 0, 128);
+//    drawPrimitiveRectLines(0, 0, 800, 600, 48, 0, 255, 255, 255);
+//    drawPrimitiveRect(0, 0, 800, 600, 255, 0, 0, 64);
+//    drawPrimitiveRect(-800, -600, 800, 600, 255, 0, 0, 64);
+//    drawPrimitiveRect(0, 0, 24, 600, 255, 0, 0, 64);
+//    drawPrimitiveRect(0, 0, 128, 196, 0, 255, 0, 128);
+//    drawPrimitiveRect(-800, -600, 800, 600, 128, 255, 0, 128);
+//    drawPrimitiveRect(-800, -600, 1600, 1200, 0, 255, 255, 32);
+//    drawPrimitiveRoundedRect(0, 0, 800, 600, 100, 0, 0, 255, 255);
+//    drawPrimitiveRoundedRect(0, 0, 800, 100, 100, 0, 255, 255, 255);
+//    drawPrimitiveCircle(100, 100, 100, 255, 0, 0, 128);
+//    drawPrimitiveRect(-600, -600, 1200, 1200, 255, 0, 255, 255);
+//    drawPrimitiveCircle(0, 0, 600, 255, 255, 255, 255);
+//    drawPrimitiveCircleLines(0, 0, 600, 48, 255, 0, 255, 128);
+//    drawPrimitiveRect(-600, -600, 48, 1200, 0, 255, 0, 128);
+
+}
+
+void DrawRecorder::testDrawAtlasSprites()
+{
+    PROFILE_ZONE("Record Sprites");
+    const int testMaxCount = 100;
+    const int testCount = std::min
+    ((int)((sin(time * 2.0f) + 1.0f) / 2.0f * testMaxCount),
+     atlasMaxInstanceCount - 1);
+    
+    simd_float4 color;
+    for (int i = 0; i < testCount; ++i) {
+        const float angle = time + ((float)i) * (2.0f * M_PI / ((float)testCount));
+        const float radius = ((float)screenSize.width) / 3.0f;
+        color.x = 0.5f + 0.5f * sin(angle);
+        color.y = 0.5f + 0.5f * cos(angle);
+        color.z = 0.5f + 0.5f * sin(angle * 0.5f);
+        color.w = 1.0f;
+        
+        drawSprite("Circle_White", cos(angle) * radius, sin(angle) * radius, 100.0f + 100.0f * sin(angle), 100.0f + 100.0f * sin(angle), color, angle * 2);
+    }
+    
+    { // Test anything static here, adds to last insance count
+        const char* spriteName = "player_1";
+        drawSprite(spriteName, 100, 100, 256, 256, colorFromBytes(255, 255, 255, 255), 0.0f);
+    }
+}
+
+void DrawRecorder::testDrawTextWithBounds()
+{
+    PROFILE_ZONE("Record Text");
+    const float fontSize = 96.0f;
+    
+    // Generate timestamp as string
+    std::time_t now = std::time(nullptr);
+    char timeBuffer[32];
+    std::snprintf(timeBuffer, sizeof(timeBuffer), "%ld", now);
+    
+    // Build text with multiple lines: "Hello, SDF\nWorld!\n\n<timestamp>"
+    char text[256];
+    std::snprintf(text, sizeof(text), "Hello, SDF\nWorld!\n\n%s", timeBuffer);
+    
+    // Measure text bounds
+    auto bounds = measureTextBounds(text, fontSize); // returns std::pair<float, float>
+    float textWidth  = bounds.first;
+    float textHeight = bounds.second;
+    
+    // Draw a circle at the top-left of the text bounds
+    simd::float4 white = {1.0f, 1.0f, 1.0f, 1.0f};
+    drawPrimitiveCircle(-textWidth / 2.0f,
+                        textHeight / 2.0f,
+                        16.0f,
+                        white);
+        
+    // Draw a rectangle behind the text to visualize bounds
+    drawPrimitiveRect(-textWidth / 2.0f,
+                      -textHeight / 2.0f,
+                      textWidth,
+                      textHeight,
+                      simd::float4{0.0f, 1.0f, 1.0f, 0.25f} // semi-transparent cyan
+                      );
+    
+    // Draw the main multi-line text
+    simd::float4 yellow = {0.9f, 0.9f, 0.1f, 1.0f};
+    drawText(
+             text,
+             -textWidth / 2.0f,
+             textHeight / 2.0f,
+             fontSize,
+             yellow
+             );
+    
+    // Draw another text at fixed offset
+    simd::float4 purple = {0.3f, 0.2f, 0.7f, 1.0f};
+    drawText("HELLO       AGAIN!!!",
+             20.0f - screenSize.width / 2.0f,
+             -20.0f + screenSize.height / 2.0f,
+             48.0f,
+             purple
+             );
+}
+
+void DrawRecorder::testDrawInterleavedTypes()
+{
+    PROFILE_ZONE("Record Interleaved");
+    // Waves and circle positions
+    float wave1   = std::sin(time * 1.5f) * 300.0f;
+    float wave2   = std::cos(time * 0.8f) * 200.0f;
+    float wave3   = std::sin(time * 3.2f) * 100.0f;
+    float circleX = std::sin(time * 2.0f) * 256.0f;
+    float circleY = std::cos(time * 1.0f) * 128.0f;
+
+    // Draw first sprite
+    drawSprite(
+        "player_2",
+        wave1,
+        wave2,
+        256.0f + wave3,
+        256.0f + wave3,
+        simd::float4{1.0f, 1.0f, 1.0f, 1.0f},
+        0.0f
+    );
+
+    // Draw moving circle
+    drawPrimitiveCircle(
+        circleX,
+        circleY,
+        128.0f + std::sin(time * 4.0f) * 64.0f,
+        simd::float4{1.0f, 0.3f, 0.5f, 1.0f}
+    );
+
+    // Draw mirrored sprite
+    drawSprite(
+        "player_2",
+        -circleX,
+        -circleY,
+        128.0f,
+        128.0f,
+        simd::float4{1.0f, 1.0f, 1.0f, 1.0f},
+        0.0f
+    );
+
+    // Dynamic text Y offset
+    float textYOffset = std::sin(time * 1.2f) * 40.0f;
+
+    // Draw first dynamic text
+    drawText(
+        "Dynamic Text\nis Alive!",
+        -200.0f,
+        300.0f + textYOffset,
+        64.0f + std::sin(time * 2.5f) * 8.0f,
+        simd::float4{1.0f, 0.8f, 0.2f, 1.0f}
+    );
+
+    // Draw static text
+    drawText(
+        "Another Test",
+        -150.0f,
+        -50.0f,
+        48.0f,
+        simd::float4{1.0f, 0.0f, 1.0f, 1.0f}
+    );
+
+    // Scroll offset for moving text block
+    float scrollOffset = std::sin(time * 0.5f) * 150.0f;
+
+    // Draw first scrolling text block
+    drawText(
+        "This is a much\nLonger test of a block\nOf text here and there\nAnother line here\nAnother line there\n  Here's one with 2 spaces before",
+        -600.0f + scrollOffset,
+        600.0f,
+        96.0f,
+        simd::float4{0.1f, 1.0f, 0.5f, 1.0f}
+    );
+
+    // Another moving circle
+    drawPrimitiveCircle(
+        std::sin(time * 0.7f) * 600.0f,
+        std::cos(time * 0.9f) * 500.0f,
+        64.0f,
+        simd::float4{0.0f, 0.5f, 0.5f, 1.0f}
+    );
+
+    // Draw mirrored scrolling text block
+    drawText(
+        "This is a much\nLonger test of a block\nOf text here and there\nAnother line here\nAnother line there\n  Here's one with 2 spaces before",
+        -900.0f - scrollOffset,
+        100.0f,
+        96.0f,
+        simd::float4{0.1f, 1.0f, 0.5f, 1.0f}
+    );
+}
+
+inline simd_float4 DrawRecorder::colorFromBytes(UInt8 r, UInt8 g, UInt8 b, UInt8 a) {
+    const float scale = 1.0 / 255.0;
+    return {
+        (float)r * scale,
+        (float)g * scale,
+        (float)b * scale,
+        (float)a * scale,
+    };
+}
+
+inline simd_float4 DrawRecorder::instanceColor(simd_float4 color) {
+    if (!premultipliedAlpha) return color;
+    return simd_make_float4(color.x * color.w, color.y * color.w, color.z * color.w, color.w);
+}
+
+inline simd_float4 DrawRecorder::additiveInstanceColor(simd_float4 color) {
+    if (!premultipliedAlpha) return color; // NOTE: Straight alpha can't express additive, falls back to normal blending.
+    return simd_make_float4(color.x * color.w, color.y * color.w, color.z * color.w, 0.0f);
+}
+
+inline int DrawRecorder::addToDrawBatchAndGetAdjustedIndex(DrawBatchType type, int increment) {
+    int nextStartIndex = nextStartIndexForTypePtr[type];
+    const int batchIndex = drawBatchCount;
+    const DrawBatchType curType = curDrawBatchType;
+    
+    // Fast path: return early
+    if (curType == type) {
+        drawBatchesArr[batchIndex - 1].count += increment;
+        nextStartIndexForTypePtr[type] = nextStartIndex + increment;
+        return nextStartIndex;
+    }
+    
+    // Infrequent path: Switching types
+    const int alignmentSize = 256;
+    const int alignmentCount = alignmentSize / strideSizesPtr[type];
+    const int misalignment = nextStartIndex % alignmentCount;
+    
+    if (misalignment != 0) {
+        nextStartIndex += alignmentCount - misalignment;
+    }
+    
+    assert(type == drawbatchtype_atlas ? (nextStartIndex + increment) < atlasMaxInstanceCount : true);
+    assert(type == drawbatchtype_primitive ? (nextStartIndex + increment) < primitiveMaxInstanceCount : true);
+    //    assert(type == drawbatchtype_text ? (nextStartIndex + increment) < textMaxVertexCount : true);
+    
+    curDrawBatchType = type;
+    drawBatchesArr[batchIndex] = (DrawBatch){
+        .type = type,
+        .startIndex = nextStartIndex,
+        .count = increment,
+        .shapeType = primitiveShapeMixed,
+        .isFitted = false,
+        .layer = nullptr,
+        .panel = nullptr,
+        .isOpaque = false,
+        .opaqueStartIndex = 0,
+        .isScreenSpace = isRecordingScreenSpace
+    };
+    drawBatchCount += 1;
+    
+    nextStartIndexForTypePtr[type] = nextStartIndex + increment;
+    return nextStartIndex;
+}
+
+// MARK: - Atlas Drawing Functions
+void DrawRecorder::drawSprite(const char* spriteName, float x, float y, float width, float height, UInt8 r, UInt8 g, UInt8 b, UInt8 a, float rotationRadians)
+{
+    drawSprite(spriteName, x, y, width, height, colorFromBytes(r, g, b, a), rotationRadians);
+}
+void DrawRecorder::drawSprite(const char* spriteName, float x, float y, float width, float height, simd_float4 color, float rotationRadians)
+{
+    const simd_float4x4 transform = simd_mul(makeTranslate(x, y), simd_mul(makeRotationZ(rotationRadians), makeScale(width, height)));
+    if (isQuadClippedOut(transform)) return;
+    
+    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_atlas, 1);
+    const AtlasUVRect& uvRect = mainAtlasUVRects[spriteName];
+    atlasInstancesPtr[index] = (AtlasInstanceData){
+        .transform = transform,
+        .color = instanceColor(color),
+        .uvMin = uvRect.minUV,
+        .uvMax = uvRect.maxUV,
+        .clipIndex = currentClipIndex,
+        .isOpaque = uvRect.isOpaque && color.w >= 1.0f
+    };
+    ++atlasInstanceCount;
+}
+
+void DrawRecorder::drawSpriteAdditive(const char* spriteName, float x, float y, float width, float height, UInt8 r, UInt8 g, UInt8 b, UInt8 a, float rotationRadians)
+{
+    drawSpriteAdditive(spriteName, x, y, width, height, colorFromBytes(r, g, b, a), rotationRadians);
+}
+void DrawRecorder::drawSpriteAdditive(const char* spriteName, float x, float y, float width, float height, simd_float4 color, float rotationRadians)
+{
+    // Same pipeline and batch as drawSprite, the zero alpha in the premultiplied instance color is what makes it additive.
+    const simd_float4x4 transform = simd_mul(makeTranslate(x, y), simd_mul(makeRotationZ(rotationRadians), makeScale(width, height)));
+    if (isQuadClippedOut(transform)) return;
+    
+    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_atlas, 1);
+    const AtlasUVRect& uvRect = mainAtlasUVRects[spriteName];
+    const simd_float4 additiveColor = additiveInstanceColor(color);
+    atlasInstancesPtr[index] = (AtlasInstanceData){
+        .transform = transform,
+        .color = additiveColor,
+        .uvMin = uvRect.minUV,
+        .uvMax = uvRect.maxUV,
+        .clipIndex = currentClipIndex,
+        .isOpaque = uvRect.isOpaque && additiveColor.w >= 1.0f // straight alpha falls back to normal blending
+    };
+    ++atlasInstanceCount;
+}
+
+
+// MARK: - Primitive Drawing Functions
+void DrawRecorder::drawPrimitiveCircle(float x, float y, float radius,
+                             UInt8 r, UInt8 g, UInt8 b, UInt8 a)
+{
+    drawPrimitiveCircle(x, y, radius, colorFromBytes(r, g, b, a));
+}
+void DrawRecorder::drawPrimitiveCircle(float x, float y, float radius, simd_float4 color)
+{
+    const simd_float4x4 transform = simd_mul(makeTranslate(x, y), makeScale(radius * 2));
+    if (isQuadClippedOut(transform)) return;
+    
+    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
+    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
+        .transform = transform,
+        .color = instanceColor(color),
+        .shapeType = ShapeTypeCircle,
+        .clipIndex = currentClipIndex,
+        .sdfParams = (simd_float4){radius, 0.5f, 0.0f, 0.0f} // hardcode edge softness to 0.5
+    };
+    ++primitiveInstanceCount;
+}
+
+void DrawRecorder::drawPrimitiveCircleLines(float x, float y, float radius, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a)
+{
+    drawPrimitiveCircleLines(x, y, radius, thickness, colorFromBytes(r, g, b, a));
+}
+void DrawRecorder::drawPrimitiveCircleLines(float x, float y, float radius, float thickness, simd_float4 color)
+{
+    const simd_float4x4 transform = simd_mul(makeTranslate(x, y), makeScale(radius * 2));
+    if (isQuadClippedOut(transform)) return;
+    
+    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
+    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
+        .transform = transform,
+        .color = instanceColor(color),
+        .shapeType = ShapeTypeCircleLines,
+        .clipIndex = currentClipIndex,
+        .sdfParams = (simd_float4){radius, 0.5f, thickness / 2.0f, 0.0f}
+    };
+    ++primitiveInstanceCount;
+}
+    
+void DrawRecorder::drawPrimitiveLine(float x1, float y1, float x2, float y2, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a)
+{
+    drawPrimitiveLine(x1, y1, x2, y2, thickness, colorFromBytes(r, g, b, a));
+}
+void DrawRecorder::drawPrimitiveLine(float x1, float y1, float x2, float y2, float thickness, simd_float4 color)
+{
+    const float dx = x2 - x1;
+    const float dy = y2 - y1;
+    const float length = sqrt(dx * dx + dy * dy);
+    const simd_float2 direction = length > 0.0f ? (simd_float2){ dx / length, dy / length } : (simd_float2){ 1.0f, 0.0f };
+    
+    const simd_float4x4 transform = makeSegmentTransform((simd_float2){ x1, y1 }, (simd_float2){ x2, y2 }, direction, thickness);
+    if (isQuadClippedOut(transform)) return;
+    
+    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
+    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
+        .transform = transform,
+        .color = instanceColor(color),
+        .shapeType = ShapeTypeRect,
+        .clipIndex = currentClipIndex,
+        .sdfParams = (simd_float4){0.0f, 0.0f, 0.0f, 0.0f}
+    };
+    ++primitiveInstanceCount;
+}
+    
+void DrawRecorder::drawPrimitiveRect(float x, float y, float width, float height, UInt8 r, UInt8 g, UInt8 b, UInt8 a)
+{
+    drawPrimitiveRect(x, y, width, height, colorFromBytes(r, g, b, a));
+}
+void DrawRecorder::drawPrimitiveRect(float x, float y, float width, float height, simd_float4 color)
+{
+    const simd_float4x4 transform = simd_mul(makeTranslate(x + (width / 2.0f), y + (height / 2.0f)), makeScale(width, height));
+    if (isQuadClippedOut(transform)) return;
+    
+    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
+    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
+        .transform = transform,
+        .color = instanceColor(color),
+        .shapeType = ShapeTypeRect,
+        .clipIndex = currentClipIndex,
+        .sdfParams = (simd_float4){0.0f, 0.0f, 0.0f, 0.0f}
+    };
+    ++primitiveInstanceCount;
+}
+
+void DrawRecorder::drawPrimitiveRoundedRect(float x, float y, float width, float height, float cornerRadius, UInt8 r, UInt8 g, UInt8 b, UInt8 a)
+{
+    drawPrimitiveRoundedRect(x, y, width, height, cornerRadius, colorFromBytes(r, g, b, a));
+}
+void DrawRecorder::drawPrimitiveRoundedRect(float x, float y, float width, float height, float cornerRadius, simd_float4 color)
+{
+    const float halfWidth = width / 2.0f;
+    const float halfHeight = height / 2.0f;
+    
+    const simd_float4x4 transform = simd_mul(makeTranslate(x + halfWidth, y + halfHeight), makeScale(width, height));
+    if (isQuadClippedOut(transform)) return;
+    
+    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
+    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
+        .transform = transform,
+        .color = instanceColor(color),
+        .shapeType = ShapeTypeRoundedRect,
+        .clipIndex = currentClipIndex,
+        .sdfParams = (simd_float4){halfWidth, halfHeight, cornerRadius, 0.0f}
+    };
+    ++primitiveInstanceCount;
+}
+
+void DrawRecorder::drawPrimitiveRectLines(float x, float y, float width, float height, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a)
+{
+    drawPrimitiveRectLines(x, y, width, height, thickness, colorFromBytes(r, g, b, a));
+}
+void DrawRecorder::drawPrimitiveRectLines(float x, float y, float width, float height, float thickness, simd_float4 color)
+{
+    const float halfWidth = width / 2.0f;
+    const float halfHeight = height / 2.0f;
+    
+    const simd_float4x4 transform = simd_mul(makeTranslate(x + halfWidth, y + halfHeight), makeScale(width, height));
+    if (isQuadClippedOut(transform)) return;
+    
+    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
+    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
+        .transform = transform,
+        .color = instanceColor(color),
+        .shapeType = ShapeTypeRectLines,
+        .clipIndex = currentClipIndex,
+        .sdfParams = (simd_float4){halfWidth, halfHeight, thickness, 0.0f}
+    };
+    ++primitiveInstanceCount;
+}
+
+void DrawRecorder::drawPrimitivePolyline(const simd_float2* points, int pointCount, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a, LineJoin join, LineCap cap)
+{
+    recordPolyline(points, pointCount, false, thickness, colorFromBytes(r, g, b, a), join, cap);
+}
+void DrawRecorder::drawPrimitivePolyline(const simd_float2* points, int pointCount, float thickness, simd_float4 color, LineJoin join, LineCap cap)
+{
+    recordPolyline(points, pointCount, false, thickness, color, join, cap);
+}
+
+void DrawRecorder::drawPrimitivePath(const simd_float2* points, int pointCount, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a, LineJoin join)
+{
+    recordPolyline(points, pointCount, true, thickness, colorFromBytes(r, g, b, a), join, linecap_butt);
+}
+void DrawRecorder::drawPrimitivePath(const simd_float2* points, int pointCount, float thickness, simd_float4 color, LineJoin join)
+{
+    recordPolyline(points, pointCount, true, thickness, color, join, linecap_butt);
+}
+
+void DrawRecorder::recordPolyline(const simd_float2* points, int pointCount, bool isClosed, float thickness, simd_float4 color, LineJoin join, LineCap cap)
+{
+    if (pointCount < 2 || thickness <= 0.0f) return;
+    const float halfThickness = thickness * 0.5f;
+    
+    // Segment directions in one tight pass over the points, repeated points are dropped so they don't break joins.
+    const int segmentCount = isClosed ? pointCount : pointCount - 1;
+    polylineSegments.resize(segmentCount);
+    int keptCount = 0;
+    for (int i = 0; i < segmentCount; ++i) {
+        const simd_float2 from = points[i];
+        const simd_float2 to = points[i + 1 < pointCount ? i + 1 : 0];
+        const float dx = to.x - from.x;
+        const float dy = to.y - from.y;
+        const float length = sqrtf(dx * dx + dy * dy);
+        if (length < 1e-4f) continue;
+        const float inverseLength = 1.0f / length;
+        polylineSegments[keptCount++] = (PolylineSegment){
+            .from = from,
+            .to = to,
+            .direction = { dx * inverseLength, dy * inverseLength },
+            .length = length
+        };
+    }
+    if (keptCount == 0) return;
+    
+    polylineCircleCenters.clear();
+    const int jointCount = isClosed && keptCount > 1 ? keptCount : keptCount - 1;
+    for (int iJoint = 0; iJoint < jointCount && join != linejoin_none; ++iJoint) {
+        PolylineSegment& a = polylineSegments[iJoint];
+        PolylineSegment& b = polylineSegments[iJoint + 1 < keptCount ? iJoint + 1 : 0];
+        const float cosTurn = a.direction.x * b.direction.x + a.direction.y * b.direction.y;
+        const float sinTurn = a.direction.x * b.direction.y - a.direction.y * b.direction.x;
+        if (cosTurn > 0.99999f) continue; // straight on, nothing to fill
+        
+        // Lengthening each segment by halfThickness * tan(turn / 2) brings their outer edges together at the miter
+        // tip. The lengthened inner corner lands innerReach along the other segment, it pokes out of it past 90 degrees
+        // or when the other segment is shorter than that.
+        const float tanHalfTurn = fabsf(sinTurn) / (1.0f + cosTurn);
+        const float innerReach = halfThickness * (tanHalfTurn * cosTurn + fabsf(sinTurn));
+        if (join == linejoin_miter && cosTurn >= 0.0f && innerReach <= std::min(a.length, b.length)) {
+            const float extension = halfThickness * tanHalfTurn;
+            a.to = a.to + a.direction * extension;
+            b.from = b.from - b.direction * extension;
+        } else {
+            polylineCircleCenters.push_back(a.to);
+        }
+    }
+    if (!isClosed) {
+        PolylineSegment& first = polylineSegments[0];
+        PolylineSegment& last = polylineSegments[keptCount - 1];
+        if (cap == linecap_square) {
+            first.from = first.from - first.direction * halfThickness;
+            last.to = last.to + last.direction * halfThickness;
+        } else if (cap == linecap_round) {
+            polylineCircleCenters.push_back(first.from);
+            polylineCircleCenters.push_back(last.to);
+        }
+    }
+    
+    int circleCount = (int)polylineCircleCenters.size();
+    if (currentClipIndex != 0) {
+        int visibleCount = 0;
+        for (int i = 0; i < keptCount; ++i) {
+            const PolylineSegment& segment = polylineSegments[i];
+            if (!isQuadClippedOut(makeSegmentTransform(segment.from, segment.to, segment.direction, thickness))) polylineSegments[visibleCount++] = segment;
+        }
+        keptCount = visibleCount;
+        visibleCount = 0;
+        for (int i = 0; i < circleCount; ++i) {
+            const simd_float2 center = polylineCircleCenters[i];
+            if (!isQuadClippedOut(simd_mul(makeTranslate(center.x, center.y), makeScale(thickness)))) polylineCircleCenters[visibleCount++] = center;
+        }
+        circleCount = visibleCount;
+        if (keptCount + circleCount == 0) return;
+    }
+    
+    // Every rect first, then every circle, so groupPrimitivesByShape can keep them to two runs.
+    const int startIndex = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, keptCount + circleCount);
+    const simd_float4 finalColor = instanceColor(color);
+    PrimitiveInstanceData* instances = primitiveInstancesPtr + startIndex;
+    for (int i = 0; i < keptCount; ++i) {
+        const PolylineSegment& segment = polylineSegments[i];
+        instances[i] = (PrimitiveInstanceData){
+            .transform = makeSegmentTransform(segment.from, segment.to, segment.direction, thickness),
+            .color = finalColor,
+            .shapeType = ShapeTypeRect,
+            .clipIndex = currentClipIndex,
+            .sdfParams = (simd_float4){0.0f, 0.0f, 0.0f, 0.0f}
+        };
+    }
+    for (int i = 0; i < circleCount; ++i) {
+        const simd_float2 center = polylineCircleCenters[i];
+        instances[keptCount + i] = (PrimitiveInstanceData){
+            .transform = simd_mul(makeTranslate(center.x, center.y), makeScale(thickness)),
+            .color = finalColor,
+            .shapeType = ShapeTypeCircle,
+            .clipIndex = currentClipIndex,
+            .sdfParams = (simd_float4){halfThickness, 0.5f, 0.0f, 0.0f}
+        };
+    }
+    primitiveInstanceCount += keptCount + circleCount;
+}
+
+void DrawRecorder::drawText(const char* text,
+                        float posX, float posY,
+                        float fontSize,
+                        simd::float4 color)
+{
+    if (!text || text[0] == '\0') return;
+    
+    const int predictedMaxVertices = (int)strlen(text) * 6;
+    assert(predictedMaxVertices <= textMaxSingleDrawVertCount);
+    
+    int vertexCount = 0;
+    buildMesh(text, posX, posY, fontSize, color,
+              textTempVertexBuffer,
+              vertexCount);
+    
+    if (vertexCount == 0) return; // whitespace, or every glyph clipped out
+
+    int startIndex = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_text, vertexCount);
+    memcpy(textVertexBufferPtr + startIndex, textTempVertexBuffer, sizeof(TextVertex) * vertexCount);
+    textVertexCount += vertexCount;
+}
+
+void DrawRecorder::appendBatch(DrawBatchType type, const void* data, int count)
+{
+    assert(count > 0);
+    const int startIndex = addToDrawBatchAndGetAdjustedIndex(type, count);
+    switch (type) {
+        case drawbatchtype_atlas: {
+            memcpy(atlasInstancesPtr + startIndex, data, sizeof(AtlasInstanceData) * count);
+            atlasInstanceCount += count;
+        } break;
+        case drawbatchtype_primitive: {
+            memcpy(primitiveInstancesPtr + startIndex, data, sizeof(PrimitiveInstanceData) * count);
+            primitiveInstanceCount += count;
+        } break;
+        case drawbatchtype_text: {
+            assert(startIndex + count <= textMaxVertexCount);
+            memcpy(textVertexBufferPtr + startIndex, data, sizeof(TextVertex) * count);
+            textVertexCount += count;
+        } break;
+        case drawbatchtype_none:
+        case drawbatchtype_count: {
+            __builtin_printf("Append Batch with invalid type %d\n", (int)type);
+            assert(false);
+        } break;
+    }
+}
+
+// MARK: - Clip Rects
+void DrawRecorder::pushClipRect(float x, float y, float width, float height)
+{
+    clipIndexStack.push_back(currentClipIndex);
+    const simd_float4 parent = clipRects[currentClipIndex];
+    const simd_float4 clip = {
+        std::max(x, parent.x), std::max(y, parent.y),
+        std::min(x + width, parent.z), std::min(y + height, parent.w)
+    };
+
+    // Reuse the last slot for the same rect, or for another empty one, so lists of scrolled out rows and siblings
+    // pushed the same rect don't each take a slot.
+    const simd_float4 last = clipRects.back();
+    const bool isEmpty = clip.x >= clip.z || clip.y >= clip.w;
+    const bool isLastEmpty = last.x >= last.z || last.y >= last.w;
+    const bool isSameAsLast = clip.x == last.x && clip.y == last.y && clip.z == last.z && clip.w == last.w;
+    if ((isEmpty && isLastEmpty) || isSameAsLast) {
+        currentClipIndex = (uint32_t)clipRects.size() - 1;
+        return;
+    }
+    if ((int)clipRects.size() >= clipRectMaxCount) {
+        // Out of slots: keep drawing under the enclosing rect, overdraw beats missing content.
+        __builtin_printf("More than %d clip rects in a frame, clipping to the enclosing one\n", clipRectMaxCount);
+        return;
+    }
+    currentClipIndex = (uint32_t)clipRects.size();
+    clipRects.push_back(clip);
+}
+
+void DrawRecorder::popClipRect()
+{
+    assert(!clipIndexStack.empty());
+    if (clipIndexStack.empty()) return;
+    currentClipIndex = clipIndexStack.back();
+    clipIndexStack.pop_back();
+}
+
+inline bool DrawRecorder::isQuadClippedOut(const simd_float4x4& transform) const
+{
+    if (currentClipIndex == 0) return false;
+    const simd_float4 clip = clipRects[currentClipIndex];
+    const float extentX = 0.5f * (fabsf(transform.columns[0].x) + fabsf(transform.columns[1].x));
+    const float extentY = 0.5f * (fabsf(transform.columns[0].y) + fabsf(transform.columns[1].y));
+    const float centerX = transform.columns[3].x;
+    const float centerY = transform.columns[3].y;
+    return clip.x >= clip.z || clip.y >= clip.w // nested rects that don't overlap leave nothing
+        || centerX + extentX <= clip.x || centerX - extentX >= clip.z
+        || centerY + extentY <= clip.y || centerY - extentY >= clip.w;
+}
+
+void DrawRecorder::clipRectPixelBounds(const std::vector<simd_float4>& rects, const simd_float4x4& viewProjection, int width, int height, std::vector<simd_float4>& outBounds)
+{
+    // World space -> clip space -> framebuffer pixels (y flips), bounds of the 4 corners.
+    const float halfWidth = width * 0.5f;
+    const float halfHeight = height * 0.5f;
+    outBounds.resize(rects.size());
+    for (size_t i = 0; i < rects.size(); ++i) {
+        const simd_float4 clip = rects[i];
+        if (clip.x >= clip.z || clip.y >= clip.w) {
+            outBounds[i] = (simd_float4){ 0.0f, 0.0f, 0.0f, 0.0f }; // empty stays empty, the corners would make it inside out
+            continue;
+        }
+        simd_float4 bounds = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+        for (int iCorner = 0; iCorner < 4; ++iCorner) {
+            const simd_float4 corner = simd_mul(viewProjection, simd_make_float4((iCorner & 1) ? clip.z : clip.x, (iCorner & 2) ? clip.w : clip.y, 0.0f, 1.0f));
+            const float x = (corner.x + 1.0f) * halfWidth;
+            const float y = (1.0f - corner.y) * halfHeight;
+            bounds = (simd_float4){ std::min(bounds.x, x), std::min(bounds.y, y), std::max(bounds.z, x), std::max(bounds.w, y) };
+        }
+        outBounds[i] = (simd_float4){
+            std::clamp(bounds.x, 0.0f, (float)width), std::clamp(bounds.y, 0.0f, (float)height),
+            std::clamp(bounds.z, 0.0f, (float)width), std::clamp(bounds.w, 0.0f, (float)height)
+        };
+    }
+}
+
+// MARK: - Retained Layers
+static uint64_t lastLayerGeneration = 0;
+
+// Appends a batch's instances to a layer array, 256 byte aligned like the frame's batches, returns the new startIndex.
+template <typename T>
+static int appendLayerInstances(std::vector<T>& layerInstances, const T* instances, int count)
+{
+    const int alignmentCount = std::max(1, 256 / (int)sizeof(T));
+    const int startIndex = ((int)layerInstances.size() + alignmentCount - 1) / alignmentCount * alignmentCount;
+    layerInstances.resize(startIndex); // zero padding, never drawn
+    layerInstances.insert(layerInstances.end(), instances, instances + count);
+    return startIndex;
+}
+
+void DrawRecorder::beginLayer(Layer& layer)
+{
+    assert(!layerRecording.layer); // layers don't nest
+    layerRecording = (LayerRecording){
+        .layer = &layer,
+        .drawBatchCount = drawBatchCount,
+        .curDrawBatchType = curDrawBatchType,
+        .nextStartIndexForType = {},
+        .atlasInstanceCount = atlasInstanceCount,
+        .primitiveInstanceCount = primitiveInstanceCount,
+        .textVertexCount = textVertexCount,
+        .currentClipIndex = currentClipIndex,
+        .clipRectCount = clipRects.size(),
+        .clipIndexStackSize = clipIndexStack.size(),
+        .isRecordingScreenSpace = isRecordingScreenSpace
+    };
+    memcpy(layerRecording.nextStartIndexForType, nextStartIndexForTypePtr, sizeof(layerRecording.nextStartIndexForType));
+
+    // The layer is recorded into this frame's memory past everything so far, starting its own batches, unclipped.
+    // Its batches take their space from where the layer is drawn.
+    curDrawBatchType = drawbatchtype_none;
+    currentClipIndex = 0;
+    isRecordingScreenSpace = false;
+}
+
+void DrawRecorder::endLayer()
+{
+    PROFILE_ZONE("End Layer");
+    assert(layerRecording.layer);
+    assert(clipIndexStack.size() == layerRecording.clipIndexStackSize); // every pushClipRect in the layer needs its pop
+    Layer& layer = *layerRecording.layer;
+
+    layer.atlasInstances.clear();
+    layer.primitiveInstances.clear();
+    layer.textVertices.clear();
+    const int batchCount = drawBatchCount - layerRecording.drawBatchCount;
+    std::vector<DrawBatch> recordedBatches(drawBatchesArr + layerRecording.drawBatchCount, drawBatchesArr + drawBatchCount);
+    for (DrawBatch& batch : recordedBatches) {
+        switch (batch.type) {
+            case drawbatchtype_atlas: batch.startIndex = appendLayerInstances(layer.atlasInstances, atlasInstancesPtr + batch.startIndex, batch.count); break;
+            case drawbatchtype_primitive: batch.startIndex = appendLayerInstances(layer.primitiveInstances, primitiveInstancesPtr + batch.startIndex, batch.count); break;
+            case drawbatchtype_text: batch.startIndex = appendLayerInstances(layer.textVertices, textVertexBufferPtr + batch.startIndex, batch.count); break;
+            case drawbatchtype_none:
+            case drawbatchtype_count: {
+                __builtin_printf("Layer batch with invalid type %d\n", (int)batch.type);
+                assert(false);
+            } break;
+        }
+    }
+    // Grouped once here instead of every frame it's drawn.
+    const int groupedBatchCount = groupBatchesByShape(recordedBatches.data(), batchCount, layer.primitiveInstances.data(), groupedBatchesArr);
+    layer.batches.assign(groupedBatchesArr, groupedBatchesArr + groupedBatchCount);
+    layer.clipRects = clipRects;
+    layer.generation = ++lastLayerGeneration;
+    layer.isDirty = false;
+
+    // Rewind, as if the layer's draws never happened in this frame.
+    drawBatchCount = layerRecording.drawBatchCount;
+    curDrawBatchType = layerRecording.curDrawBatchType;
+    memcpy(nextStartIndexForTypePtr, layerRecording.nextStartIndexForType, sizeof(layerRecording.nextStartIndexForType));
+    atlasInstanceCount = layerRecording.atlasInstanceCount;
+    primitiveInstanceCount = layerRecording.primitiveInstanceCount;
+    textVertexCount = layerRecording.textVertexCount;
+    currentClipIndex = layerRecording.currentClipIndex;
+    clipRects.resize(layerRecording.clipRectCount);
+    isRecordingScreenSpace = layerRecording.isRecordingScreenSpace;
+    layerRecording = {};
+}
+
+void DrawRecorder::drawLayer(Layer& layer)
+{
+    assert(!layerRecording.layer);
+    assert(layer.generation != 0); // never built
+    assert(drawBatchCount + (int)layer.batches.size() <= drawBatchMaxCount);
+    for (const DrawBatch& batch : layer.batches) {
+        DrawBatch& frameBatch = drawBatchesArr[drawBatchCount++];
+        frameBatch = batch;
+        frameBatch.layer = &layer;
+        frameBatch.isScreenSpace = isRecordingScreenSpace;
+    }
+    // Later draws can't extend a layer batch.
+    curDrawBatchType = drawbatchtype_none;
+
+    // Hand what changed since the last draw over to the backends.
+    if (!layer.dirtyInstances.empty()) {
+        layerUpdates.push_back((LayerUpdate){ .layer = &layer, .firstUpdate = (int)instanceUpdates.size(), .updateCount = (int)layer.dirtyInstances.size() });
+        for (uint32_t index : layer.dirtyInstances) {
+            instanceUpdates.push_back((InstanceUpdate){ .index = index, .fields = layer.instanceDirtyFields[index] });
+            layer.instanceDirtyFields[index] = 0;
+        }
+        layer.dirtyInstances.clear();
+    }
+}
+
+
+// MARK: - Persistent Sprites
+static inline void markInstanceDirty(DrawRecorder::Layer& layer, uint32_t index, uint8_t fields)
+{
+    if (layer.instanceDirtyFields[index] == 0) layer.dirtyInstances.push_back(index);
+    layer.instanceDirtyFields[index] |= fields;
+}
+
+DrawRecorder::SpriteHandle DrawRecorder::createSprite(SpritePool& pool, const char* spriteName, float x, float y, float width, float height, simd_float4 color, float rotationRadians)
+{
+    Layer& layer = pool.layer;
+    if (pool.count == (int)layer.atlasInstances.size()) {
+        // Out of room: double it. Backends see the new generation and upload the whole pool again, including the
+        // spare capacity, so growing doesn't happen often.
+        const size_t capacity = std::max<size_t>(256, layer.atlasInstances.size() * 2);
+        layer.atlasInstances.resize(capacity);
+        layer.instanceDirtyFields.resize(capacity, 0);
+        pool.instanceSlots.resize(capacity);
+        layer.clipRects.assign(1, unclippedRect);
+        layer.isUpdatedInPlace = true;
+        layer.isDirty = false;
+        layer.generation = ++lastLayerGeneration;
+    }
+
+    uint32_t slot;
+    if (!pool.freeSlots.empty()) {
+        slot = pool.freeSlots.back();
+        pool.freeSlots.pop_back();
+    } else {
+        slot = (uint32_t)pool.slotInstances.size();
+        pool.slotInstances.push_back(0);
+        pool.slotGenerations.push_back(1);
+    }
+
+    const uint32_t index = (uint32_t)pool.count++;
+    const AtlasUVRect& uvRect = mainAtlasUVRects[spriteName];
+    layer.atlasInstances[index] = (AtlasInstanceData){
+        .transform = simd_mul(makeTranslate(x, y), simd_mul(makeRotationZ(rotationRadians), makeScale(width, height))),
+        .color = instanceColor(color),
+        .uvMin = uvRect.minUV,
+        .uvMax = uvRect.maxUV,
+        .clipIndex = 0,
+        .isOpaque = 0 // pools are layers, separateOpaqueDraws and cullOccludedDraws never look inside them
+    };
+    markInstanceDirty(layer, index, instancefields_all);
+    pool.slotInstances[slot] = index;
+    pool.instanceSlots[index] = slot;
+    return (SpriteHandle){ .slot = slot, .generation = pool.slotGenerations[slot] };
+}
+
+bool DrawRecorder::isSpriteAlive(const SpritePool& pool, SpriteHandle handle) const
+{
+    return handle.slot < pool.slotGenerations.size() && pool.slotGenerations[handle.slot] == handle.generation;
+}
+
+void DrawRecorder::moveSprite(SpritePool& pool, SpriteHandle handle, float x, float y)
+{
+    assert(isSpriteAlive(pool, handle));
+    const uint32_t index = pool.slotInstances[handle.slot];
+    pool.layer.atlasInstances[index].transform.columns[3] = simd_make_float4(x, y, 0.0f, 1.0f);
+    markInstanceDirty(pool.layer, index, instancefields_transform);
+}
+
+void DrawRecorder::setSpriteTransform(SpritePool& pool, SpriteHandle handle, float x, float y, float width, float height, float rotationRadians)
+{
+    assert(isSpriteAlive(pool, handle));
+    const uint32_t index = pool.slotInstances[handle.slot];
+    pool.layer.atlasInstances[index].transform = simd_mul(makeTranslate(x, y), simd_mul(makeRotationZ(rotationRadians), makeScale(width, height)));
+    markInstanceDirty(pool.layer, index, instancefields_transform);
+}
+
+void DrawRecorder::setSpriteColor(SpritePool& pool, SpriteHandle handle, simd_float4 color)
+{
+    assert(isSpriteAlive(pool, handle));
+    const uint32_t index = pool.slotInstances[handle.slot];
+    AtlasInstanceData& instance = pool.layer.atlasInstances[index];
+    instance.color = instanceColor(color);
+    markInstanceDirty(pool.layer, index, instancefields_all);
+}
+
+void DrawRecorder::destroySprite(SpritePool& pool, SpriteHandle handle)
+{
+    assert(isSpriteAlive(pool, handle));
+    const uint32_t index = pool.slotInstances[handle.slot];
+    const uint32_t lastIndex = (uint32_t)--pool.count;
+    if (index != lastIndex) {
+        // Keep the live instances dense, the last one fills the hole and its handle follows it.
+        pool.layer.atlasInstances[index] = pool.layer.atlasInstances[lastIndex];
+        const uint32_t movedSlot = pool.instanceSlots[lastIndex];
+        pool.instanceSlots[index] = movedSlot;
+        pool.slotInstances[movedSlot] = index;
+        markInstanceDirty(pool.layer, index, instancefields_all);
+    }
+    ++pool.slotGenerations[handle.slot];
+    pool.freeSlots.push_back(handle.slot);
+}
+
+void DrawRecorder::drawSpritePool(SpritePool& pool)
+{
+    if (pool.count == 0) return;
+    Layer& layer = pool.layer;
+    layer.batches.assign(1, (DrawBatch){
+        .type = drawbatchtype_atlas,
+        .startIndex = 0,
+        .count = pool.count,
+        .shapeType = primitiveShapeMixed,
+        .isFitted = false,
+        .layer = nullptr,
+        .panel = nullptr,
+        .isOpaque = false,
+        .opaqueStartIndex = 0,
+        .isScreenSpace = false // drawLayer's to decide
+    });
+    drawLayer(layer);
+}
+
+void DrawRecorder::collectInstanceUpdates(const Layer& layer, std::vector<InstanceUpdate>& outUpdates) const
+{
+    for (const LayerUpdate& update : layerUpdates) {
+        if (update.layer != &layer) continue;
+        outUpdates.insert(outUpdates.end(), instanceUpdates.begin() + update.firstUpdate, instanceUpdates.begin() + update.firstUpdate + update.updateCount);
+    }
+}
+
+
+// MARK: - Cached Panels
+void DrawRecorder::beginCachedPanel(CachedPanel& panel, float x, float y, float width, float height)
+{
+    assert(width > 0.0f && height > 0.0f);
+    panel.rect = simd_make_float4(x, y, x + width, y + height);
+    beginLayer(panel.layer);
+}
+
+void DrawRecorder::endCachedPanel()
+{
+    endLayer();
+}
+
+void DrawRecorder::drawCachedPanel(const CachedPanel& panel)
+{
+    assert(!layerRecording.layer); // backends render panel textures from the frame's batches only
+    assert(panel.layer.generation != 0); // never built
+    const float width = panel.rect.z - panel.rect.x;
+    const float height = panel.rect.w - panel.rect.y;
+    const simd_float4x4 transform = simd_mul(makeTranslate(panel.rect.x + width * 0.5f, panel.rect.y + height * 0.5f), makeScale(width, height));
+    if (isQuadClippedOut(transform)) return;
+
+    // A batch of its own, it binds a different texture than the sprites around it.
+    curDrawBatchType = drawbatchtype_none;
+    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_atlas, 1);
+    drawBatchesArr[drawBatchCount - 1].panel = &panel;
+    drawBatchesArr[drawBatchCount - 1].isScreenSpace = true; // HUD, see CachedPanel
+    curDrawBatchType = drawbatchtype_none;
+    // The panel sits in the top left of its texture, top row first, so its bottom edge is at v = height / textureHeight.
+    atlasInstancesPtr[index] = (AtlasInstanceData){
+        .transform = transform,
+        .color = simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f),
+        .uvMin = (simd_float2){ 0.0f, 0.0f },
+        .uvMax = (simd_float2){ width / cachedPanelTextureSize(width), height / cachedPanelTextureSize(height) },
+        .clipIndex = currentClipIndex,
+        .isOpaque = 0 // blended, the texture keeps whatever alpha was drawn into it, and panel batches are never split anyway
+    };
+    ++atlasInstanceCount;
+}
+
+int DrawRecorder::cachedPanelTextureSize(float size)
+{
+    int textureSize = cachedPanelMinTextureSize;
+    while (textureSize < size) textureSize *= 2;
+    return textureSize;
+}
+
+simd_float4x4 DrawRecorder::cachedPanelProjection(const CachedPanel& panel)
+{
+    // Like pixelSpaceProjection, but the panel's minX / maxY corner lands on the texture's top left.
+    const float scaleX = 2.0f / cachedPanelTextureSize(panel.rect.z - panel.rect.x);
+    const float scaleY = 2.0f / cachedPanelTextureSize(panel.rect.w - panel.rect.y);
+    return simd_float4x4{
+        simd_float4{ scaleX, 0.0f, 0.0f, 0.0f },
+        simd_float4{ 0.0f, scaleY, 0.0f, 0.0f },
+        simd_float4{ 0.0f, 0.0f, 1.0f, 0.0f },
+        simd_float4{ -1.0f - panel.rect.x * scaleX, 1.0f - panel.rect.w * scaleY, 0.0f, 1.0f }
+    };
+}
+
+
+// MARK: - Primitive Shape Grouping
+bool DrawRecorder::hasFittedGeometry(int32_t shapeType)
+{
+    return shapeType == ShapeTypeCircle || shapeType == ShapeTypeCircleLines || shapeType == ShapeTypeRectLines;
+}
+
+static inline float primitiveQuadArea(const PrimitiveInstanceData& instance)
+{
+    const simd_float4x4& transform = instance.transform;
+    return fabsf(transform.columns[0].x * transform.columns[1].y - transform.columns[0].y * transform.columns[1].x);
+}
+
+void DrawRecorder::groupPrimitivesByShape()
+{
+    PROFILE_ZONE("Group Primitives By Shape");
+    mixedPrimitiveInstanceCount = 0;
+    drawBatchCount = groupBatchesByShape(drawBatchesArr, drawBatchCount, primitiveInstancesPtr, groupedBatchesArr);
+    std::swap(drawBatchesArr, groupedBatchesArr);
+    // Batches no longer end where recording would continue, start a fresh one if anything else is recorded.
+    curDrawBatchType = drawbatchtype_none;
+}
+
+int DrawRecorder::groupBatchesByShape(const DrawBatch* batches, int batchCount, PrimitiveInstanceData* instancesBase, DrawBatch* outBatches)
+{
+    int groupedBatchCount = 0;
+
+    const float cellSize = (float)primitiveShapeGroupCellSize;
+    const int gridWidth = std::max(1, (int)ceilf((float)screenSize.width / cellSize));
+    const int gridHeight = std::max(1, (int)ceilf((float)screenSize.height / cellSize));
+    const float gridLeft = -(float)screenSize.width / 2.0f;
+    const float gridBottom = -(float)screenSize.height / 2.0f;
+
+    for (int iBatch = 0; iBatch < batchCount; ++iBatch) {
+        DrawBatch batch = batches[iBatch];
+        if (batch.type != drawbatchtype_primitive || batch.layer) {
+            if (batch.layer && batch.type == drawbatchtype_primitive && batch.shapeType == primitiveShapeMixed) mixedPrimitiveInstanceCount += batch.count;
+            outBatches[groupedBatchCount++] = batch;
+            continue;
+        }
+
+        // Common case first, a batch that's one shape already (the 100k circles) needs no reordering.
+        PrimitiveInstanceData* instances = instancesBase + batch.startIndex;
+        const int32_t firstShapeType = instances[0].shapeType;
+        bool isUniform = true;
+        bool isValid = true;
+        for (int i = 0; i < batch.count && isValid; ++i) {
+            isUniform = isUniform && instances[i].shapeType == firstShapeType;
+            isValid = instances[i].shapeType >= 0 && instances[i].shapeType < primitiveShapeTypeCount;
+        }
+        const float minFitArea = (float)(primitiveFitMinSize * primitiveFitMinSize);
+        if (isUniform || !isValid || !groupPrimitiveShapes) {
+            batch.shapeType = isUniform && isValid && groupPrimitiveShapes ? firstShapeType : primitiveShapeMixed;
+            if (batch.shapeType == primitiveShapeMixed) mixedPrimitiveInstanceCount += batch.count;
+            if (batch.shapeType != primitiveShapeMixed && fitPrimitiveGeometry && hasFittedGeometry(batch.shapeType)) {
+                float area = 0.0f;
+                for (int i = 0; i < batch.count; ++i) area += primitiveQuadArea(instances[i]);
+                batch.isFitted = area >= minFitArea * batch.count;
+            }
+            outBatches[groupedBatchCount++] = batch;
+            continue;
+        }
+
+        // Every instance gets the lowest layer that still draws it after each earlier instance it overlaps: the same
+        // layer as an overlapped instance of its own shape, one above one of another shape. Drawing in (layer, shape)
+        // order, stable within a run, then keeps every overlapping pair in recorded order.
+        // Per cell only the top layer matters (layer << 8 | mask of the shapes on it, 0 is empty): it's one above that
+        // unless the top layer holds nothing but this shape.
+        shapeLayerGrid.assign((size_t)gridWidth * gridHeight, 0);
+        if ((int)shapeGroupKeys.size() < batch.count) shapeGroupKeys.resize(batch.count);
+        int32_t maxKey = 0;
+        for (int i = 0; i < batch.count; ++i) {
+            const PrimitiveInstanceData& instance = instances[i];
+            const simd_float4x4& transform = instance.transform;
+            const float extentX = 0.5f * (fabsf(transform.columns[0].x) + fabsf(transform.columns[1].x));
+            const float extentY = 0.5f * (fabsf(transform.columns[0].y) + fabsf(transform.columns[1].y));
+            // Off screen parts clamp to the border cells, that only ever adds overlap.
+            const int cellMinX = std::clamp((int)floorf((transform.columns[3].x - extentX - gridLeft) / cellSize), 0, gridWidth - 1);
+            const int cellMaxX = std::clamp((int)floorf((transform.columns[3].x + extentX - gridLeft) / cellSize), 0, gridWidth - 1);
+            const int cellMinY = std::clamp((int)floorf((transform.columns[3].y - extentY - gridBottom) / cellSize), 0, gridHeight - 1);
+            const int cellMaxY = std::clamp((int)floorf((transform.columns[3].y + extentY - gridBottom) / cellSize), 0, gridHeight - 1);
+
+            const int32_t shapeBit = 1 << instance.shapeType;
+            int32_t layer = 0;
+            for (int cellY = cellMinY; cellY <= cellMaxY; ++cellY) {
+                const int32_t* row = shapeLayerGrid.data() + (size_t)cellY * gridWidth;
+                for (int cellX = cellMinX; cellX <= cellMaxX; ++cellX) {
+                    const int32_t cell = row[cellX];
+                    const int32_t mask = cell & 0xff;
+                    if (mask != 0) layer = std::max(layer, (cell >> 8) + (mask != shapeBit ? 1 : 0));
+                }
+            }
+            // Every touched cell's top layer is <= layer, this either raises it or joins it.
+            for (int cellY = cellMinY; cellY <= cellMaxY; ++cellY) {
+                int32_t* row = shapeLayerGrid.data() + (size_t)cellY * gridWidth;
+                for (int cellX = cellMinX; cellX <= cellMaxX; ++cellX) {
+                    row[cellX] = (row[cellX] & 0xff) != 0 && (row[cellX] >> 8) == layer ? row[cellX] | shapeBit : (layer << 8) | shapeBit;
+                }
+            }
+            shapeGroupKeys[i] = layer * primitiveShapeTypeCount + instance.shapeType;
+            maxKey = std::max(maxKey, shapeGroupKeys[i]);
+        }
+
+        shapeGroupOffsets.assign(maxKey + 1, 0);
+        shapeGroupAreas.assign(maxKey + 1, 0.0f);
+        for (int i = 0; i < batch.count; ++i) {
+            ++shapeGroupOffsets[shapeGroupKeys[i]];
+            shapeGroupAreas[shapeGroupKeys[i]] += primitiveQuadArea(instances[i]);
+        }
+        int groupCount = 0;
+        for (int key = 0; key <= maxKey; ++key) groupCount += shapeGroupOffsets[key] > 0 ? 1 : 0;
+
+        const int remainingBatchCount = batchCount - iBatch - 1;
+        const bool isWorthSplitting = batch.count >= groupCount * primitiveShapeGroupMinInstances;
+        if (!isWorthSplitting || groupedBatchCount + groupCount + remainingBatchCount > drawBatchMaxCount) {
+            batch.shapeType = primitiveShapeMixed;
+            mixedPrimitiveInstanceCount += batch.count;
+            outBatches[groupedBatchCount++] = batch;
+            continue;
+        }
+
+        // Counting sort by key into scratch, then back over the batch's range. Run starts aren't 256 byte aligned, the
+        // encoder binds the batch's aligned start and offsets with baseInstance instead.
+        int writeIndex = 0;
+        for (int key = 0; key <= maxKey; ++key) {
+            const int runCount = shapeGroupOffsets[key];
+            if (runCount == 0) continue;
+            const int32_t shapeType = key % primitiveShapeTypeCount;
+            outBatches[groupedBatchCount++] = (DrawBatch){
+                .type = drawbatchtype_primitive,
+                .startIndex = batch.startIndex + writeIndex,
+                .count = runCount,
+                .shapeType = shapeType,
+                .isFitted = fitPrimitiveGeometry && hasFittedGeometry(shapeType) && shapeGroupAreas[key] >= minFitArea * runCount,
+                .layer = nullptr,
+                .panel = nullptr,
+                .isOpaque = false,
+                .opaqueStartIndex = 0,
+                .isScreenSpace = batch.isScreenSpace
+            };
+            shapeGroupOffsets[key] = writeIndex;
+            writeIndex += runCount;
+        }
+        assert(writeIndex == batch.count);
+        if ((int)shapeGroupScratch.size() < batch.count) shapeGroupScratch.resize(batch.count);
+        for (int i = 0; i < batch.count; ++i) shapeGroupScratch[shapeGroupOffsets[shapeGroupKeys[i]]++] = instances[i];
+        memcpy(instances, shapeGroupScratch.data(), sizeof(PrimitiveInstanceData) * batch.count);
+    }
+    return groupedBatchCount;
+}
+
+
+// MARK: - Opaque Draws
+void DrawRecorder::markOpaqueSprites(const MipChain& atlas)
+{
+    assert(!atlas.levels.empty());
+    const uint8_t* pixels = atlas.pixels.data() + atlas.levels[0].offset;
+    for (auto& [name, uvRect] : mainAtlasUVRects) {
+        const int minX = std::clamp((int)lroundf(uvRect.minUV.x * atlas.width), 0, atlas.width);
+        const int maxX = std::clamp((int)lroundf(uvRect.maxUV.x * atlas.width), 0, atlas.width);
+        const int minY = std::clamp((int)lroundf(uvRect.minUV.y * atlas.height), 0, atlas.height);
+        const int maxY = std::clamp((int)lroundf(uvRect.maxUV.y * atlas.height), 0, atlas.height);
+        bool isOpaque = minX < maxX && minY < maxY;
+        for (int y = minY; y < maxY && isOpaque; ++y) {
+            for (int x = minX; x < maxX && isOpaque; ++x) isOpaque = pixels[((size_t)y * atlas.width + x) * 4 + 3] == 255;
+        }
+        uvRect.isOpaque = isOpaque;
+    }
+}
+
+inline bool DrawRecorder::isOpaqueInstance(DrawBatchType type, int index) const
+{
+    if (type == drawbatchtype_atlas) return atlasInstancesPtr[index].isOpaque != 0;
+    const PrimitiveInstanceData& instance = primitiveInstancesPtr[index];
+    return instance.shapeType == ShapeTypeRect && instance.color.w >= 1.0f;
+}
+
+void DrawRecorder::separateOpaqueDraws()
+{
+    PROFILE_ZONE("Separate Opaque Draws");
+    opaqueInstanceCount = 0;
+    if (!separateOpaqueInstances) return;
+
+    int separatedBatchCount = 0;
+    for (int iBatch = 0; iBatch < drawBatchCount; ++iBatch) {
+        const DrawBatch batch = drawBatchesArr[iBatch];
+        const bool canHoldOpaque = !batch.layer && !batch.panel
+            && (batch.type == drawbatchtype_atlas
+                || (batch.type == drawbatchtype_primitive && (batch.shapeType == ShapeTypeRect || batch.shapeType == primitiveShapeMixed)));
+        if (!canHoldOpaque) {
+            groupedBatchesArr[separatedBatchCount++] = batch;
+            continue;
+        }
+
+        // Instances [pendingIndex, i) are translucent and not written out yet, they go out as one batch when an opaque
+        // run is split off after them, or at the end.
+        const int endIndex = batch.startIndex + batch.count;
+        int pendingIndex = batch.startIndex;
+        int i = batch.startIndex;
+        while (i < endIndex) {
+            if (!isOpaqueInstance(batch.type, i)) {
+                ++i;
+                continue;
+            }
+            int runEnd = i + 1;
+            while (runEnd < endIndex && isOpaqueInstance(batch.type, runEnd)) ++runEnd;
+            const int runCount = runEnd - i;
+
+            // Room for the translucent batch before the run, the run and the one after it, and every batch still to come.
+            const bool hasBatchRoom = separatedBatchCount + 3 + (drawBatchCount - iBatch - 1) <= drawBatchMaxCount;
+            // The back to front copy goes after everything recorded, aligned like any batch start.
+            const int alignmentCount = 256 / strideSizesPtr[batch.type];
+            const int maxCount = batch.type == drawbatchtype_atlas ? atlasMaxInstanceCount : primitiveMaxInstanceCount;
+            int copyIndex = nextStartIndexForTypePtr[batch.type];
+            if (copyIndex % alignmentCount != 0) copyIndex += alignmentCount - copyIndex % alignmentCount;
+            if ((runCount < opaqueRunMinInstances && runCount != batch.count) || !hasBatchRoom || copyIndex + runCount > maxCount) {
+                i = runEnd;
+                continue;
+            }
+
+            if (pendingIndex < i) {
+                DrawBatch translucentBatch = batch;
+                translucentBatch.startIndex = pendingIndex;
+                translucentBatch.count = i - pendingIndex;
+                groupedBatchesArr[separatedBatchCount++] = translucentBatch;
+            }
+            DrawBatch opaqueBatch = batch;
+            opaqueBatch.startIndex = i;
+            opaqueBatch.count = runCount;
+            opaqueBatch.shapeType = batch.type == drawbatchtype_primitive ? (int32_t)ShapeTypeRect : batch.shapeType;
+            opaqueBatch.isOpaque = true;
+            opaqueBatch.opaqueStartIndex = copyIndex;
+            groupedBatchesArr[separatedBatchCount++] = opaqueBatch;
+
+            for (int iRun = 0; iRun < runCount; ++iRun) {
+                if (batch.type == drawbatchtype_atlas) {
+                    atlasInstancesPtr[copyIndex + iRun] = atlasInstancesPtr[runEnd - 1 - iRun];
+                } else {
+                    primitiveInstancesPtr[copyIndex + iRun] = primitiveInstancesPtr[runEnd - 1 - iRun];
+                }
+            }
+            nextStartIndexForTypePtr[batch.type] = copyIndex + runCount;
+            if (batch.type == drawbatchtype_primitive && batch.shapeType == primitiveShapeMixed) mixedPrimitiveInstanceCount -= runCount;
+            opaqueInstanceCount += runCount;
+            pendingIndex = i = runEnd;
+        }
+        if (pendingIndex < endIndex) {
+            DrawBatch translucentBatch = batch;
+            translucentBatch.startIndex = pendingIndex;
+            translucentBatch.count = endIndex - pendingIndex;
+            groupedBatchesArr[separatedBatchCount++] = translucentBatch;
+        }
+    }
+    drawBatchCount = separatedBatchCount;
+    std::swap(drawBatchesArr, groupedBatchesArr);
+    curDrawBatchType = drawbatchtype_none;
+}
+
+
+// MARK: - Occlusion Culling
+void DrawRecorder::cullOccludedDraws()
+{
+    PROFILE_ZONE("Cull Occluded Draws");
+    occludedInstanceCount = 0;
+    if (!cullOccludedInstances) return;
+    const int width = (int)screenSize.width;
+    const int height = (int)screenSize.height;
+    if (width <= 0 || height <= 0) return;
+
+    const int cellCountX = (width + occlusionCellSize - 1) / occlusionCellSize;
+    const int cellCountY = (height + occlusionCellSize - 1) / occlusionCellSize;
+    occlusionCells.assign((size_t)cellCountX * cellCountY, 0);
+    clipRectPixelBounds(clipRects, viewProjectionMatrix, width, height, occlusionClipBounds);
+    clipRectPixelBounds(clipRects, projectionMatrix, width, height, occlusionScreenClipBounds);
+    // A rotated camera turns every quad and clip rect, their pixel bounds are bigger than what they cover. Screen space
+    // draws are never turned.
+    const bool isCameraAligned = viewProjectionMatrix.columns[0].y == 0.0f && viewProjectionMatrix.columns[1].x == 0.0f;
+    bool hasOccluder = false;
+
+    for (int iBatch = drawBatchCount - 1; iBatch >= 0; --iBatch) {
+        DrawBatch& batch = drawBatchesArr[iBatch];
+        if (batch.layer || batch.panel || (batch.type != drawbatchtype_atlas && batch.type != drawbatchtype_primitive)) continue;
+
+        if ((int)occludedFlags.size() < batch.count) occludedFlags.resize(batch.count);
+        const simd_float4x4& batchProjection = batchViewProjection(batch);
+        const std::vector<simd_float4>& batchClipBounds = batch.isScreenSpace ? occlusionScreenClipBounds : occlusionClipBounds;
+        const bool isBatchAligned = batch.isScreenSpace || isCameraAligned;
+        int batchOccludedCount = 0;
+        for (int i = batch.startIndex + batch.count - 1; i >= batch.startIndex; --i) {
+            const bool isAtlas = batch.type == drawbatchtype_atlas;
+            const simd_float4x4& transform = isAtlas ? atlasInstancesPtr[i].transform : primitiveInstancesPtr[i].transform;
+            const uint32_t clipIndex = isAtlas ? atlasInstancesPtr[i].clipIndex : primitiveInstancesPtr[i].clipIndex;
+            occludedFlags[i - batch.startIndex] = 0;
+
+            // Quad -> screen pixel bounds (y down), inside its clip rect's.
+            const simd_float4 quadBounds = quadPixelMapping(simd_mul(batchProjection, transform), width, height).bounds;
+            const simd_float4 clip = batchClipBounds[clipIndex];
+            const float minX = std::max(quadBounds.x, clip.x);
+            const float minY = std::max(quadBounds.y, clip.y);
+            const float maxX = std::min(quadBounds.z, clip.z);
+            const float maxY = std::min(quadBounds.w, clip.w);
+            if (minX >= maxX || minY >= maxY) continue; // off screen or clipped away, nothing to hide
+
+            if (hasOccluder) {
+                const int cellMinX = std::clamp((int)floorf(minX / occlusionCellSize), 0, cellCountX - 1);
+                const int cellMinY = std::clamp((int)floorf(minY / occlusionCellSize), 0, cellCountY - 1);
+                const int cellMaxX = std::clamp((int)ceilf(maxX / occlusionCellSize), cellMinX + 1, cellCountX);
+                const int cellMaxY = std::clamp((int)ceilf(maxY / occlusionCellSize), cellMinY + 1, cellCountY);
+                bool isOccluded = true;
+                for (int cellY = cellMinY; cellY < cellMaxY && isOccluded; ++cellY) {
+                    for (int cellX = cellMinX; cellX < cellMaxX && isOccluded; ++cellX) isOccluded = occlusionCells[(size_t)cellY * cellCountX + cellX] != 0;
+                }
+                if (isOccluded) {
+                    occludedFlags[i - batch.startIndex] = 1;
+                    ++batchOccludedCount;
+                    continue;
+                }
+            }
+
+            const bool isAligned = isBatchAligned && transform.columns[0].y == 0.0f && transform.columns[1].x == 0.0f;
+            if (!isAligned || !isOpaqueInstance((DrawBatchType)batch.type, i)) continue;
+            // Cells inside the bounds, the ones cut by the screen's right / bottom edge count whole.
+            const int cellMinX = (int)ceilf(minX / occlusionCellSize);
+            const int cellMinY = (int)ceilf(minY / occlusionCellSize);
+            const int cellMaxX = maxX >= width ? cellCountX : (int)floorf(maxX / occlusionCellSize);
+            const int cellMaxY = maxY >= height ? cellCountY : (int)floorf(maxY / occlusionCellSize);
+            for (int cellY = cellMinY; cellY < cellMaxY; ++cellY) {
+                for (int cellX = cellMinX; cellX < cellMaxX; ++cellX) {
+                    occlusionCells[(size_t)cellY * cellCountX + cellX] = 1;
+                    hasOccluder = true;
+                }
+            }
+        }
+        if (batchOccludedCount == 0) continue;
+
+        // Compact what's left in place, in order.
+        int writeIndex = batch.startIndex;
+        for (int i = batch.startIndex; i < batch.startIndex + batch.count; ++i) {
+            if (occludedFlags[i - batch.startIndex]) continue;
+            if (batch.type == drawbatchtype_atlas) {
+                atlasInstancesPtr[writeIndex++] = atlasInstancesPtr[i];
+            } else {
+                primitiveInstancesPtr[writeIndex++] = primitiveInstancesPtr[i];
+            }
+        }
+        batch.count -= batchOccludedCount;
+        if (batch.type == drawbatchtype_primitive && batch.shapeType == primitiveShapeMixed) mixedPrimitiveInstanceCount -= batchOccludedCount;
+        occludedInstanceCount += batchOccludedCount;
+    }
+    if (occludedInstanceCount == 0) return;
+
+    // Batches hidden whole go, backends expect every batch to draw something.
+    int keptBatchCount = 0;
+    for (int iBatch = 0; iBatch < drawBatchCount; ++iBatch) {
+        if (drawBatchesArr[iBatch].count > 0) drawBatchesArr[keptBatchCount++] = drawBatchesArr[iBatch];
+    }
+    drawBatchCount = keptBatchCount;
+    curDrawBatchType = drawbatchtype_none;
+}
+
+
+void DrawRecorder::buildMesh(const char* text,
+                         float posX, float posY,
+                         float fontSize,
+                         simd::float4 color,
+                         TextVertex* outVertices,
+                         int& outVertexCount)
+{
+    outVertexCount = 0;
+
+    float atlasWidth  = static_cast<float>(fontAtlas.atlas.width);
+    float atlasHeight = static_cast<float>(fontAtlas.atlas.height);
+
+    float scale      = fontSize / static_cast<float>(fontAtlas.metrics.emSize);
+    float lineHeight = static_cast<float>(fontAtlas.metrics.lineHeight) * scale;
+    float ascender   = static_cast<float>(fontAtlas.metrics.ascender) * scale;
+
+    float cursorX = posX;
+    float cursorY = posY - ascender;
+    color = instanceColor(color);
+    uint32_t previousChar = 0;
+
+    for (const char* p = text; *p; ++p) {
+        uint32_t unicode = static_cast<unsigned char>(*p); // ensures 0-255
+        if (unicode > 127) continue; // skip non-ASCII
+
+
+        if (unicode == '\n') {
+            cursorX = posX;
+            cursorY -= lineHeight;
+            previousChar = 0;
+            continue;
+        }
+
+        // Kerning
+        if (previousChar != 0) {
+            uint64_t key = (static_cast<uint64_t>(previousChar) << 32) | unicode;
+            auto it = fontKerning.find(key);
+            if (it != fontKerning.end()) {
+                cursorX += static_cast<float>(it->second.advance) * scale;
+            }
+        }
+
+        auto gIt = fontGlyphs.find(unicode);
+        if (gIt == fontGlyphs.end()) {
+            previousChar = unicode;
+            continue;
+        }
+        const Glyph& glyph = gIt->second;
+
+        if (glyph.planeBounds && glyph.atlasBounds) {
+            const Bounds& plane = *glyph.planeBounds;
+            const Bounds& atlas = *glyph.atlasBounds;
+
+            float x0 = cursorX + static_cast<float>(plane.left) * scale;
+            float y0 = cursorY + static_cast<float>(plane.bottom) * scale;
+            float x1 = cursorX + static_cast<float>(plane.right) * scale;
+            float y1 = cursorY + static_cast<float>(plane.top) * scale;
+
+            float u0 = static_cast<float>(atlas.left) / atlasWidth;
+            float u1 = static_cast<float>(atlas.right) / atlasWidth;
+            float v0 = (atlasHeight - static_cast<float>(atlas.top)) / atlasHeight;
+            float v1 = (atlasHeight - static_cast<float>(atlas.bottom)) / atlasHeight;
+
+            // Glyph quads are axis aligned, so clipping is cropping the quad and its uvs by the same fractions.
+            if (currentClipIndex != 0) {
+                const simd_float4 clip = clipRects[currentClipIndex];
+                const float cropX0 = std::max(x0, clip.x), cropX1 = std::min(x1, clip.z);
+                const float cropY0 = std::max(y0, clip.y), cropY1 = std::min(y1, clip.w);
+                if (cropX0 >= cropX1 || cropY0 >= cropY1) {
+                    cursorX += static_cast<float>(glyph.advance) * scale;
+                    previousChar = unicode;
+                    continue;
+                }
+                const float uPerX = (u1 - u0) / (x1 - x0);
+                const float vPerY = (v0 - v1) / (y1 - y0); // v0 is the top edge
+                const float croppedU0 = u0 + (cropX0 - x0) * uPerX, croppedU1 = u0 + (cropX1 - x0) * uPerX;
+                const float croppedV0 = v1 + (cropY1 - y0) * vPerY, croppedV1 = v1 + (cropY0 - y0) * vPerY;
+                x0 = cropX0; x1 = cropX1; y0 = cropY0; y1 = cropY1;
+                u0 = croppedU0; u1 = croppedU1; v0 = croppedV0; v1 = croppedV1;
+            }
+
+            TextVertex topLeft     {{x0, y1}, {u0, v0}, color};
+            TextVertex topRight    {{x1, y1}, {u1, v0}, color};
+            TextVertex bottomLeft  {{x0, y0}, {u0, v1}, color};
+            TextVertex bottomRight {{x1, y0}, {u1, v1}, color};
+
+            // Two triangles = 6 vertices
+            outVertices[outVertexCount++] = bottomLeft;
+            outVertices[outVertexCount++] = bottomRight;
+            outVertices[outVertexCount++] = topRight;
+            outVertices[outVertexCount++] = bottomLeft;
+            outVertices[outVertexCount++] = topRight;
+            outVertices[outVertexCount++] = topLeft;
+        }
+
+        cursorX += static_cast<float>(glyph.advance) * scale;
+        previousChar = unicode;
+    }
+}
+
+
+// TODO: Convert into a Vector2 return type.
+std::pair<float, float> DrawRecorder::measureTextBounds(const char* text, float fontSize)
+{
+    if (!text || text[0] == '\0') return {0.0f, 0.0f};
+
+    float scale      = fontSize / static_cast<float>(fontAtlas.metrics.emSize);
+    float lineHeight = static_cast<float>(fontAtlas.metrics.lineHeight) * scale;
+
+    float maxXInLine = 0.0f;
+    float maxLineWidth = 0.0f;
+    float cursorX = 0.0f;
+    int lineCount = 1;
+    uint32_t previousChar = 0;
+
+    for (const char* p = text; *p; ++p) {
+        uint32_t unicode = static_cast<unsigned char>(*p); // ensures 0-255
+        if (unicode > 127) continue; // skip non-ASCII
+
+        if (unicode == '\n') {
+            maxLineWidth = std::max(maxLineWidth, maxXInLine);
+            cursorX = 0;
+            maxXInLine = 0;
+            lineCount++;
+            previousChar = 0;
+            continue;
+        }
+
+        if (previousChar != 0) {
+            uint64_t key = (static_cast<uint64_t>(previousChar) << 32) | unicode;
+            auto it = fontKerning.find(key);
+            if (it != fontKerning.end()) {
+                cursorX += static_cast<float>(it->second.advance) * scale;
+            }
+        }
+
+        auto gIt = fontGlyphs.find(unicode);
+        if (gIt != fontGlyphs.end()) {
+            const Glyph& glyph = gIt->second;
+            float glyphRight = 0.0f;
+            if (glyph.planeBounds) {
+                glyphRight = cursorX + static_cast<float>(glyph.planeBounds->right) * scale;
+            } else {
+                glyphRight = cursorX + static_cast<float>(glyph.advance) * scale;
+            }
+            maxXInLine = std::max(maxXInLine, glyphRight);
+            cursorX += static_cast<float>(glyph.advance) * scale;
+        }
+
+        previousChar = unicode;
+    }
+
+    float textWidth  = std::max(maxLineWidth, maxXInLine);
+    float textHeight = static_cast<float>(lineCount) * lineHeight;
+
+    return {textWidth, textHeight};
+}
@@ -0,0 +1,512 @@
+//
+//  DrawRecorder.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef DrawRecorder_hpp
+#define DrawRecorder_hpp
+
+#include <cmath>
+#include <map>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+#include "PlatformTypes.hpp"
+#include "TextureMips.hpp"
+
+struct AtlasInstanceData {
+    simd_float4x4 transform; // world space, the vertex stage applies the camera
+    simd_float4 color;
+    simd_float2 uvMin;
+    simd_float2 uvMax;
+    uint32_t clipIndex; // into DrawRecorder::clipRects, or the layer's for layer instances
+    uint32_t isOpaque; // alpha 1 everywhere it's drawn, see DrawRecorder::separateOpaqueDraws
+    uint32_t __padding[6];
+};
+
+struct AtlasUVRect {
+    simd_float2 minUV; // bottom-left
+    simd_float2 maxUV; // top-right
+    bool isOpaque = false; // every texel has alpha 1, set by DrawRecorder::markOpaqueSprites
+};
+
+struct PrimitiveInstanceData {
+    simd_float4x4 transform;
+    simd_float4 color;
+    int32_t shapeType;
+    uint32_t clipIndex; // into DrawRecorder::clipRects, or the layer's for layer instances
+    simd_float4 sdfParams;
+    uint32_t __padding[4];
+};
+
+struct TextVertex {
+    simd_float2 position;
+    simd_float2 uv;
+    simd_float4 textColor;
+};
+
+// MARK: - Font Atlas Structs
+struct AtlasMetrics {
+    std::string type;
+    float distanceRange;
+    float size;
+    int width;
+    int height;
+    std::string yOrigin;
+};
+
+struct FontMetrics {
+    float emSize;
+    float lineHeight;
+    float ascender;
+    float descender;
+    float underlineY;
+    float underlineThickness;
+};
+
+struct Bounds {
+    float left;
+    float bottom;
+    float right;
+    float top;
+};
+
+struct Glyph {
+    int unicode;
+    float advance;
+    std::optional<Bounds> planeBounds;
+    std::optional<Bounds> atlasBounds;
+};
+
+struct Kerning {
+    int unicode1;
+    int unicode2;
+    float advance;
+};
+
+struct FontAtlas {
+    AtlasMetrics atlas;
+    FontMetrics metrics;
+    std::vector<Glyph> glyphs;
+    std::vector<Kerning> kerning;
+};
+
+// Everything between "start of frame" and "hand the batches to the GPU": the draw* calls, batching and text meshing.
+// No Metal in here, a backend owns the instance memory and points the recorder at it every frame, then walks
+// drawBatchesArr to encode. Renderer is the Metal backend, the benchmark has a null one.
+class DrawRecorder
+{
+public:
+    DrawRecorder();
+    ~DrawRecorder();
+
+    // Points recording at this frame's instance memory and clears every count and batch.
+    // Each pointer needs room for the matching *MaxInstanceCount / textMaxVertexCount.
+    void beginFrame(AtlasInstanceData* atlasInstances, PrimitiveInstanceData* primitiveInstances, TextVertex* textVertices);
+    void setScreenSize(CGSize size);
+
+    // Parse the asset metadata recording needs, textures are up to the backend.
+    void loadAtlasUVs(const std::string& uvFileUrl, int textureWidth, int textureHeight, std::vector<TextureRegion>& outSpriteRegions);
+    void loadFontInfo(const std::string& jsonFileUrl, std::vector<TextureRegion>& outGlyphRegions);
+
+
+    // NOTE: Opt in premultiplied alpha. Atlas texels and all instance colors get premultiplied, and every pipeline blends
+    // with One / OneMinusSourceAlpha. That lets drawSpriteAdditive share the same pipeline and batches as drawSprite.
+    static const bool premultipliedAlpha = false;
+
+    simd_float4x4 projectionMatrix = matrix_identity_float4x4;
+    CGSize screenSize = {0.0f, 0.0f};
+
+
+    // MARK: - Camera
+    // Draws are in world space, which is pixel space with the camera at rest (origin at the centre of the screen, y up).
+    // Instances never bake the camera in, every vertex stage applies viewProjectionMatrix, so panning, zooming or
+    // resizing leaves all instance data as it was.
+    struct Camera {
+        simd_float2 position; // world point at the centre of the screen
+        float zoom; // > 1 zooms in
+        float rotationRadians;
+    };
+    Camera camera = { .position = {0.0f, 0.0f}, .zoom = 1.0f, .rotationRadians = 0.0f };
+    simd_float4x4 viewMatrix = matrix_identity_float4x4; // world -> pixel space
+    simd_float4x4 viewProjectionMatrix = matrix_identity_float4x4; // projectionMatrix * viewMatrix, what the backends upload
+    // Takes effect for the whole frame, it's a uniform and not stored per instance.
+    void setCamera(const Camera& newCamera);
+    // Draws between beginScreenSpace and endScreenSpace (HUDs, overlays) stay put whatever the camera does: they're in
+    // pixel space with the camera at rest, and clip rects pushed in between are too. Their batches are flagged
+    // isScreenSpace and drawn with projectionMatrix alone. Layers and sprite pools drawn in between go on screen space,
+    // cached panels always do.
+    // NOTE: Doesn't nest, and not while recording a layer (where it's drawn decides).
+    void beginScreenSpace();
+    void endScreenSpace();
+    bool isRecordingScreenSpace = false;
+
+
+    // MARK: - ATLAS RECORDING VARS
+    AtlasInstanceData* atlasInstancesPtr = nullptr;
+    const int atlasMaxInstanceCount = 150000;
+    int atlasInstanceCount = 0;
+    std::map<std::string, AtlasUVRect> mainAtlasUVRects;
+
+
+    // MARK: - PRIMITIVE RECORDING VARS
+    PrimitiveInstanceData* primitiveInstancesPtr = nullptr;
+    const int primitiveMaxInstanceCount = 150000;
+    int primitiveInstanceCount = 0;
+
+
+    // MARK: - TEXT RECORDING VARS
+    FontAtlas fontAtlas;
+    std::map<UInt32, Glyph> fontGlyphs;
+    std::map<UInt64, Kerning> fontKerning;
+
+    const int textMaxVertexCount = 4096 * 6;
+    TextVertex* textVertexBufferPtr = nullptr;
+    int textVertexCount = 0;
+    const int textMaxSingleDrawVertCount = 320 * 6;
+    TextVertex* textTempVertexBuffer = nullptr;
+
+
+    // MARK: - Draw Command Batching
+    enum DrawBatchType {
+        drawbatchtype_none = 0,
+        drawbatchtype_atlas = 1,
+        drawbatchtype_primitive = 2,
+        drawbatchtype_text = 3,
+        drawbatchtype_count = 4,
+    };
+    struct Layer;
+    struct CachedPanel;
+    struct DrawBatch {
+        DrawBatchType type;
+        int startIndex;
+        int count;
+        int32_t shapeType; // primitive batches only: the ShapeType every instance shares, or primitiveShapeMixed
+        bool isFitted; // primitive batches only: drawn with the shape's fitted mesh instead of the quad
+        const Layer* layer; // nullptr: startIndex is into this frame's instance memory, otherwise into the layer's
+        const CachedPanel* panel; // atlas batches only: one quad sampling the panel's texture instead of the main atlas
+        bool isOpaque; // every instance is opaque, see separateOpaqueDraws
+        int opaqueStartIndex; // isOpaque only: the same instances back to front, in this frame's instance memory
+        bool isScreenSpace; // drawn with projectionMatrix instead of viewProjectionMatrix, see beginScreenSpace
+    };
+    DrawBatch* drawBatchesArr = nullptr;
+    int drawBatchCount = 0;
+    const int drawBatchMaxCount = 1024;
+    DrawBatchType curDrawBatchType = drawbatchtype_none;
+    // TODO: Can rename these next two vars also...
+    int nextStartIndexForTypePtr[drawbatchtype_count];
+    int strideSizesPtr[drawbatchtype_count];
+
+
+    // MARK: - Primitive Shape Grouping
+    // fragment_primitive branches on shapeType per fragment, a batch where every instance has the same shape can use
+    // a pipeline specialised for it instead. groupPrimitivesByShape reorders each primitive batch into runs of one shape
+    // and splits it into one batch per run. An instance is only moved past instances it doesn't overlap, so the blended
+    // result is unchanged.
+    static const int32_t primitiveShapeMixed = -1;
+    static const int primitiveShapeTypeCount = 6; // ShapeTypeNone ... ShapeTypeCircleLines
+    // Overlap is tested per screen cell, not per instance. Coarser is cheaper but splits into more runs.
+    static const int primitiveShapeGroupCellSize = 32;
+    // Splitting a batch into fewer instances per draw than this costs more in draw calls than divergence saves, the
+    // batch stays mixed.
+    static const int primitiveShapeGroupMinInstances = 32;
+    // Circles, circle outlines and rect outlines get a mesh that skips most of the quad their SDF leaves at zero alpha:
+    // an octagon around the circle, a ring / frame strip around an outline's hollow centre. Extra vertices and thin
+    // triangles don't pay off on small shapes, runs whose average quad side is under this keep the quad.
+    static const int primitiveFitMinSize = 16;
+    bool fitPrimitiveGeometry = true;
+    static bool hasFittedGeometry(int32_t shapeType);
+    bool groupPrimitiveShapes = true;
+    int mixedPrimitiveInstanceCount = 0; // set by groupPrimitivesByShape, instances left on the generic pipeline
+    // NOTE: Call once per frame after the last draw*, right before the backend walks drawBatchesArr. Layer batches were
+    // grouped by endLayer and are left alone.
+    void groupPrimitivesByShape();
+
+
+    // MARK: - Opaque Draws
+    // An instance with alpha 1 over every pixel it covers (a sprite with no transparent texels at full alpha, a rect at
+    // full alpha, rects have no AA edge) doesn't need blending, and whatever it covers from earlier in the frame never
+    // shows. separateOpaqueDraws splits runs of them out of the frame's batches into batches of their own, flagged
+    // isOpaque, and copies each run back to front after the frame's instances. Depth tested backends draw the opaque
+    // batches first, front to back with depth writes and no blending, then every other batch in order, depth tested
+    // against them: fragments under a later opaque draw are rejected before they're shaded. Backends drawing in
+    // painter's order can ignore the flag, the batches are still in draw order and draw the same.
+    // Shorter runs than this inside a batch cost a draw call or two more than they save, they stay blended. A batch
+    // that's opaque as a whole is always flagged.
+    static const int opaqueRunMinInstances = 8;
+    bool separateOpaqueInstances = true;
+    int opaqueInstanceCount = 0; // set by separateOpaqueDraws
+    // Flags the sprites whose texels are all opaque, from the atlas' level 0 (mips of an opaque sprite stay opaque).
+    void markOpaqueSprites(const MipChain& atlas);
+    // NOTE: Call after groupPrimitivesByShape. Layer and panel batches are left alone.
+    void separateOpaqueDraws();
+
+
+    // MARK: - Occlusion Culling
+    // Frame instances hidden whole behind later opaque draws (a full screen background, an opaque panel) are dropped
+    // before anything is drawn. cullOccludedDraws walks the frame's instances back to front over a coarse grid of screen
+    // cells: an opaque (see separateOpaqueDraws), axis aligned instance marks the cells it covers completely, clip rect
+    // included, and any instance whose pixel bounds only touch marked cells is dropped. Conservative, a cell only partly
+    // covered by every occluder hides nothing. Text, layer and panel batches are neither culled nor occluders.
+    static const int occlusionCellSize = 32; // screen pixels
+    bool cullOccludedInstances = true;
+    int occludedInstanceCount = 0; // set by cullOccludedDraws
+    // NOTE: Call after groupPrimitivesByShape (it's draw order that decides what's hidden), before separateOpaqueDraws.
+    void cullOccludedDraws();
+
+
+    // MARK: - Clip Rects
+    // Axis aligned clip rects in world space. Every atlas / primitive instance stores the current one as an index into
+    // clipRects and its vertex stage clips against it, so clipped and unclipped draws still share batches. Text glyphs
+    // are cropped on the CPU instead, and any draw entirely outside the current rect is dropped at record time.
+    static const int clipRectMaxCount = 256; // the whole table fits one setVertexBytes (4KB)
+    std::vector<simd_float4> clipRects; // minX, minY, maxX, maxY. Slot 0 is unclipped, reset by beginFrame
+    uint32_t currentClipIndex = 0;
+    // Intersected with the current rect. x, y is the bottom left corner, same as drawPrimitiveRect.
+    void pushClipRect(float x, float y, float width, float height);
+    void popClipRect();
+    // For CPU backends: every clip rect as framebuffer pixel bounds (y down, top row first), clamped to width x height.
+    // Rects are in world space like the draws, a rotated camera gets the bounds of the rotated rect. viewProjection is
+    // viewProjectionMatrix, or cachedPanelProjection for a panel's texture.
+    static void clipRectPixelBounds(const std::vector<simd_float4>& rects, const simd_float4x4& viewProjection, int width, int height, std::vector<simd_float4>& outBounds);
+    // For CPU backends: an instance's unit quad (-0.5 to 0.5) in the same framebuffer pixels, as one 2D affine transform
+    // (pixel = a * local + t) and its unclipped bounds. clipTransform is the projection times the instance transform.
+    struct QuadPixelMapping {
+        float a00, a01, a10, a11;
+        float tx, ty; // the quad's center
+        simd_float4 bounds; // minX, minY, maxX, maxY
+    };
+    static QuadPixelMapping quadPixelMapping(const simd_float4x4& clipTransform, int width, int height)
+    {
+        const float halfWidth = width * 0.5f;
+        const float halfHeight = height * 0.5f;
+        QuadPixelMapping mapping;
+        mapping.a00 = clipTransform.columns[0].x * halfWidth;
+        mapping.a01 = clipTransform.columns[1].x * halfWidth;
+        mapping.a10 = -clipTransform.columns[0].y * halfHeight;
+        mapping.a11 = -clipTransform.columns[1].y * halfHeight;
+        mapping.tx = (clipTransform.columns[3].x + 1.0f) * halfWidth;
+        mapping.ty = (1.0f - clipTransform.columns[3].y) * halfHeight;
+        const float extentX = 0.5f * (std::fabs(mapping.a00) + std::fabs(mapping.a01));
+        const float extentY = 0.5f * (std::fabs(mapping.a10) + std::fabs(mapping.a11));
+        mapping.bounds = (simd_float4){ mapping.tx - extentX, mapping.ty - extentY, mapping.tx + extentX, mapping.ty + extentY };
+        return mapping;
+    }
+
+
+    // MARK: - Retained Layers
+    // Static content (backgrounds, tile maps, HUD chrome) recorded once and drawn every frame after that, without any
+    // draw* calls or instance writes. Draws between beginLayer and endLayer go into the layer instead of the frame, and
+    // drawLayer adds the layer's batches to the frame in draw order. Backends keep their own copy of the instances and
+    // only upload it again when generation changes.
+    struct Layer {
+        std::vector<AtlasInstanceData> atlasInstances;
+        std::vector<PrimitiveInstanceData> primitiveInstances;
+        std::vector<TextVertex> textVertices;
+        std::vector<DrawBatch> batches; // startIndex into the arrays above, starts 256 byte aligned, grouped by shape
+        std::vector<simd_float4> clipRects; // the instances' clipIndex points in here, not the frame's clipRects
+        uint64_t generation = 0; // unique per build, 0 until the first endLayer
+        bool isDirty = true; // set when the content changes, endLayer clears it
+        // SpritePool layers only. Their atlas instances are written in place between builds, backends keep one copy per
+        // frame in flight and only copy over what changed.
+        bool isUpdatedInPlace = false;
+        std::vector<uint32_t> dirtyInstances; // atlasInstances changed since the layer was last drawn
+        std::vector<uint8_t> instanceDirtyFields; // InstanceFields per atlas instance, 0 when not in dirtyInstances
+    };
+    // NOTE: Record mid frame, after beginFrame. Layers don't nest, start unclipped and leave the frame as it was.
+    void beginLayer(Layer& layer);
+    void endLayer();
+    void drawLayer(Layer& layer);
+
+    // Where a batch's instances live, for backends walking drawBatchesArr.
+    const AtlasInstanceData* batchAtlasInstances(const DrawBatch& batch) const { return batch.layer ? batch.layer->atlasInstances.data() : atlasInstancesPtr; }
+    const PrimitiveInstanceData* batchPrimitiveInstances(const DrawBatch& batch) const { return batch.layer ? batch.layer->primitiveInstances.data() : primitiveInstancesPtr; }
+    const TextVertex* batchTextVertices(const DrawBatch& batch) const { return batch.layer ? batch.layer->textVertices.data() : textVertexBufferPtr; }
+    const std::vector<simd_float4>& batchClipRects(const DrawBatch& batch) const { return batch.layer ? batch.layer->clipRects : clipRects; }
+    const simd_float4x4& batchViewProjection(const DrawBatch& batch) const { return batch.isScreenSpace ? projectionMatrix : viewProjectionMatrix; }
+
+
+    // MARK: - Persistent Sprites
+    // Long lived sprites (units, pickups, particles that idle) created once and then changed in place through a handle,
+    // instead of drawing every sprite again every frame. A pool is a layer whose atlas instances stay writable: only the
+    // instances (and of those only the fields) changed since the pool was last drawn are uploaded, so a pool where most
+    // sprites sit still costs little more than a static layer. Instances are kept dense, destroying one moves the last
+    // into its place, so draw order within a pool isn't kept. Not clipped, one atlas batch per pool.
+    enum InstanceFields : uint8_t {
+        instancefields_transform = 1 << 0, // AtlasInstanceData::transform
+        instancefields_all = 0xff,
+    };
+    struct InstanceUpdate {
+        uint32_t index; // into the layer's atlasInstances
+        uint32_t fields; // InstanceFields
+    };
+    struct SpriteHandle {
+        uint32_t slot;
+        uint32_t generation; // 0 is never valid, so a zeroed handle is a null handle
+    };
+    struct SpritePool {
+        Layer layer; // atlasInstances[0, count) are live, the rest is spare capacity
+        int count = 0;
+        std::vector<uint32_t> slotInstances; // handle slot -> instance
+        std::vector<uint32_t> slotGenerations; // bumped when the slot's sprite is destroyed
+        std::vector<uint32_t> instanceSlots; // instance -> handle slot, to fix up the moved sprite on destroy
+        std::vector<uint32_t> freeSlots;
+    };
+    SpriteHandle createSprite(SpritePool& pool, const char* spriteName, float x, float y, float width, float height, simd_float4 color, float rotationRadians);
+    // These two only touch the transform, the cheapest update to upload. moveSprite keeps size and rotation.
+    void moveSprite(SpritePool& pool, SpriteHandle handle, float x, float y);
+    void setSpriteTransform(SpritePool& pool, SpriteHandle handle, float x, float y, float width, float height, float rotationRadians);
+    void setSpriteColor(SpritePool& pool, SpriteHandle handle, simd_float4 color);
+    void destroySprite(SpritePool& pool, SpriteHandle handle);
+    bool isSpriteAlive(const SpritePool& pool, SpriteHandle handle) const;
+    void drawSpritePool(SpritePool& pool);
+
+    // What drawLayer handed over this frame, for backends keeping copies of in place layers. Cleared by beginFrame.
+    struct LayerUpdate {
+        const Layer* layer;
+        int firstUpdate; // into instanceUpdates
+        int updateCount;
+    };
+    std::vector<InstanceUpdate> instanceUpdates;
+    std::vector<LayerUpdate> layerUpdates;
+    // Appends every update handed over for layer this frame.
+    void collectInstanceUpdates(const Layer& layer, std::vector<InstanceUpdate>& outUpdates) const;
+    static size_t instanceUpdateSize(InstanceUpdate update) { return update.fields == instancefields_transform ? sizeof(simd_float4x4) : sizeof(AtlasInstanceData); }
+
+
+    // MARK: - Cached Panels
+    // A panel (HUD window, minimap) rendered into an offscreen texture once and composited as one textured quad every
+    // frame after that, until its layer is marked dirty. Draws between beginCachedPanel and endCachedPanel go into the
+    // panel's layer, in the same space as the panel rect, and only what's inside the rect ends up in the texture.
+    // Backends render it at one texel per unit into a pooled texture of the panel's size class, and composite it in
+    // screen space like the rest of the HUD (see beginScreenSpace), the camera never moves it. The texture is
+    // premultiplied whatever premultipliedAlpha says.
+    struct CachedPanel {
+        Layer layer; // isDirty and generation are the panel's
+        simd_float4 rect; // minX, minY, maxX, maxY in screen space
+    };
+    static const int cachedPanelMinTextureSize = 64;
+    // NOTE: Panels can't be drawn inside a layer or another panel.
+    void beginCachedPanel(CachedPanel& panel, float x, float y, float width, float height);
+    void endCachedPanel();
+    void drawCachedPanel(const CachedPanel& panel);
+    // Power of two size classes, so a texture can be handed to the next panel of about the same size.
+    static int cachedPanelTextureSize(float size);
+    // Maps the panel rect to the top left of its texture, what backends render the panel's layer with.
+    static simd_float4x4 cachedPanelProjection(const CachedPanel& panel);
+
+    // MARK: - GAME RELATED
+    float time = 0.0f;
+
+    // MARK: - Test functions
+    void testDrawPrimitives();
+    void testDrawAtlasSprites();
+    void testDrawTextWithBounds();
+    void testDrawInterleavedTypes();
+
+    // MARK: - Draw Helpers
+    static inline simd_float4 colorFromBytes(UInt8 r, UInt8 g, UInt8 b, UInt8 a);
+    static inline simd_float4 instanceColor(simd_float4 color);
+    static inline simd_float4 additiveInstanceColor(simd_float4 color);
+    inline int addToDrawBatchAndGetAdjustedIndex(DrawBatchType type, int increment);
+    // transform maps the unit quad to pixel space (no projection). True when it's entirely outside the current clip rect.
+    inline bool isQuadClippedOut(const simd_float4x4& transform) const;
+
+    void drawSprite(const char* spriteName, float x, float y, float width, float height, UInt8 r, UInt8 g, UInt8 b, UInt8 a, float rotationRadians);
+    void drawSprite(const char* spriteName, float x, float y, float width, float height, simd_float4 color, float rotationRadians);
+    void drawSpriteAdditive(const char* spriteName, float x, float y, float width, float height, UInt8 r, UInt8 g, UInt8 b, UInt8 a, float rotationRadians);
+    void drawSpriteAdditive(const char* spriteName, float x, float y, float width, float height, simd_float4 color, float rotationRadians);
+
+    void drawPrimitiveCircle(float x, float y, float radius, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
+    void drawPrimitiveCircle(float x, float y, float radius, simd_float4 color);
+
+    void drawPrimitiveCircleLines(float x, float y, float radius, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
+    void drawPrimitiveCircleLines(float x, float y, float radius, float thickness, simd_float4 color);
+
+    void drawPrimitiveLine(float x1, float y1, float x2, float y2, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
+    void drawPrimitiveLine(float x1, float y1, float x2, float y2, float thickness, simd_float4 color);
+
+    void drawPrimitiveRect(float x, float y, float width, float height, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
+    void drawPrimitiveRect(float x, float y, float width, float height, simd_float4 color);
+
+    void drawPrimitiveRoundedRect(float x, float y, float width, float height, float cornerRadius, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
+    void drawPrimitiveRoundedRect(float x, float y, float width, float height, float cornerRadius, simd_float4 color);
+
+    void drawPrimitiveRectLines(float x, float y, float width, float height, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
+    void drawPrimitiveRectLines(float x, float y, float width, float height, float thickness, simd_float4 color);
+
+    // Polylines are one rect instance per segment plus a circle per round join / round cap, reserved in one go. Miter
+    // joins lengthen the two segments until their outer edges meet, turns sharper than 90 degrees (or segments too
+    // short for the miter) fall back to round. Segments overlap at joins, a translucent color shows it.
+    enum LineJoin {
+        linejoin_miter = 0,
+        linejoin_round = 1,
+        linejoin_none = 2,
+    };
+    enum LineCap {
+        linecap_butt = 0,
+        linecap_square = 1,
+        linecap_round = 2,
+    };
+    void drawPrimitivePolyline(const simd_float2* points, int pointCount, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a, LineJoin join = linejoin_miter, LineCap cap = linecap_butt);
+    void drawPrimitivePolyline(const simd_float2* points, int pointCount, float thickness, simd_float4 color, LineJoin join = linejoin_miter, LineCap cap = linecap_butt);
+    // Closed polyline, the last point joins back to the first.
+    void drawPrimitivePath(const simd_float2* points, int pointCount, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a, LineJoin join = linejoin_miter);
+    void drawPrimitivePath(const simd_float2* points, int pointCount, float thickness, simd_float4 color, LineJoin join = linejoin_miter);
+
+    void drawText(const char* text, float posX, float posY, float fontSize, simd::float4 color);
+    // Appends count already built instances (text: vertices) of one type as a single draw, frame replay uses this.
+    void appendBatch(DrawBatchType type, const void* data, int count);
+    void buildMesh(const char* text, float posX, float posY, float fontSize, simd::float4 color, TextVertex* outVertices, int& outVertexCount);
+    std::pair<float, float> measureTextBounds(const char* text, float fontSize);
+
+private:
+    std::vector<uint32_t> clipIndexStack; // indices to return to on popClipRect
+
+    // The frame as it was at beginLayer, endLayer moves what was recorded since into the layer and rewinds to it.
+    struct LayerRecording {
+        Layer* layer;
+        int drawBatchCount;
+        DrawBatchType curDrawBatchType;
+        int nextStartIndexForType[drawbatchtype_count];
+        int atlasInstanceCount;
+        int primitiveInstanceCount;
+        int textVertexCount;
+        uint32_t currentClipIndex;
+        size_t clipRectCount;
+        size_t clipIndexStackSize;
+        bool isRecordingScreenSpace;
+    };
+    LayerRecording layerRecording = {};
+
+    // Scratch for groupPrimitivesByShape, kept across frames so the pass doesn't allocate.
+    DrawBatch* groupedBatchesArr = nullptr;
+    std::vector<int32_t> shapeLayerGrid; // per screen cell, top layer and the shapes on it
+    std::vector<int32_t> shapeGroupKeys; // per instance, layer * primitiveShapeTypeCount + shapeType
+    std::vector<int> shapeGroupOffsets; // per key, instance count and then write position
+    std::vector<float> shapeGroupAreas; // per key, summed quad area in pixels
+    std::vector<PrimitiveInstanceData> shapeGroupScratch;
+    // Writes batches grouped into outBatches (room for drawBatchMaxCount), reordering the instances they point at.
+    int groupBatchesByShape(const DrawBatch* batches, int batchCount, PrimitiveInstanceData* instancesBase, DrawBatch* outBatches);
+    inline bool isOpaqueInstance(DrawBatchType type, int index) const;
+    std::vector<uint8_t> occlusionCells; // per cell, 1 once a later opaque instance covers it whole
+    std::vector<simd_float4> occlusionClipBounds; // clipRects in screen pixels
+    std::vector<simd_float4> occlusionScreenClipBounds; // the same for isScreenSpace batches
+    std::vector<uint8_t> occludedFlags; // per instance of the batch being culled
+
+    // Scratch for drawPrimitivePolyline / drawPrimitivePath.
+    struct PolylineSegment {
+        simd_float2 from;
+        simd_float2 to;
+        simd_float2 direction;
+        float length;
+    };
+    std::vector<PolylineSegment> polylineSegments;
+    std::vector<simd_float2> polylineCircleCenters;
+    void recordPolyline(const simd_float2* points, int pointCount, bool isClosed, float thickness, simd_float4 color, LineJoin join, LineCap cap);
+};
+
+#endif /* DrawRecorder_hpp */
@@ -0,0 +1,383 @@
+//
+//  FrameCapture.cpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include "FrameCapture.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <map>
+#include <vector>
+
+static_assert(sizeof(FrameCaptureFileHeader) == 28 && sizeof(FrameCaptureFrameHeader) == 128 && sizeof(FrameCaptureBatch) == 16,
+              "Capture file layout changed, bump frameCaptureVersion");
+
+static FrameCaptureResource resourceForBatchType(DrawRecorder::DrawBatchType type)
+{
+    switch (type) {
+        case DrawRecorder::drawbatchtype_atlas: return framecaptureresource_mainAtlas;
+        case DrawRecorder::drawbatchtype_text: return framecaptureresource_font;
+        default: return framecaptureresource_none;
+    }
+}
+
+static uint32_t strideSizeForBatchType(int type)
+{
+    switch (type) {
+        case DrawRecorder::drawbatchtype_atlas: return sizeof(AtlasInstanceData);
+        case DrawRecorder::drawbatchtype_primitive: return sizeof(PrimitiveInstanceData);
+        case DrawRecorder::drawbatchtype_text: return sizeof(TextVertex);
+        default: return 0;
+    }
+}
+
+static const uint8_t* batchPayload(const DrawRecorder& recorder, const DrawRecorder::DrawBatch& batch)
+{
+    switch (batch.type) {
+        case DrawRecorder::drawbatchtype_atlas: return (const uint8_t*)(recorder.batchAtlasInstances(batch) + batch.startIndex);
+        case DrawRecorder::drawbatchtype_primitive: return (const uint8_t*)(recorder.batchPrimitiveInstances(batch) + batch.startIndex);
+        case DrawRecorder::drawbatchtype_text: return (const uint8_t*)(recorder.batchTextVertices(batch) + batch.startIndex);
+        default: return nullptr;
+    }
+}
+
+// Layer whose clip rects didn't fit the captured table, its instances are captured unclipped.
+static const uint32_t layerClipOffsetUnclipped = UINT32_MAX;
+
+// Points copied layer instances at the layer's clip rects in the captured table. Indices below firstIndex are left
+// as they are, 1 for layers (slot 0 is unclipped in both), 0 for panels (their slot 0 is the panel rect).
+template <typename T>
+static void offsetClipIndices(uint8_t* payload, int count, uint32_t firstIndex, uint32_t clipOffset)
+{
+    T* instances = (T*)payload;
+    for (int i = 0; i < count; ++i) {
+        if (instances[i].clipIndex < firstIndex) continue;
+        instances[i].clipIndex = clipOffset == layerClipOffsetUnclipped ? 0 : instances[i].clipIndex + clipOffset;
+    }
+}
+
+// Layer clip rects go on the end of the frame's table, once per layer. Offset to add to the layer's clip indices.
+static uint32_t layerClipOffset(const DrawRecorder::Layer& layer, std::vector<simd_float4>& clipRects,
+                                std::map<const DrawRecorder::Layer*, uint32_t>& layerClipOffsets)
+{
+    auto found = layerClipOffsets.find(&layer);
+    if (found != layerClipOffsets.end()) return found->second;
+
+    uint32_t clipOffset = (uint32_t)clipRects.size() - 1;
+    if (clipRects.size() + layer.clipRects.size() - 1 > (size_t)DrawRecorder::clipRectMaxCount) {
+        __builtin_printf("Frame capture: layer clip rects don't fit the clip rect table, captured unclipped\n");
+        clipOffset = layerClipOffsetUnclipped;
+    } else {
+        clipRects.insert(clipRects.end(), layer.clipRects.begin() + 1, layer.clipRects.end());
+    }
+    layerClipOffsets[&layer] = clipOffset;
+    return clipOffset;
+}
+
+// A panel's contents are captured as if drawn straight into the frame, every one of its layer's clip rects (slot 0
+// included) intersected with the panel rect and the clip its composite was drawn under. Text isn't clip rect clipped,
+// glyphs spilling past the panel rect show in the replay. Offset to add to the layer's clip indices.
+static uint32_t panelClipOffset(const DrawRecorder::CachedPanel& panel, simd_float4 compositeClip, std::vector<simd_float4>& clipRects,
+                                std::map<const DrawRecorder::Layer*, uint32_t>& panelClipOffsets)
+{
+    auto found = panelClipOffsets.find(&panel.layer);
+    if (found != panelClipOffsets.end()) return found->second;
+
+    uint32_t clipOffset = (uint32_t)clipRects.size();
+    if (clipRects.size() + panel.layer.clipRects.size() > (size_t)DrawRecorder::clipRectMaxCount) {
+        __builtin_printf("Frame capture: panel clip rects don't fit the clip rect table, captured unclipped\n");
+        clipOffset = layerClipOffsetUnclipped;
+    } else {
+        const simd_float4 bounds = {
+            std::max(panel.rect.x, compositeClip.x), std::max(panel.rect.y, compositeClip.y),
+            std::min(panel.rect.z, compositeClip.z), std::min(panel.rect.w, compositeClip.w)
+        };
+        for (const simd_float4 rect : panel.layer.clipRects) {
+            clipRects.push_back((simd_float4){
+                std::max(rect.x, bounds.x), std::max(rect.y, bounds.y),
+                std::min(rect.z, bounds.z), std::min(rect.w, bounds.w)
+            });
+        }
+    }
+    panelClipOffsets[&panel.layer] = clipOffset;
+    return clipOffset;
+}
+
+void FrameCapture::capture(const DrawRecorder& recorder, uint64_t frameIndex, CapturedFrame& outFrame)
+{
+    // Cached panel composites are swapped for the batches of the panel's layer, replay has no panel textures.
+    std::vector<DrawRecorder::DrawBatch> batches;
+    std::vector<const DrawRecorder::DrawBatch*> composites; // per batch, the panel composite it came from or nullptr
+    batches.reserve(recorder.drawBatchCount);
+    for (int iBatch = 0; iBatch < recorder.drawBatchCount; ++iBatch) {
+        const DrawRecorder::DrawBatch& batch = recorder.drawBatchesArr[iBatch];
+        if (!batch.panel) {
+            batches.push_back(batch);
+            composites.push_back(nullptr);
+            continue;
+        }
+        for (DrawRecorder::DrawBatch panelBatch : batch.panel->layer.batches) {
+            panelBatch.layer = &batch.panel->layer;
+            batches.push_back(panelBatch);
+            composites.push_back(&batch);
+        }
+    }
+
+    outFrame.batches.resize(batches.size());
+    size_t payloadSize = 0;
+    for (size_t iBatch = 0; iBatch < batches.size(); ++iBatch) {
+        const DrawRecorder::DrawBatch& batch = batches[iBatch];
+        outFrame.batches[iBatch] = (FrameCaptureBatch){
+            .type = (uint32_t)batch.type,
+            .resource = resourceForBatchType(batch.type),
+            .count = (uint32_t)batch.count,
+            .isScreenSpace = (uint32_t)(composites[iBatch] ? composites[iBatch]->isScreenSpace : batch.isScreenSpace)
+        };
+        payloadSize += (size_t)batch.count * strideSizeForBatchType(batch.type);
+    }
+
+    // Gather the batches back to back, dropping the alignment gaps between them. Layer batches are flattened into the
+    // frame, replay doesn't need the layers.
+    outFrame.clipRects = recorder.clipRects;
+    std::map<const DrawRecorder::Layer*, uint32_t> layerClipOffsets;
+    std::map<const DrawRecorder::Layer*, uint32_t> panelClipOffsets;
+    outFrame.payload.resize(payloadSize);
+    uint8_t* dst = outFrame.payload.data();
+    for (size_t iBatch = 0; iBatch < batches.size(); ++iBatch) {
+        const DrawRecorder::DrawBatch& batch = batches[iBatch];
+        const size_t batchSize = (size_t)batch.count * strideSizeForBatchType(batch.type);
+        memcpy(dst, batchPayload(recorder, batch), batchSize);
+        const DrawRecorder::DrawBatch* composite = composites[iBatch];
+        const bool isClipped = composite || (batch.layer && batch.layer->clipRects.size() > 1);
+        if (isClipped && batch.type != DrawRecorder::drawbatchtype_text) {
+            const uint32_t firstIndex = composite ? 0 : 1;
+            const uint32_t clipOffset = composite
+                ? panelClipOffset(*composite->panel, recorder.clipRects[recorder.batchAtlasInstances(*composite)[composite->startIndex].clipIndex], outFrame.clipRects, panelClipOffsets)
+                : layerClipOffset(*batch.layer, outFrame.clipRects, layerClipOffsets);
+            if (batch.type == DrawRecorder::drawbatchtype_atlas) {
+                offsetClipIndices<AtlasInstanceData>(dst, batch.count, firstIndex, clipOffset);
+            } else {
+                offsetClipIndices<PrimitiveInstanceData>(dst, batch.count, firstIndex, clipOffset);
+            }
+        }
+        dst += batchSize;
+    }
+
+    outFrame.header = (FrameCaptureFrameHeader){
+        .projectionMatrix = recorder.projectionMatrix,
+        .camera = recorder.camera,
+        .frameIndex = frameIndex,
+        .screenWidth = recorder.screenSize.width,
+        .screenHeight = recorder.screenSize.height,
+        .time = recorder.time,
+        .distanceRange = recorder.fontAtlas.atlas.distanceRange,
+        .batchCount = (uint32_t)outFrame.batches.size(),
+        .payloadSize = (uint32_t)payloadSize,
+        .clipRectCount = (uint32_t)outFrame.clipRects.size(),
+        .__padding = 0
+    };
+}
+
+void FrameCapture::replay(const CapturedFrame& frame, DrawRecorder& recorder)
+{
+    recorder.projectionMatrix = frame.header.projectionMatrix;
+    recorder.setCamera(frame.header.camera);
+    recorder.screenSize = (CGSize){ frame.header.screenWidth, frame.header.screenHeight };
+    recorder.time = frame.header.time;
+    recorder.fontAtlas.atlas.distanceRange = frame.header.distanceRange;
+    recorder.clipRects = frame.clipRects;
+
+    const uint8_t* src = frame.payload.data();
+    for (const FrameCaptureBatch& batch : frame.batches) {
+        const DrawRecorder::DrawBatchType type = (DrawRecorder::DrawBatchType)batch.type;
+        if (batch.isScreenSpace && !recorder.isRecordingScreenSpace) recorder.beginScreenSpace();
+        if (!batch.isScreenSpace && recorder.isRecordingScreenSpace) recorder.endScreenSpace();
+        recorder.appendBatch(type, src, (int)batch.count);
+        src += (size_t)batch.count * strideSizeForBatchType(type);
+    }
+    if (recorder.isRecordingScreenSpace) recorder.endScreenSpace();
+    assert(src == frame.payload.data() + frame.payload.size());
+}
+
+// Whether replay can append every batch without running out of room, packed the way appendBatch packs them: a new
+// batch whenever the type or screen space changes, starting at the next 256 byte aligned index.
+static bool fitsRecorder(const CapturedFrame& frame, const DrawRecorder& recorder)
+{
+    const uint64_t maxCounts[DrawRecorder::drawbatchtype_count] = {
+        0, (uint64_t)recorder.atlasMaxInstanceCount, (uint64_t)recorder.primitiveMaxInstanceCount, (uint64_t)recorder.textMaxVertexCount
+    };
+    uint64_t nextStartIndices[DrawRecorder::drawbatchtype_count] = {};
+    uint32_t previousType = DrawRecorder::drawbatchtype_none;
+    uint32_t previousScreenSpace = 0;
+    int batchCount = 0;
+    for (const FrameCaptureBatch& batch : frame.batches) {
+        uint64_t& nextStartIndex = nextStartIndices[batch.type];
+        if (batch.type != previousType || batch.isScreenSpace != previousScreenSpace) {
+            const uint64_t alignmentCount = 256 / strideSizeForBatchType(batch.type);
+            if (nextStartIndex % alignmentCount != 0) nextStartIndex += alignmentCount - nextStartIndex % alignmentCount;
+            ++batchCount;
+            previousType = batch.type;
+            previousScreenSpace = batch.isScreenSpace;
+        }
+        nextStartIndex += batch.count;
+        if (nextStartIndex > maxCounts[batch.type] || batchCount > recorder.drawBatchMaxCount) return false;
+    }
+    return true;
+}
+
+// Backends size render targets and the rasterizer from it.
+static bool hasValidScreenSize(const FrameCaptureFrameHeader& header)
+{
+    return header.screenWidth >= 1.0 && header.screenWidth <= frameCaptureMaxScreenSize
+        && header.screenHeight >= 1.0 && header.screenHeight <= frameCaptureMaxScreenSize;
+}
+
+// Every instance's clipIndex has to be in the frame's clip rect table and every primitive's shapeType one the shaders
+// know, backends index with both unchecked. Text vertices hold no indices. The payload is packed, fields are copied out.
+static bool hasValidInstances(const CapturedFrame& frame)
+{
+    const uint8_t* src = frame.payload.data();
+    for (const FrameCaptureBatch& batch : frame.batches) {
+        const uint32_t stride = strideSizeForBatchType((int)batch.type);
+        if (batch.type == DrawRecorder::drawbatchtype_text) {
+            src += (size_t)batch.count * stride;
+            continue;
+        }
+        for (uint32_t i = 0; i < batch.count; ++i, src += stride) {
+            uint32_t clipIndex = 0;
+            int32_t shapeType = 0;
+            if (batch.type == DrawRecorder::drawbatchtype_atlas) {
+                memcpy(&clipIndex, src + offsetof(AtlasInstanceData, clipIndex), sizeof(clipIndex));
+            } else {
+                memcpy(&clipIndex, src + offsetof(PrimitiveInstanceData, clipIndex), sizeof(clipIndex));
+                memcpy(&shapeType, src + offsetof(PrimitiveInstanceData, shapeType), sizeof(shapeType));
+            }
+            if (clipIndex >= frame.clipRects.size() || shapeType < 0 || shapeType >= DrawRecorder::primitiveShapeTypeCount) return false;
+        }
+    }
+    return true;
+}
+
+bool FrameCapture::load(const std::string& path, const DrawRecorder& recorder, std::vector<CapturedFrame>& outFrames)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) {
+        __builtin_printf("Can't open frame capture %s\n", path.c_str());
+        return false;
+    }
+    // Every count in the file is checked against the bytes left before anything is sized from it.
+    const long fileSize = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    if (fileSize < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        __builtin_printf("Can't read frame capture %s\n", path.c_str());
+        fclose(file);
+        return false;
+    }
+    uint64_t remainingSize = (uint64_t)fileSize;
+
+    FrameCaptureFileHeader fileHeader;
+    bool isValid = fread(&fileHeader, sizeof(fileHeader), 1, file) == 1
+        && fileHeader.magic == frameCaptureMagic
+        && fileHeader.version == frameCaptureVersion;
+    for (int iType = 0; isValid && iType < DrawRecorder::drawbatchtype_count; ++iType) {
+        isValid = fileHeader.strideSizes[iType] == strideSizeForBatchType(iType);
+    }
+    if (!isValid) {
+        __builtin_printf("Frame capture %s is not a version %u capture with matching struct sizes\n", path.c_str(), frameCaptureVersion);
+        fclose(file);
+        return false;
+    }
+    remainingSize -= sizeof(fileHeader);
+
+    // A frame is at least its header and the unclipped rect.
+    const uint64_t minFrameSize = sizeof(FrameCaptureFrameHeader) + sizeof(simd_float4);
+    isValid = (uint64_t)fileHeader.frameCount * minFrameSize <= remainingSize;
+    if (isValid) outFrames.resize(fileHeader.frameCount);
+    for (uint32_t iFrame = 0; isValid && iFrame < fileHeader.frameCount; ++iFrame) {
+        CapturedFrame& frame = outFrames[iFrame];
+        isValid = fread(&frame.header, sizeof(frame.header), 1, file) == 1;
+        if (!isValid) break;
+        remainingSize -= sizeof(frame.header);
+
+        // Slot 0 (unclipped) is always there, and the table has to fit what the backends upload.
+        isValid = frame.header.clipRectCount > 0 && frame.header.clipRectCount <= (uint32_t)DrawRecorder::clipRectMaxCount
+            && frame.header.batchCount <= (uint32_t)recorder.drawBatchMaxCount;
+        const uint64_t frameSize = (uint64_t)frame.header.batchCount * sizeof(FrameCaptureBatch)
+            + (uint64_t)frame.header.clipRectCount * sizeof(simd_float4) + frame.header.payloadSize;
+        isValid = isValid && frameSize <= remainingSize;
+        if (!isValid) break;
+        remainingSize -= frameSize;
+
+        frame.batches.resize(frame.header.batchCount);
+        frame.clipRects.resize(frame.header.clipRectCount);
+        frame.payload.resize(frame.header.payloadSize);
+        isValid = fread(frame.batches.data(), sizeof(FrameCaptureBatch), frame.batches.size(), file) == frame.batches.size()
+            && fread(frame.clipRects.data(), sizeof(simd_float4), frame.clipRects.size(), file) == frame.clipRects.size()
+            && fread(frame.payload.data(), 1, frame.payload.size(), file) == frame.payload.size();
+
+        // Every batch has to be replayable and account for the payload exactly.
+        uint64_t expectedPayloadSize = 0;
+        for (const FrameCaptureBatch& batch : frame.batches) {
+            if (!isValid) break;
+            isValid = batch.type > DrawRecorder::drawbatchtype_none && batch.type < DrawRecorder::drawbatchtype_count && batch.count > 0
+                && batch.isScreenSpace <= 1;
+            if (isValid) expectedPayloadSize += (uint64_t)batch.count * fileHeader.strideSizes[batch.type];
+        }
+        isValid = isValid && expectedPayloadSize == frame.payload.size() && fitsRecorder(frame, recorder)
+            && hasValidScreenSize(frame.header) && hasValidInstances(frame);
+    }
+    fclose(file);
+
+    if (!isValid) {
+        __builtin_printf("Frame capture %s is truncated, corrupt or too big for the recorder\n", path.c_str());
+        outFrames.clear();
+    }
+    return isValid;
+}
+
+FrameCaptureWriter::FrameCaptureWriter(const std::string& path)
+{
+    file = fopen(path.c_str(), "wb");
+    if (!file) {
+        __builtin_printf("Can't create frame capture %s\n", path.c_str());
+        return;
+    }
+
+    FrameCaptureFileHeader fileHeader = { .magic = frameCaptureMagic, .version = frameCaptureVersion, .frameCount = 0, .strideSizes = {} };
+    for (int iType = 0; iType < DrawRecorder::drawbatchtype_count; ++iType) {
+        fileHeader.strideSizes[iType] = strideSizeForBatchType(iType);
+    }
+    if (fwrite(&fileHeader, sizeof(fileHeader), 1, file) != 1) {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+FrameCaptureWriter::~FrameCaptureWriter()
+{
+    close();
+}
+
+bool FrameCaptureWriter::write(const CapturedFrame& frame)
+{
+    if (!file) return false;
+    const bool isWritten = fwrite(&frame.header, sizeof(frame.header), 1, file) == 1
+        && fwrite(frame.batches.data(), sizeof(FrameCaptureBatch), frame.batches.size(), file) == frame.batches.size()
+        && fwrite(frame.clipRects.data(), sizeof(simd_float4), frame.clipRects.size(), file) == frame.clipRects.size()
+        && fwrite(frame.payload.data(), 1, frame.payload.size(), file) == frame.payload.size();
+    if (isWritten) ++frameCount;
+    return isWritten;
+}
+
+bool FrameCaptureWriter::close()
+{
+    if (!file) return false;
+    bool isClosed = fseek(file, offsetof(FrameCaptureFileHeader, frameCount), SEEK_SET) == 0
+        && fwrite(&frameCount, sizeof(frameCount), 1, file) == 1;
+    isClosed = fclose(file) == 0 && isClosed;
+    file = nullptr;
+    return isClosed;
+}
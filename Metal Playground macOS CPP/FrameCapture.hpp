@@ -0,0 +1,102 @@
+//
+//  FrameCapture.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef FrameCapture_hpp
+#define FrameCapture_hpp
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "DrawRecorder.hpp"
+
+// Capture files hold a run of recorded frames, exactly what the backend would have encoded: batches, their instance /
+// vertex payloads and the uniforms. Replaying needs no game state, so a frame captured once from the app becomes a
+// repeatable benchmark or regression input for batching and packing changes.
+//
+// Layout, host endian and tightly packed (no alignment gaps between batches, replay re-packs them):
+//   FrameCaptureFileHeader
+//   per frame: FrameCaptureFrameHeader, batchCount x FrameCaptureBatch, clipRectCount x simd_float4 (DrawRecorder::clipRects,
+//   the instances index into it), then every batch's payload back to back.
+
+static const uint32_t frameCaptureMagic = 0x4346504d; // "MPFC"
+static const uint32_t frameCaptureVersion = 4;
+static const double frameCaptureMaxScreenSize = 16384.0; // per side, the largest texture Metal makes
+
+// Which texture a batch samples, so a capture stays meaningful once batches can bind more than one atlas.
+enum FrameCaptureResource : uint32_t {
+    framecaptureresource_none = 0,
+    framecaptureresource_mainAtlas = 1,
+    framecaptureresource_font = 2,
+};
+
+struct FrameCaptureFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frameCount;
+    uint32_t strideSizes[DrawRecorder::drawbatchtype_count]; // replay refuses captures whose structs changed size
+};
+
+struct FrameCaptureFrameHeader {
+    simd_float4x4 projectionMatrix;
+    DrawRecorder::Camera camera; // with projectionMatrix, the vertex uniforms
+    uint64_t frameIndex;
+    double screenWidth;
+    double screenHeight;
+    float time;
+    float distanceRange; // text fragment uniforms
+    uint32_t batchCount;
+    uint32_t payloadSize;
+    uint32_t clipRectCount;
+    uint32_t __padding; // spelled out so captures are byte for byte reproducible
+};
+
+struct FrameCaptureBatch {
+    uint32_t type; // DrawRecorder::DrawBatchType
+    uint32_t resource; // FrameCaptureResource
+    uint32_t count;
+    uint32_t isScreenSpace; // 0 or 1, DrawRecorder::DrawBatch::isScreenSpace
+};
+
+struct CapturedFrame {
+    FrameCaptureFrameHeader header;
+    std::vector<FrameCaptureBatch> batches;
+    std::vector<simd_float4> clipRects;
+    std::vector<uint8_t> payload;
+};
+
+namespace FrameCapture {
+    // Copies out everything recorded since the recorder's last beginFrame.
+    void capture(const DrawRecorder& recorder, uint64_t frameIndex, CapturedFrame& outFrame);
+
+    // Call after the backend's beginFrame, then encode as usual. Payloads are copied straight in through
+    // DrawRecorder::appendBatch, so the only recording cost left is the batching itself.
+    void replay(const CapturedFrame& frame, DrawRecorder& recorder);
+
+    // Fails on anything truncated or corrupt (clip indices or shape types out of range included), and on frames that
+    // wouldn't fit recorder's buffers when replayed.
+    bool load(const std::string& path, const DrawRecorder& recorder, std::vector<CapturedFrame>& outFrames);
+}
+
+// Streams frames to disk as they're captured, the frame count in the header is patched on close.
+class FrameCaptureWriter
+{
+public:
+    FrameCaptureWriter(const std::string& path);
+    ~FrameCaptureWriter();
+
+    bool isOpen() const { return file != nullptr; }
+    bool write(const CapturedFrame& frame);
+    bool close();
+
+    uint32_t frameCount = 0;
+
+private:
+    FILE* file = nullptr;
+};
+
+#endif /* FrameCapture_hpp */
@@ -0,0 +1,178 @@
+//
+//  FrameStats.cpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include "FrameStats.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+const char* framePhaseName(FramePhase phase)
+{
+    switch (phase) {
+        case framephase_semaphoreWait: return "Semaphore Wait";
+        case framephase_update: return "Update";
+        case framephase_encode: return "Encode";
+        case framephase_commit: return "Commit";
+        case framephase_outsideDraw: return "Outside Draw";
+        case framephase_count: break;
+    }
+    return "Unknown";
+}
+
+// MARK: - FrameTimeHistogram
+
+int FrameTimeHistogram::bucketIndex(uint64_t valueUs)
+{
+    if (valueUs > maxValueUs) valueUs = maxValueUs;
+    if (valueUs < subBucketCount) return (int)valueUs;
+
+    // Shift the value down until it lands in the top half of the sub buckets, each shift is a new power of 2 bucket.
+    const int highestBit = 63 - __builtin_clzll(valueUs);
+    const int shift = highestBit - (subBucketBits - 1);
+    const int subBucket = (int)(valueUs >> shift) - subBucketHalfCount;
+    return subBucketCount + (shift - 1) * subBucketHalfCount + subBucket;
+}
+
+uint64_t FrameTimeHistogram::bucketLowerBound(int index)
+{
+    if (index < subBucketCount) return (uint64_t)index;
+    const int shift = (index - subBucketCount) / subBucketHalfCount + 1;
+    const uint64_t subBucket = (uint64_t)((index - subBucketCount) % subBucketHalfCount + subBucketHalfCount);
+    return subBucket << shift;
+}
+
+uint64_t FrameTimeHistogram::bucketUpperBound(int index)
+{
+    if (index < subBucketCount) return (uint64_t)index + 1;
+    const int shift = (index - subBucketCount) / subBucketHalfCount + 1;
+    const uint64_t subBucket = (uint64_t)((index - subBucketCount) % subBucketHalfCount + subBucketHalfCount);
+    return (subBucket + 1) << shift;
+}
+
+void FrameTimeHistogram::record(uint64_t valueUs)
+{
+    ++buckets[bucketIndex(valueUs)];
+    ++count;
+    sum += valueUs;
+    if (valueUs < minValue) minValue = valueUs;
+    if (valueUs > maxValue) maxValue = valueUs;
+}
+
+void FrameTimeHistogram::reset()
+{
+    memset(buckets, 0, sizeof(buckets));
+    count = 0;
+    sum = 0;
+    minValue = UINT64_MAX;
+    maxValue = 0;
+}
+
+uint64_t FrameTimeHistogram::percentileUs(double percentile) const
+{
+    if (count == 0) return 0;
+    if (percentile < 0.0) percentile = 0.0;
+    if (percentile > 100.0) percentile = 100.0;
+
+    // Rank of the sample we're after, 1 based so p0 is the smallest and p100 the largest.
+    uint64_t targetRank = (uint64_t)(percentile / 100.0 * count + 0.5);
+    if (targetRank < 1) targetRank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < bucketCount; ++i) {
+        seen += buckets[i];
+        if (seen >= targetRank) {
+            const uint64_t lower = bucketLowerBound(i);
+            const uint64_t mid = lower + (bucketUpperBound(i) - lower) / 2;
+            // Never report outside what was actually recorded.
+            if (mid < minValue) return minValue;
+            if (mid > maxValue) return maxValue;
+            return mid;
+        }
+    }
+    return maxValue;
+}
+
+// MARK: - FrameStats
+
+bool FrameStats::addFrame(const FrameSample& inSample)
+{
+    FrameSample sample = inSample;
+    uint64_t measuredNs = 0;
+    for (int i = 0; i < framephase_count; ++i) {
+        if (i != framephase_outsideDraw) measuredNs += sample.phaseNs[i];
+    }
+    sample.phaseNs[framephase_outsideDraw] = sample.frameNs > measuredNs ? sample.frameNs - measuredNs : 0;
+
+    frameTimes.record(sample.frameNs / 1000);
+
+    if (!hasPhaseAverage) {
+        for (int i = 0; i < framephase_count; ++i) phaseAverageNs[i] = (double)sample.phaseNs[i];
+        hasPhaseAverage = true;
+        return false;
+    }
+
+    const bool isHitch = sample.frameNs > (uint64_t)(frameBudgetNs * hitchFactor);
+    if (!isHitch) {
+        // Hitches stay out of the averages, otherwise a run of them slowly becomes the new normal.
+        const double blend = 1.0 / 32.0;
+        for (int i = 0; i < framephase_count; ++i) {
+            phaseAverageNs[i] += ((double)sample.phaseNs[i] - phaseAverageNs[i]) * blend;
+        }
+        return false;
+    }
+
+    FramePhase blamedPhase = framephase_outsideDraw;
+    double blamedExcess = -1.0;
+    for (int i = 0; i < framephase_count; ++i) {
+        const double excess = (double)sample.phaseNs[i] - phaseAverageNs[i];
+        if (excess > blamedExcess) {
+            blamedExcess = excess;
+            blamedPhase = (FramePhase)i;
+        }
+    }
+
+    FrameHitch& hitch = hitches[totalHitchCount % maxHitches];
+    hitch.sample = sample;
+    hitch.blamedPhase = blamedPhase;
+    hitch.blamedExcessNs = blamedExcess > 0.0 ? (uint64_t)blamedExcess : 0;
+    ++totalHitchCount;
+    return true;
+}
+
+float ResolutionScaler::addFrame(uint64_t gpuNs, uint64_t cpuNs)
+{
+    if (gpuNs == 0) return scale();
+    // Averaged so one slow frame doesn't move the scale.
+    const double blend = 1.0 / 8.0;
+    if (smoothedGpuNs == 0.0) {
+        smoothedGpuNs = (double)gpuNs;
+        smoothedCpuNs = (double)cpuNs;
+    } else {
+        smoothedGpuNs += ((double)gpuNs - smoothedGpuNs) * blend;
+        smoothedCpuNs += ((double)cpuNs - smoothedCpuNs) * blend;
+    }
+    if (++framesSinceChange < settleFrameCount) return scale();
+
+    const double budgetNs = frameBudgetNs * budgetHeadroom;
+    int nextSteps = scaleSteps;
+    if (smoothedGpuNs > budgetNs && smoothedGpuNs >= smoothedCpuNs) {
+        // CPU bound it wouldn't help, the CPU's time doesn't depend on the scale.
+        nextSteps = (int)std::floor(scaleSteps * std::sqrt(budgetNs / smoothedGpuNs));
+    } else if (scaleSteps < scaleStepCount) {
+        const double growth = (double)(scaleSteps + 1) / scaleSteps;
+        if (smoothedGpuNs * growth * growth < budgetNs) nextSteps = scaleSteps + 1;
+    }
+    nextSteps = std::clamp(nextSteps, (int)minScaleSteps, (int)scaleStepCount); // by value, the constants have no definition
+    if (nextSteps != scaleSteps) {
+        // What the GPU should take at the new scale, until measurements at it come in.
+        const double ratio = (double)nextSteps / scaleSteps;
+        smoothedGpuNs *= ratio * ratio;
+        scaleSteps = nextSteps;
+        framesSinceChange = 0;
+    }
+    return scale();
+}
@@ -0,0 +1,154 @@
+//
+//  FrameStats.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef FrameStats_hpp
+#define FrameStats_hpp
+
+#include <cstdint>
+#include "Profiler.hpp"
+
+enum FramePhase {
+    framephase_semaphoreWait = 0, // waiting on the GPU to give a buffer back
+    framephase_update,            // game update + draw recording
+    framephase_encode,
+    framephase_commit,
+    framephase_outsideDraw,       // rest of the frame interval, run loop / vsync / OS
+    framephase_count,
+};
+
+const char* framePhaseName(FramePhase phase);
+
+struct FrameSample {
+    uint64_t frameIndex = 0;
+    uint64_t frameNs = 0; // start of this frame to the start of the next one
+    uint64_t phaseNs[framephase_count] = {};
+    int batchCount = 0;
+    int atlasInstanceCount = 0;
+    int primitiveInstanceCount = 0;
+    int textVertexCount = 0;
+    int occludedInstanceCount = 0; // dropped by DrawRecorder::cullOccludedDraws, after recording
+};
+
+struct FrameHitch {
+    FrameSample sample;
+    FramePhase blamedPhase;
+    uint64_t blamedExcessNs; // how far over its running average the blamed phase was
+};
+
+// Log-linear (HdrHistogram style) histogram of frame times in microseconds. Buckets are exact below 128us and ~1.6% wide
+// above that, up to maxValueUs. Fixed size, recording is a couple of shifts and an increment.
+class FrameTimeHistogram
+{
+public:
+    static const int subBucketBits = 7;
+    static const int subBucketCount = 1 << subBucketBits;
+    static const int subBucketHalfCount = subBucketCount / 2;
+    static const uint64_t maxValueUs = (1ull << 24) - 1; // ~16s, anything longer is clamped
+    static const int bucketCount = subBucketCount + (24 - subBucketBits) * subBucketHalfCount;
+
+    void record(uint64_t valueUs);
+    void reset();
+
+    // percentile in [0, 100], returns the midpoint of the bucket the percentile lands in.
+    uint64_t percentileUs(double percentile) const;
+    uint64_t totalCount() const { return count; }
+    uint64_t minUs() const { return count > 0 ? minValue : 0; }
+    uint64_t maxUs() const { return maxValue; }
+    double meanUs() const { return count > 0 ? (double)sum / count : 0.0; }
+
+    static int bucketIndex(uint64_t valueUs);
+    static uint64_t bucketLowerBound(int index);
+    static uint64_t bucketUpperBound(int index); // exclusive
+
+private:
+    uint32_t buckets[bucketCount] = {};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t minValue = UINT64_MAX;
+    uint64_t maxValue = 0;
+};
+
+// Frame time percentiles plus a hitch log. A frame is a hitch once it runs past hitchFactor x the frame budget, and the
+// phase furthest over its own running average gets the blame.
+class FrameStats
+{
+public:
+    static const int maxHitches = 32;
+    constexpr static const float hitchFactor = 1.5f;
+
+    void setFrameBudget(uint64_t budgetNs) { frameBudgetNs = budgetNs; }
+    uint64_t frameBudget() const { return frameBudgetNs; }
+
+    // Returns true if the frame was a hitch, latestHitch() then has the details.
+    bool addFrame(const FrameSample& sample);
+
+    const FrameTimeHistogram& histogram() const { return frameTimes; }
+    void resetHistogram() { frameTimes.reset(); }
+
+    int hitchCount() const { return totalHitchCount; }
+    const FrameHitch& latestHitch() const { return hitches[(totalHitchCount + maxHitches - 1) % maxHitches]; }
+    // Oldest first, at most maxHitches.
+    template <typename Fn>
+    void forEachHitch(Fn fn) const
+    {
+        const int stored = totalHitchCount < maxHitches ? totalHitchCount : maxHitches;
+        for (int i = totalHitchCount - stored; i < totalHitchCount; ++i) fn(hitches[i % maxHitches]);
+    }
+
+private:
+    FrameTimeHistogram frameTimes;
+    uint64_t frameBudgetNs = 16666667;
+    double phaseAverageNs[framephase_count] = {};
+    bool hasPhaseAverage = false;
+    FrameHitch hitches[maxHitches] = {};
+    int totalHitchCount = 0;
+};
+
+// Dynamic resolution: picks the scale to render the next frame at from measured GPU and CPU frame times. GPU time is
+// taken to grow with the pixel count, scale squared. Over budget while GPU bound, it drops straight to the scale that
+// should fit. Under budget, it climbs back one step at a time while the step is predicted to fit. Every change waits
+// settleFrameCount frames for the times to catch up, so it doesn't oscillate.
+class ResolutionScaler
+{
+public:
+    static const int scaleStepCount = 20; // scales are multiples of 1 / scaleStepCount
+    static const int minScaleSteps = 10; // half resolution, text stays sharp but everything else gets soft below that
+    static const int settleFrameCount = 30;
+    constexpr static const float budgetHeadroom = 0.9f; // of the frame budget, vsync and the OS need the rest
+
+    void setFrameBudget(uint64_t budgetNs) { frameBudgetNs = budgetNs; }
+    // gpuNs 0 when the GPU time isn't known (yet), the frame is skipped. Returns the scale for the next frame.
+    float addFrame(uint64_t gpuNs, uint64_t cpuNs);
+    float scale() const { return (float)scaleSteps / scaleStepCount; }
+
+private:
+    uint64_t frameBudgetNs = 16666667;
+    int scaleSteps = scaleStepCount;
+    double smoothedGpuNs = 0.0;
+    double smoothedCpuNs = 0.0;
+    int framesSinceChange = 0;
+};
+
+// Adds the time until the end of the scope onto one phase of a sample.
+class FramePhaseTimer
+{
+public:
+    inline FramePhaseTimer(FrameSample& sample, FramePhase phase)
+    : out(sample.phaseNs[phase]), startNs(Profiler::nowNs())
+    {}
+
+    inline ~FramePhaseTimer() { out += Profiler::nowNs() - startNs; }
+
+    FramePhaseTimer(const FramePhaseTimer&) = delete;
+    FramePhaseTimer& operator=(const FramePhaseTimer&) = delete;
+
+private:
+    uint64_t& out;
+    uint64_t startNs;
+};
+
+#endif /* FrameStats_hpp */
@@ -0,0 +1,155 @@
+//
+//  KTX2.cpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include "KTX2.hpp"
+#include <algorithm>
+#include <cstring>
+
+static const uint8_t ktx2Identifier[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+// NOTE: All fields are little endian, same as every machine we ship on, so these are read with a plain memcpy.
+struct KTX2Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+static_assert(sizeof(KTX2Header) == 80, "KTX2 header must match the file layout");
+
+struct KTX2LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+static_assert(sizeof(KTX2LevelIndex) == 24, "KTX2 level index must match the file layout");
+
+static bool fail(std::string* outError, const char* message)
+{
+    if (outError) *outError = message;
+    return false;
+}
+
+bool ktx2FormatInfo(KTX2Format format, KTX2FormatInfo& outInfo)
+{
+    switch (format) {
+        case ktx2format_rgba8_unorm:
+        case ktx2format_rgba8_srgb:
+            outInfo = { 1, 1, 4, false, format == ktx2format_rgba8_srgb, false, false };
+            return true;
+        case ktx2format_bc1_rgba_unorm:
+        case ktx2format_bc1_rgba_srgb:
+            outInfo = { 4, 4, 8, true, format == ktx2format_bc1_rgba_srgb, false, true };
+            return true;
+        case ktx2format_bc3_unorm:
+        case ktx2format_bc3_srgb:
+            outInfo = { 4, 4, 16, true, format == ktx2format_bc3_srgb, false, true };
+            return true;
+        case ktx2format_bc7_unorm:
+        case ktx2format_bc7_srgb:
+            outInfo = { 4, 4, 16, true, format == ktx2format_bc7_srgb, false, true };
+            return true;
+        case ktx2format_astc_4x4_unorm:
+        case ktx2format_astc_4x4_srgb:
+            outInfo = { 4, 4, 16, true, format == ktx2format_astc_4x4_srgb, true, false };
+            return true;
+        case ktx2format_astc_6x6_unorm:
+        case ktx2format_astc_6x6_srgb:
+            outInfo = { 6, 6, 16, true, format == ktx2format_astc_6x6_srgb, true, false };
+            return true;
+        case ktx2format_astc_8x8_unorm:
+        case ktx2format_astc_8x8_srgb:
+            outInfo = { 8, 8, 16, true, format == ktx2format_astc_8x8_srgb, true, false };
+            return true;
+        case ktx2format_undefined:
+            break;
+    }
+    return false;
+}
+
+bool parseKTX2(const uint8_t* data, size_t size, KTX2Image& outImage, std::string* outError)
+{
+    if (!data || size < sizeof(KTX2Header)) return fail(outError, "File too small for a KTX2 header");
+
+    KTX2Header header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.identifier, ktx2Identifier, sizeof(ktx2Identifier)) != 0) return fail(outError, "Missing KTX2 identifier");
+
+    KTX2FormatInfo info;
+    if (!ktx2FormatInfo((KTX2Format)header.vkFormat, info)) return fail(outError, "Unsupported vkFormat");
+    if (info.isCompressed && header.typeSize != 1) return fail(outError, "typeSize must be 1 for block compressed formats");
+    if (header.pixelWidth == 0 || header.pixelHeight == 0) return fail(outError, "Only 2D textures are supported");
+    if (header.pixelDepth != 0) return fail(outError, "3D textures are not supported");
+    if (header.layerCount > 1) return fail(outError, "Texture arrays are not supported");
+    if (header.faceCount != 1) return fail(outError, "Cube maps are not supported");
+    if (header.supercompressionScheme != 0) return fail(outError, "Supercompressed (BasisLZ / zstd) data is not supported");
+    if (header.levelCount == 0) return fail(outError, "levelCount 0 asks for runtime mip generation, ship prebuilt mips instead");
+
+    uint32_t maxLevels = 1;
+    for (uint32_t levelSize = std::max(header.pixelWidth, header.pixelHeight); levelSize > 1; levelSize >>= 1) ++maxLevels;
+    if (header.levelCount > maxLevels) return fail(outError, "levelCount is larger than the full mip chain");
+
+    const size_t levelIndexEnd = sizeof(KTX2Header) + sizeof(KTX2LevelIndex) * header.levelCount;
+    if (levelIndexEnd > size) return fail(outError, "Truncated level index");
+
+    // Level data must start on a multiple of lcm(texel block size, 4).
+    const size_t alignment = info.bytesPerBlock % 4 == 0 ? info.bytesPerBlock : info.bytesPerBlock * 4;
+
+    // Basic data format descriptor: dfdTotalSize, then a 2 word block header, then colorModel, colorPrimaries, transferFunction, flags.
+    bool isPremultiplied = false;
+    if (header.dfdByteLength > 0) {
+        const size_t flagsOffset = (size_t)header.dfdByteOffset + 4 + 8 + 3;
+        if (header.dfdByteLength < 16 || flagsOffset >= size) return fail(outError, "Truncated data format descriptor");
+        isPremultiplied = (data[flagsOffset] & 0x1) != 0;
+    }
+
+    outImage.format = (KTX2Format)header.vkFormat;
+    outImage.isPremultiplied = isPremultiplied;
+    outImage.width = (int)header.pixelWidth;
+    outImage.height = (int)header.pixelHeight;
+    outImage.levels.clear();
+    outImage.levels.reserve(header.levelCount);
+
+    for (uint32_t iLevel = 0; iLevel < header.levelCount; ++iLevel) {
+        KTX2LevelIndex levelIndex;
+        memcpy(&levelIndex, data + sizeof(KTX2Header) + sizeof(KTX2LevelIndex) * iLevel, sizeof(levelIndex));
+
+        const int levelWidth = std::max(1, (int)(header.pixelWidth >> iLevel));
+        const int levelHeight = std::max(1, (int)(header.pixelHeight >> iLevel));
+        const size_t blocksWide = (levelWidth + info.blockWidth - 1) / info.blockWidth;
+        const size_t blocksHigh = (levelHeight + info.blockHeight - 1) / info.blockHeight;
+        const size_t bytesPerRow = blocksWide * info.bytesPerBlock;
+        const size_t expectedLength = bytesPerRow * blocksHigh;
+
+        if (levelIndex.byteOffset < levelIndexEnd) return fail(outError, "Level data overlaps the header");
+        if (levelIndex.byteOffset % alignment != 0) return fail(outError, "Level data is misaligned");
+        if (levelIndex.byteLength != expectedLength) return fail(outError, "Level byteLength doesn't match its dimensions");
+        if (levelIndex.uncompressedByteLength != levelIndex.byteLength) return fail(outError, "uncompressedByteLength mismatch");
+        if (levelIndex.byteOffset > size || levelIndex.byteLength > size - levelIndex.byteOffset) return fail(outError, "Level data out of bounds");
+
+        outImage.levels.push_back((KTX2Level){
+            .width = levelWidth,
+            .height = levelHeight,
+            .offset = (size_t)levelIndex.byteOffset,
+            .length = (size_t)levelIndex.byteLength,
+            .bytesPerRow = bytesPerRow
+        });
+    }
+
+    return true;
+}
@@ -0,0 +1,68 @@
+//
+//  KTX2.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef KTX2_hpp
+#define KTX2_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Subset of vkFormat values we can upload as-is. Values match the Vulkan spec, which is what KTX2 stores.
+enum KTX2Format : uint32_t {
+    ktx2format_undefined = 0,
+    ktx2format_rgba8_unorm = 37,
+    ktx2format_rgba8_srgb = 43,
+    ktx2format_bc1_rgba_unorm = 133,
+    ktx2format_bc1_rgba_srgb = 134,
+    ktx2format_bc3_unorm = 137,
+    ktx2format_bc3_srgb = 138,
+    ktx2format_bc7_unorm = 145,
+    ktx2format_bc7_srgb = 146,
+    ktx2format_astc_4x4_unorm = 157,
+    ktx2format_astc_4x4_srgb = 158,
+    ktx2format_astc_6x6_unorm = 165,
+    ktx2format_astc_6x6_srgb = 166,
+    ktx2format_astc_8x8_unorm = 171,
+    ktx2format_astc_8x8_srgb = 172,
+};
+
+struct KTX2FormatInfo {
+    int blockWidth;
+    int blockHeight;
+    int bytesPerBlock;
+    bool isCompressed;
+    bool isSRGB;
+    bool isASTC;
+    bool isBC;
+};
+
+struct KTX2Level {
+    int width;
+    int height;
+    size_t offset; // byte offset into the file
+    size_t length;
+    size_t bytesPerRow; // row of blocks for compressed formats
+};
+
+struct KTX2Image {
+    KTX2Format format = ktx2format_undefined;
+    int width = 0;
+    int height = 0;
+    bool isPremultiplied = false; // KHR_DF_FLAG_ALPHA_PREMULTIPLIED from the data format descriptor
+    std::vector<KTX2Level> levels; // level 0 is the full size image
+};
+
+// Returns false for formats we don't handle.
+bool ktx2FormatInfo(KTX2Format format, KTX2FormatInfo& outInfo);
+
+// Parses and validates a KTX2 container in memory. Only plain 2D textures (1 layer, 1 face, no supercompression) with
+// prebuilt mips are accepted. Level offsets point into the original data, nothing is copied.
+bool parseKTX2(const uint8_t* data, size_t size, KTX2Image& outImage, std::string* outError);
+
+#endif /* KTX2_hpp */
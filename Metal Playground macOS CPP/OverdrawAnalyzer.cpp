@@ -0,0 +1,290 @@
+//
+//  OverdrawAnalyzer.cpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include "OverdrawAnalyzer.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include "Profiler.hpp"
+#include "ShaderTypes.h"
+
+// fragment_primitive returns exactly zero alpha here, the fragment was paid for and contributes nothing.
+static inline bool isTransparentPrimitiveFragment(const PrimitiveInstanceData& instance, float uvX, float uvY)
+{
+    const simd_float4 params = instance.sdfParams;
+    switch (instance.shapeType) {
+        case ShapeTypeRoundedRect: {
+            const float radius = std::min(params.z, std::min(params.x, params.y));
+            const float dX = std::fabs(uvX * params.x * 2.0f) - (params.x - radius);
+            const float dY = std::fabs(uvY * params.y * 2.0f) - (params.y - radius);
+            return std::hypot(std::max(dX, 0.0f), std::max(dY, 0.0f)) - radius >= 0.5f;
+        }
+        case ShapeTypeRectLines: {
+            const float thickness = std::max(params.z, 1.0f);
+            const float dX = std::fabs(uvX * params.x * 2.0f) - params.x + thickness;
+            const float dY = std::fabs(uvY * params.y * 2.0f) - params.y + thickness;
+            return std::hypot(std::max(dX, 0.0f), std::max(dY, 0.0f)) + std::min(std::max(dX, dY), 0.0f) <= -0.5f;
+        }
+        case ShapeTypeCircle: {
+            const float radius = params.x;
+            const float edge = std::max(params.y, 0.5f);
+            return std::hypot(uvX * radius * 2.0f, uvY * radius * 2.0f) - radius >= edge;
+        }
+        case ShapeTypeCircleLines: {
+            const float radius = params.x;
+            const float edge = std::max(params.y, 0.5f);
+            const float halfThickness = std::max(params.z, 1.0f);
+            const float dist = std::hypot(uvX * radius * 2.0f, uvY * radius * 2.0f) - radius;
+            return std::fabs(dist + halfThickness) - halfThickness >= edge;
+        }
+        default: return false;
+    }
+}
+
+// Mirrors vertex_primitive_fitted: true where the fitted mesh leaves the quad's pixel out, so it is never shaded.
+static inline bool isOutsideFittedMesh(const PrimitiveInstanceData& instance, float uvX, float uvY)
+{
+    const simd_float4 params = instance.sdfParams;
+    const float x = std::fabs(uvX), y = std::fabs(uvY);
+    if (instance.shapeType == ShapeTypeRectLines) {
+        const float thickness = std::max(params.z, 1.0f);
+        const float innerX = std::max((params.x - thickness - 0.5f) / std::max(params.x * 2.0f, 1e-6f), 0.0f);
+        const float innerY = std::max((params.y - thickness - 0.5f) / std::max(params.y * 2.0f, 1e-6f), 0.0f);
+        return x < innerX && y < innerY;
+    }
+    const float radius = std::max(params.x, 1e-6f);
+    const float edge = std::max(params.y, 0.5f);
+    const float outerRadius = 0.5f + edge / (radius * 2.0f);
+    if (x + y > outerRadius * (float)M_SQRT2) return true;
+    if (instance.shapeType != ShapeTypeCircleLines) return false;
+    const float halfThickness = std::max(params.z, 1.0f);
+    const float innerRadius = std::max((radius - 2.0f * halfThickness - edge) / (radius * 2.0f), 0.0f);
+    const float innerApothem = innerRadius * 0.92387953f;
+    return std::max(x, y) < innerApothem && x + y < innerApothem * (float)M_SQRT2;
+}
+
+OverdrawAnalyzer::OverdrawAnalyzer(int width, int height)
+: analyzerWidth(width), analyzerHeight(height)
+{
+    assert(width > 0 && height > 0);
+    overdrawCounts.resize((size_t)width * height);
+    frontOpaqueBatches.resize((size_t)width * height);
+}
+
+void OverdrawAnalyzer::analyze(const DrawRecorder& recorder, OverdrawReport& outReport)
+{
+    PROFILE_ZONE("Overdraw Analysis");
+    std::fill(overdrawCounts.begin(), overdrawCounts.end(), 0);
+    outReport = OverdrawReport();
+    outReport.width = analyzerWidth;
+    outReport.height = analyzerHeight;
+
+    recorder.clipRectPixelBounds(recorder.clipRects, recorder.viewProjectionMatrix, analyzerWidth, analyzerHeight, clipBounds);
+    recorder.clipRectPixelBounds(recorder.clipRects, recorder.projectionMatrix, analyzerWidth, analyzerHeight, screenClipBounds);
+    markOpaqueBatches(recorder);
+    const DrawRecorder::Layer* boundsLayer = nullptr;
+    bool isBoundsLayerScreenSpace = false;
+
+    std::vector<OverdrawDraw> draws;
+    for (int iBatch = 0; iBatch < recorder.drawBatchCount; ++iBatch) {
+        const DrawRecorder::DrawBatch batch = recorder.drawBatchesArr[iBatch];
+        const int endIndex = batch.startIndex + batch.count;
+        const simd_float4x4& batchProjection = recorder.batchViewProjection(batch);
+        if (batch.layer && (batch.layer != boundsLayer || batch.isScreenSpace != isBoundsLayerScreenSpace)) {
+            recorder.clipRectPixelBounds(batch.layer->clipRects, batchProjection, analyzerWidth, analyzerHeight, layerClipBounds);
+            boundsLayer = batch.layer;
+            isBoundsLayerScreenSpace = batch.isScreenSpace;
+        }
+        const std::vector<simd_float4>& batchBounds = batch.layer ? layerClipBounds : batch.isScreenSpace ? screenClipBounds : clipBounds;
+        switch (batch.type) {
+            case DrawRecorder::drawbatchtype_atlas: {
+                const AtlasInstanceData* instances = recorder.batchAtlasInstances(batch);
+                for (int i = batch.startIndex; i < endIndex; ++i) {
+                    const AtlasInstanceData& instance = instances[i];
+                    OverdrawDraw draw = countQuad(simd_mul(batchProjection, instance.transform), batchBounds[instance.clipIndex], nullptr, false, iBatch);
+                    draw.batchIndex = iBatch;
+                    draw.type = batch.type;
+                    draw.instanceIndex = i;
+                    draws.push_back(draw);
+                }
+            } break;
+            case DrawRecorder::drawbatchtype_primitive: {
+                const PrimitiveInstanceData* instances = recorder.batchPrimitiveInstances(batch);
+                for (int i = batch.startIndex; i < endIndex; ++i) {
+                    const PrimitiveInstanceData& instance = instances[i];
+                    OverdrawDraw draw = countQuad(simd_mul(batchProjection, instance.transform), batchBounds[instance.clipIndex], &instance, batch.isFitted, iBatch);
+                    draw.batchIndex = iBatch;
+                    draw.type = batch.type;
+                    draw.instanceIndex = i;
+                    draws.push_back(draw);
+                }
+            } break;
+            case DrawRecorder::drawbatchtype_text: {
+                OverdrawDraw draw = { .batchIndex = iBatch, .type = batch.type, .instanceIndex = -1, .fragmentCount = 0, .transparentFragmentCount = 0, .hiddenFragmentCount = 0 };
+                const TextVertex* vertices = recorder.batchTextVertices(batch);
+                for (int i = batch.startIndex; i + 2 < endIndex; i += 3) countTriangle(vertices + i, batchProjection, draw);
+                draws.push_back(draw);
+            } break;
+            case DrawRecorder::drawbatchtype_none:
+            case DrawRecorder::drawbatchtype_count: {
+                __builtin_printf("Draw Batch with invalid type %d\n", (int)batch.type);
+                assert(false);
+            } break;
+        }
+    }
+
+    for (const OverdrawDraw& draw : draws) {
+        outReport.fragmentCount += draw.fragmentCount;
+        outReport.transparentFragmentCount += draw.transparentFragmentCount;
+        outReport.hiddenFragmentCount += draw.hiddenFragmentCount;
+        outReport.fragmentCountForType[draw.type] += draw.fragmentCount;
+    }
+    for (const uint32_t count : overdrawCounts) {
+        if (count > 0) ++outReport.coveredPixelCount;
+        outReport.maxOverdraw = std::max(outReport.maxOverdraw, count);
+    }
+
+    const size_t worstCount = std::min(draws.size(), (size_t)worstDrawCount);
+    std::partial_sort(draws.begin(), draws.begin() + worstCount, draws.end(), [](const OverdrawDraw& a, const OverdrawDraw& b) {
+        if (a.fragmentCount != b.fragmentCount) return a.fragmentCount > b.fragmentCount;
+        return a.batchIndex != b.batchIndex ? a.batchIndex < b.batchIndex : a.instanceIndex < b.instanceIndex; // stable across runs
+    });
+    outReport.worstDraws.assign(draws.begin(), draws.begin() + worstCount);
+}
+
+template <typename Fn>
+void OverdrawAnalyzer::forEachQuadPixel(simd_float4x4 clipTransform, simd_float4 clip, Fn fn)
+{
+    const DrawRecorder::QuadPixelMapping mapping = DrawRecorder::quadPixelMapping(clipTransform, analyzerWidth, analyzerHeight);
+    const float det = mapping.a00 * mapping.a11 - mapping.a01 * mapping.a10;
+    if (std::fabs(det) < 1e-12f) return;
+
+    // Clipped to the pixels whose center is inside the clip rect, like SoftwareRasterizer.
+    const int minX = std::max(std::clamp((int)std::floor(mapping.bounds.x), 0, analyzerWidth), (int)std::ceil(clip.x - 0.5f));
+    const int maxX = std::min(std::clamp((int)std::ceil(mapping.bounds.z), 0, analyzerWidth), (int)std::ceil(clip.z - 0.5f));
+    const int minY = std::max(std::clamp((int)std::floor(mapping.bounds.y), 0, analyzerHeight), (int)std::ceil(clip.y - 0.5f));
+    const int maxY = std::min(std::clamp((int)std::ceil(mapping.bounds.w), 0, analyzerHeight), (int)std::ceil(clip.w - 0.5f));
+
+    const float inverseDet = 1.0f / det;
+    const float i00 = mapping.a11 * inverseDet, i01 = -mapping.a01 * inverseDet;
+    const float i10 = -mapping.a10 * inverseDet, i11 = mapping.a00 * inverseDet;
+    for (int y = minY; y < maxY; ++y) {
+        const float dy = y + 0.5f - mapping.ty;
+        for (int x = minX; x < maxX; ++x) {
+            const float dx = x + 0.5f - mapping.tx;
+            const float localX = i00 * dx + i01 * dy;
+            const float localY = i10 * dx + i11 * dy;
+            if (localX < -0.5f || localX >= 0.5f || localY < -0.5f || localY >= 0.5f) continue;
+            fn((size_t)y * analyzerWidth + x, localX, localY);
+        }
+    }
+}
+
+void OverdrawAnalyzer::markOpaqueBatches(const DrawRecorder& recorder)
+{
+    // Opaque batches only ever hold frame instances, clipped against the frame's rects (see separateOpaqueDraws).
+    std::fill(frontOpaqueBatches.begin(), frontOpaqueBatches.end(), -1);
+    for (int iBatch = 0; iBatch < recorder.drawBatchCount; ++iBatch) {
+        const DrawRecorder::DrawBatch batch = recorder.drawBatchesArr[iBatch];
+        if (!batch.isOpaque) continue;
+        const std::vector<simd_float4>& batchBounds = batch.isScreenSpace ? screenClipBounds : clipBounds;
+        for (int i = batch.startIndex; i < batch.startIndex + batch.count; ++i) {
+            const bool isAtlas = batch.type == DrawRecorder::drawbatchtype_atlas;
+            const simd_float4x4& transform = isAtlas ? recorder.atlasInstancesPtr[i].transform : recorder.primitiveInstancesPtr[i].transform;
+            const uint32_t clipIndex = isAtlas ? recorder.atlasInstancesPtr[i].clipIndex : recorder.primitiveInstancesPtr[i].clipIndex;
+            forEachQuadPixel(simd_mul(recorder.batchViewProjection(batch), transform), batchBounds[clipIndex], [&](size_t pixel, float, float) {
+                frontOpaqueBatches[pixel] = iBatch;
+            });
+        }
+    }
+}
+
+OverdrawDraw OverdrawAnalyzer::countQuad(simd_float4x4 clipTransform, simd_float4 clip, const PrimitiveInstanceData* primitive, bool isFitted, int batchIndex)
+{
+    OverdrawDraw result = {};
+    forEachQuadPixel(clipTransform, clip, [&](size_t pixel, float localX, float localY) {
+        if (isFitted && isOutsideFittedMesh(*primitive, localX, localY)) return;
+        ++overdrawCounts[pixel];
+        ++result.fragmentCount;
+        if (primitive && isTransparentPrimitiveFragment(*primitive, localX, localY)) ++result.transparentFragmentCount;
+        if (batchIndex < frontOpaqueBatches[pixel]) ++result.hiddenFragmentCount;
+    });
+    return result;
+}
+
+void OverdrawAnalyzer::countTriangle(const TextVertex* vertices, simd_float4x4 projection, OverdrawDraw& draw)
+{
+    const float halfWidth = analyzerWidth * 0.5f;
+    const float halfHeight = analyzerHeight * 0.5f;
+    float sx[3], sy[3];
+    for (int iVertex = 0; iVertex < 3; ++iVertex) {
+        const simd_float4 clip = simd_mul(projection, simd_make_float4(vertices[iVertex].position.x, vertices[iVertex].position.y, 0.0f, 1.0f));
+        sx[iVertex] = (clip.x + 1.0f) * halfWidth;
+        sy[iVertex] = (1.0f - clip.y) * halfHeight;
+    }
+    const float area = (sx[2] - sx[1]) * (sy[0] - sy[1]) - (sy[2] - sy[1]) * (sx[0] - sx[1]);
+    if (std::fabs(area) < 1e-12f) return;
+
+    // Edge functions with the top-left rule, see SoftwareRasterizer::addTriangleShape.
+    float edgeA[3], edgeB[3], edgeC[3];
+    bool isTopLeft[3];
+    for (int k = 0; k < 3; ++k) {
+        const int i = (k + 1) % 3;
+        const int j = (k + 2) % 3;
+        edgeA[k] = -(sy[j] - sy[i]) / area;
+        edgeB[k] = (sx[j] - sx[i]) / area;
+        edgeC[k] = -(edgeA[k] * sx[i] + edgeB[k] * sy[i]);
+        isTopLeft[k] = edgeA[k] > 0.0f || (edgeA[k] == 0.0f && edgeB[k] > 0.0f);
+    }
+
+    const int minX = std::clamp((int)std::floor(std::min({ sx[0], sx[1], sx[2] })), 0, analyzerWidth);
+    const int maxX = std::clamp((int)std::ceil(std::max({ sx[0], sx[1], sx[2] })), 0, analyzerWidth);
+    const int minY = std::clamp((int)std::floor(std::min({ sy[0], sy[1], sy[2] })), 0, analyzerHeight);
+    const int maxY = std::clamp((int)std::ceil(std::max({ sy[0], sy[1], sy[2] })), 0, analyzerHeight);
+    for (int y = minY; y < maxY; ++y) {
+        const float py = y + 0.5f;
+        uint32_t* row = overdrawCounts.data() + (size_t)y * analyzerWidth;
+        const int32_t* opaqueRow = frontOpaqueBatches.data() + (size_t)y * analyzerWidth;
+        for (int x = minX; x < maxX; ++x) {
+            const float px = x + 0.5f;
+            bool isInside = true;
+            for (int k = 0; k < 3 && isInside; ++k) {
+                const float weight = edgeA[k] * px + edgeB[k] * py + edgeC[k];
+                isInside = isTopLeft[k] ? weight >= 0.0f : weight > 0.0f;
+            }
+            if (!isInside) continue;
+            ++row[x];
+            ++draw.fragmentCount;
+            if (draw.batchIndex < opaqueRow[x]) ++draw.hiddenFragmentCount;
+        }
+    }
+}
+
+void OverdrawAnalyzer::writeHeatmap(std::vector<uint8_t>& outPixels) const
+{
+    struct HeatStop { uint32_t minCount; uint8_t r, g, b; };
+    static const HeatStop stops[] = {
+        { 50, 255, 255, 255 },
+        { 20, 255, 0, 0 },
+        { 10, 255, 128, 0 },
+        { 5, 255, 255, 0 },
+        { 3, 0, 200, 0 },
+        { 2, 0, 200, 255 },
+        { 1, 0, 0, 200 },
+        { 0, 0, 0, 0 },
+    };
+
+    outPixels.resize(overdrawCounts.size() * 4);
+    for (size_t i = 0; i < overdrawCounts.size(); ++i) {
+        const HeatStop* stop = stops;
+        while (overdrawCounts[i] < stop->minCount) ++stop;
+        outPixels[i * 4 + 0] = stop->r;
+        outPixels[i * 4 + 1] = stop->g;
+        outPixels[i * 4 + 2] = stop->b;
+        outPixels[i * 4 + 3] = 255;
+    }
+}
@@ -0,0 +1,75 @@
+//
+//  OverdrawAnalyzer.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef OverdrawAnalyzer_hpp
+#define OverdrawAnalyzer_hpp
+
+#include <cstdint>
+#include <vector>
+#include "DrawRecorder.hpp"
+
+// One instance (atlas / primitive) or one whole text batch, glyphs are too small to be worth ranking on their own.
+struct OverdrawDraw {
+    int batchIndex;
+    DrawRecorder::DrawBatchType type;
+    int instanceIndex; // -1 for text batches, into the layer's instances for layer batches
+    uint64_t fragmentCount;
+    uint64_t transparentFragmentCount; // SDF primitives only, fragments whose shader returns zero alpha
+    uint64_t hiddenFragmentCount; // under a later opaque batch, depth tested backends reject them unshaded
+};
+
+struct OverdrawReport {
+    int width = 0;
+    int height = 0;
+    uint64_t fragmentCount = 0; // every pixel shaded, including ones shaded again and ones shaded to zero alpha
+    uint64_t transparentFragmentCount = 0;
+    uint64_t hiddenFragmentCount = 0;
+    uint64_t coveredPixelCount = 0; // pixels shaded at least once
+    uint32_t maxOverdraw = 0;
+    uint64_t fragmentCountForType[DrawRecorder::drawbatchtype_count] = {};
+    std::vector<OverdrawDraw> worstDraws; // most fragments first
+
+    // Fragments per covered pixel, 1.0 means nothing is drawn over anything else.
+    double averageOverdraw() const { return coveredPixelCount > 0 ? (double)fragmentCount / coveredPixelCount : 0.0; }
+};
+
+// Fill cost of a recorded frame. Rasterises the quads and triangles the GPU would (same coverage rules as
+// SoftwareRasterizer) and counts fragments per pixel, without shading them. Works on a live recorder or a replayed capture.
+class OverdrawAnalyzer
+{
+public:
+    static const int worstDrawCount = 10;
+
+    OverdrawAnalyzer(int width, int height);
+
+    void analyze(const DrawRecorder& recorder, OverdrawReport& outReport);
+
+    // Fixed color ramp (black 0, blue 1, cyan 2, green 3-4, yellow 5-9, orange 10-19, red 20-49, white 50+) so
+    // heatmaps of different frames compare at a glance. RGBA8, top row first.
+    void writeHeatmap(std::vector<uint8_t>& outPixels) const;
+
+    int width() const { return analyzerWidth; }
+    int height() const { return analyzerHeight; }
+
+private:
+    int analyzerWidth;
+    int analyzerHeight;
+    std::vector<uint32_t> overdrawCounts;
+    std::vector<int32_t> frontOpaqueBatches; // per pixel, the last opaque batch (DrawBatch::isOpaque) over it or -1
+    std::vector<simd_float4> clipBounds; // DrawRecorder::clipRects in pixels, per analyze()
+    std::vector<simd_float4> screenClipBounds; // same for isScreenSpace batches
+    std::vector<simd_float4> layerClipBounds; // same for the layer being counted
+
+    // fn(pixelIndex, localX, localY) for every pixel the quad covers, localX / localY in [-0.5, 0.5).
+    template <typename Fn>
+    void forEachQuadPixel(simd_float4x4 clipTransform, simd_float4 clip, Fn fn);
+    void markOpaqueBatches(const DrawRecorder& recorder);
+    OverdrawDraw countQuad(simd_float4x4 clipTransform, simd_float4 clip, const PrimitiveInstanceData* primitive, bool isFitted, int batchIndex);
+    void countTriangle(const TextVertex* vertices, simd_float4x4 projection, OverdrawDraw& draw);
+};
+
+#endif /* OverdrawAnalyzer_hpp */
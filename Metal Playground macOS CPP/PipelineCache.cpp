@@ -0,0 +1,195 @@
+//
+//  PipelineCache.cpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include "PipelineCache.hpp"
+#include <cassert>
+#include <unistd.h>
+
+static MTL::BinaryArchive* newArchive(MTL::Device* device, const std::string& archivePath)
+{
+    using namespace NS;
+    using NS::StringEncoding::UTF8StringEncoding;
+
+    MTL::BinaryArchiveDescriptor* archiveDesc = MTL::BinaryArchiveDescriptor::alloc()->init();
+    const bool hasArchiveFile = !archivePath.empty() && access(archivePath.c_str(), R_OK) == 0;
+    if (hasArchiveFile) {
+        archiveDesc->setUrl(URL::fileURLWithPath(String::string(archivePath.c_str(), UTF8StringEncoding)));
+    }
+
+    NS::Error* err = nullptr;
+    MTL::BinaryArchive* result = device->newBinaryArchive(archiveDesc, &err);
+    if (!result && hasArchiveFile) {
+        // Stale or corrupt archive (eg. after an OS / driver update), start over with an empty one.
+        __builtin_printf("Discarding pipeline archive: %s\n", err ? err->localizedDescription()->utf8String() : "unknown error");
+        remove(archivePath.c_str());
+        archiveDesc->setUrl(nullptr);
+        err = nullptr;
+        result = device->newBinaryArchive(archiveDesc, &err);
+    }
+    if (!result) {
+        __builtin_printf("Failed to create pipeline archive: %s\n", err ? err->localizedDescription()->utf8String() : "unknown error");
+    }
+
+    archiveDesc->release();
+    return result;
+}
+
+PipelineCache::PipelineCache( MTL::Device* pDevice, std::string archivePath )
+: archivePath(archivePath)
+{
+    device = pDevice->retain();
+    library = device->newDefaultLibrary();
+    assert(library);
+    archive = newArchive(device, archivePath);
+}
+
+PipelineCache::~PipelineCache()
+{
+    table.forEach([](MTL::RenderPipelineState* state) { state->release(); });
+    if (archive) archive->release();
+    library->release();
+    device->release();
+}
+
+MTL::Function* PipelineCache::newFunction(const std::string& name, const PipelineKey& key)
+{
+    using namespace NS;
+    using NS::StringEncoding::UTF8StringEncoding;
+
+    if (key.functionConstantCount == 0) {
+        return library->newFunction(String::string(name.c_str(), UTF8StringEncoding));
+    }
+
+    MTL::FunctionConstantValues* constantValues = MTL::FunctionConstantValues::alloc()->init();
+    for (int i = 0; i < key.functionConstantCount; ++i) {
+        const PipelineFunctionConstant& constant = key.functionConstants[i];
+        if (constant.dataType == MTL::DataTypeBool) {
+            const bool value = constant.value != 0;
+            constantValues->setConstantValue(&value, MTL::DataTypeBool, constant.index);
+        } else {
+            constantValues->setConstantValue(&constant.value, static_cast<MTL::DataType>(constant.dataType), constant.index);
+        }
+    }
+
+    NS::Error* err = nullptr;
+    MTL::Function* result = library->newFunction(String::string(name.c_str(), UTF8StringEncoding), constantValues, &err);
+    if (!result) {
+        __builtin_printf("%s", err->localizedDescription()->utf8String());
+        assert(false);
+    }
+    constantValues->release();
+    return result;
+}
+
+MTL::RenderPipelineDescriptor* PipelineCache::newPipelineDescriptor(const PipelineKey& key)
+{
+    MTL::Function* vertFunc = newFunction(key.vertexFunction, key);
+    MTL::Function* fragFunc = newFunction(key.fragmentFunction, key);
+    assert(vertFunc && fragFunc);
+
+    MTL::RenderPipelineDescriptor* pipelineDesc = MTL::RenderPipelineDescriptor::alloc()->init();
+    pipelineDesc->setVertexFunction(vertFunc);
+    pipelineDesc->setFragmentFunction(fragFunc);
+
+    MTL::RenderPipelineColorAttachmentDescriptor* colorAttachment = pipelineDesc->colorAttachments()->object(0);
+    colorAttachment->setPixelFormat(static_cast<MTL::PixelFormat>(key.colorPixelFormat));
+    colorAttachment->setBlendingEnabled(key.blendingEnabled);
+    colorAttachment->setRgbBlendOperation(static_cast<MTL::BlendOperation>(key.rgbBlendOperation));
+    colorAttachment->setAlphaBlendOperation(static_cast<MTL::BlendOperation>(key.alphaBlendOperation));
+    colorAttachment->setSourceRGBBlendFactor(static_cast<MTL::BlendFactor>(key.sourceRGBBlendFactor));
+    colorAttachment->setDestinationRGBBlendFactor(static_cast<MTL::BlendFactor>(key.destinationRGBBlendFactor));
+    colorAttachment->setSourceAlphaBlendFactor(static_cast<MTL::BlendFactor>(key.sourceAlphaBlendFactor));
+    colorAttachment->setDestinationAlphaBlendFactor(static_cast<MTL::BlendFactor>(key.destinationAlphaBlendFactor));
+    pipelineDesc->setDepthAttachmentPixelFormat(static_cast<MTL::PixelFormat>(key.depthPixelFormat));
+
+    if (key.vertexStride > 0) {
+        MTL::VertexDescriptor* vertexDesc = MTL::VertexDescriptor::alloc()->init();
+        for (int iAttr = 0; iAttr < key.vertexAttributeCount; ++iAttr) {
+            const PipelineVertexAttribute& attr = key.vertexAttributes[iAttr];
+            MTL::VertexAttributeDescriptor* pAttribute = vertexDesc->attributes()->object(static_cast<NS::UInteger>(iAttr));
+            pAttribute->setFormat(static_cast<MTL::VertexFormat>(attr.format));
+            pAttribute->setOffset(attr.offset);
+            pAttribute->setBufferIndex(attr.bufferIndex);
+        }
+        MTL::VertexBufferLayoutDescriptor* pLayout = vertexDesc->layouts()->object(0);
+        pLayout->setStride(key.vertexStride);
+        pLayout->setStepFunction(MTL::VertexStepFunctionPerVertex);
+        pipelineDesc->setVertexDescriptor(vertexDesc);
+        vertexDesc->release();
+    }
+
+    if (archive) {
+        pipelineDesc->setBinaryArchives(NS::Array::array(archive));
+    }
+
+    fragFunc->release();
+    vertFunc->release();
+    return pipelineDesc;
+}
+
+MTL::RenderPipelineState* PipelineCache::pipelineState(const PipelineKey& key)
+{
+    const uint64_t keyHash = hashPipelineKey(key);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        MTL::RenderPipelineState* cached = table.find(key, keyHash);
+        if (cached) return cached;
+    }
+    
+    // NOTE: Compiled without holding the lock, so different pipelines can build on different threads at the same time.
+    MTL::RenderPipelineDescriptor* pipelineDesc = newPipelineDescriptor(key);
+    MTL::RenderPipelineState* result = nullptr;
+
+    NS::Error* err = nullptr;
+    if (archive) {
+        // Archive only first, a miss here is cheap and tells us whether this pipeline still needs adding.
+        result = device->newRenderPipelineState(pipelineDesc, MTL::PipelineOptionFailOnBinaryArchiveMiss, nullptr, &err);
+    }
+    const bool fromArchive = result != nullptr;
+    if (!result) {
+        err = nullptr;
+        result = device->newRenderPipelineState(pipelineDesc, &err);
+        if (!result) {
+            __builtin_printf("%s", err->localizedDescription()->utf8String());
+            assert(false);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (fromArchive) {
+        ++archiveHitCount;
+    } else {
+        ++archiveMissCount;
+        if (archive && archive->addRenderPipelineFunctions(pipelineDesc, &err)) {
+            archiveDirty = true;
+        }
+    }
+    pipelineDesc->release();
+
+    if (!table.insert(key, keyHash, result)) {
+        // Another thread finished the same key first, keep theirs.
+        result->release();
+        result = table.find(key, keyHash);
+    }
+    return result;
+}
+
+void PipelineCache::saveArchive()
+{
+    using namespace NS;
+    using NS::StringEncoding::UTF8StringEncoding;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!archive || !archiveDirty || archivePath.empty()) return;
+
+    NS::Error* err = nullptr;
+    if (archive->serializeToURL(URL::fileURLWithPath(String::string(archivePath.c_str(), UTF8StringEncoding)), &err)) {
+        archiveDirty = false;
+    } else {
+        __builtin_printf("Failed to save pipeline archive: %s\n", err ? err->localizedDescription()->utf8String() : "unknown error");
+    }
+}
@@ -0,0 +1,47 @@
+//
+//  PipelineCache.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef PipelineCache_hpp
+#define PipelineCache_hpp
+
+#include <Metal/Metal.hpp>
+#include <mutex>
+#include <string>
+#include "PipelineKey.hpp"
+
+// Loads the default library once and hands out pipeline states by PipelineKey. Compiled pipelines are also added to a
+// binary archive on disk, so the next launch loads them instead of compiling from source.
+// NOTE: Owns every pipeline state it returns, don't release them. Safe to call from several threads at once, pipelines
+// compile outside the lock so independent keys build in parallel.
+class PipelineCache
+{
+public:
+    PipelineCache( MTL::Device* pDevice, std::string archivePath );
+    ~PipelineCache();
+
+    MTL::RenderPipelineState* pipelineState(const PipelineKey& key);
+
+    // Writes the archive back to disk if anything new was compiled since the last save.
+    void saveArchive();
+
+    int archiveHitCount = 0;
+    int archiveMissCount = 0;
+
+private:
+    MTL::Device* device;
+    MTL::Library* library;
+    MTL::BinaryArchive* archive = nullptr;
+    std::string archivePath;
+    bool archiveDirty = false;
+    PipelineTable<MTL::RenderPipelineState> table;
+    std::mutex mutex; // guards table, archive and the counters
+
+    MTL::Function* newFunction(const std::string& name, const PipelineKey& key);
+    MTL::RenderPipelineDescriptor* newPipelineDescriptor(const PipelineKey& key);
+};
+
+#endif /* PipelineCache_hpp */
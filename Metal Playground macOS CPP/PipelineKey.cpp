@@ -0,0 +1,108 @@
+//
+//  PipelineKey.cpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include "PipelineKey.hpp"
+#include <cassert>
+#include "TextureMips.hpp"
+
+// hashBytes' FNV-1a, fields are fed one at a time so struct padding never ends up in the hash.
+static inline void hashAppend(uint64_t& hash, const void* data, size_t size)
+{
+    hash = hashBytes(data, size, hash);
+}
+
+template <typename T>
+static inline void hashAppend(uint64_t& hash, const T& value)
+{
+    hashAppend(hash, &value, sizeof(value));
+}
+
+static inline void hashAppendString(uint64_t& hash, const std::string& value)
+{
+    const uint64_t length = value.size();
+    hashAppend(hash, length);
+    hashAppend(hash, value.data(), value.size());
+}
+
+void PipelineKey::addFunctionConstant(uint64_t index, uint64_t dataType, int32_t value)
+{
+    assert(functionConstantCount < maxFunctionConstants);
+    // Kept sorted by index, so the order they're added in doesn't make a different key.
+    int insertIndex = functionConstantCount;
+    while (insertIndex > 0 && functionConstants[insertIndex - 1].index > index) {
+        functionConstants[insertIndex] = functionConstants[insertIndex - 1];
+        --insertIndex;
+    }
+    assert(insertIndex == 0 || functionConstants[insertIndex - 1].index != index);
+    functionConstants[insertIndex] = (PipelineFunctionConstant){ index, dataType, value };
+    ++functionConstantCount;
+}
+
+void PipelineKey::addVertexAttribute(uint64_t format, uint64_t offset, uint64_t bufferIndex)
+{
+    assert(vertexAttributeCount < maxVertexAttributes);
+    vertexAttributes[vertexAttributeCount++] = (PipelineVertexAttribute){ format, offset, bufferIndex };
+}
+
+bool operator==(const PipelineKey& a, const PipelineKey& b)
+{
+    if (a.vertexFunction != b.vertexFunction || a.fragmentFunction != b.fragmentFunction) return false;
+    if (a.functionConstantCount != b.functionConstantCount || a.vertexAttributeCount != b.vertexAttributeCount) return false;
+    for (int i = 0; i < a.functionConstantCount; ++i) {
+        const PipelineFunctionConstant& ca = a.functionConstants[i];
+        const PipelineFunctionConstant& cb = b.functionConstants[i];
+        if (ca.index != cb.index || ca.dataType != cb.dataType || ca.value != cb.value) return false;
+    }
+    for (int i = 0; i < a.vertexAttributeCount; ++i) {
+        const PipelineVertexAttribute& va = a.vertexAttributes[i];
+        const PipelineVertexAttribute& vb = b.vertexAttributes[i];
+        if (va.format != vb.format || va.offset != vb.offset || va.bufferIndex != vb.bufferIndex) return false;
+    }
+    return a.colorPixelFormat == b.colorPixelFormat
+        && a.blendingEnabled == b.blendingEnabled
+        && a.rgbBlendOperation == b.rgbBlendOperation
+        && a.alphaBlendOperation == b.alphaBlendOperation
+        && a.sourceRGBBlendFactor == b.sourceRGBBlendFactor
+        && a.destinationRGBBlendFactor == b.destinationRGBBlendFactor
+        && a.sourceAlphaBlendFactor == b.sourceAlphaBlendFactor
+        && a.destinationAlphaBlendFactor == b.destinationAlphaBlendFactor
+        && a.depthPixelFormat == b.depthPixelFormat
+        && a.vertexStride == b.vertexStride;
+}
+
+uint64_t hashPipelineKey(const PipelineKey& key)
+{
+    uint64_t hash = hashBytes(nullptr, 0); // the offset basis
+    hashAppendString(hash, key.vertexFunction);
+    hashAppendString(hash, key.fragmentFunction);
+
+    hashAppend(hash, key.functionConstantCount);
+    for (int i = 0; i < key.functionConstantCount; ++i) {
+        hashAppend(hash, key.functionConstants[i].index);
+        hashAppend(hash, key.functionConstants[i].dataType);
+        hashAppend(hash, key.functionConstants[i].value);
+    }
+
+    hashAppend(hash, key.colorPixelFormat);
+    hashAppend(hash, key.blendingEnabled);
+    hashAppend(hash, key.rgbBlendOperation);
+    hashAppend(hash, key.alphaBlendOperation);
+    hashAppend(hash, key.sourceRGBBlendFactor);
+    hashAppend(hash, key.destinationRGBBlendFactor);
+    hashAppend(hash, key.sourceAlphaBlendFactor);
+    hashAppend(hash, key.destinationAlphaBlendFactor);
+    hashAppend(hash, key.depthPixelFormat);
+
+    hashAppend(hash, key.vertexAttributeCount);
+    for (int i = 0; i < key.vertexAttributeCount; ++i) {
+        hashAppend(hash, key.vertexAttributes[i].format);
+        hashAppend(hash, key.vertexAttributes[i].offset);
+        hashAppend(hash, key.vertexAttributes[i].bufferIndex);
+    }
+    hashAppend(hash, key.vertexStride);
+    return hash;
+}
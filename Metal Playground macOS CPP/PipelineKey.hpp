@@ -0,0 +1,117 @@
+//
+//  PipelineKey.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef PipelineKey_hpp
+#define PipelineKey_hpp
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// NOTE: Plain data only, no Metal types. Enum values are stored as their raw MTL (NS::UInteger) values so the key and the table below
+// can be hashed / exercised without a device.
+struct PipelineFunctionConstant {
+    uint64_t index;
+    uint64_t dataType; // MTL::DataType
+    int32_t value;
+};
+
+struct PipelineVertexAttribute {
+    uint64_t format; // MTL::VertexFormat
+    uint64_t offset;
+    uint64_t bufferIndex;
+};
+
+struct PipelineKey {
+    static const int maxFunctionConstants = 4;
+    static const int maxVertexAttributes = 4;
+
+    std::string vertexFunction;
+    std::string fragmentFunction;
+    PipelineFunctionConstant functionConstants[maxFunctionConstants] = {}; // sorted by index, see addFunctionConstant
+    int functionConstantCount = 0;
+
+    uint64_t colorPixelFormat = 0; // MTL::PixelFormat
+    bool blendingEnabled = false;
+    uint64_t rgbBlendOperation = 0;
+    uint64_t alphaBlendOperation = 0;
+    uint64_t sourceRGBBlendFactor = 0;
+    uint64_t destinationRGBBlendFactor = 0;
+    uint64_t sourceAlphaBlendFactor = 0;
+    uint64_t destinationAlphaBlendFactor = 0;
+    uint64_t depthPixelFormat = 0; // MTL::PixelFormat, 0 (Invalid) for passes without a depth attachment
+
+    // Vertex descriptor, array index is the attribute index. vertexStride 0 means the pipeline has none and fetches its
+    // vertices manually.
+    PipelineVertexAttribute vertexAttributes[maxVertexAttributes] = {};
+    int vertexAttributeCount = 0;
+    uint64_t vertexStride = 0;
+
+    void addFunctionConstant(uint64_t index, uint64_t dataType, int32_t value);
+    void addVertexAttribute(uint64_t format, uint64_t offset, uint64_t bufferIndex);
+};
+
+bool operator==(const PipelineKey& a, const PipelineKey& b);
+uint64_t hashPipelineKey(const PipelineKey& key);
+
+// Key -> pipeline state bookkeeping, T is whatever the backend compiles (MTL::RenderPipelineState for Metal).
+// Entries store their full key and keys whose hashes collide share a bucket, so a collision is neither the wrong pipeline
+// nor a key that can never be cached.
+template <typename T>
+class PipelineTable
+{
+public:
+    T* find(const PipelineKey& key, uint64_t keyHash)
+    {
+        auto it = buckets.find(keyHash);
+        if (it != buckets.end()) {
+            for (const Entry& entry : it->second) {
+                if (!(entry.key == key)) continue;
+                ++hitCount;
+                return entry.state;
+            }
+        }
+        ++missCount;
+        return nullptr;
+    }
+
+    // Returns false if the key is already in the table, the caller keeps ownership of state in that case.
+    bool insert(const PipelineKey& key, uint64_t keyHash, T* state)
+    {
+        std::vector<Entry>& bucket = buckets[keyHash];
+        for (const Entry& entry : bucket) {
+            if (entry.key == key) return false;
+        }
+        bucket.push_back(Entry{ key, state });
+        ++entryCount;
+        return true;
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const
+    {
+        for (const auto& it : buckets) {
+            for (const Entry& entry : it.second) fn(entry.state);
+        }
+    }
+
+    size_t count() const { return entryCount; }
+
+    int hitCount = 0;
+    int missCount = 0;
+
+private:
+    struct Entry {
+        PipelineKey key;
+        T* state;
+    };
+    std::unordered_map<uint64_t, std::vector<Entry>> buckets; // almost always one entry each
+    size_t entryCount = 0;
+};
+
+#endif /* PipelineKey_hpp */
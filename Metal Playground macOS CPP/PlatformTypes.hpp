@@ -0,0 +1,86 @@
+//
+//  PlatformTypes.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef PlatformTypes_hpp
+#define PlatformTypes_hpp
+
+#include <cstdint>
+
+#if defined(__APPLE__)
+#include <simd/simd.h>
+#include <CoreGraphics/CGGeometry.h>
+#include <MacTypes.h>
+#else
+// Just enough of <simd/simd.h>, CoreGraphics and MacTypes for the draw recording code to build off Apple platforms
+// (the Linux benchmark). Sizes and alignment match Apple's types, so the instance structs keep their GPU layout.
+#include <cmath>
+
+typedef uint8_t UInt8;
+typedef uint32_t UInt32;
+typedef uint64_t UInt64;
+
+struct CGSize {
+    double width;
+    double height;
+};
+
+struct alignas(8) simd_float2 {
+    float x, y;
+};
+
+struct alignas(16) simd_float4 {
+    float x, y, z, w;
+};
+
+struct alignas(16) simd_float4x4 {
+    simd_float4 columns[4];
+};
+
+// Texel math only needs element access and lane-wise arithmetic, GCC vector extensions cover that.
+typedef uint8_t simd_uchar4 __attribute__((__vector_size__(4)));
+typedef uint16_t simd_ushort4 __attribute__((__vector_size__(8)));
+
+static inline simd_ushort4 simd_ushort(simd_uchar4 v) { return __builtin_convertvector(v, simd_ushort4); }
+static inline simd_uchar4 simd_uchar(simd_ushort4 v) { return __builtin_convertvector(v, simd_uchar4); }
+
+namespace simd {
+    typedef simd_float2 float2;
+    typedef simd_float4 float4;
+    typedef simd_float4x4 float4x4;
+}
+
+static const simd_float4x4 matrix_identity_float4x4 = {{
+    { 1.0f, 0.0f, 0.0f, 0.0f },
+    { 0.0f, 1.0f, 0.0f, 0.0f },
+    { 0.0f, 0.0f, 1.0f, 0.0f },
+    { 0.0f, 0.0f, 0.0f, 1.0f },
+}};
+
+static inline simd_float2 operator+(simd_float2 a, simd_float2 b) { return { a.x + b.x, a.y + b.y }; }
+static inline simd_float2 operator-(simd_float2 a, simd_float2 b) { return { a.x - b.x, a.y - b.y }; }
+static inline simd_float2 operator*(simd_float2 a, float s) { return { a.x * s, a.y * s }; }
+static inline simd_float4 operator+(simd_float4 a, simd_float4 b) { return { a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w }; }
+static inline simd_float4 operator*(simd_float4 a, float s) { return { a.x * s, a.y * s, a.z * s, a.w * s }; }
+
+static inline simd_float4 simd_make_float4(float x, float y, float z, float w) { return { x, y, z, w }; }
+
+static inline simd_float4 simd_mul(simd_float4x4 m, simd_float4 v)
+{
+    return m.columns[0] * v.x + m.columns[1] * v.y + m.columns[2] * v.z + m.columns[3] * v.w;
+}
+
+static inline simd_float4x4 simd_mul(simd_float4x4 a, simd_float4x4 b)
+{
+    return {{ simd_mul(a, b.columns[0]), simd_mul(a, b.columns[1]), simd_mul(a, b.columns[2]), simd_mul(a, b.columns[3]) }};
+}
+#endif
+
+static_assert(sizeof(simd_float2) == 8 && alignof(simd_float2) == 8, "simd_float2 layout");
+static_assert(sizeof(simd_float4) == 16 && alignof(simd_float4) == 16, "simd_float4 layout");
+static_assert(sizeof(simd_float4x4) == 64, "simd_float4x4 layout");
+
+#endif /* PlatformTypes_hpp */
@@ -0,0 +1,110 @@
+//
+//  Profiler.cpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include "Profiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// NOTE: Buffers are never freed, a thread that has exited can still show up in a later capture.
+static const int maxProfiledThreads = 32;
+static std::atomic<ProfileThreadBuffer*> threadBuffers[maxProfiledThreads];
+static std::atomic<int> threadBufferCount = 0;
+static thread_local ProfileThreadBuffer* localThreadBuffer = nullptr;
+static thread_local bool localThreadBufferFailed = false;
+
+std::atomic<bool> Profiler::enabled = true;
+
+uint64_t Profiler::nowNs()
+{
+    const auto sinceEpoch = std::chrono::steady_clock::now().time_since_epoch();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch).count();
+}
+
+ProfileThreadBuffer* Profiler::threadBuffer()
+{
+    if (localThreadBuffer || localThreadBufferFailed) return localThreadBuffer;
+
+    // Only the first zone on each thread gets here, after that it's a thread_local read.
+    const int index = threadBufferCount.fetch_add(1, std::memory_order_relaxed);
+    if (index >= maxProfiledThreads) {
+        localThreadBufferFailed = true;
+        __builtin_printf("Profiler: more than %d threads, zones on this one are dropped\n", maxProfiledThreads);
+        return nullptr;
+    }
+
+    ProfileThreadBuffer* buffer = new ProfileThreadBuffer();
+    buffer->threadIndex = (uint32_t)index;
+    snprintf(buffer->threadName, sizeof(buffer->threadName), "Thread %d", index);
+    threadBuffers[index].store(buffer, std::memory_order_release);
+    localThreadBuffer = buffer;
+    return buffer;
+}
+
+void Profiler::setThreadName(const char* name)
+{
+    ProfileThreadBuffer* buffer = threadBuffer();
+    if (buffer) snprintf(buffer->threadName, sizeof(buffer->threadName), "%s", name);
+}
+
+static void writeJSONString(FILE* file, const char* value)
+{
+    fputc('"', file);
+    for (const char* c = value; *c; ++c) {
+        if (*c == '"' || *c == '\\') fputc('\\', file);
+        if ((unsigned char)*c < 0x20) continue;
+        fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+bool Profiler::exportChromeTrace(const std::string& path)
+{
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", file);
+    bool isFirstEvent = true;
+    std::vector<ProfileZoneEvent> events;
+
+    const int bufferCount = std::min(threadBufferCount.load(std::memory_order_relaxed), maxProfiledThreads);
+    for (int iBuffer = 0; iBuffer < bufferCount; ++iBuffer) {
+        const ProfileThreadBuffer* buffer = threadBuffers[iBuffer].load(std::memory_order_acquire);
+        if (!buffer) continue; // still being registered
+
+        // Copy out first, then drop anything the owning thread lapped while we were copying.
+        const uint64_t writeEnd = buffer->writeCount.load(std::memory_order_acquire);
+        const uint64_t writeBegin = writeEnd > ProfileThreadBuffer::capacity ? writeEnd - ProfileThreadBuffer::capacity : 0;
+        events.resize((size_t)(writeEnd - writeBegin));
+        for (uint64_t i = writeBegin; i < writeEnd; ++i) {
+            events[(size_t)(i - writeBegin)] = buffer->events[i & (ProfileThreadBuffer::capacity - 1)];
+        }
+        const uint64_t writeEndAfterCopy = buffer->writeCount.load(std::memory_order_acquire);
+        // push() writes slot writeEndAfterCopy before publishing it, and that slot is also the oldest one we copied
+        // (index writeEndAfterCopy - capacity), so it may be half overwritten. One extra slot is dropped for it.
+        const uint64_t firstValid = writeEndAfterCopy + 1 > ProfileThreadBuffer::capacity ? writeEndAfterCopy + 1 - ProfileThreadBuffer::capacity : 0;
+
+        fprintf(file, "%s{\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"name\":\"thread_name\",\"args\":{\"name\":", isFirstEvent ? "" : ",\n", buffer->threadIndex);
+        writeJSONString(file, buffer->threadName);
+        fputs("}}", file);
+        isFirstEvent = false;
+
+        for (uint64_t i = std::max(writeBegin, firstValid); i < writeEnd; ++i) {
+            const ProfileZoneEvent& event = events[(size_t)(i - writeBegin)];
+            // Chrome trace timestamps are in microseconds, fractions keep the ns precision.
+            fprintf(file, ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":",
+                    buffer->threadIndex, event.startNs / 1000.0, (event.endNs - event.startNs) / 1000.0);
+            writeJSONString(file, event.name);
+            fputc('}', file);
+        }
+    }
+
+    fputs("\n]}\n", file);
+    return fclose(file) == 0;
+}
@@ -0,0 +1,93 @@
+//
+//  Profiler.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef Profiler_hpp
+#define Profiler_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Scoped CPU timing zones, eg.
+//     PROFILE_ZONE("Encode Batches");
+// Every thread writes its zones into its own fixed size ring buffer, so recording never takes a lock or allocates.
+// Zones nest by time, the trace viewer rebuilds the hierarchy from that.
+// NOTE: Zone names are stored as pointers, only pass string literals (or anything else that outlives the capture).
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+struct ProfileZoneEvent {
+    const char* name;
+    uint64_t startNs;
+    uint64_t endNs;
+};
+
+// Single producer (the owning thread) / single consumer (the exporter) ring.
+// Once full the oldest zones get overwritten, so a capture always holds the most recent history.
+struct ProfileThreadBuffer {
+    static const int capacity = 1 << 14; // must be a power of 2
+
+    ProfileZoneEvent events[capacity];
+    std::atomic<uint64_t> writeCount = 0;
+    uint32_t threadIndex = 0;
+    char threadName[32] = {};
+
+    inline void push(const ProfileZoneEvent& event)
+    {
+        const uint64_t index = writeCount.load(std::memory_order_relaxed);
+        events[index & (capacity - 1)] = event;
+        writeCount.store(index + 1, std::memory_order_release);
+    }
+};
+
+namespace Profiler {
+    uint64_t nowNs(); // monotonic
+
+    // On by default. Clearing it stops new zones from being recorded, zones already open still finish.
+    extern std::atomic<bool> enabled;
+
+    // Buffer for the calling thread, created on first use. Returns nullptr once every buffer is taken.
+    ProfileThreadBuffer* threadBuffer();
+    void setThreadName(const char* name);
+
+    // Writes every zone recorded so far as Chrome trace event JSON, load it in chrome://tracing or ui.perfetto.dev.
+    bool exportChromeTrace(const std::string& path);
+}
+
+class ProfileZone
+{
+public:
+    inline explicit ProfileZone(const char* name)
+    : name(name), startNs(Profiler::enabled.load(std::memory_order_relaxed) ? Profiler::nowNs() : 0)
+    {}
+
+    inline ~ProfileZone()
+    {
+        if (startNs == 0) return;
+        ProfileThreadBuffer* buffer = Profiler::threadBuffer();
+        if (buffer) buffer->push((ProfileZoneEvent){ name, startNs, Profiler::nowNs() });
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    const char* name;
+    uint64_t startNs;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#if PROFILER_ENABLED
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone_, __COUNTER__)(name)
+#else
+#define PROFILE_ZONE(name) do {} while (0)
+#endif
+
+#endif /* Profiler_hpp */
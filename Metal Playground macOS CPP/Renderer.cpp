@@ -8,183 +8,131 @@
 // TODO: Cache all the sizeof stride sizes
 
 #include <cassert>
+#include <cstring>
 #include <fstream>
 #include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "Renderer.hpp"
 #include "ShaderTypes.h"
-#include "ii_random.h"
+#include "KTX2.hpp"
+#include "PipelineCache.hpp"
+#include "Profiler.hpp"
+#include "TextureMips.hpp"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
-#include "json.hpp"
-using json = nlohmann::json;
 
-// JSON mapping
-void from_json(const json& j, Bounds& b) {
-    j.at("left").get_to(b.left);
-    j.at("bottom").get_to(b.bottom);
-    j.at("right").get_to(b.right);
-    j.at("top").get_to(b.top);
-}
-
-void from_json(const json& j, Glyph& g) {
-    j.at("unicode").get_to(g.unicode);
-    j.at("advance").get_to(g.advance);
-    
-    if (j.contains("planeBounds") && !j["planeBounds"].is_null()) {
-        g.planeBounds = j["planeBounds"].get<Bounds>();
-    } else {
-        g.planeBounds = std::nullopt;
-    }
-    
-    if (j.contains("atlasBounds") && !j["atlasBounds"].is_null()) {
-        g.atlasBounds = j["atlasBounds"].get<Bounds>();
-    } else {
-        g.atlasBounds = std::nullopt;
-    }
-}
-
-void from_json(const json& j, Kerning& k) {
-    j.at("unicode1").get_to(k.unicode1);
-    j.at("unicode2").get_to(k.unicode2);
-    j.at("advance").get_to(k.advance);
-}
-
-void from_json(const json& j, AtlasMetrics& a) {
-    j.at("type").get_to(a.type);
-    j.at("distanceRange").get_to(a.distanceRange);
-    j.at("size").get_to(a.size);
-    j.at("width").get_to(a.width);
-    j.at("height").get_to(a.height);
-    j.at("yOrigin").get_to(a.yOrigin);
-}
-
-void from_json(const json& j, FontMetrics& m) {
-    j.at("emSize").get_to(m.emSize);
-    j.at("lineHeight").get_to(m.lineHeight);
-    j.at("ascender").get_to(m.ascender);
-    j.at("descender").get_to(m.descender);
-    j.at("underlineY").get_to(m.underlineY);
-    j.at("underlineThickness").get_to(m.underlineThickness);
-}
-
-void from_json(const json& j, FontAtlas& f) {
-    j.at("atlas").get_to(f.atlas);
-    j.at("metrics").get_to(f.metrics);
-    j.at("glyphs").get_to(f.glyphs);
-    j.at("kerning").get_to(f.kerning);
-}
-
-
-// MARK: - Math Helpers
-static inline simd_float4x4 makeTranslate(float tx, float ty)
-{
-    simd_float4x4 m = matrix_identity_float4x4;
-    m.columns[3].x = tx;
-    m.columns[3].y = ty;
-    return m;
-}
-
-static inline simd_float4x4 makeScale(float sx, float sy)
-{
-    simd_float4x4 m = matrix_identity_float4x4;
-    m.columns[0].x = sx;
-    m.columns[1].y = sy;
-    m.columns[2].z = 1.0f;
-    return m;
-}
-
-static inline simd_float4x4 makeScale(float sXY)
-{
-    simd_float4x4 m = matrix_identity_float4x4;
-    m.columns[0].x = sXY;
-    m.columns[1].y = sXY;
-    m.columns[2].z = 1.0f;
-    return m;
-}
-
-static inline simd_float4x4 makeRotationZ(float angle)
-{
-    simd_float4x4 m = matrix_identity_float4x4;
-    float c = std::cos(angle);
-    float s = std::sin(angle);
-    
-    m.columns[0].x =  c;
-    m.columns[0].y =  s;
-    m.columns[1].x = -s;
-    m.columns[1].y =  c;
-    return m;
-}
-
-static inline simd_float4x4 pixelSpaceProjection(float screenWidth, float screenHeight)
-{
-    float scaleX = 2.0f / screenWidth;
-    float scaleY = 2.0f / screenHeight;
-    
-    return simd_float4x4{
-        simd_float4{ scaleX, 0.0f,   0.0f, 0.0f },
-        simd_float4{ 0.0f,   scaleY, 0.0f, 0.0f },
-        simd_float4{ 0.0f,   0.0f,   1.0f, 0.0f },
-        simd_float4{ 0.0f,   0.0f,   0.0f, 1.0f }
-    };
-}
+// MARK: - Resource Helpers (defined further down)
+static std::string pipelineArchivePath();
+static void releaseRetainedLayerBuffers(RetainedLayerBuffers& buffers);
 
+// Of every pass's depth attachment, and so of every pipeline, see encodeBatches.
+static const MTL::PixelFormat depthPixelFormat = MTL::PixelFormatDepth32Float;
 
 
 Renderer::Renderer( MTL::Device* pDevice, MTK::View* pView )
 {
-    // TODO: Figure out how to assert the padding and stride of the shader structs too!
-    assert(sizeof(AtlasInstanceData) == 128);
-    assert(sizeof(PrimitiveInstanceData) == 128);
-    assert(sizeof(TextVertex) == 32);
-    
     inFlightSemaphore = dispatch_semaphore_create(Renderer::maxBuffersInFlight);
     
-    drawBatchesArr = new DrawBatch[drawBatchMaxCount];
-    // TODO: Check but I think nextStartIndexForTypePtr and strideSizesPtr are already created via definition.
-    for (int i = 0; i < drawbatchtype_count; ++i) nextStartIndexForTypePtr[i] = 0;
-    for (int i = 0; i < drawbatchtype_count; ++i) strideSizesPtr[i] = 0;
-    strideSizesPtr[drawbatchtype_atlas] = sizeof(AtlasInstanceData);
-    strideSizesPtr[drawbatchtype_primitive] = sizeof(PrimitiveInstanceData);
-    strideSizesPtr[drawbatchtype_text] = sizeof(TextVertex);
-
     device = pDevice->retain();
     commandQueue = device->newCommandQueue();
     
+    // Kick off asset loading and pipeline compilation on worker threads. Time to first frame becomes the longest single
+    // task rather than the sum of all of them.
+    Profiler::setThreadName("Render");
+    const MTL::PixelFormat pixelFormat = pView->colorPixelFormat();
+    colorPixelFormat = pixelFormat;
+    pView->setDepthStencilPixelFormat(depthPixelFormat);
+    pView->setClearDepth(1.0);
+    buildDepthStencilStates();
+    dispatch_queue_t workQueue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+    
+    dispatch_group_t assetGroup = dispatch_group_create();
+    dispatch_group_async(assetGroup, workQueue, ^{ loadAtlasTextureAndUV(); });
+    dispatch_group_async(assetGroup, workQueue, ^{ loadTextInfoAndTexture(); });
+    
+    startupGroup = dispatch_group_create();
+    pipelineCache = new PipelineCache(device, pipelineArchivePath());
+    pendingPipelineCount = 3;
+    buildPipelineAsync(drawbatchtype_atlas, pixelFormat, workQueue);
+    buildPipelineAsync(drawbatchtype_primitive, pixelFormat, workQueue);
+    buildPipelineAsync(drawbatchtype_text, pixelFormat, workQueue);
+    
     buildAtlasBuffers();
     buildPrimitiveBuffers();
     buildTextBuffers();
     
-    buildAtlasPipeline(pView->colorPixelFormat());
-    buildPrimitivePipeline(pView->colorPixelFormat());
-    buildTextPipeline(pView->colorPixelFormat());
-    
-    loadAtlasTextureAndUV();
-    loadTextInfoAndTexture();
-    textTempVertexBuffer = new TextVertex[textMaxSingleDrawVertCount];
+    // NOTE: Recording needs the sprite UVs and glyph metrics, so assets are joined here. Pipelines are only joined when a
+    // batch of their type is first encoded, see waitForPipeline.
+    dispatch_group_wait(assetGroup, DISPATCH_TIME_FOREVER);
+    dispatch_release(assetGroup);
+}
+
+void Renderer::buildPipelineAsync(DrawBatchType type, MTL::PixelFormat pixelFormat, dispatch_queue_t queue)
+{
+    pipelineBuildGroups[type] = dispatch_group_create();
+    pipelineReady[type] = false;
+    
+    dispatch_group_enter(startupGroup);
+    dispatch_group_async(pipelineBuildGroups[type], queue, ^{
+        switch (type) {
+            case drawbatchtype_atlas: buildAtlasPipeline(pixelFormat); break;
+            case drawbatchtype_primitive: buildPrimitivePipeline(pixelFormat); break;
+            case drawbatchtype_text: buildTextPipeline(pixelFormat); break;
+            default: assert(false); break;
+        }
+        
+        // Last one to finish writes the archive, still inside startupGroup so the destructor waits for it.
+        if (--pendingPipelineCount == 0) {
+            pipelineCache->saveArchive();
+            __builtin_printf("Pipelines: %d from archive, %d compiled\n", pipelineCache->archiveHitCount, pipelineCache->archiveMissCount);
+        }
+        dispatch_group_leave(startupGroup);
+    });
+}
+
+inline void Renderer::waitForPipeline(DrawBatchType type)
+{
+    if (pipelineReady[type]) return;
+    PROFILE_ZONE("Wait For Pipeline");
+    dispatch_group_wait(pipelineBuildGroups[type], DISPATCH_TIME_FOREVER);
+    pipelineReady[type] = true;
 }
 
 Renderer::~Renderer()
 {
-    delete[] drawBatchesArr;
-    drawBatchesArr = nullptr;
+    // Don't pull anything out from under a pipeline build that's still running.
+    dispatch_group_wait(startupGroup, DISPATCH_TIME_FOREVER);
+    dispatch_release(startupGroup);
+    for (int i = drawbatchtype_atlas; i <= drawbatchtype_text; ++i) dispatch_release(pipelineBuildGroups[i]);
+    
     device->release();
     commandQueue->release();
     
     atlasVertexBuffer->release();
     atlasTriInstanceBuffer->release();
     atlasSamplerState->release();
-    atlasPipelineState->release();
+    panelSamplerState->release();
     primitiveVertexBuffer->release();
+    primitiveFitVertexBuffer->release();
     primitiveTriInstanceBuffer->release();
-    primitivePipelineState->release();
     textTriVertexBuffer->release();
     textSamplerState->release();
-    textPipelineState->release();
+    for (std::pair<const Layer* const, RetainedLayerBuffers>& entry : retainedLayerBuffers) releaseRetainedLayerBuffers(entry.second);
+    for (std::pair<const CachedPanel* const, CachedPanelTexture>& entry : cachedPanelTextures) entry.second.texture->release();
+    for (MTL::Texture* texture : freePanelTextures) texture->release();
+    if (canvasTexture) canvasTexture->release();
+    if (scaledSceneTexture) scaledSceneTexture->release();
+    releaseDepthTextures();
+    opaqueDepthStencilState->release();
+    translucentDepthStencilState->release();
+    delete pipelineCache; // NOTE: Owns and releases all the pipeline states.
+    pipelineCache = nullptr;
+    delete frameCaptureWriter; // NOTE: Closes the file, so a capture cut short by quitting is still replayable.
+    frameCaptureWriter = nullptr;
     
     mainAtlasTexture->release();
     fontTexture->release();
-    delete[] textTempVertexBuffer;
-    textTempVertexBuffer = nullptr;
 }
 
 void Renderer::buildAtlasBuffers()
@@ -208,6 +156,40 @@ void Renderer::buildPrimitiveBuffers()
     primitiveVertexBuffer = device->newBuffer(&primitiveSquareVertices, verticeCount * sizeof(PrimitiveVertex), MTL::ResourceStorageModeShared);
     primitiveVertexBuffer->setLabel(String::string("Primitive Square Vertex Buffer", StringEncoding::UTF8StringEncoding));
     
+    // Octagon corners counter clockwise from 22.5 degrees, the first one on the x edge.
+    const PrimitiveFitVertex octagon[8] = {
+        { .corner={  1,  1 }, .isXEdge=1 }, { .corner={  1,  1 }, .isXEdge=0 },
+        { .corner={ -1,  1 }, .isXEdge=0 }, { .corner={ -1,  1 }, .isXEdge=1 },
+        { .corner={ -1, -1 }, .isXEdge=1 }, { .corner={ -1, -1 }, .isXEdge=0 },
+        { .corner={  1, -1 }, .isXEdge=0 }, { .corner={  1, -1 }, .isXEdge=1 },
+    };
+    const simd_float2 rectCorners[4] = { { 1, 1 }, { -1, 1 }, { -1, -1 }, { 1, -1 } };
+    std::vector<PrimitiveFitVertex> fitVertices;
+    
+    primitiveFitMeshes[ShapeTypeCircle].vertexStart = (int)fitVertices.size();
+    const int octagonStripOrder[8] = { 0, 1, 7, 2, 6, 3, 5, 4 };
+    for (int i : octagonStripOrder) fitVertices.push_back(octagon[i]);
+    primitiveFitMeshes[ShapeTypeCircle].vertexCount = (int)fitVertices.size() - primitiveFitMeshes[ShapeTypeCircle].vertexStart;
+    
+    primitiveFitMeshes[ShapeTypeCircleLines].vertexStart = (int)fitVertices.size();
+    for (int i = 0; i <= 8; ++i) {
+        PrimitiveFitVertex inner = octagon[i % 8];
+        inner.isInner = 1;
+        fitVertices.push_back(octagon[i % 8]);
+        fitVertices.push_back(inner);
+    }
+    primitiveFitMeshes[ShapeTypeCircleLines].vertexCount = (int)fitVertices.size() - primitiveFitMeshes[ShapeTypeCircleLines].vertexStart;
+    
+    primitiveFitMeshes[ShapeTypeRectLines].vertexStart = (int)fitVertices.size();
+    for (int i = 0; i <= 4; ++i) {
+        fitVertices.push_back((PrimitiveFitVertex){ .corner=rectCorners[i % 4], .isXEdge=0, .isInner=0 });
+        fitVertices.push_back((PrimitiveFitVertex){ .corner=rectCorners[i % 4], .isXEdge=0, .isInner=1 });
+    }
+    primitiveFitMeshes[ShapeTypeRectLines].vertexCount = (int)fitVertices.size() - primitiveFitMeshes[ShapeTypeRectLines].vertexStart;
+    
+    primitiveFitVertexBuffer = device->newBuffer(fitVertices.data(), fitVertices.size() * sizeof(PrimitiveFitVertex), MTL::ResourceStorageModeShared);
+    primitiveFitVertexBuffer->setLabel(String::string("Primitive Fitted Mesh Vertex Buffer", StringEncoding::UTF8StringEncoding));
+    
     const int primitiveTriInstanceBufferSize = sizeof(PrimitiveInstanceData) * primitiveMaxInstanceCount * maxBuffersInFlight;
     primitiveTriInstanceBuffer = device->newBuffer(primitiveTriInstanceBufferSize, MTL::ResourceStorageModeShared);
     primitiveTriInstanceBuffer->setLabel(String::string("Primitive Tri Instance Buffer", StringEncoding::UTF8StringEncoding));
@@ -226,63 +208,209 @@ void Renderer::updateTriBufferStates()
     triBufferIndex = (triBufferIndex + 1) % maxBuffersInFlight;
     
     atlasTriInstanceBufferOffset = sizeof(AtlasInstanceData) * atlasMaxInstanceCount * triBufferIndex;
-    atlasInstancesPtr = (static_cast<AtlasInstanceData*>(atlasTriInstanceBuffer->contents())) + (atlasMaxInstanceCount * triBufferIndex);
-    
     primitiveTriInstanceBufferOffset = sizeof(PrimitiveInstanceData) * primitiveMaxInstanceCount * triBufferIndex;
-    primitiveInstancesPtr = (static_cast<PrimitiveInstanceData*>(primitiveTriInstanceBuffer->contents())) + (primitiveMaxInstanceCount * triBufferIndex);
-    
     textTriInstanceBufferOffset = sizeof(TextVertex) * textMaxVertexCount * triBufferIndex;
-    textVertexBufferPtr = (static_cast<TextVertex*>(textTriVertexBuffer->contents())) + (textMaxVertexCount * triBufferIndex);
+    
+    beginFrame((static_cast<AtlasInstanceData*>(atlasTriInstanceBuffer->contents())) + (atlasMaxInstanceCount * triBufferIndex),
+               (static_cast<PrimitiveInstanceData*>(primitiveTriInstanceBuffer->contents())) + (primitiveMaxInstanceCount * triBufferIndex),
+               (static_cast<TextVertex*>(textTriVertexBuffer->contents())) + (textMaxVertexCount * triBufferIndex));
 }
 
-void Renderer::buildAtlasPipeline(MTL::PixelFormat pixelFormat)
+// MARK: - Retained Layers
+static void releaseRetainedLayerBuffers(RetainedLayerBuffers& buffers)
 {
-    using namespace NS;
-    using NS::StringEncoding::UTF8StringEncoding;
-    MTL::Library* library = device->newDefaultLibrary();
-    
-    MTL::Function* vertFunc = library->newFunction(String::string("vertex_atlas", UTF8StringEncoding));
-    MTL::Function* fragFunc = library->newFunction(String::string("fragment_atlas", UTF8StringEncoding));
-    
-    MTL::RenderPipelineDescriptor* pipelineDesc = MTL::RenderPipelineDescriptor::alloc()->init();
-    pipelineDesc->setVertexFunction(vertFunc);
-    pipelineDesc->setFragmentFunction(fragFunc);
-    
-    MTL::RenderPipelineColorAttachmentDescriptor* colorAttachment = pipelineDesc->colorAttachments()->object(0);
-    colorAttachment->setPixelFormat(pixelFormat);
-    colorAttachment->setBlendingEnabled(true);
-    colorAttachment->setRgbBlendOperation(MTL::BlendOperationAdd);
-    colorAttachment->setAlphaBlendOperation(MTL::BlendOperationAdd);
-    colorAttachment->setSourceRGBBlendFactor(MTL::BlendFactorSourceAlpha);
-    colorAttachment->setDestinationRGBBlendFactor(MTL::BlendFactorOneMinusSourceAlpha);
-    colorAttachment->setSourceAlphaBlendFactor(MTL::BlendFactorSourceAlpha);
-    colorAttachment->setDestinationAlphaBlendFactor(MTL::BlendFactorOneMinusSourceAlpha);
-    
-    MTL::VertexDescriptor* vertexDesc = MTL::VertexDescriptor::alloc()->init();
-    // Position attribute
-    MTL::VertexAttributeDescriptor* pPositionAttribute = vertexDesc->attributes()->object(static_cast<NS::UInteger>(AtlasVertAttrPosition));
-    pPositionAttribute->setFormat(MTL::VertexFormatFloat2);
-    pPositionAttribute->setOffset(0);
-    pPositionAttribute->setBufferIndex(static_cast<NS::UInteger>(BufferIndexVertices));
+    if (buffers.atlasInstances) buffers.atlasInstances->release();
+    if (buffers.primitiveInstances) buffers.primitiveInstances->release();
+    if (buffers.textVertices) buffers.textVertices->release();
+    buffers.atlasInstances = nullptr;
+    buffers.primitiveInstances = nullptr;
+    buffers.textVertices = nullptr;
+}
+
+template <typename T>
+static MTL::Buffer* newLayerBuffer(MTL::Device* device, const std::vector<T>& instances, const char* label, int copyCount = 1)
+{
+    if (instances.empty()) return nullptr;
+    const size_t copySize = sizeof(T) * instances.size();
+    MTL::Buffer* buffer = device->newBuffer(copySize * copyCount, MTL::ResourceStorageModeShared);
+    for (int iCopy = 0; iCopy < copyCount; ++iCopy) {
+        memcpy(static_cast<uint8_t*>(buffer->contents()) + copySize * iCopy, instances.data(), copySize);
+    }
+    buffer->setLabel(NS::String::string(label, NS::StringEncoding::UTF8StringEncoding));
+    return buffer;
+}
 
-    // UV attribute
-    MTL::VertexAttributeDescriptor* pUVAttribute = vertexDesc->attributes()->object(static_cast<NS::UInteger>(AtlasVertAttrUV));
-    pUVAttribute->setFormat(MTL::VertexFormatFloat2);
-    pUVAttribute->setOffset(offsetof(AtlasVertex, uv));
-    pUVAttribute->setBufferIndex(static_cast<NS::UInteger>(BufferIndexVertices));
+const RetainedLayerBuffers& Renderer::retainedLayerBuffersFor(const Layer& layer)
+{
+    RetainedLayerBuffers& buffers = retainedLayerBuffers[&layer];
+    if (buffers.lastDrawnFrame == frameIndex) return buffers; // an earlier batch of the layer already uploaded
+    buffers.lastDrawnFrame = frameIndex;
+    if (buffers.generation != layer.generation) {
+        PROFILE_ZONE("Upload Layer");
+        releaseRetainedLayerBuffers(buffers);
+        // In place layers get a copy per frame in flight, so the CPU never writes one the GPU may still be reading.
+        const int atlasCopyCount = layer.isUpdatedInPlace ? maxBuffersInFlight : 1;
+        buffers.atlasInstances = newLayerBuffer(device, layer.atlasInstances, "Layer Atlas Instance Buffer", atlasCopyCount);
+        buffers.primitiveInstances = newLayerBuffer(device, layer.primitiveInstances, "Layer Primitive Instance Buffer");
+        buffers.textVertices = newLayerBuffer(device, layer.textVertices, "Layer Text Vertex Buffer");
+        buffers.generation = layer.generation;
+        buffers.atlasCopyIndex = 0;
+        buffers.atlasCopyOffset = 0;
+        buffers.recentUpdates.assign(atlasCopyCount, {});
+    } else if (layer.isUpdatedInPlace) {
+        PROFILE_ZONE("Update Layer");
+        // Copies are used in turn, so this one was last written maxBuffersInFlight draws ago and its frame is done.
+        buffers.atlasCopyIndex = (buffers.atlasCopyIndex + 1) % maxBuffersInFlight;
+        buffers.atlasCopyOffset = sizeof(AtlasInstanceData) * layer.atlasInstances.size() * buffers.atlasCopyIndex;
+        std::vector<InstanceUpdate>& updates = buffers.recentUpdates[buffers.atlasCopyIndex];
+        updates.clear();
+        collectInstanceUpdates(layer, updates);
+
+        // It's behind by the updates of every draw since, this one's included. Only the changed fields are copied.
+        AtlasInstanceData* copy = reinterpret_cast<AtlasInstanceData*>(static_cast<uint8_t*>(buffers.atlasInstances->contents()) + buffers.atlasCopyOffset);
+        const AtlasInstanceData* source = layer.atlasInstances.data();
+        for (const std::vector<InstanceUpdate>& recent : buffers.recentUpdates) {
+            for (const InstanceUpdate& update : recent) {
+                if (update.fields == instancefields_transform) {
+                    copy[update.index].transform = source[update.index].transform;
+                } else {
+                    copy[update.index] = source[update.index];
+                }
+            }
+        }
+    }
+    return buffers;
+}
+
+void Renderer::releaseUndrawnLayers()
+{
+    for (auto it = retainedLayerBuffers.begin(); it != retainedLayerBuffers.end();) {
+        if (frameIndex - it->second.lastDrawnFrame > maxBuffersInFlight) {
+            releaseRetainedLayerBuffers(it->second);
+            it = retainedLayerBuffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+// MARK: - Cached Panels
+void Renderer::renderCachedPanels(MTL::CommandBuffer* cmdBuffer)
+{
+    std::vector<DrawBatch> panelBatches;
+    for (int iBatch = 0; iBatch < drawBatchCount; ++iBatch) {
+        const CachedPanel* panel = drawBatchesArr[iBatch].panel;
+        if (!panel) continue;
+        CachedPanelTexture& cached = cachedPanelTextures[panel];
+        cached.lastDrawnFrame = frameIndex;
+        const int textureWidth = cachedPanelTextureSize(panel->rect.z - panel->rect.x);
+        const int textureHeight = cachedPanelTextureSize(panel->rect.w - panel->rect.y);
+        if (cached.texture && cached.generation == panel->layer.generation) continue;
+        
+        PROFILE_ZONE("Render Cached Panel");
+        FramePhaseTimer phaseTimer(currentFrameSample, framephase_encode);
+        // Rebuilt into another size class, the old texture goes to the pool for whoever fits it.
+        if (cached.texture && ((int)cached.texture->width() != textureWidth || (int)cached.texture->height() != textureHeight)) {
+            freePanelTextures.push_back(cached.texture);
+            cached.texture = nullptr;
+        }
+        if (!cached.texture) cached.texture = panelTexture(textureWidth, textureHeight);
+        cached.generation = panel->layer.generation;
+        
+        MTL::RenderPassDescriptor* passDesc = MTL::RenderPassDescriptor::renderPassDescriptor();
+        MTL::RenderPassColorAttachmentDescriptor* colorAttachment = passDesc->colorAttachments()->object(0);
+        colorAttachment->setTexture(cached.texture);
+        colorAttachment->setLoadAction(MTL::LoadActionClear);
+        colorAttachment->setClearColor(MTL::ClearColor::Make(0.0, 0.0, 0.0, 0.0));
+        colorAttachment->setStoreAction(MTL::StoreActionStore);
+        attachDepthTexture(passDesc, textureWidth, textureHeight);
+        MTL::RenderCommandEncoder* encoder = cmdBuffer->renderCommandEncoder(passDesc);
+        encoder->setLabel(NS::String::string("Cached Panel Encoder", NS::StringEncoding::UTF8StringEncoding));
+        
+        panelBatches.assign(panel->layer.batches.begin(), panel->layer.batches.end());
+        for (DrawBatch& batch : panelBatches) batch.layer = &panel->layer;
+        encodeBatches(encoder, panelBatches.data(), (int)panelBatches.size(), cachedPanelProjection(*panel));
+        encoder->endEncoding();
+    }
+}
+
+MTL::Texture* Renderer::panelTexture(int width, int height)
+{
+    for (size_t i = 0; i < freePanelTextures.size(); ++i) {
+        MTL::Texture* texture = freePanelTextures[i];
+        if ((int)texture->width() != width || (int)texture->height() != height) continue;
+        freePanelTextures.erase(freePanelTextures.begin() + i);
+        return texture;
+    }
+    
+    MTL::TextureDescriptor* textureDesc = MTL::TextureDescriptor::texture2DDescriptor(colorPixelFormat, width, height, false);
+    textureDesc->setStorageMode(MTL::StorageModePrivate);
+    textureDesc->setUsage(MTL::TextureUsageRenderTarget | MTL::TextureUsageShaderRead);
+    MTL::Texture* texture = device->newTexture(textureDesc);
+    texture->setLabel(NS::String::string("Cached Panel Texture", NS::StringEncoding::UTF8StringEncoding));
+    return texture;
+}
 
-    // Layouts
-    MTL::VertexBufferLayoutDescriptor* pLayout = vertexDesc->layouts()->object(0);
-    pLayout->setStride(sizeof(AtlasVertex));
-    pLayout->setStepFunction(MTL::VertexStepFunctionPerVertex);
-    pipelineDesc->setVertexDescriptor(vertexDesc);
-    
-    NS::Error* err = nullptr;
-    atlasPipelineState = device->newRenderPipelineState(pipelineDesc, &err);
-    if (!atlasPipelineState) {
-        __builtin_printf("%s", err->localizedDescription()->utf8String());
-        assert(false);
+void Renderer::releaseUndrawnPanels()
+{
+    for (auto it = cachedPanelTextures.begin(); it != cachedPanelTextures.end();) {
+        if (frameIndex - it->second.lastDrawnFrame > maxBuffersInFlight) {
+            freePanelTextures.push_back(it->second.texture);
+            it = cachedPanelTextures.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    // Oldest first, they've gone longest without anyone taking them. Command buffers retain what they use.
+    while ((int)freePanelTextures.size() > cachedPanelPoolMaxCount) {
+        freePanelTextures.front()->release();
+        freePanelTextures.erase(freePanelTextures.begin());
     }
+}
+
+static PipelineKey makeBlendedPipelineKey(const char* vertexFunction, const char* fragmentFunction, MTL::PixelFormat pixelFormat, bool premultipliedAlpha)
+{
+    PipelineKey key;
+    key.vertexFunction = vertexFunction;
+    key.fragmentFunction = fragmentFunction;
+    key.addFunctionConstant(FunctionConstantIndexPremultipliedAlpha, MTL::DataTypeBool, premultipliedAlpha ? 1 : 0);
+    
+    key.colorPixelFormat = pixelFormat;
+    key.blendingEnabled = true;
+    key.rgbBlendOperation = MTL::BlendOperationAdd;
+    key.alphaBlendOperation = MTL::BlendOperationAdd;
+    key.sourceRGBBlendFactor = premultipliedAlpha ? MTL::BlendFactorOne : MTL::BlendFactorSourceAlpha;
+    key.destinationRGBBlendFactor = MTL::BlendFactorOneMinusSourceAlpha;
+    // NOTE: One in straight mode too. Destination alpha is then coverage, which cached panel textures need to be
+    // composited, and the RGB they end up with is premultiplied already. The drawable ignores it either way.
+    key.sourceAlphaBlendFactor = MTL::BlendFactorOne;
+    key.destinationAlphaBlendFactor = MTL::BlendFactorOneMinusSourceAlpha;
+    key.depthPixelFormat = depthPixelFormat;
+    return key;
+}
+
+void Renderer::buildAtlasPipeline(MTL::PixelFormat pixelFormat)
+{
+    PROFILE_ZONE("Build Atlas Pipeline");
+    PipelineKey key = makeBlendedPipelineKey("vertex_atlas", "fragment_atlas", pixelFormat, premultipliedAlpha);
+    key.addFunctionConstant(FunctionConstantIndexClipRects, MTL::DataTypeBool, 1);
+    key.addFunctionConstant(FunctionConstantIndexWorldSpaceInstances, MTL::DataTypeBool, 1);
+    key.addVertexAttribute(MTL::VertexFormatFloat2, 0, BufferIndexVertices);                         // AtlasVertAttrPosition
+    key.addVertexAttribute(MTL::VertexFormatFloat2, offsetof(AtlasVertex, uv), BufferIndexVertices); // AtlasVertAttrUV
+    key.vertexStride = sizeof(AtlasVertex);
+    atlasPipelineState = pipelineCache->pipelineState(key);
+    
+    // What makeBlendedPipelineKey(..., true) would give, with the same constants and vertex layout.
+    PipelineKey premultipliedKey = key;
+    assert(premultipliedKey.functionConstants[0].index == FunctionConstantIndexPremultipliedAlpha);
+    premultipliedKey.functionConstants[0].value = 1;
+    premultipliedKey.sourceRGBBlendFactor = MTL::BlendFactorOne;
+    atlasPremultipliedPipelineState = premultipliedAlpha ? atlasPipelineState : pipelineCache->pipelineState(premultipliedKey);
+    
+    // Opaque batches write alpha 1 over whatever is there, blending would give the same.
+    PipelineKey opaqueKey = key;
+    opaqueKey.blendingEnabled = false;
+    atlasOpaquePipelineState = pipelineCache->pipelineState(opaqueKey);
     
     MTL::SamplerDescriptor* sampleDesc = MTL::SamplerDescriptor::alloc()->init();
     sampleDesc->setMinFilter(MTL::SamplerMinMagFilterLinear);
@@ -291,106 +419,50 @@ void Renderer::buildAtlasPipeline(MTL::PixelFormat pixelFormat)
     atlasSamplerState = device->newSamplerState(sampleDesc);
     assert(atlasSamplerState);
     
+    sampleDesc->setMagFilter(MTL::SamplerMinMagFilterLinear);
+    sampleDesc->setMipFilter(MTL::SamplerMipFilterNotMipmapped);
+    panelSamplerState = device->newSamplerState(sampleDesc);
+    assert(panelSamplerState);
+    
     
     sampleDesc->release();
-    vertexDesc->release();
-    pipelineDesc->release();
-    library->release();
-    fragFunc->release();
-    vertFunc->release();
 }
 
 void Renderer::buildPrimitivePipeline(MTL::PixelFormat pixelFormat)
 {
-    using namespace NS;
-    using NS::StringEncoding::UTF8StringEncoding;
-    MTL::Library* library = device->newDefaultLibrary();
-    
-    MTL::Function* vertFunc = library->newFunction(String::string("vertex_primitive", UTF8StringEncoding));
-    MTL::Function* fragFunc = library->newFunction(String::string("fragment_primitive", UTF8StringEncoding));
-    
-    MTL::RenderPipelineDescriptor* pipelineDesc = MTL::RenderPipelineDescriptor::alloc()->init();
-    pipelineDesc->setVertexFunction(vertFunc);
-    pipelineDesc->setFragmentFunction(fragFunc);
-
-    MTL::RenderPipelineColorAttachmentDescriptor* colorAttachment = pipelineDesc->colorAttachments()->object(0);
-    colorAttachment->setPixelFormat(pixelFormat);
-    colorAttachment->setBlendingEnabled(true);
-    colorAttachment->setRgbBlendOperation(MTL::BlendOperationAdd);
-    colorAttachment->setAlphaBlendOperation(MTL::BlendOperationAdd);
-    colorAttachment->setSourceRGBBlendFactor(MTL::BlendFactorSourceAlpha);
-    colorAttachment->setDestinationRGBBlendFactor(MTL::BlendFactorOneMinusSourceAlpha);
-    colorAttachment->setSourceAlphaBlendFactor(MTL::BlendFactorSourceAlpha);
-    colorAttachment->setDestinationAlphaBlendFactor(MTL::BlendFactorOneMinusSourceAlpha);
-    
-    NS::Error* err = nullptr;
-    primitivePipelineState = device->newRenderPipelineState(pipelineDesc, &err);
-    if (!primitivePipelineState) {
-        __builtin_printf("%s", err->localizedDescription()->utf8String());
-        assert(false);
+    PROFILE_ZONE("Build Primitive Pipeline");
+    PipelineKey key = makeBlendedPipelineKey("vertex_primitive", "fragment_primitive", pixelFormat, premultipliedAlpha);
+    key.addFunctionConstant(FunctionConstantIndexClipRects, MTL::DataTypeBool, 1);
+    primitivePipelineState = pipelineCache->pipelineState(key);
+    
+    // One variant per shape, fragment_primitive with the shape branch resolved at compile time. They come out of the
+    // binary archive after the first launch, so building them all up front is cheap.
+    for (int shapeType = 0; shapeType < primitiveShapeTypeCount; ++shapeType) {
+        PipelineKey shapeKey = key;
+        shapeKey.addFunctionConstant(FunctionConstantIndexPrimitiveShapeType, MTL::DataTypeInt, shapeType);
+        primitiveShapePipelineStates[shapeType] = pipelineCache->pipelineState(shapeKey);
+        
+        if (!hasFittedGeometry(shapeType)) continue;
+        shapeKey.vertexFunction = "vertex_primitive_fitted";
+        primitiveFittedPipelineStates[shapeType] = pipelineCache->pipelineState(shapeKey);
     }
     
-    pipelineDesc->release();
-    library->release();
-    fragFunc->release();
-    vertFunc->release();
+    // Only rects can be opaque, every other shape has an antialiased edge.
+    PipelineKey opaqueKey = key;
+    opaqueKey.addFunctionConstant(FunctionConstantIndexPrimitiveShapeType, MTL::DataTypeInt, ShapeTypeRect);
+    opaqueKey.blendingEnabled = false;
+    primitiveOpaquePipelineState = pipelineCache->pipelineState(opaqueKey);
 }
 
 void Renderer::buildTextPipeline(MTL::PixelFormat pixelFormat)
 {
-    using namespace NS;
-    using NS::StringEncoding::UTF8StringEncoding;
-    MTL::Library* library = device->newDefaultLibrary();
-    
-    MTL::Function* vertFunc = library->newFunction(String::string("vertex_text", UTF8StringEncoding));
-    MTL::Function* fragFunc = library->newFunction(String::string("fragment_text", UTF8StringEncoding));
-    
-    MTL::RenderPipelineDescriptor* pipelineDesc = MTL::RenderPipelineDescriptor::alloc()->init();
-    pipelineDesc->setVertexFunction(vertFunc);
-    pipelineDesc->setFragmentFunction(fragFunc);
-    
-    MTL::RenderPipelineColorAttachmentDescriptor* colorAttachment = pipelineDesc->colorAttachments()->object(0);
-    colorAttachment->setPixelFormat(pixelFormat);
-    colorAttachment->setBlendingEnabled(true);
-    colorAttachment->setRgbBlendOperation(MTL::BlendOperationAdd);
-    colorAttachment->setAlphaBlendOperation(MTL::BlendOperationAdd);
-    colorAttachment->setSourceRGBBlendFactor(MTL::BlendFactorSourceAlpha);
-    colorAttachment->setDestinationRGBBlendFactor(MTL::BlendFactorOneMinusSourceAlpha);
-    colorAttachment->setSourceAlphaBlendFactor(MTL::BlendFactorSourceAlpha);
-    colorAttachment->setDestinationAlphaBlendFactor(MTL::BlendFactorOneMinusSourceAlpha);
-    
-    
-    MTL::VertexDescriptor* vertexDesc = MTL::VertexDescriptor::alloc()->init();
-    // Position attribute
-    MTL::VertexAttributeDescriptor* pPositionAttribute = vertexDesc->attributes()->object(static_cast<NS::UInteger>(TextVertAttrPosition));
-    pPositionAttribute->setFormat(MTL::VertexFormatFloat2);
-    pPositionAttribute->setOffset(0);
-    pPositionAttribute->setBufferIndex(static_cast<NS::UInteger>(TextBufferIndexVertices));
-    
-    // UV attribute
-    MTL::VertexAttributeDescriptor* pUVAttribute = vertexDesc->attributes()->object(static_cast<NS::UInteger>(TextVertAttrUV));
-    pUVAttribute->setFormat(MTL::VertexFormatFloat2);
-    pUVAttribute->setOffset(offsetof(TextVertex, uv));
-    pUVAttribute->setBufferIndex(static_cast<NS::UInteger>(TextBufferIndexVertices));
-    
-    // Color Attribute
-    MTL::VertexAttributeDescriptor* pColorAttribute = vertexDesc->attributes()->object(static_cast<NS::UInteger>(TextVertAttrTextColor));
-    pColorAttribute->setFormat(MTL::VertexFormatFloat4);
-    pColorAttribute->setOffset(offsetof(TextVertex, textColor));
-    pColorAttribute->setBufferIndex(static_cast<NS::UInteger>(TextBufferIndexVertices));
-    
-    // Layouts
-    MTL::VertexBufferLayoutDescriptor* pLayout = vertexDesc->layouts()->object(0);
-    pLayout->setStride(sizeof(TextVertex));
-    pLayout->setStepFunction(MTL::VertexStepFunctionPerVertex);
-    pipelineDesc->setVertexDescriptor(vertexDesc);
-    
-    NS::Error* err = nullptr;
-    textPipelineState = device->newRenderPipelineState(pipelineDesc, &err);
-    if (!textPipelineState) {
-        __builtin_printf("%s", err->localizedDescription()->utf8String());
-        assert(false);
-    }
+    PROFILE_ZONE("Build Text Pipeline");
+    PipelineKey key = makeBlendedPipelineKey("vertex_text", "fragment_text", pixelFormat, premultipliedAlpha);
+    key.addVertexAttribute(MTL::VertexFormatFloat2, 0, TextBufferIndexVertices);                              // TextVertAttrPosition
+    key.addVertexAttribute(MTL::VertexFormatFloat2, offsetof(TextVertex, uv), TextBufferIndexVertices);       // TextVertAttrUV
+    key.addVertexAttribute(MTL::VertexFormatFloat4, offsetof(TextVertex, textColor), TextBufferIndexVertices); // TextVertAttrTextColor
+    key.vertexStride = sizeof(TextVertex);
+    textPipelineState = pipelineCache->pipelineState(key);
     
     MTL::SamplerDescriptor* sampleDesc = MTL::SamplerDescriptor::alloc()->init();
     sampleDesc->setMinFilter(MTL::SamplerMinMagFilterLinear);
@@ -401,11 +473,6 @@ void Renderer::buildTextPipeline(MTL::PixelFormat pixelFormat)
     
     
     sampleDesc->release();
-    vertexDesc->release();
-    pipelineDesc->release();
-    library->release();
-    fragFunc->release();
-    vertFunc->release();
 }
 
 static std::string formatResourceURL(std::string filename, std::string extension)
@@ -444,25 +511,194 @@ static std::string formatResourceURL(std::string filename, std::string extension
     return result;
 }
 
-static MTL::Texture* loadTexture(int width, int height, std::string imageUrl, MTL::Device* device, bool hasAlpha)
+static bool hasResource(std::string filename, std::string extension)
 {
+    CFStringRef cf_filename = CFStringCreateWithCString(kCFAllocatorDefault, filename.c_str(), kCFStringEncodingUTF8);
+    CFStringRef cf_ext = CFStringCreateWithCString(kCFAllocatorDefault, extension.c_str(), kCFStringEncodingUTF8);
+    CFURLRef cf_rscUrl = CFBundleCopyResourceURL(CFBundleGetMainBundle(), cf_filename, cf_ext, nullptr);
+    
+    const bool result = cf_rscUrl != nullptr;
+    
+    if (cf_rscUrl) CFRelease(cf_rscUrl);
+    CFRelease(cf_ext);
+    CFRelease(cf_filename);
+    
+    return result;
+}
+
+static std::string cacheDirectoryPath()
+{
+    using namespace std;
+    
+    char buffer[PATH_MAX];
+    size_t length = confstr(_CS_DARWIN_USER_CACHE_DIR, buffer, sizeof(buffer));
+    if (length == 0 || length > sizeof(buffer)) return string();
+    
+    string result = string(buffer);
+    CFStringRef bundleId = CFBundleGetIdentifier(CFBundleGetMainBundle()); // NOTE: Get rule, not owned.
+    if (bundleId) {
+        char idBuffer[256];
+        if (CFStringGetCString(bundleId, idBuffer, sizeof(idBuffer), kCFStringEncodingUTF8)) {
+            result += string(idBuffer) + "/";
+            mkdir(result.c_str(), 0755);
+        }
+    }
+    return result;
+}
+
+static std::string pipelineArchivePath()
+{
+    using namespace std;
+    
+    const string cacheDir = cacheDirectoryPath();
+    if (cacheDir.empty()) return string();
+    
+    // Key the archive by the shader library, so a rebuilt metallib starts from a fresh archive.
+    uint64_t libraryKey = 0;
+    if (hasResource("default", "metallib")) {
+        ifstream file(formatResourceURL("default", "metallib"), ios::binary);
+        vector<uint8_t> libraryBytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+        libraryKey = hashBytes(libraryBytes.data(), libraryBytes.size());
+    }
+    char fileName[64];
+    snprintf(fileName, sizeof(fileName), "pipelines_%016llx.binarchive", (unsigned long long)libraryKey);
+    return cacheDir + fileName;
+}
+
+// outMipChain, when given, gets a copy of the texels uploaded.
+static MTL::Texture* loadTexture(int width, int height, std::string imageUrl, MTL::Device* device, bool hasAlpha, bool premultiply, const std::vector<TextureRegion>& mipRegions, MipChain* outMipChain = nullptr)
+{
+    using namespace std;
+    
+    // Read the raw file so the cache can be keyed by the asset contents (asset version), not by path or timestamp.
+    vector<uint8_t> fileBytes;
+    {
+        ifstream file(imageUrl, ios::binary);
+        assert(file.is_open());
+        fileBytes.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+    uint64_t assetKey = hashBytes(fileBytes.data(), fileBytes.size());
+    assetKey = hashBytes(mipRegions.data(), mipRegions.size() * sizeof(TextureRegion), assetKey);
+    assetKey = hashBytes(&premultiply, sizeof(premultiply), assetKey);
+    
+    const string cacheDir = cacheDirectoryPath();
+    const string cachePath = cacheDir.empty() ? string() : cacheDir + imageUrl.substr(imageUrl.find_last_of('/') + 1) + ".mips";
+    
+    MipChain mipChain;
+    if (cachePath.empty() || !loadMipChainCache(cachePath, assetKey, mipChain)) {
+        int numChannels = 4;
+        if (!hasAlpha) numChannels = 3;
+        int imageWidth = 0;
+        int imageHeight = 0;
+        unsigned char* imageData = stbi_load_from_memory(fileBytes.data(), (int)fileBytes.size(), &imageWidth, &imageHeight, &numChannels, 4); // NOTE: Force to always return 4 channels
+        assert(imageData);
+        // NOTE: Premultiply before filtering, so the mips average premultiplied colors and transparent texels don't darken edges.
+        if (premultiply) premultiplyAlpha(imageData, (size_t)imageWidth * imageHeight);
+        generateMipChain(imageData, imageWidth, imageHeight, mipRegions, mipChain);
+        stbi_image_free(imageData);
+        
+        if (!cachePath.empty() && !saveMipChainCache(cachePath, assetKey, mipChain)) {
+            __builtin_printf("Failed to write mip cache: %s\n", cachePath.c_str());
+        }
+    }
+    assert(mipChain.width == width && mipChain.height == height);
+    
     MTL::Texture* resultTexture;
     MTL::TextureDescriptor* textureDesc = MTL::TextureDescriptor::alloc()->init();
     
-    textureDesc->setWidth(width);
-    textureDesc->setHeight(height);
+    textureDesc->setWidth(mipChain.width);
+    textureDesc->setHeight(mipChain.height);
+    textureDesc->setMipmapLevelCount(mipChain.levels.size());
     textureDesc->setPixelFormat( MTL::PixelFormatRGBA8Unorm );
     textureDesc->setTextureType( MTL::TextureType2D );
     textureDesc->setStorageMode( MTL::StorageModeShared );
     textureDesc->setUsage( MTL::ResourceUsageSample | MTL::ResourceUsageRead );
     
     resultTexture = device->newTexture(textureDesc);
-    int numChannels = 4;
-    if (!hasAlpha) numChannels = 3;
-    unsigned char* imageData = stbi_load(imageUrl.c_str(), &width, &height, &numChannels, 4); // NOTE: Force to always return 4 channels
-    if (imageData) {
-        resultTexture->replaceRegion( MTL::Region( 0, 0, 0, width, height, 1 ), 0, (uint8_t*)imageData, width * 4 );
-        stbi_image_free(imageData);
+    for (NS::UInteger iLevel = 0; iLevel < mipChain.levels.size(); ++iLevel) {
+        const MipLevel& level = mipChain.levels[iLevel];
+        resultTexture->replaceRegion( MTL::Region( 0, 0, 0, level.width, level.height, 1 ), iLevel, mipChain.pixels.data() + level.offset, level.width * 4 );
+    }
+    textureDesc->release();
+    if (outMipChain) *outMipChain = mipChain;
+    return resultTexture;
+}
+
+static MTL::PixelFormat pixelFormatForKTX2Format(KTX2Format format)
+{
+    switch (format) {
+        case ktx2format_rgba8_unorm: return MTL::PixelFormatRGBA8Unorm;
+        case ktx2format_rgba8_srgb: return MTL::PixelFormatRGBA8Unorm_sRGB;
+        case ktx2format_bc1_rgba_unorm: return MTL::PixelFormatBC1_RGBA;
+        case ktx2format_bc1_rgba_srgb: return MTL::PixelFormatBC1_RGBA_sRGB;
+        case ktx2format_bc3_unorm: return MTL::PixelFormatBC3_RGBA;
+        case ktx2format_bc3_srgb: return MTL::PixelFormatBC3_RGBA_sRGB;
+        case ktx2format_bc7_unorm: return MTL::PixelFormatBC7_RGBAUnorm;
+        case ktx2format_bc7_srgb: return MTL::PixelFormatBC7_RGBAUnorm_sRGB;
+        case ktx2format_astc_4x4_unorm: return MTL::PixelFormatASTC_4x4_LDR;
+        case ktx2format_astc_4x4_srgb: return MTL::PixelFormatASTC_4x4_sRGB;
+        case ktx2format_astc_6x6_unorm: return MTL::PixelFormatASTC_6x6_LDR;
+        case ktx2format_astc_6x6_srgb: return MTL::PixelFormatASTC_6x6_sRGB;
+        case ktx2format_astc_8x8_unorm: return MTL::PixelFormatASTC_8x8_LDR;
+        case ktx2format_astc_8x8_srgb: return MTL::PixelFormatASTC_8x8_sRGB;
+        case ktx2format_undefined: break;
+    }
+    return MTL::PixelFormatInvalid;
+}
+
+// Uploads the prebuilt, block compressed mips of a KTX2 file as-is. Returns nullptr if the file is invalid, isn't width x
+// height (what the UV tables were built for) or the GPU can't sample its format, callers then fall back to the PNG path.
+static MTL::Texture* loadCompressedTexture(std::string ktx2Url, int width, int height, MTL::Device* device, bool premultiplied)
+{
+    using namespace std;
+    
+    vector<uint8_t> fileBytes;
+    {
+        ifstream file(ktx2Url, ios::binary);
+        if (!file.is_open()) return nullptr;
+        fileBytes.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    }
+    
+    KTX2Image image;
+    string error;
+    if (!parseKTX2(fileBytes.data(), fileBytes.size(), image, &error)) {
+        __builtin_printf("Invalid KTX2 %s: %s\n", ktx2Url.c_str(), error.c_str());
+        return nullptr;
+    }
+    if (image.width != width || image.height != height) {
+        __builtin_printf("KTX2 is %dx%d, expected %dx%d: %s\n", image.width, image.height, width, height, ktx2Url.c_str());
+        return nullptr;
+    }
+    
+    // Block compressed data can't be converted at load time, it has to be authored with the alpha the pipelines blend
+    // with. Premultiplied texels under a straight alpha blend get alpha applied twice and dark edges.
+    if (premultiplied != image.isPremultiplied) {
+        __builtin_printf("KTX2 is %s, the renderer blends %s: %s\n", image.isPremultiplied ? "premultiplied" : "straight alpha",
+                         premultiplied ? "premultiplied" : "straight alpha", ktx2Url.c_str());
+        return nullptr;
+    }
+    
+    KTX2FormatInfo info;
+    ktx2FormatInfo(image.format, info);
+    if ((info.isASTC && !device->supportsFamily(MTL::GPUFamilyApple2)) ||
+        (info.isBC && !device->supportsBCTextureCompression())) {
+        __builtin_printf("KTX2 format %u not supported on this GPU: %s\n", (uint32_t)image.format, ktx2Url.c_str());
+        return nullptr;
+    }
+    
+    MTL::TextureDescriptor* textureDesc = MTL::TextureDescriptor::alloc()->init();
+    textureDesc->setWidth(image.width);
+    textureDesc->setHeight(image.height);
+    textureDesc->setMipmapLevelCount(image.levels.size());
+    textureDesc->setPixelFormat( pixelFormatForKTX2Format(image.format) );
+    textureDesc->setTextureType( MTL::TextureType2D );
+    textureDesc->setStorageMode( MTL::StorageModeShared );
+    textureDesc->setUsage( MTL::ResourceUsageSample | MTL::ResourceUsageRead );
+    
+    MTL::Texture* resultTexture = device->newTexture(textureDesc);
+    for (NS::UInteger iLevel = 0; iLevel < image.levels.size(); ++iLevel) {
+        const KTX2Level& level = image.levels[iLevel];
+        resultTexture->replaceRegion( MTL::Region( 0, 0, 0, level.width, level.height, 1 ), iLevel, fileBytes.data() + level.offset, level.bytesPerRow );
     }
     textureDesc->release();
     return resultTexture;
@@ -470,6 +706,7 @@ static MTL::Texture* loadTexture(int width, int height, std::string imageUrl, MT
 
 void Renderer::loadAtlasTextureAndUV()
 {
+    PROFILE_ZONE("Load Atlas");
     using namespace std;
     
     int mainAtlasTWidth = 256;
@@ -478,37 +715,30 @@ void Renderer::loadAtlasTextureAndUV()
     string imageFileUrl = formatResourceURL("main_atlas", "png");
     string uvFileUrl = formatResourceURL("main_atlas", "txt");
     
-    // Load the Texture data
-    mainAtlasTexture = loadTexture(mainAtlasTWidth, mainAtlasTHeight, imageFileUrl, device, true);
+    vector<TextureRegion> spriteRegions;
+    loadAtlasUVs(uvFileUrl, mainAtlasTWidth, mainAtlasTHeight, spriteRegions);
+    for (const auto& [name, rect] : mainAtlasUVRects) {
+        __builtin_printf("name: %s, (%0.f, %0.f), w:%0.f, h%0.f\n", name.c_str(),
+                         rect.minUV.x * mainAtlasTWidth, rect.minUV.y * mainAtlasTHeight,
+                         (rect.maxUV.x - rect.minUV.x) * mainAtlasTWidth, (rect.maxUV.y - rect.minUV.y) * mainAtlasTHeight);
+    }
     
-    { // Load the UV data
-        ifstream file(uvFileUrl);
-        assert(file.is_open());
-        string line;
-        
-        // Skip the first line (count line)
-        getline(file, line);
-        while (std::getline(file, line)) {
-            if (line.empty()) continue;
-            
-            std::istringstream iss(line);
-            std::string name;
-            float x, y, w, h;
-            
-            if (iss >> name >> x >> y >> w >> h) {
-                simd::float2 minUV = {x / mainAtlasTWidth, y / mainAtlasTHeight};
-                simd::float2 maxUV = {(x + w) / mainAtlasTWidth, (y + h) / mainAtlasTHeight};
-                
-                mainAtlasUVRects[name] = {minUV, maxUV};
-                __builtin_printf("name: %s, (%0.f, %0.f), w:%0.f, h%0.f\n", name.c_str(), x, y, w, h);
-            }
-        }
-        file.close();
+    // Load the Texture data, prefer the block compressed KTX2 build of the atlas when there is one.
+    // NOTE: Sprites are only found opaque from the PNG's texels, a KTX2 atlas has none on the CPU and draws every sprite blended.
+    if (hasResource("main_atlas", "ktx2")) {
+        mainAtlasTexture = loadCompressedTexture(formatResourceURL("main_atlas", "ktx2"), mainAtlasTWidth, mainAtlasTHeight, device, premultipliedAlpha);
+    }
+    if (!mainAtlasTexture) {
+        MipChain atlasTexels;
+        mainAtlasTexture = loadTexture(mainAtlasTWidth, mainAtlasTHeight, imageFileUrl, device, true, premultipliedAlpha, spriteRegions, &atlasTexels);
+        markOpaqueSprites(atlasTexels);
     }
+    assert(mainAtlasTexture->width() == (NS::UInteger)mainAtlasTWidth && mainAtlasTexture->height() == (NS::UInteger)mainAtlasTHeight);
 }
 
 void Renderer::loadTextInfoAndTexture()
 {
+    PROFILE_ZONE("Load Font");
     using namespace std;
     
     int fontTextureWidth = 792;
@@ -518,691 +748,563 @@ void Renderer::loadTextInfoAndTexture()
     string fontImageUrl = formatResourceURL(fontName, "png");
     string fontJsonUrl = formatResourceURL(fontName, "json");
 
-    // Load the Texture data
-    fontTexture = loadTexture(fontTextureWidth, fontTextureHeight, fontImageUrl, device, false);
- 
-    { // Load JSON file
-        ifstream file(fontJsonUrl);
-        assert(file.is_open());
-        
-        json j;
-        file >> j;
-        fontAtlas = j.get<FontAtlas>();
-        
-        file.close();
-        
-        for (const auto& glyph : fontAtlas.glyphs) {
-            fontGlyphs[(uint32_t)glyph.unicode] = glyph;
-        }
-        
-        for (const auto& kern : fontAtlas.kerning) {
-            uint64_t key = ((uint64_t)kern.unicode1 << 32) | (uint64_t)kern.unicode2;
-            fontKerning[key] = kern;
-        }
+    vector<TextureRegion> glyphRegions;
+    loadFontInfo(fontJsonUrl, glyphRegions);
+    assert(fontAtlas.atlas.width == fontTextureWidth && fontAtlas.atlas.height == fontTextureHeight);
+    
+    // Load the Texture data, prefer the block compressed KTX2 build of the font when there is one.
+    fontTexture = nullptr;
+    if (hasResource(fontName, "ktx2")) {
+        fontTexture = loadCompressedTexture(formatResourceURL(fontName, "ktx2"), fontTextureWidth, fontTextureHeight, device, false); // NOTE: MSDF channels are distances, never premultiplied.
     }
-}
-
-void Renderer::testDrawPrimitives() {
-    const int circleCount = 100000;
-    RNG rng = {U32(time * 1000000)};
-    simd_float4 color = {};
-    
-    for (int iCircle = 0; iCircle < circleCount; ++iCircle) {
-        const float x = RandomRangeF32(&rng, -screenSize.width, screenSize.width);
-        const float y = RandomRangeF32(&rng, -screenSize.height, screenSize.height);
-        const float radius = RandomRangeF32(&rng, 5, 25);
-        
-        color.x = RandomF01(&rng);
-        color.y = RandomF01(&rng);
-        color.z = RandomF01(&rng);
-        color.w = 1.0;
-        
-        drawPrimitiveCircle(x, y, radius, color);
+    if (!fontTexture) {
+        fontTexture = loadTexture(fontTextureWidth, fontTextureHeight, fontImageUrl, device, false, false, glyphRegions);
     }
-    
-//    drawPrimitiveCircle(0, 0, 50, 0, 255, 255, 255);
-//    drawPrimitiveCircle(0, 0, 800.0, 255, 255, 255, 64);
-//    drawPrimitiveCircle(0, 0, 512.0, 0, 255, 255, 64);
-//    drawPrimitiveCircle(0, 0, 256.0, 255, 0, 255, 64);
-//    drawPrimitiveCircle(256, 256, 128.0, 255, 0, 0, 64);
-//    drawPrimitiveCircle(0, 0, 128.0, 0, 255, 0, 64);
-//    drawPrimitiveCircle(-256, -256, 128.0, 0, 0, 255, 64);
-//    drawPrimitiveLine(-800, -600, 800, 600, 10, 200, 100, 0, 128);
-//    drawPrimitiveRectLines(0, 0, 800, 600, 48, 0, 255, 255, 255);
-//    drawPrimitiveRect(0, 0, 800, 600, 255, 0, 0, 64);
-//    drawPrimitiveRect(-800, -600, 800, 600, 255, 0, 0, 64);
-//    drawPrimitiveRect(0, 0, 24, 600, 255, 0, 0, 64);
-//    drawPrimitiveRect(0, 0, 128, 196, 0, 255, 0, 128);
-//    drawPrimitiveRect(-800, -600, 800, 600, 128, 255, 0, 128);
-//    drawPrimitiveRect(-800, -600, 1600, 1200, 0, 255, 255, 32);
-//    drawPrimitiveRoundedRect(0, 0, 800, 600, 100, 0, 0, 255, 255);
-//    drawPrimitiveRoundedRect(0, 0, 800, 100, 100, 0, 255, 255, 255);
-//    drawPrimitiveCircle(100, 100, 100, 255, 0, 0, 128);
-//    drawPrimitiveRect(-600, -600, 1200, 1200, 255, 0, 255, 255);
-//    drawPrimitiveCircle(0, 0, 600, 255, 255, 255, 255);
-//    drawPrimitiveCircleLines(0, 0, 600, 48, 255, 0, 255, 128);
-//    drawPrimitiveRect(-600, -600, 48, 1200, 0, 255, 0, 128);
-
+    assert(fontTexture->width() == (NS::UInteger)fontTextureWidth && fontTexture->height() == (NS::UInteger)fontTextureHeight);
 }
 
-void Renderer::testDrawAtlasSprites()
+void Renderer::draw( MTK::View* pView )
 {
-    const int testMaxCount = 100;
-    const int testCount = MIN
-    ((int)((sin(time * 2.0f) + 1.0f) / 2.0f * testMaxCount),
-     atlasMaxInstanceCount - 1);
-    
-    simd_float4 color;
-    for (int i = 0; i < testCount; ++i) {
-        const float angle = time + ((float)i) * (2.0f * M_PI / ((float)testCount));
-        const float radius = ((float)screenSize.width) / 3.0f;
-        color.x = 0.5f + 0.5f * sin(angle);
-        color.y = 0.5f + 0.5f * cos(angle);
-        color.z = 0.5f + 0.5f * sin(angle * 0.5f);
-        color.w = 1.0f;
-        
-        drawSprite("Circle_White", cos(angle) * radius, sin(angle) * radius, 100.0f + 100.0f * sin(angle), 100.0f + 100.0f * sin(angle), color, angle * 2);
+    if (profileCaptureFrame > 0 && frameIndex == profileCaptureFrame) {
+        const std::string tracePath = cacheDirectoryPath() + "frame_trace.json";
+        if (Profiler::exportChromeTrace(tracePath)) __builtin_printf("Wrote profiler trace to %s\n", tracePath.c_str());
     }
     
-    { // Test anything static here, adds to last insance count
-        const char* spriteName = "player_1";
-        drawSprite(spriteName, 100, 100, 256, 256, colorFromBytes(255, 255, 255, 255), 0.0f);
+    // The previous frame's interval is only known now.
+    const uint64_t frameStartNs = Profiler::nowNs();
+    if (lastFrameStartNs != 0) {
+        currentFrameSample.frameNs = frameStartNs - lastFrameStartNs;
+        frameStats.setFrameBudget((uint64_t)(1e9 / pView->preferredFramesPerSecond()));
+        recordFrameStats(currentFrameSample);
+        if (dynamicResolution) {
+            const FrameSample& sample = currentFrameSample;
+            resolutionScaler.setFrameBudget(frameStats.frameBudget());
+            resolutionScaler.addFrame(lastGpuFrameNs.load(std::memory_order_relaxed),
+                                      sample.phaseNs[framephase_update] + sample.phaseNs[framephase_encode] + sample.phaseNs[framephase_commit]);
+        }
     }
-}
-
-void Renderer::testDrawTextWithBounds()
-{
-    const float fontSize = 96.0f;
-    
-    // Generate timestamp as string
-    std::time_t now = std::time(nullptr);
-    char timeBuffer[32];
-    std::snprintf(timeBuffer, sizeof(timeBuffer), "%ld", now);
-    
-    // Build text with multiple lines: "Hello, SDF\nWorld!\n\n<timestamp>"
-    char text[256];
-    std::snprintf(text, sizeof(text), "Hello, SDF\nWorld!\n\n%s", timeBuffer);
-    
-    // Measure text bounds
-    auto bounds = measureTextBounds(text, fontSize); // returns std::pair<float, float>
-    float textWidth  = bounds.first;
-    float textHeight = bounds.second;
-    
-    // Draw a circle at the top-left of the text bounds
-    simd::float4 white = {1.0f, 1.0f, 1.0f, 1.0f};
-    drawPrimitiveCircle(-textWidth / 2.0f,
-                        textHeight / 2.0f,
-                        16.0f,
-                        white);
-        
-    // Draw a rectangle behind the text to visualize bounds
-    drawPrimitiveRect(-textWidth / 2.0f,
-                      -textHeight / 2.0f,
-                      textWidth,
-                      textHeight,
-                      simd::float4{0.0f, 1.0f, 1.0f, 0.25f} // semi-transparent cyan
-                      );
-    
-    // Draw the main multi-line text
-    simd::float4 yellow = {0.9f, 0.9f, 0.1f, 1.0f};
-    drawText(
-             text,
-             -textWidth / 2.0f,
-             textHeight / 2.0f,
-             fontSize,
-             yellow
-             );
-    
-    // Draw another text at fixed offset
-    simd::float4 purple = {0.3f, 0.2f, 0.7f, 1.0f};
-    drawText("HELLO       AGAIN!!!",
-             20.0f - screenSize.width / 2.0f,
-             -20.0f + screenSize.height / 2.0f,
-             48.0f,
-             purple
-             );
-}
-
-void Renderer::testDrawInterleavedTypes()
-{
-    // Waves and circle positions
-    float wave1   = std::sin(time * 1.5f) * 300.0f;
-    float wave2   = std::cos(time * 0.8f) * 200.0f;
-    float wave3   = std::sin(time * 3.2f) * 100.0f;
-    float circleX = std::sin(time * 2.0f) * 256.0f;
-    float circleY = std::cos(time * 1.0f) * 128.0f;
-
-    // Draw first sprite
-    drawSprite(
-        "player_2",
-        wave1,
-        wave2,
-        256.0f + wave3,
-        256.0f + wave3,
-        simd::float4{1.0f, 1.0f, 1.0f, 1.0f},
-        0.0f
-    );
-
-    // Draw moving circle
-    drawPrimitiveCircle(
-        circleX,
-        circleY,
-        128.0f + std::sin(time * 4.0f) * 64.0f,
-        simd::float4{1.0f, 0.3f, 0.5f, 1.0f}
-    );
-
-    // Draw mirrored sprite
-    drawSprite(
-        "player_2",
-        -circleX,
-        -circleY,
-        128.0f,
-        128.0f,
-        simd::float4{1.0f, 1.0f, 1.0f, 1.0f},
-        0.0f
-    );
-
-    // Dynamic text Y offset
-    float textYOffset = std::sin(time * 1.2f) * 40.0f;
-
-    // Draw first dynamic text
-    drawText(
-        "Dynamic Text\nis Alive!",
-        -200.0f,
-        300.0f + textYOffset,
-        64.0f + std::sin(time * 2.5f) * 8.0f,
-        simd::float4{1.0f, 0.8f, 0.2f, 1.0f}
-    );
-
-    // Draw static text
-    drawText(
-        "Another Test",
-        -150.0f,
-        -50.0f,
-        48.0f,
-        simd::float4{1.0f, 0.0f, 1.0f, 1.0f}
-    );
-
-    // Scroll offset for moving text block
-    float scrollOffset = std::sin(time * 0.5f) * 150.0f;
-
-    // Draw first scrolling text block
-    drawText(
-        "This is a much\nLonger test of a block\nOf text here and there\nAnother line here\nAnother line there\n  Here's one with 2 spaces before",
-        -600.0f + scrollOffset,
-        600.0f,
-        96.0f,
-        simd::float4{0.1f, 1.0f, 0.5f, 1.0f}
-    );
-
-    // Another moving circle
-    drawPrimitiveCircle(
-        std::sin(time * 0.7f) * 600.0f,
-        std::cos(time * 0.9f) * 500.0f,
-        64.0f,
-        simd::float4{0.0f, 0.5f, 0.5f, 1.0f}
-    );
-
-    // Draw mirrored scrolling text block
-    drawText(
-        "This is a much\nLonger test of a block\nOf text here and there\nAnother line here\nAnother line there\n  Here's one with 2 spaces before",
-        -900.0f - scrollOffset,
-        100.0f,
-        96.0f,
-        simd::float4{0.1f, 1.0f, 0.5f, 1.0f}
-    );
-}
-
-void Renderer::draw( MTK::View* pView )
-{
+    lastFrameStartNs = frameStartNs;
+    currentFrameSample = FrameSample();
+    currentFrameSample.frameIndex = frameIndex;
+    ++frameIndex;
+    
+    PROFILE_ZONE("Frame");
     NS::AutoreleasePool* pPool = NS::AutoreleasePool::alloc()->init();
     
-    dispatch_semaphore_wait(inFlightSemaphore, DISPATCH_TIME_FOREVER);
+    {
+        PROFILE_ZONE("Semaphore Wait");
+        FramePhaseTimer phaseTimer(currentFrameSample, framephase_semaphoreWait);
+        dispatch_semaphore_wait(inFlightSemaphore, DISPATCH_TIME_FOREVER);
+    }
     MTL::CommandBuffer* cmdBuffer = commandQueue->commandBuffer();
     if (cmdBuffer) {
         cmdBuffer->addCompletedHandler(^void(MTL::CommandBuffer* completedBuffer) {
+            lastGpuFrameNs.store((uint64_t)((completedBuffer->GPUEndTime() - completedBuffer->GPUStartTime()) * 1e9), std::memory_order_relaxed);
             dispatch_semaphore_signal(inFlightSemaphore);
         });
         
         updateTriBufferStates();
-        drawBatchCount = 0;
-        for (int iBatchType = 0; iBatchType < drawbatchtype_count; ++iBatchType) { nextStartIndexForTypePtr[iBatchType] = 0; }
-        curDrawBatchType = drawbatchtype_none;
-        atlasInstanceCount = 0;
-        primitiveInstanceCount = 0;
-        textVertexCount = 0;
         
         time += 1.0 / pView->preferredFramesPerSecond();
-        testDrawPrimitives();
-        testDrawAtlasSprites();
-        testDrawTextWithBounds();
-        testDrawInterleavedTypes();
-
-        MTL::RenderPassDescriptor* renderPassDesc = pView->currentRenderPassDescriptor();
-        MTL::RenderCommandEncoder* encoder = cmdBuffer->renderCommandEncoder(renderPassDesc);
-        if (renderPassDesc && encoder) {
-            encoder->setLabel(NS::String::string("Primary Render Encoder", NS::StringEncoding::UTF8StringEncoding));
+        {
+            PROFILE_ZONE("Game Update");
+            FramePhaseTimer phaseTimer(currentFrameSample, framephase_update);
+            testDrawPrimitives();
+            testDrawAtlasSprites();
+            testDrawTextWithBounds();
+            testDrawInterleavedTypes();
             
-            for (int iBatch = 0; iBatch < drawBatchCount; ++iBatch) {
-                const DrawBatch batch = drawBatchesArr[iBatch];
-                assert(batch.count > 0);
-                assert(batch.startIndex >= 0);
-                switch (batch.type) {
-                    case drawbatchtype_count: {
-                        __builtin_printf("Draw Batch with type count, should never be implemented");
-                        assert(false);
-                    } break;
-                    case drawbatchtype_none: {
-                        __builtin_printf("Draw Batch with type none");
-                        assert(false);
-                    } break;
-                    case drawbatchtype_atlas: {
-                        encoder->setRenderPipelineState(atlasPipelineState);
-                        encoder->setVertexBuffer(atlasVertexBuffer, 0, BufferIndexVertices);
-                        
-                        encoder->setVertexBuffer(atlasTriInstanceBuffer, atlasTriInstanceBufferOffset + (sizeof(AtlasInstanceData) * batch.startIndex), BufferIndexInstances);
-                        
-                        encoder->setFragmentTexture(mainAtlasTexture, 0);
-                        encoder->setFragmentSamplerState(atlasSamplerState, 0);
-                        encoder->drawPrimitives(MTL::PrimitiveTypeTriangleStrip, 0, sizeof(atlasSquareVertices) / sizeof(atlasSquareVertices[0]), batch.count);
-                    } break;
-                    case drawbatchtype_primitive: {
-                        encoder->setRenderPipelineState(primitivePipelineState);
-                        encoder->setVertexBuffer(primitiveVertexBuffer, 0, BufferIndexVertices);
-                        
-                        encoder->setVertexBuffer(primitiveTriInstanceBuffer, primitiveTriInstanceBufferOffset + (sizeof(PrimitiveInstanceData) * batch.startIndex), BufferIndexInstances);
-                        
-                        encoder->setVertexBytes(&primitiveUniforms, sizeof(primitiveUniforms), BufferIndexUniforms);
-                        encoder->drawPrimitives(MTL::PrimitiveTypeTriangleStrip, 0, sizeof(primitiveSquareVertices) / sizeof(primitiveSquareVertices[0]), batch.count);
-                    } break;
-                    case drawbatchtype_text: {
-                        encoder->setRenderPipelineState(textPipelineState);
-                        encoder->setVertexBuffer(textTriVertexBuffer, textTriInstanceBufferOffset + (sizeof(TextVertex) * batch.startIndex), TextBufferIndexVertices);
-                        
-                        simd_float4x4 bindableProjMatrix = projectionMatrix;
-                        encoder->setVertexBytes(&bindableProjMatrix, sizeof(simd_float4x4), TextBufferIndexProjectionMatrix);
-                        
-                        TextFragmentUniforms uniforms = (TextFragmentUniforms){
-                            .distanceRange = static_cast<float>(fontAtlas.atlas.distanceRange)
-                        };
-                        encoder->setFragmentBytes(&uniforms, sizeof(TextFragmentUniforms), 0);
-                        encoder->setFragmentTexture(fontTexture, 0);
-                        encoder->setFragmentSamplerState(textSamplerState, 0);
-                        
-                        encoder->drawPrimitives(MTL::PrimitiveType::PrimitiveTypeTriangle, static_cast<NS::UInteger>(0), static_cast<NS::UInteger>(batch.count));
-                    } break;
+            // Snapshot before the overlay so it reports the scene, not itself.
+            currentFrameSample.batchCount = drawBatchCount;
+            currentFrameSample.atlasInstanceCount = atlasInstanceCount;
+            currentFrameSample.primitiveInstanceCount = primitiveInstanceCount;
+            currentFrameSample.textVertexCount = textVertexCount;
+            if (showStatsOverlay && !renderOnDemand) drawStatsOverlay();
+        }
+        if (frameCaptureCount > 0) captureFrame(currentFrameSample.frameIndex);
+        groupPrimitivesByShape(); // after the capture, so captures hold what was recorded
+        cullOccludedDraws();
+        currentFrameSample.occludedInstanceCount = occludedInstanceCount;
+        separateOpaqueDraws();
+        const bool isDamageTracked = (partialRedraw || renderOnDemand) && trackDamage(pView);
+        if (renderOnDemand && isDamageTracked && !isRedrawRequested && damageTracker.isFrameUnchanged(*this)) {
+            // Never committed, so its completed handler won't run. The tri buffer slot this frame wrote is free again.
+            ++skippedFrameCount;
+            dispatch_semaphore_signal(inFlightSemaphore);
+            pPool->release();
+            return;
+        }
+        isRedrawRequested = false;
+        renderCachedPanels(cmdBuffer);
+        const bool isScaled = dynamicResolution && !partialRedraw && renderScaledScene(cmdBuffer, pView);
+
+        MTL::RenderPassDescriptor* renderPassDesc = partialRedraw ? (isDamageTracked ? canvasRenderPassDescriptor() : nullptr) : pView->currentRenderPassDescriptor();
+        // NOTE: A partial redraw with nothing damaged has no pass at all, the canvas is only copied to the drawable.
+        const bool isCanvasUnchanged = partialRedraw && damageTracker.rects().empty();
+        MTL::RenderCommandEncoder* encoder = isCanvasUnchanged ? nullptr : cmdBuffer->renderCommandEncoder(renderPassDesc);
+        if (renderPassDesc && (encoder || isCanvasUnchanged)) {
+            PROFILE_ZONE("Encode Batches");
+            FramePhaseTimer phaseTimer(currentFrameSample, framephase_encode);
+            if (encoder) {
+                encoder->setLabel(NS::String::string("Primary Render Encoder", NS::StringEncoding::UTF8StringEncoding));
+                if (partialRedraw) {
+                    encodeDamage(encoder);
+                } else if (isScaled) {
+                    encodeUpscaledScene(encoder);
+                } else {
+                    encodeBatches(encoder, drawBatchesArr, drawBatchCount, viewProjectionMatrix);
                 }
+                encoder->endEncoding();
             }
+            releaseUndrawnLayers();
+            releaseUndrawnPanels();
             
-            encoder->endEncoding();
             if (pView->currentDrawable()) {
+                if (partialRedraw) {
+                    MTL::BlitCommandEncoder* blitEncoder = cmdBuffer->blitCommandEncoder();
+                    blitEncoder->copyFromTexture(canvasTexture, pView->currentDrawable()->texture());
+                    blitEncoder->endEncoding();
+                }
                 cmdBuffer->presentDrawable(pView->currentDrawable());
                 
-                // TODO: The Render Frame Count debugging stuff
+                // NOTE: For debugging
+                const CFTimeInterval now = Profiler::nowNs() * 1e-9;
+                if (lastRenderTimestamp == 0) {
+                    lastRenderTimestamp = now;
+                }
+                renderFrameCount += 1;
+                const CFTimeInterval delta = now - lastRenderTimestamp;
+                if (delta >= 1.0) {
+                    reportedFPS = renderFrameCount / delta;
+                    lastRenderTimestamp = now;
+                    renderFrameCount = 0;
+                }
+                
+                if (onFramePresented) onFramePresented(reportedFPS);
             }
         }
         
+        PROFILE_ZONE("Commit");
+        FramePhaseTimer phaseTimer(currentFrameSample, framephase_commit);
         cmdBuffer->commit();
     }
     
     pPool->release();
 }
 
-void Renderer::drawableSizeWillChange( MTK::View* pView, CGSize size )
+// MARK: - Partial Redraw
+bool Renderer::trackDamage(MTK::View* pView)
 {
-    __builtin_printf("drawableSizeWillChange called, (%0.f, %0.f)\n", size.width, size.height);
-    screenSize = size;
-    projectionMatrix = pixelSpaceProjection((float)size.width, (float)size.height);
-    primitiveUniforms = (PrimitiveUniforms){projectionMatrix};
+    const CGSize drawableSize = pView->drawableSize();
+    const int width = (int)drawableSize.width;
+    const int height = (int)drawableSize.height;
+    if (width <= 0 || height <= 0) return false;
+    
+    if (partialRedraw && (!canvasTexture || (int)canvasTexture->width() != width || (int)canvasTexture->height() != height)) {
+        if (canvasTexture) canvasTexture->release();
+        MTL::TextureDescriptor* textureDesc = MTL::TextureDescriptor::texture2DDescriptor(colorPixelFormat, width, height, false);
+        textureDesc->setStorageMode(MTL::StorageModePrivate);
+        textureDesc->setUsage(MTL::TextureUsageRenderTarget);
+        canvasTexture = device->newTexture(textureDesc);
+        canvasTexture->setLabel(NS::String::string("Partial Redraw Canvas", NS::StringEncoding::UTF8StringEncoding));
+        pView->setFramebufferOnly(false); // the canvas is blitted into the drawable
+        damageTracker.invalidate();
+    }
+    // Both modes off in between, what's on screen (or in the canvas) is older than the last tracked frame.
+    if (lastTrackedFrame != frameIndex - 1) damageTracker.invalidate();
+    lastTrackedFrame = frameIndex;
+    
+    const MTL::ClearColor clearColor = pView->clearColor();
+    canvasClearColor = simd_make_float4((float)clearColor.red, (float)clearColor.green, (float)clearColor.blue, (float)clearColor.alpha);
+    damageTracker.update(*this, width, height, canvasClearColor);
+    return true;
 }
 
-inline simd_float4 Renderer::colorFromBytes(UInt8 r, UInt8 g, UInt8 b, UInt8 a) {
-    const float scale = 1.0 / 255.0;
-    return {
-        (float)r * scale,
-        (float)g * scale,
-        (float)b * scale,
-        (float)a * scale,
-    };
+MTL::RenderPassDescriptor* Renderer::canvasRenderPassDescriptor()
+{
+    const MTL::ClearColor clearColor = MTL::ClearColor::Make(canvasClearColor.x, canvasClearColor.y, canvasClearColor.z, canvasClearColor.w);
+    MTL::RenderPassDescriptor* passDesc = MTL::RenderPassDescriptor::renderPassDescriptor();
+    MTL::RenderPassColorAttachmentDescriptor* colorAttachment = passDesc->colorAttachments()->object(0);
+    colorAttachment->setTexture(canvasTexture);
+    colorAttachment->setLoadAction(damageTracker.isFullDamage() ? MTL::LoadActionClear : MTL::LoadActionLoad);
+    colorAttachment->setClearColor(clearColor);
+    colorAttachment->setStoreAction(MTL::StoreActionStore);
+    attachDepthTexture(passDesc, (int)canvasTexture->width(), (int)canvasTexture->height());
+    return passDesc;
 }
 
-inline int Renderer::addToDrawBatchAndGetAdjustedIndex(DrawBatchType type, int increment) {
-    int nextStartIndex = nextStartIndexForTypePtr[type];
-    const int batchIndex = drawBatchCount;
-    const DrawBatchType curType = curDrawBatchType;
-    
-    // Fast path: return early
-    if (curType == type) {
-        drawBatchesArr[batchIndex - 1].count += increment;
-        nextStartIndexForTypePtr[type] = nextStartIndex + increment;
-        return nextStartIndex;
-    }
-    
-    // Infrequent path: Switching types
-    const int alignmentSize = 256;
-    const int alignmentCount = alignmentSize / strideSizesPtr[type];
-    const int misalignment = nextStartIndex % alignmentCount;
-    
-    if (misalignment != 0) {
-        nextStartIndex += alignmentCount - misalignment;
+void Renderer::encodeDamage(MTL::RenderCommandEncoder* encoder)
+{
+    if (damageTracker.isFullDamage()) {
+        encodeBatches(encoder, drawBatchesArr, drawBatchCount, viewProjectionMatrix);
+        return;
     }
     
-    assert(type == drawbatchtype_atlas ? (nextStartIndex + increment) < atlasMaxInstanceCount : true);
-    assert(type == drawbatchtype_primitive ? (nextStartIndex + increment) < primitiveMaxInstanceCount : true);
-    //    assert(type == drawbatchtype_text ? (nextStartIndex + increment) < textMaxVertexCount : true);
-    
-    curDrawBatchType = type;
-    drawBatchesArr[batchIndex] = (DrawBatch){
-        .type = type,
-        .startIndex = nextStartIndex,
-        .count = increment
+    // The pass loads, so each rect is cleared by hand first: one rect over the whole target, scissored like the rest.
+    // NOTE: Relies on the view's clear color being opaque, the rect is blended.
+    waitForPipeline(drawbatchtype_primitive);
+    const CameraUniforms clipSpaceUniforms = { .viewProjectionMatrix = matrix_identity_float4x4 };
+    simd_float4x4 clearTransform = matrix_identity_float4x4;
+    clearTransform.columns[0].x = 2.0f;
+    clearTransform.columns[1].y = 2.0f;
+    const PrimitiveInstanceData clearInstance = {
+        .transform = clearTransform,
+        .color = canvasClearColor,
+        .shapeType = ShapeTypeRect,
+        .clipIndex = 0,
+        .sdfParams = simd_make_float4(0.0f, 0.0f, 0.0f, 0.0f),
     };
-    drawBatchCount += 1;
-    
-    nextStartIndexForTypePtr[type] = nextStartIndex + increment;
-    return nextStartIndex;
+    const simd_float4 unclipped = clipRects[0];
+    
+    for (const DamageRect& rect : damageTracker.rects()) {
+        encoder->setScissorRect((MTL::ScissorRect){ .x = (NS::UInteger)rect.x, .y = (NS::UInteger)rect.y, .width = (NS::UInteger)rect.width, .height = (NS::UInteger)rect.height });
+        encoder->setRenderPipelineState(primitiveShapePipelineStates[ShapeTypeRect]);
+        encoder->setVertexBuffer(primitiveVertexBuffer, 0, BufferIndexVertices);
+        encoder->setVertexBytes(&clearInstance, sizeof(clearInstance), BufferIndexInstances);
+        encoder->setVertexBytes(&clipSpaceUniforms, sizeof(clipSpaceUniforms), BufferIndexUniforms);
+        encoder->setVertexBytes(&unclipped, sizeof(unclipped), BufferIndexClipRects);
+        encoder->drawPrimitives(MTL::PrimitiveTypeTriangleStrip, 0, sizeof(primitiveSquareVertices) / sizeof(primitiveSquareVertices[0]), 1);
+        
+        encodeBatches(encoder, drawBatchesArr, drawBatchCount, viewProjectionMatrix);
+    }
 }
 
-// MARK: - Atlas Drawing Functions
-void Renderer::drawSprite(const char* spriteName, float x, float y, float width, float height, UInt8 r, UInt8 g, UInt8 b, UInt8 a, float rotationRadians)
-{
-    drawSprite(spriteName, x, y, width, height, colorFromBytes(r, g, b, a), rotationRadians);
-}
-void Renderer::drawSprite(const char* spriteName, float x, float y, float width, float height, simd_float4 color, float rotationRadians)
+// MARK: - Dynamic Resolution
+bool Renderer::renderScaledScene(MTL::CommandBuffer* cmdBuffer, MTK::View* pView)
 {
-    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_atlas, 1);
-    atlasInstancesPtr[index] = (AtlasInstanceData){
-        .transform =
-        simd_mul(projectionMatrix,
-                 simd_mul(makeTranslate(x, y),
-                          simd_mul(makeRotationZ(rotationRadians),
-                                   makeScale(width, height)))),
-        .color = color,
-        .uvMin = mainAtlasUVRects[spriteName].minUV,
-        .uvMax = mainAtlasUVRects[spriteName].maxUV
-    };
-    ++atlasInstanceCount;
+    const CGSize drawableSize = pView->drawableSize();
+    const int width = (int)drawableSize.width;
+    const int height = (int)drawableSize.height;
+    if (width <= 0 || height <= 0) return false;
+    
+    PROFILE_ZONE("Render Scaled Scene");
+    FramePhaseTimer phaseTimer(currentFrameSample, framephase_encode);
+    if (!scaledSceneTexture || (int)scaledSceneTexture->width() != width || (int)scaledSceneTexture->height() != height) {
+        if (scaledSceneTexture) scaledSceneTexture->release();
+        MTL::TextureDescriptor* textureDesc = MTL::TextureDescriptor::texture2DDescriptor(colorPixelFormat, width, height, false);
+        textureDesc->setStorageMode(MTL::StorageModePrivate);
+        textureDesc->setUsage(MTL::TextureUsageRenderTarget | MTL::TextureUsageShaderRead);
+        scaledSceneTexture = device->newTexture(textureDesc);
+        scaledSceneTexture->setLabel(NS::String::string("Scaled Scene Texture", NS::StringEncoding::UTF8StringEncoding));
+    }
+    
+    scaledSceneBatches.clear();
+    nativeTextBatches.clear();
+    for (int iBatch = 0; iBatch < drawBatchCount; ++iBatch) {
+        (drawBatchesArr[iBatch].type == drawbatchtype_text ? nativeTextBatches : scaledSceneBatches).push_back(drawBatchesArr[iBatch]);
+    }
+    
+    const float scale = resolutionScaler.scale();
+    const int scaledWidth = std::max(1, (int)(width * scale + 0.5f));
+    const int scaledHeight = std::max(1, (int)(height * scale + 0.5f));
+    // Half a texel in from the edges, linear filtering would blend in what's past them.
+    scaledSceneUVMax = (simd_float2){ (scaledWidth - 0.5f) / width, (scaledHeight - 0.5f) / height };
+    
+    MTL::RenderPassDescriptor* passDesc = MTL::RenderPassDescriptor::renderPassDescriptor();
+    MTL::RenderPassColorAttachmentDescriptor* colorAttachment = passDesc->colorAttachments()->object(0);
+    colorAttachment->setTexture(scaledSceneTexture);
+    colorAttachment->setLoadAction(MTL::LoadActionClear);
+    colorAttachment->setClearColor(pView->clearColor());
+    colorAttachment->setStoreAction(MTL::StoreActionStore);
+    attachDepthTexture(passDesc, width, height);
+    MTL::RenderCommandEncoder* encoder = cmdBuffer->renderCommandEncoder(passDesc);
+    encoder->setLabel(NS::String::string("Scaled Scene Encoder", NS::StringEncoding::UTF8StringEncoding));
+    encoder->setViewport((MTL::Viewport){ .originX = 0.0, .originY = 0.0, .width = (double)scaledWidth, .height = (double)scaledHeight, .znear = 0.0, .zfar = 1.0 });
+    if (!scaledSceneBatches.empty()) encodeBatches(encoder, scaledSceneBatches.data(), (int)scaledSceneBatches.size(), viewProjectionMatrix);
+    encoder->endEncoding();
+    return true;
 }
 
-
-// MARK: - Primitive Drawing Functions
-void Renderer::drawPrimitiveCircle(float x, float y, float radius,
-                             UInt8 r, UInt8 g, UInt8 b, UInt8 a)
-{
-    drawPrimitiveCircle(x, y, radius, colorFromBytes(r, g, b, a));
-}
-void Renderer::drawPrimitiveCircle(float x, float y, float radius, simd_float4 color)
+void Renderer::encodeUpscaledScene(MTL::RenderCommandEncoder* encoder)
 {
-    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
-    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
-        .transform = simd_mul(makeTranslate(x, y), makeScale(radius * 2)),
-        .color = color,
-        .shapeType = ShapeTypeCircle,
-        .sdfParams = (simd_float4){radius, 0.5f, 0.0f, 0.0f} // hardcode edge softness to 0.5
+    // One quad over the whole drawable, sampled like a cached panel: linear, premultiplied (opaque here anyway).
+    waitForPipeline(drawbatchtype_atlas);
+    const CameraUniforms clipSpaceUniforms = { .viewProjectionMatrix = matrix_identity_float4x4 };
+    simd_float4x4 quadTransform = matrix_identity_float4x4;
+    quadTransform.columns[0].x = 2.0f;
+    quadTransform.columns[1].y = 2.0f;
+    const AtlasInstanceData quadInstance = {
+        .transform = quadTransform,
+        .color = simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f),
+        .uvMin = (simd_float2){ 0.5f / scaledSceneTexture->width(), 0.5f / scaledSceneTexture->height() },
+        .uvMax = scaledSceneUVMax,
+        .clipIndex = 0,
     };
-    ++primitiveInstanceCount;
+    const simd_float4 unclipped = clipRects[0];
+    encoder->setRenderPipelineState(atlasPremultipliedPipelineState);
+    encoder->setVertexBuffer(atlasVertexBuffer, 0, BufferIndexVertices);
+    encoder->setVertexBytes(&quadInstance, sizeof(quadInstance), BufferIndexInstances);
+    encoder->setVertexBytes(&clipSpaceUniforms, sizeof(clipSpaceUniforms), BufferIndexUniforms);
+    encoder->setVertexBytes(&unclipped, sizeof(unclipped), BufferIndexClipRects);
+    encoder->setFragmentTexture(scaledSceneTexture, 0);
+    encoder->setFragmentSamplerState(panelSamplerState, 0);
+    encoder->drawPrimitives(MTL::PrimitiveTypeTriangleStrip, 0, sizeof(atlasSquareVertices) / sizeof(atlasSquareVertices[0]), 1);
+    
+    if (!nativeTextBatches.empty()) encodeBatches(encoder, nativeTextBatches.data(), (int)nativeTextBatches.size(), viewProjectionMatrix);
 }
 
-void Renderer::drawPrimitiveCircleLines(float x, float y, float radius, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a)
+// MARK: - Opaque Pass
+void Renderer::buildDepthStencilStates()
 {
-    drawPrimitiveCircleLines(x, y, radius, thickness, colorFromBytes(r, g, b, a));
+    MTL::DepthStencilDescriptor* depthDesc = MTL::DepthStencilDescriptor::alloc()->init();
+    // Less, not LessEqual: an opaque batch is copied back to front at one depth, its first (frontmost) instance wins.
+    depthDesc->setDepthCompareFunction(MTL::CompareFunctionLess);
+    depthDesc->setDepthWriteEnabled(true);
+    opaqueDepthStencilState = device->newDepthStencilState(depthDesc);
+    depthDesc->setDepthWriteEnabled(false);
+    translucentDepthStencilState = device->newDepthStencilState(depthDesc);
+    depthDesc->release();
 }
-void Renderer::drawPrimitiveCircleLines(float x, float y, float radius, float thickness, simd_float4 color)
-{
-    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
-    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
-        .transform = simd_mul(makeTranslate(x, y), makeScale(radius * 2)),
-        .color = color,
-        .shapeType = ShapeTypeCircleLines,
-        .sdfParams = (simd_float4){radius, 0.5f, thickness / 2.0f, 0.0f}
-    };
-    ++primitiveInstanceCount;
-}
-    
-void Renderer::drawPrimitiveLine(float x1, float y1, float x2, float y2, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a)
-{
-    drawPrimitiveLine(x1, y1, x2, y2, thickness, colorFromBytes(r, g, b, a));
-}
-void Renderer::drawPrimitiveLine(float x1, float y1, float x2, float y2, float thickness, simd_float4 color)
+
+void Renderer::attachDepthTexture(MTL::RenderPassDescriptor* passDesc, int width, int height)
 {
-    const float dx = x2 - x1;
-    const float dy = y2 - y1;
-    const float length = sqrt(dx * dx + dy * dy);
-    const float angle = atan2(dy, dx);
-    
-    // Center between endpoints
-    const float cx = (x1 + x2) * 0.5f;
-    const float cy = (y1 + y2) * 0.5f;
-    
-    // Build transform: scale -> rotate -> translate
-    // Multiple: translate * rotation * scale
-    const simd_float4x4 transform = simd_mul(makeTranslate(cx, cy), simd_mul(makeRotationZ(angle), makeScale(length, thickness)));
-    
-    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
-    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
-        .transform = transform,
-        .color = color,
-        .shapeType = ShapeTypeRect,
-        .sdfParams = (simd_float4){0.0f, 0.0f, 0.0f, 0.0f}
-    };
-    ++primitiveInstanceCount;
-}
+    MTL::Texture* depthTexture = nullptr;
+    for (MTL::Texture* texture : depthTextures) {
+        if ((int)texture->width() == width && (int)texture->height() == height) depthTexture = texture;
+    }
+    if (!depthTexture) {
+        MTL::TextureDescriptor* textureDesc = MTL::TextureDescriptor::texture2DDescriptor(depthPixelFormat, width, height, false);
+        textureDesc->setStorageMode(device->supportsFamily(MTL::GPUFamilyApple1) ? MTL::StorageModeMemoryless : MTL::StorageModePrivate);
+        textureDesc->setUsage(MTL::TextureUsageRenderTarget);
+        depthTexture = device->newTexture(textureDesc);
+        depthTexture->setLabel(NS::String::string("Depth Texture", NS::StringEncoding::UTF8StringEncoding));
+        depthTextures.push_back(depthTexture);
+    }
     
-void Renderer::drawPrimitiveRect(float x, float y, float width, float height, UInt8 r, UInt8 g, UInt8 b, UInt8 a)
-{
-    drawPrimitiveRect(x, y, width, height, colorFromBytes(r, g, b, a));
+    MTL::RenderPassDepthAttachmentDescriptor* depthAttachment = passDesc->depthAttachment();
+    depthAttachment->setTexture(depthTexture);
+    depthAttachment->setLoadAction(MTL::LoadActionClear);
+    depthAttachment->setClearDepth(1.0);
+    depthAttachment->setStoreAction(MTL::StoreActionDontCare);
 }
-void Renderer::drawPrimitiveRect(float x, float y, float width, float height, simd_float4 color)
+
+void Renderer::releaseDepthTextures()
 {
-    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
-    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
-        .transform = simd_mul(makeTranslate(x + (width / 2.0f), y + (height / 2.0f)), makeScale(width, height)),
-        .color = color,
-        .shapeType = ShapeTypeRect,
-        .sdfParams = (simd_float4){0.0f, 0.0f, 0.0f, 0.0f}
-    };
-    ++primitiveInstanceCount;
+    // Command buffers retain what they use.
+    for (MTL::Texture* texture : depthTextures) texture->release();
+    depthTextures.clear();
 }
 
-void Renderer::drawPrimitiveRoundedRect(float x, float y, float width, float height, float cornerRadius, UInt8 r, UInt8 g, UInt8 b, UInt8 a)
+// Instances and glyphs are flat (z = 0 before the camera, which leaves z alone), so the translation's z is the clip
+// space depth of the whole batch. Later batches are nearer, all of them in (0, 1).
+static inline simd_float4x4 batchDepthProjection(simd_float4x4 viewProjection, int batchIndex, int batchCount)
 {
-    drawPrimitiveRoundedRect(x, y, width, height, cornerRadius, colorFromBytes(r, g, b, a));
+    viewProjection.columns[3].z = 1.0f - (float)(batchIndex + 1) / (float)(batchCount + 1);
+    return viewProjection;
 }
-void Renderer::drawPrimitiveRoundedRect(float x, float y, float width, float height, float cornerRadius, simd_float4 color)
+
+void Renderer::encodeBatches(MTL::RenderCommandEncoder* encoder, const DrawBatch* batches, int batchCount, const simd_float4x4& viewProjection)
 {
-    const float halfWidth = width / 2.0f;
-    const float halfHeight = height / 2.0f;
-    
-    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
-    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
-        .transform = simd_mul(makeTranslate(x + halfWidth, y + halfHeight), makeScale(width, height)),
-        .color = color,
-        .shapeType = ShapeTypeRoundedRect,
-        .sdfParams = (simd_float4){halfWidth, halfHeight, cornerRadius, 0.0f}
-    };
-    ++primitiveInstanceCount;
+    // Opaque batches front to back, so early depth testing rejects what they'd cover of each other. Then everything else
+    // in order, blended, and rejected where a later opaque batch is in front. Screen space batches skip the camera.
+    encoder->setDepthStencilState(opaqueDepthStencilState);
+    for (int iBatch = batchCount - 1; iBatch >= 0; --iBatch) {
+        const simd_float4x4& batchProjection = batches[iBatch].isScreenSpace ? projectionMatrix : viewProjection;
+        if (batches[iBatch].isOpaque) encodeBatch(encoder, batches[iBatch], batchDepthProjection(batchProjection, iBatch, batchCount), true);
+    }
+    encoder->setDepthStencilState(translucentDepthStencilState);
+    for (int iBatch = 0; iBatch < batchCount; ++iBatch) {
+        const simd_float4x4& batchProjection = batches[iBatch].isScreenSpace ? projectionMatrix : viewProjection;
+        if (!batches[iBatch].isOpaque) encodeBatch(encoder, batches[iBatch], batchDepthProjection(batchProjection, iBatch, batchCount), false);
+    }
 }
 
-void Renderer::drawPrimitiveRectLines(float x, float y, float width, float height, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a)
+void Renderer::encodeBatch(MTL::RenderCommandEncoder* encoder, const DrawBatch& batch, const simd_float4x4& viewProjection, bool isOpaquePass)
 {
-    drawPrimitiveRectLines(x, y, width, height, thickness, colorFromBytes(r, g, b, a));
+    // The camera (or a panel's projection) only exists here, every vertex stage applies it to world space instances.
+    const CameraUniforms cameraUniforms = { .viewProjectionMatrix = viewProjection };
+    
+    assert(batch.count > 0);
+    assert(batch.startIndex >= 0);
+    assert(!isOpaquePass || (batch.isOpaque && !batch.layer));
+    // The opaque pass draws the back to front copy, separateOpaqueDraws put it in this frame's instance memory.
+    const int startIndex = isOpaquePass ? batch.opaqueStartIndex : batch.startIndex;
+    // Layer batches bind the layer's own buffers and clip rects, offsets are from the start of those.
+    const RetainedLayerBuffers* layerBuffers = batch.layer ? &retainedLayerBuffersFor(*batch.layer) : nullptr;
+    const std::vector<simd_float4>& batchRects = batchClipRects(batch);
+    const size_t clipRectsSize = sizeof(simd_float4) * batchRects.size();
+    switch (batch.type) {
+        case drawbatchtype_count: {
+            __builtin_printf("Draw Batch with type count, should never be implemented");
+            assert(false);
+        } break;
+        case drawbatchtype_none: {
+            __builtin_printf("Draw Batch with type none");
+            assert(false);
+        } break;
+        case drawbatchtype_atlas: {
+            waitForPipeline(drawbatchtype_atlas);
+            encoder->setRenderPipelineState(isOpaquePass ? atlasOpaquePipelineState : batch.panel ? atlasPremultipliedPipelineState : atlasPipelineState);
+            encoder->setVertexBuffer(atlasVertexBuffer, 0, BufferIndexVertices);
+            
+            // Batches split around opaque runs can start anywhere, same as primitive shape runs below.
+            const int alignmentCount = 256 / sizeof(AtlasInstanceData);
+            const int alignedStartIndex = startIndex - startIndex % alignmentCount;
+            if (layerBuffers) {
+                encoder->setVertexBuffer(layerBuffers->atlasInstances, layerBuffers->atlasCopyOffset + (sizeof(AtlasInstanceData) * alignedStartIndex), BufferIndexInstances);
+            } else {
+                encoder->setVertexBuffer(atlasTriInstanceBuffer, atlasTriInstanceBufferOffset + (sizeof(AtlasInstanceData) * alignedStartIndex), BufferIndexInstances);
+            }
+            encoder->setVertexBytes(&cameraUniforms, sizeof(cameraUniforms), BufferIndexUniforms);
+            encoder->setVertexBytes(batchRects.data(), clipRectsSize, BufferIndexClipRects);
+            
+            if (batch.panel) {
+                encoder->setFragmentTexture(cachedPanelTextures.at(batch.panel).texture, 0);
+                encoder->setFragmentSamplerState(panelSamplerState, 0);
+            } else {
+                encoder->setFragmentTexture(mainAtlasTexture, 0);
+                encoder->setFragmentSamplerState(atlasSamplerState, 0);
+            }
+            encoder->drawPrimitives(MTL::PrimitiveTypeTriangleStrip, 0, sizeof(atlasSquareVertices) / sizeof(atlasSquareVertices[0]), batch.count, startIndex - alignedStartIndex);
+        } break;
+        case drawbatchtype_primitive: {
+            waitForPipeline(drawbatchtype_primitive);
+            assert(batch.shapeType < primitiveShapeTypeCount);
+            assert(!batch.isFitted || primitiveFittedPipelineStates[batch.shapeType]);
+            if (isOpaquePass) {
+                assert(batch.shapeType == ShapeTypeRect && !batch.isFitted);
+                encoder->setRenderPipelineState(primitiveOpaquePipelineState);
+                encoder->setVertexBuffer(primitiveVertexBuffer, 0, BufferIndexVertices);
+            } else if (batch.isFitted) {
+                encoder->setRenderPipelineState(primitiveFittedPipelineStates[batch.shapeType]);
+                encoder->setVertexBuffer(primitiveFitVertexBuffer, 0, BufferIndexVertices);
+            } else {
+                encoder->setRenderPipelineState(batch.shapeType == primitiveShapeMixed ? primitivePipelineState : primitiveShapePipelineStates[batch.shapeType]);
+                encoder->setVertexBuffer(primitiveVertexBuffer, 0, BufferIndexVertices);
+            }
+            
+            // Shape runs split out of a batch can start anywhere, bind from the aligned slot below and skip
+            // the difference with baseInstance. instance_id counts from baseInstance.
+            const int alignmentCount = 256 / sizeof(PrimitiveInstanceData);
+            const int alignedStartIndex = startIndex - startIndex % alignmentCount;
+            if (layerBuffers) {
+                encoder->setVertexBuffer(layerBuffers->primitiveInstances, sizeof(PrimitiveInstanceData) * alignedStartIndex, BufferIndexInstances);
+            } else {
+                encoder->setVertexBuffer(primitiveTriInstanceBuffer, primitiveTriInstanceBufferOffset + (sizeof(PrimitiveInstanceData) * alignedStartIndex), BufferIndexInstances);
+            }
+            
+            encoder->setVertexBytes(&cameraUniforms, sizeof(cameraUniforms), BufferIndexUniforms);
+            encoder->setVertexBytes(batchRects.data(), clipRectsSize, BufferIndexClipRects);
+            const PrimitiveFitMesh mesh = batch.isFitted ? primitiveFitMeshes[batch.shapeType]
+                : (PrimitiveFitMesh){ .vertexStart = 0, .vertexCount = sizeof(primitiveSquareVertices) / sizeof(primitiveSquareVertices[0]) };
+            encoder->drawPrimitives(MTL::PrimitiveTypeTriangleStrip, mesh.vertexStart, mesh.vertexCount, batch.count, startIndex - alignedStartIndex);
+        } break;
+        case drawbatchtype_text: {
+            waitForPipeline(drawbatchtype_text);
+            encoder->setRenderPipelineState(textPipelineState);
+            if (layerBuffers) {
+                encoder->setVertexBuffer(layerBuffers->textVertices, sizeof(TextVertex) * batch.startIndex, TextBufferIndexVertices);
+            } else {
+                encoder->setVertexBuffer(textTriVertexBuffer, textTriInstanceBufferOffset + (sizeof(TextVertex) * batch.startIndex), TextBufferIndexVertices);
+            }
+            
+            simd_float4x4 bindableProjMatrix = viewProjection;
+            encoder->setVertexBytes(&bindableProjMatrix, sizeof(simd_float4x4), TextBufferIndexProjectionMatrix);
+            
+            TextFragmentUniforms uniforms = (TextFragmentUniforms){
+                .distanceRange = static_cast<float>(fontAtlas.atlas.distanceRange)
+            };
+            encoder->setFragmentBytes(&uniforms, sizeof(TextFragmentUniforms), 0);
+            encoder->setFragmentTexture(fontTexture, 0);
+            encoder->setFragmentSamplerState(textSamplerState, 0);
+            
+            encoder->drawPrimitives(MTL::PrimitiveType::PrimitiveTypeTriangle, static_cast<NS::UInteger>(0), static_cast<NS::UInteger>(batch.count));
+        } break;
+    }
 }
-void Renderer::drawPrimitiveRectLines(float x, float y, float width, float height, float thickness, simd_float4 color)
+
+void Renderer::recordFrameStats(const FrameSample& sample)
 {
-    const float halfWidth = width / 2.0f;
-    const float halfHeight = height / 2.0f;
-    
-    const int index = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_primitive, 1);
-    primitiveInstancesPtr[index] = (PrimitiveInstanceData){
-        .transform = simd_mul(makeTranslate(x + halfWidth, y + halfHeight), makeScale(width, height)),
-        .color = color,
-        .shapeType = ShapeTypeRectLines,
-        .sdfParams = (simd_float4){halfWidth, halfHeight, thickness, 0.0f}
-    };
-    ++primitiveInstanceCount;
+    lastFrameSample = sample;
+    if (frameStats.addFrame(sample)) {
+        const FrameHitch& hitch = frameStats.latestHitch();
+        __builtin_printf("Hitch on frame %llu: %.2fms (budget %.2fms), %s was %.2fms over its average. %d batches, %d sprites, %d primitives, %d text verts\n",
+                         (unsigned long long)hitch.sample.frameIndex,
+                         hitch.sample.frameNs * 1e-6, frameStats.frameBudget() * 1e-6,
+                         framePhaseName(hitch.blamedPhase), hitch.blamedExcessNs * 1e-6,
+                         hitch.sample.batchCount, hitch.sample.atlasInstanceCount, hitch.sample.primitiveInstanceCount, hitch.sample.textVertexCount);
+    }
+    
+    const FrameTimeHistogram& histogram = frameStats.histogram();
+    if (histogram.totalCount() >= frameStatsReportInterval) {
+        __builtin_printf("Frame times over %llu frames: p50 %.2fms, p95 %.2fms, p99 %.2fms, max %.2fms\n",
+                         (unsigned long long)histogram.totalCount(),
+                         histogram.percentileUs(50) * 1e-3, histogram.percentileUs(95) * 1e-3,
+                         histogram.percentileUs(99) * 1e-3, histogram.maxUs() * 1e-3);
+        frameStats.resetHistogram();
+    }
 }
 
-void Renderer::drawText(const char* text,
-                        float posX, float posY,
-                        float fontSize,
-                        simd::float4 color)
+void Renderer::captureFrame(uint64_t index)
 {
-    if (!text || text[0] == '\0') return;
-    
-    const int predictedMaxVertices = (int)strlen(text) * 6;
-    assert(predictedMaxVertices <= textMaxSingleDrawVertCount);
+    if (index < (uint64_t)frameCaptureStart || index >= (uint64_t)(frameCaptureStart + frameCaptureCount)) return;
     
-    int vertexCount = 0;
-    buildMesh(text, posX, posY, fontSize, color,
-              textTempVertexBuffer,
-              vertexCount);
+    PROFILE_ZONE("Frame Capture");
+    const std::string capturePath = cacheDirectoryPath() + "frame_capture.mpfc";
+    if (!frameCaptureWriter) frameCaptureWriter = new FrameCaptureWriter(capturePath);
     
-    assert(vertexCount > 0);
-
-    int startIndex = addToDrawBatchAndGetAdjustedIndex(drawbatchtype_text, vertexCount);
-    memcpy(textVertexBufferPtr + startIndex, textTempVertexBuffer, sizeof(TextVertex) * vertexCount);
-    textVertexCount += vertexCount;
+    FrameCapture::capture(*this, index, capturedFrame);
+    frameCaptureWriter->write(capturedFrame);
+    if (frameCaptureWriter->frameCount == (uint32_t)frameCaptureCount) {
+        if (frameCaptureWriter->close()) __builtin_printf("Wrote %d captured frames to %s\n", frameCaptureCount, capturePath.c_str());
+    }
 }
 
-
-void Renderer::buildMesh(const char* text,
-                         float posX, float posY,
-                         float fontSize,
-                         simd::float4 color,
-                         TextVertex* outVertices,
-                         int& outVertexCount)
+// NOTE: Counts come from this frame, timings and the culled count from the previous one since this frame's aren't known yet.
+// One background rect and one drawText call, so it adds exactly 2 batches on top of the scene.
+void Renderer::drawStatsOverlay()
 {
-    outVertexCount = 0;
-
-    float atlasWidth  = static_cast<float>(fontAtlas.atlas.width);
-    float atlasHeight = static_cast<float>(fontAtlas.atlas.height);
-
-    float scale      = fontSize / static_cast<float>(fontAtlas.metrics.emSize);
-    float lineHeight = static_cast<float>(fontAtlas.metrics.lineHeight) * scale;
-    float ascender   = static_cast<float>(fontAtlas.metrics.ascender) * scale;
-
-    float cursorX = posX;
-    float cursorY = posY - ascender;
-    uint32_t previousChar = 0;
-
-    for (const char* p = text; *p; ++p) {
-        uint32_t unicode = static_cast<unsigned char>(*p); // ensures 0-255
-        if (unicode > 127) continue; // skip non-ASCII
-
-
-        if (unicode == '\n') {
-            cursorX = posX;
-            cursorY -= lineHeight;
-            previousChar = 0;
-            continue;
-        }
-
-        // Kerning
-        if (previousChar != 0) {
-            uint64_t key = (static_cast<uint64_t>(previousChar) << 32) | unicode;
-            auto it = fontKerning.find(key);
-            if (it != fontKerning.end()) {
-                cursorX += static_cast<float>(it->second.advance) * scale;
-            }
-        }
-
-        auto gIt = fontGlyphs.find(unicode);
-        if (gIt == fontGlyphs.end()) {
-            previousChar = unicode;
-            continue;
-        }
-        const Glyph& glyph = gIt->second;
-
-        if (glyph.planeBounds && glyph.atlasBounds) {
-            const Bounds& plane = *glyph.planeBounds;
-            const Bounds& atlas = *glyph.atlasBounds;
-
-            float x0 = cursorX + static_cast<float>(plane.left) * scale;
-            float y0 = cursorY + static_cast<float>(plane.bottom) * scale;
-            float x1 = cursorX + static_cast<float>(plane.right) * scale;
-            float y1 = cursorY + static_cast<float>(plane.top) * scale;
-
-            float u0 = static_cast<float>(atlas.left) / atlasWidth;
-            float u1 = static_cast<float>(atlas.right) / atlasWidth;
-            float v0 = (atlasHeight - static_cast<float>(atlas.top)) / atlasHeight;
-            float v1 = (atlasHeight - static_cast<float>(atlas.bottom)) / atlasHeight;
-
-            TextVertex topLeft     {{x0, y1}, {u0, v0}, color};
-            TextVertex topRight    {{x1, y1}, {u1, v0}, color};
-            TextVertex bottomLeft  {{x0, y0}, {u0, v1}, color};
-            TextVertex bottomRight {{x1, y0}, {u1, v1}, color};
-
-            // Two triangles = 6 vertices
-            outVertices[outVertexCount++] = bottomLeft;
-            outVertices[outVertexCount++] = bottomRight;
-            outVertices[outVertexCount++] = topRight;
-            outVertices[outVertexCount++] = bottomLeft;
-            outVertices[outVertexCount++] = topRight;
-            outVertices[outVertexCount++] = topLeft;
-        }
-
-        cursorX += static_cast<float>(glyph.advance) * scale;
-        previousChar = unicode;
-    }
+    PROFILE_ZONE("Stats Overlay");
+    const uint64_t overlayStartNs = Profiler::nowNs();
+    const FrameSample& sample = currentFrameSample;
+    const FrameSample& timing = lastFrameSample;
+    
+    const double cpuMs = (timing.phaseNs[framephase_update] + timing.phaseNs[framephase_encode] + timing.phaseNs[framephase_commit]) * 1e-6;
+    const double waitMs = timing.phaseNs[framephase_semaphoreWait] * 1e-6;
+    const double uploadedKB = (sample.atlasInstanceCount * sizeof(AtlasInstanceData)
+                               + sample.primitiveInstanceCount * sizeof(PrimitiveInstanceData)
+                               + sample.textVertexCount * sizeof(TextVertex)) / 1024.0;
+    // Used slots include the alignment gaps between batches, that's what actually runs out.
+    const double atlasUsage = 100.0 * nextStartIndexForTypePtr[drawbatchtype_atlas] / atlasMaxInstanceCount;
+    const double primitiveUsage = 100.0 * nextStartIndexForTypePtr[drawbatchtype_primitive] / primitiveMaxInstanceCount;
+    const double textUsage = 100.0 * nextStartIndexForTypePtr[drawbatchtype_text] / textMaxVertexCount;
+    
+    char text[320];
+    snprintf(text, sizeof(text),
+             "CPU %.2fms  p99 %.2fms\n"
+             "Wait %.2fms  Overlay %.0fus\n"
+             "Batches %d  Culled %d\n"
+             "Sprites %d (%.1f%%)\n"
+             "Primitives %d (%.1f%%)\n"
+             "Text verts %d (%.1f%%)\n"
+             "Uploaded %.1fKB",
+             cpuMs, frameStats.histogram().percentileUs(99) * 1e-3,
+             waitMs, lastOverlayNs * 1e-3,
+             sample.batchCount, timing.occludedInstanceCount,
+             sample.atlasInstanceCount, atlasUsage,
+             sample.primitiveInstanceCount, primitiveUsage,
+             sample.textVertexCount, textUsage,
+             uploadedKB);
+    
+    const float fontSize = 20.0f;
+    const float padding = 8.0f;
+    const float left = 16.0f - (float)screenSize.width / 2.0f;
+    const float top = (float)screenSize.height / 2.0f - 16.0f;
+    const std::pair<float, float> bounds = measureTextBounds(text, fontSize);
+    beginScreenSpace();
+    drawPrimitiveRect(left - padding, top - bounds.second - padding, bounds.first + padding * 2.0f, bounds.second + padding * 2.0f,
+                      simd_make_float4(0.0f, 0.0f, 0.0f, 0.6f));
+    drawText(text, left, top, fontSize, simd_make_float4(1.0f, 1.0f, 1.0f, 1.0f));
+    endScreenSpace();
+    
+    lastOverlayNs = Profiler::nowNs() - overlayStartNs;
 }
 
-
-// TODO: Convert into a Vector2 return type.
-std::pair<float, float> Renderer::measureTextBounds(const char* text, float fontSize)
+void Renderer::drawableSizeWillChange( MTK::View* pView, CGSize size )
 {
-    if (!text || text[0] == '\0') return {0.0f, 0.0f};
-
-    float scale      = fontSize / static_cast<float>(fontAtlas.metrics.emSize);
-    float lineHeight = static_cast<float>(fontAtlas.metrics.lineHeight) * scale;
-
-    float maxXInLine = 0.0f;
-    float maxLineWidth = 0.0f;
-    float cursorX = 0.0f;
-    int lineCount = 1;
-    uint32_t previousChar = 0;
-
-    for (const char* p = text; *p; ++p) {
-        uint32_t unicode = static_cast<unsigned char>(*p); // ensures 0-255
-        if (unicode > 127) continue; // skip non-ASCII
-
-        if (unicode == '\n') {
-            maxLineWidth = std::max(maxLineWidth, maxXInLine);
-            cursorX = 0;
-            maxXInLine = 0;
-            lineCount++;
-            previousChar = 0;
-            continue;
-        }
-
-        if (previousChar != 0) {
-            uint64_t key = (static_cast<uint64_t>(previousChar) << 32) | unicode;
-            auto it = fontKerning.find(key);
-            if (it != fontKerning.end()) {
-                cursorX += static_cast<float>(it->second.advance) * scale;
-            }
-        }
-
-        auto gIt = fontGlyphs.find(unicode);
-        if (gIt != fontGlyphs.end()) {
-            const Glyph& glyph = gIt->second;
-            float glyphRight = 0.0f;
-            if (glyph.planeBounds) {
-                glyphRight = cursorX + static_cast<float>(glyph.planeBounds->right) * scale;
-            } else {
-                glyphRight = cursorX + static_cast<float>(glyph.advance) * scale;
-            }
-            maxXInLine = std::max(maxXInLine, glyphRight);
-            cursorX += static_cast<float>(glyph.advance) * scale;
-        }
-
-        previousChar = unicode;
-    }
-
-    float textWidth  = std::max(maxLineWidth, maxXInLine);
-    float textHeight = static_cast<float>(lineCount) * lineHeight;
-
-    return {textWidth, textHeight};
+    __builtin_printf("drawableSizeWillChange called, (%0.f, %0.f)\n", size.width, size.height);
+    setScreenSize(size);
+    damageTracker.invalidate();
+    releaseDepthTextures(); // sized for the old drawable, made again when next needed
 }
 
-
-
@@ -11,137 +11,130 @@
 #include <Metal/Metal.hpp>
 #include <MetalKit/MetalKit.hpp>
 #include <simd/simd.h>
+#include <atomic>
 #include <functional>
 #include <map>
 #include <string>
 #include <vector>
 #include <optional>
+#include "DamageTracker.hpp"
+#include "DrawRecorder.hpp"
+#include "FrameCapture.hpp"
+#include "FrameStats.hpp"
+
+class PipelineCache;
 
 struct AtlasVertex {
     simd_float2 position;
     simd_float2 uv;
 };
 
-struct AtlasInstanceData {
-    simd_float4x4 transform;
-    simd_float4 color;
-    simd_float2 uvMin;
-    simd_float2 uvMax;
-    uint32_t __padding[8];
-};
-
-struct AtlasUVRect {
-    simd_float2 minUV; // bottom-left
-    simd_float2 maxUV; // top-right
-};
-
 struct PrimitiveVertex {
     simd_float2 position;
 };
 
-struct PrimitiveUniforms {
-    simd_float4x4 projectionMatrix;
+struct PrimitiveFitVertex {
+    simd_float2 corner; // quadrant, (+-1, +-1)
+    float isXEdge; // outer octagon vertices: 1 sits on the quad's x = +-0.5 edge, 0 on its y edge
+    float isInner; // 1: inner edge of a ring / frame strip
 };
 
-struct PrimitiveInstanceData {
-    simd_float4x4 transform;
-    simd_float4 color;
-    int32_t shapeType;
-    simd_float4 sdfParams;
-    uint32_t __padding[4];
+struct PrimitiveFitMesh {
+    int vertexStart;
+    int vertexCount;
 };
 
-struct TextVertex {
-    simd_float2 position;
-    simd_float2 uv;
-    simd_float4 textColor;
+// A DrawRecorder::Layer's instances on the GPU, any of the buffers is null when the layer has none of that type.
+struct RetainedLayerBuffers {
+    MTL::Buffer* atlasInstances = nullptr; // in place layers: one copy per frame in flight, back to back
+    MTL::Buffer* primitiveInstances = nullptr;
+    MTL::Buffer* textVertices = nullptr;
+    uint64_t generation = 0; // Layer::generation uploaded
+    int lastDrawnFrame = -1;
+    // In place layers only. The copy this frame reads, and per copy the updates handed over on the draw it was last
+    // written for. A copy is behind by exactly the updates in the lists.
+    int atlasCopyIndex = 0;
+    size_t atlasCopyOffset = 0;
+    std::vector<std::vector<DrawRecorder::InstanceUpdate>> recentUpdates;
 };
 
-struct TextFragmentUniforms {
-    float distanceRange;
-};
-
-// MARK: - Font Atlas Structs
-struct AtlasMetrics {
-    std::string type;
-    float distanceRange;
-    float size;
-    int width;
-    int height;
-    std::string yOrigin;
+// A DrawRecorder::CachedPanel's texture, rendered again only when the panel's layer is rebuilt.
+struct CachedPanelTexture {
+    MTL::Texture* texture = nullptr;
+    uint64_t generation = 0; // Layer::generation rendered
+    int lastDrawnFrame = -1;
 };
 
-struct FontMetrics {
-    float emSize;
-    float lineHeight;
-    float ascender;
-    float descender;
-    float underlineY;
-    float underlineThickness;
+// Atlas and primitive vertex uniforms.
+struct CameraUniforms {
+    simd_float4x4 viewProjectionMatrix;
 };
 
-struct Bounds {
-    float left;
-    float bottom;
-    float right;
-    float top;
-};
-
-struct Glyph {
-    int unicode;
-    float advance;
-    std::optional<Bounds> planeBounds;
-    std::optional<Bounds> atlasBounds;
-};
-
-struct Kerning {
-    int unicode1;
-    int unicode2;
-    float advance;
-};
-
-struct FontAtlas {
-    AtlasMetrics atlas;
-    FontMetrics metrics;
-    std::vector<Glyph> glyphs;
-    std::vector<Kerning> kerning;
+struct TextFragmentUniforms {
+    float distanceRange;
 };
 
-class Renderer
+class Renderer : public DrawRecorder
 {
 public:
     Renderer( MTL::Device* pDevice, MTK::View* pView );
     ~Renderer();
     void draw( MTK::View* pView );
     void drawableSizeWillChange( MTK::View* pView, CGSize size );
+    
+    // Only what changed since the last frame is drawn again, scissored, into a canvas that keeps everything else and is
+    // copied to the drawable. For mostly static screens, see DamageTracker. The copy costs a full screen of bandwidth.
+    bool partialRedraw = false;
+    // Frames that would draw exactly what's on screen already are skipped, nothing is encoded, committed or presented.
+    // The frame is still recorded, that's what gets compared. requestRedraw forces the next frame through, for changes
+    // the draws don't show (the window was exposed again, a texture was reloaded).
+    // NOTE: The stats overlay changes every frame and would never let one be skipped, it isn't drawn in this mode.
+    bool renderOnDemand = false;
+    void requestRedraw() { isRedrawRequested = true; }
+    // Everything but text is drawn into an offscreen target at renderScale() of the drawable and upscaled, the scale
+    // follows the measured GPU time against the frame budget (ResolutionScaler). Text is drawn afterwards at full
+    // resolution so it stays sharp, which puts it above everything else. Ignored while partialRedraw is on.
+    bool dynamicResolution = false;
+    float renderScale() const { return resolutionScaler.scale(); }
 
     
     // MARK: - For debugging
     CFTimeInterval lastRenderTimestamp = 0;
     int renderFrameCount = 0;
+    int skippedFrameCount = 0; // renderOnDemand
     double reportedFPS = 0;
     std::function<void(double)> onFramePresented = nullptr;
+    // NOTE: Set to a frame number to write a Chrome trace of everything profiled up to that frame into the cache directory.
+    static const int profileCaptureFrame = 0;
+    int frameIndex = 0;
+    // Frame time percentiles are printed and reset every frameStatsReportInterval frames, hitches as they happen.
+    FrameStats frameStats;
+    static const int frameStatsReportInterval = 600;
+    bool showStatsOverlay = true; // not while renderOnDemand
+    // NOTE: Set frameCaptureCount to write that many frames, starting at frameCaptureStart, into the cache directory.
+    // Replay them with the benchmark (--replay) or FrameCapture::replay.
+    static const int frameCaptureStart = 0;
+    static const int frameCaptureCount = 0;
 
 private:
-    simd_float4x4 projectionMatrix = matrix_identity_float4x4;
-    CGSize screenSize = {0.0f, 0.0f};
-    
     MTL::Device* device;
     MTL::CommandQueue* commandQueue;
     
+    PipelineCache* pipelineCache = nullptr;
+    
     static const int maxBuffersInFlight = 3;
+    
     dispatch_semaphore_t inFlightSemaphore;
     int triBufferIndex = 0;
     
     
     // MARK: - ATLAS PIPELINE VARS
     MTL::RenderPipelineState* atlasPipelineState = nullptr;
+    MTL::RenderPipelineState* atlasPremultipliedPipelineState = nullptr; // cached panel textures, premultiplied in either mode
+    MTL::RenderPipelineState* atlasOpaquePipelineState = nullptr; // opaque batches, blending off
     MTL::Buffer* atlasVertexBuffer = nullptr;
     MTL::Buffer* atlasTriInstanceBuffer = nullptr;
     int atlasTriInstanceBufferOffset = 0;
-    AtlasInstanceData* atlasInstancesPtr = nullptr;
-    const int atlasMaxInstanceCount = 150000;
-    int atlasInstanceCount = 0;
     
     const AtlasVertex atlasSquareVertices[4] = {
         AtlasVertex{ .position={ -0.5f, -0.5f }, .uv={ 0.0f, 1.0f } },
@@ -151,18 +144,18 @@ private:
     };
     // TODO: Use Arguement buffers to pass multiple texture atlasses?
     MTL::Texture* mainAtlasTexture = nullptr;
-    std::map<std::string, AtlasUVRect> mainAtlasUVRects;
     MTL::SamplerState* atlasSamplerState;
+    MTL::SamplerState* panelSamplerState; // linear, a panel has no neighbours to bleed from
     
     
     // MARK: - PRIMITIVE PIPELINE VARs
-    MTL::RenderPipelineState* primitivePipelineState = nullptr;
+    MTL::RenderPipelineState* primitivePipelineState = nullptr; // generic, for batches of mixed shapes
+    MTL::RenderPipelineState* primitiveShapePipelineStates[primitiveShapeTypeCount] = {}; // by ShapeType, see groupPrimitivesByShape
+    MTL::RenderPipelineState* primitiveFittedPipelineStates[primitiveShapeTypeCount] = {}; // by ShapeType, only shapes with a fitted mesh
+    MTL::RenderPipelineState* primitiveOpaquePipelineState = nullptr; // opaque batches, ShapeTypeRect with blending off
     MTL::Buffer* primitiveVertexBuffer = nullptr;
     MTL::Buffer* primitiveTriInstanceBuffer = nullptr;
     int primitiveTriInstanceBufferOffset = 0;
-    PrimitiveInstanceData* primitiveInstancesPtr = nullptr;
-    const int primitiveMaxInstanceCount = 150000;
-    int primitiveInstanceCount = 0;
     
     const PrimitiveVertex primitiveSquareVertices[4] = {
         PrimitiveVertex{.position={-0.5, -0.5}},
@@ -171,96 +164,115 @@ private:
         PrimitiveVertex{.position={0.5, 0.5}}
     };
     
-    PrimitiveUniforms primitiveUniforms = PrimitiveUniforms {.projectionMatrix=matrix_identity_float4x4};
-    
+    // Triangle strips, vertex_primitive_fitted places them per instance. Octagon (circle), then ring (circle outline, outer
+    // and inner octagon), then frame (rect outline, outer and inner rect).
+    MTL::Buffer* primitiveFitVertexBuffer = nullptr;
+    PrimitiveFitMesh primitiveFitMeshes[primitiveShapeTypeCount] = {}; // by ShapeType
     
     
     // MARK: - TEXT PIPELINE VARS
     MTL::Texture* fontTexture;
-    FontAtlas fontAtlas;
-    std::map<UInt32, Glyph> fontGlyphs;
-    std::map<UInt64, Kerning> fontKerning;
     
     MTL::RenderPipelineState* textPipelineState;
     MTL::SamplerState* textSamplerState;
     MTL::Buffer* textTriVertexBuffer;
-    const int textMaxVertexCount = 4096 * 6;
     int textTriInstanceBufferOffset = 0;
-    TextVertex* textVertexBufferPtr = nullptr;
-    int textVertexCount = 0;
-    const int textMaxSingleDrawVertCount = 320 * 6;
-    TextVertex* textTempVertexBuffer = nullptr;
-    
-    
-    // MARK: - Draw Command Batching
-    enum DrawBatchType {
-        drawbatchtype_none = 0,
-        drawbatchtype_atlas = 1,
-        drawbatchtype_primitive = 2,
-        drawbatchtype_text = 3,
-        drawbatchtype_count = 4,
-    };
-    struct DrawBatch {
-        DrawBatchType type;
-        int startIndex;
-        int count;
-    };
-    DrawBatch* drawBatchesArr = nullptr;
-    int drawBatchCount = 0;
-    const int drawBatchMaxCount = 1024;
-    DrawBatchType curDrawBatchType = drawbatchtype_none;
-    // TODO: Can rename these next two vars also...
-    int nextStartIndexForTypePtr[drawbatchtype_count];
-    int strideSizesPtr[drawbatchtype_count];
     
     
-    // MARK: - GAME RELATED
-    float time = 0.0f;
+    // MARK: - Retained Layers
+    // Each drawn layer's instances, uploaded once per build (Layer::generation) instead of into the tri buffers every
+    // frame. Command buffers retain what they use, so a rebuilt or dropped layer's buffers can be released right away.
+    // Layers not drawn for maxBuffersInFlight frames are dropped, the delay only saves an upload when one is skipped briefly.
+    std::map<const Layer*, RetainedLayerBuffers> retainedLayerBuffers;
+    const RetainedLayerBuffers& retainedLayerBuffersFor(const Layer& layer);
+    void releaseUndrawnLayers();
+    
+    
+    // MARK: - Cached Panels
+    // Panels whose texture is missing or older than their layer are rendered in passes of their own before the frame's
+    // pass. Textures of panels not drawn for maxBuffersInFlight frames go back to a pool by size class, for the next
+    // panel of that size, and past cachedPanelPoolMaxCount they're released.
+    static const int cachedPanelPoolMaxCount = 8;
+    MTL::PixelFormat colorPixelFormat;
+    std::map<const CachedPanel*, CachedPanelTexture> cachedPanelTextures;
+    std::vector<MTL::Texture*> freePanelTextures;
+    void renderCachedPanels(MTL::CommandBuffer* cmdBuffer);
+    MTL::Texture* panelTexture(int width, int height);
+    void releaseUndrawnPanels();
     
-    void buildAtlasBuffers();
-    void buildPrimitiveBuffers();
-    void buildTextBuffers();
-    void updateTriBufferStates();
-    void buildAtlasPipeline(MTL::PixelFormat pixelFormat);
-    void buildPrimitivePipeline(MTL::PixelFormat pixelFormat);
-    void buildTextPipeline(MTL::PixelFormat pixelFormat);
-    void loadAtlasTextureAndUV();
-    void loadTextInfoAndTexture();
     
-    // MARK: - Test functions
-    void testDrawPrimitives();
-    void testDrawAtlasSprites();
-    void testDrawTextWithBounds();
-    void testDrawInterleavedTypes();
+    // MARK: - Partial Redraw / On Demand
+    // MTKView drawables don't keep their contents between frames, the canvas does. Its pass loads instead of clearing.
+    DamageTracker damageTracker;
+    MTL::Texture* canvasTexture = nullptr;
+    int lastTrackedFrame = -1;
+    simd_float4 canvasClearColor;
+    bool isRedrawRequested = false;
+    bool trackDamage(MTK::View* pView); // false when there's no drawable size yet
+    MTL::RenderPassDescriptor* canvasRenderPassDescriptor();
+    void encodeDamage(MTL::RenderCommandEncoder* encoder);
     
-    // MARK: - Draw Helpers
-    static inline simd_float4 colorFromBytes(UInt8 r, UInt8 g, UInt8 b, UInt8 a);
-    inline int addToDrawBatchAndGetAdjustedIndex(DrawBatchType type, int increment);
     
-    void drawSprite(const char* spriteName, float x, float y, float width, float height, UInt8 r, UInt8 g, UInt8 b, UInt8 a, float rotationRadians);
-    void drawSprite(const char* spriteName, float x, float y, float width, float height, simd_float4 color, float rotationRadians);
+    // MARK: - Opaque Pass
+    // Every pass has a depth attachment and every batch its own depth, later batches nearer. encodeBatches draws the
+    // opaque batches (DrawRecorder::separateOpaqueDraws) front to back writing depth, then the rest in order testing
+    // against it without writing. Offscreen passes share depth textures by size, memoryless where the GPU has tile
+    // memory, since nothing reads them after the pass.
+    MTL::DepthStencilState* opaqueDepthStencilState = nullptr;
+    MTL::DepthStencilState* translucentDepthStencilState = nullptr;
+    std::vector<MTL::Texture*> depthTextures;
+    void buildDepthStencilStates();
+    void attachDepthTexture(MTL::RenderPassDescriptor* passDesc, int width, int height);
+    void releaseDepthTextures();
     
-    void drawPrimitiveCircle(float x, float y, float radius, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
-    void drawPrimitiveCircle(float x, float y, float radius, simd_float4 color);
     
-    void drawPrimitiveCircleLines(float x, float y, float radius, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
-    void drawPrimitiveCircleLines(float x, float y, float radius, float thickness, simd_float4 color);
+    // MARK: - Dynamic Resolution
+    // Allocated at the drawable's size, lower scales only use its top left corner, so changing scale never reallocates.
+    ResolutionScaler resolutionScaler;
+    MTL::Texture* scaledSceneTexture = nullptr;
+    std::atomic<uint64_t> lastGpuFrameNs = 0; // written by the completed handler
+    std::vector<DrawBatch> scaledSceneBatches; // per frame
+    std::vector<DrawBatch> nativeTextBatches;
+    simd_float2 scaledSceneUVMax;
+    bool renderScaledScene(MTL::CommandBuffer* cmdBuffer, MTK::View* pView); // false when there's no drawable size yet
+    void encodeUpscaledScene(MTL::RenderCommandEncoder* encoder);
     
-    void drawPrimitiveLine(float x1, float y1, float x2, float y2, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
-    void drawPrimitiveLine(float x1, float y1, float x2, float y2, float thickness, simd_float4 color);
     
-    void drawPrimitiveRect(float x, float y, float width, float height, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
-    void drawPrimitiveRect(float x, float y, float width, float height, simd_float4 color);
+    // MARK: - Async Startup
+    dispatch_group_t startupGroup; // every pipeline build job
+    dispatch_group_t pipelineBuildGroups[drawbatchtype_count];
+    bool pipelineReady[drawbatchtype_count];
+    std::atomic<int> pendingPipelineCount = 0;
     
-    void drawPrimitiveRoundedRect(float x, float y, float width, float height, float cornerRadius, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
-    void drawPrimitiveRoundedRect(float x, float y, float width, float height, float cornerRadius, simd_float4 color);
     
-    void drawPrimitiveRectLines(float x, float y, float width, float height, float thickness, UInt8 r, UInt8 g, UInt8 b, UInt8 a);
-    void drawPrimitiveRectLines(float x, float y, float width, float height, float thickness, simd_float4 color);
+    // MARK: - Frame Stats
+    FrameSample currentFrameSample;
+    FrameSample lastFrameSample;
+    uint64_t lastFrameStartNs = 0;
+    uint64_t lastOverlayNs = 0;
+    void recordFrameStats(const FrameSample& sample);
+    void drawStatsOverlay();
     
-    void drawText(const char* text, float posX, float posY, float fontSize, simd::float4 color);
-    void buildMesh(const char* text, float posX, float posY, float fontSize, simd::float4 color, TextVertex* outVertices, int& outVertexCount);
-    std::pair<float, float> measureTextBounds(const char* text, float fontSize);
+    
+    // MARK: - Frame Capture
+    FrameCaptureWriter* frameCaptureWriter = nullptr;
+    CapturedFrame capturedFrame;
+    void captureFrame(uint64_t index);
+    
+    
+    void encodeBatches(MTL::RenderCommandEncoder* encoder, const DrawBatch* batches, int batchCount, const simd_float4x4& viewProjection);
+    void encodeBatch(MTL::RenderCommandEncoder* encoder, const DrawBatch& batch, const simd_float4x4& viewProjection, bool isOpaquePass);
+    void buildAtlasBuffers();
+    void buildPrimitiveBuffers();
+    void buildTextBuffers();
+    void updateTriBufferStates();
+    void buildPipelineAsync(DrawBatchType type, MTL::PixelFormat pixelFormat, dispatch_queue_t queue);
+    inline void waitForPipeline(DrawBatchType type);
+    void buildAtlasPipeline(MTL::PixelFormat pixelFormat);
+    void buildPrimitivePipeline(MTL::PixelFormat pixelFormat);
+    void buildTextPipeline(MTL::PixelFormat pixelFormat);
+    void loadAtlasTextureAndUV();
+    void loadTextInfoAndTexture();
 };
 
 #endif /* Renderer_hpp */
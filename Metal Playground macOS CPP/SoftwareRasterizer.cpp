@@ -0,0 +1,678 @@
+//
+//  SoftwareRasterizer.cpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include "SoftwareRasterizer.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include "Profiler.hpp"
+#include "ShaderTypes.h"
+
+// MARK: - Lane helpers
+static inline RasterFloat4 splat(float value) { return (RasterFloat4){ value, value, value, value }; }
+
+static inline RasterFloat4 select4(RasterInt4 mask, RasterFloat4 a, RasterFloat4 b)
+{
+    return (RasterFloat4)(((RasterInt4)a & mask) | ((RasterInt4)b & ~mask));
+}
+
+static inline bool anyLane(RasterInt4 mask) { return (mask[0] | mask[1] | mask[2] | mask[3]) != 0; }
+
+static inline RasterFloat4 min4(RasterFloat4 a, RasterFloat4 b) { return select4(a < b, a, b); }
+static inline RasterFloat4 max4(RasterFloat4 a, RasterFloat4 b) { return select4(a > b, a, b); }
+static inline RasterFloat4 clamp01(RasterFloat4 v) { return min4(max4(v, splat(0.0f)), splat(1.0f)); }
+static inline RasterFloat4 abs4(RasterFloat4 v) { return (RasterFloat4)((RasterInt4)v & 0x7fffffff); }
+
+static inline RasterFloat4 sqrt4(RasterFloat4 v)
+{
+    return (RasterFloat4){ std::sqrt(v[0]), std::sqrt(v[1]), std::sqrt(v[2]), std::sqrt(v[3]) };
+}
+
+static inline RasterFloat4 length4(RasterFloat4 x, RasterFloat4 y) { return sqrt4(x * x + y * y); }
+
+// Metal's smoothstep, also used with edge0 > edge1 by the shaders to flip it.
+static inline RasterFloat4 smoothstep4(float edge0, float edge1, RasterFloat4 x)
+{
+    const RasterFloat4 t = clamp01((x - edge0) / (edge1 - edge0));
+    return t * t * (3.0f - 2.0f * t);
+}
+static inline RasterFloat4 smoothstep4(RasterFloat4 edge0, RasterFloat4 edge1, RasterFloat4 x)
+{
+    const RasterFloat4 t = clamp01((x - edge0) / (edge1 - edge0));
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// Pixel centers of the 2x2 quad whose top-left pixel is (x, y).
+static inline RasterFloat4 quadCentersX(int x) { return (RasterFloat4){ x + 0.5f, x + 1.5f, x + 0.5f, x + 1.5f }; }
+static inline RasterFloat4 quadCentersY(int y) { return (RasterFloat4){ y + 0.5f, y + 0.5f, y + 1.5f, y + 1.5f }; }
+
+// Lanes whose pixel center is inside the clip rect, what the GPU's clip distances leave.
+static inline RasterInt4 quadClipCoverage(simd_float4 clip, RasterFloat4 px, RasterFloat4 py)
+{
+    return (px >= clip.x) & (px < clip.z) & (py >= clip.y) & (py < clip.w);
+}
+
+// Per lane finite differences across the quad, what dfdx / dfdy return on the GPU.
+static inline RasterFloat4 quadDdx(RasterFloat4 v) { return (RasterFloat4){ v[1] - v[0], v[1] - v[0], v[3] - v[2], v[3] - v[2] }; }
+static inline RasterFloat4 quadDdy(RasterFloat4 v) { return (RasterFloat4){ v[2] - v[0], v[3] - v[1], v[2] - v[0], v[3] - v[1] }; }
+
+
+// MARK: - Texture sampling
+// Clamp to edge addressing, like the default sampler address mode the pipelines use.
+static inline simd_float4 loadTexel(const MipChain& texture, const MipLevel& level, int x, int y)
+{
+    x = std::clamp(x, 0, level.width - 1);
+    y = std::clamp(y, 0, level.height - 1);
+    const uint8_t* texel = texture.pixels.data() + level.offset + ((size_t)y * level.width + x) * 4;
+    const float scale = 1.0f / 255.0f;
+    return simd_make_float4(texel[0] * scale, texel[1] * scale, texel[2] * scale, texel[3] * scale);
+}
+
+static inline simd_float4 sampleNearest(const MipChain& texture, const MipLevel& level, float u, float v)
+{
+    return loadTexel(texture, level, (int)std::floor(u * level.width), (int)std::floor(v * level.height));
+}
+
+static inline simd_float4 sampleBilinear(const MipChain& texture, const MipLevel& level, float u, float v)
+{
+    const float x = u * level.width - 0.5f;
+    const float y = v * level.height - 0.5f;
+    const float x0 = std::floor(x);
+    const float y0 = std::floor(y);
+    const float fx = x - x0;
+    const float fy = y - y0;
+    const int ix = (int)x0;
+    const int iy = (int)y0;
+    const simd_float4 top = loadTexel(texture, level, ix, iy) * (1.0f - fx) + loadTexel(texture, level, ix + 1, iy) * fx;
+    const simd_float4 bottom = loadTexel(texture, level, ix, iy + 1) * (1.0f - fx) + loadTexel(texture, level, ix + 1, iy + 1) * fx;
+    return top * (1.0f - fy) + bottom * fy;
+}
+
+// lod <= 0 is magnification. Minification is always linear with linear mip blending, like both samplers.
+static inline simd_float4 sampleTexture(const MipChain& texture, float u, float v, float lod, bool isMagLinear)
+{
+    if (!(lod > 0.0f)) {
+        const MipLevel& level = texture.levels[0];
+        return isMagLinear ? sampleBilinear(texture, level, u, v) : sampleNearest(texture, level, u, v);
+    }
+    const int lastLevel = (int)texture.levels.size() - 1;
+    lod = std::min(lod, (float)lastLevel);
+    const int level0 = (int)lod;
+    const int level1 = std::min(level0 + 1, lastLevel);
+    const float t = lod - level0;
+    const simd_float4 a = sampleBilinear(texture, texture.levels[level0], u, v);
+    if (t <= 0.0f || level0 == level1) return a;
+    return a * (1.0f - t) + sampleBilinear(texture, texture.levels[level1], u, v) * t;
+}
+
+// Texture space derivatives are constant across a quad for affine mappings, so one lod per quad.
+static inline float quadLod(const MipChain& texture, RasterFloat4 u, RasterFloat4 v)
+{
+    const float dudx = (u[1] - u[0]) * texture.width, dvdx = (v[1] - v[0]) * texture.height;
+    const float dudy = (u[2] - u[0]) * texture.width, dvdy = (v[2] - v[0]) * texture.height;
+    const float rho = std::max(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+    return rho > 0.0f ? 0.5f * std::log2(rho) : -1.0f;
+}
+
+
+// MARK: - Blending
+// The render target is unorm, shader outputs are clamped before they blend. isPremultiplied is
+// DrawRecorder::premultipliedAlpha, except for cached panel images which are premultiplied in either mode.
+static inline void blendQuad(SoftwareRasterizerQuad& dst, RasterInt4 coverage, RasterFloat4 r, RasterFloat4 g, RasterFloat4 b, RasterFloat4 a, bool isPremultiplied)
+{
+    r = clamp01(r);
+    g = clamp01(g);
+    b = clamp01(b);
+    a = clamp01(a);
+    const RasterFloat4 inverseAlpha = 1.0f - a;
+    RasterFloat4 outR, outG, outB, outA;
+    if (isPremultiplied) {
+        // One, OneMinusSourceAlpha
+        outR = r + dst.r * inverseAlpha;
+        outG = g + dst.g * inverseAlpha;
+        outB = b + dst.b * inverseAlpha;
+        outA = a + dst.a * inverseAlpha;
+    } else {
+        // SourceAlpha, OneMinusSourceAlpha, alpha One, OneMinusSourceAlpha
+        outR = r * a + dst.r * inverseAlpha;
+        outG = g * a + dst.g * inverseAlpha;
+        outB = b * a + dst.b * inverseAlpha;
+        outA = a + dst.a * inverseAlpha;
+    }
+    dst.r = select4(coverage, outR, dst.r);
+    dst.g = select4(coverage, outG, dst.g);
+    dst.b = select4(coverage, outB, dst.b);
+    dst.a = select4(coverage, outA, dst.a);
+}
+
+
+// MARK: - Lifetime
+SoftwareRasterizer::SoftwareRasterizer(int width, int height, int threadCount)
+{
+    if (threadCount <= 0) threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    tileBuffers.resize(threadCount);
+    for (std::vector<SoftwareRasterizerQuad>& tileBuffer : tileBuffers) {
+        tileBuffer.resize((tileSize / 2) * (tileSize / 2));
+    }
+    resize(width, height);
+
+    for (int iWorker = 1; iWorker < threadCount; ++iWorker) {
+        workers.emplace_back(&SoftwareRasterizer::workerLoop, this, iWorker);
+    }
+}
+
+SoftwareRasterizer::~SoftwareRasterizer()
+{
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        isShuttingDown = true;
+    }
+    jobStarted.notify_all();
+    for (std::thread& worker : workers) worker.join();
+}
+
+void SoftwareRasterizer::resize(int width, int height)
+{
+    setFramebufferSize(width, height);
+    damageTracker.invalidate();
+}
+
+void SoftwareRasterizer::setFramebufferSize(int width, int height)
+{
+    assert(width > 0 && height > 0);
+    framebufferWidth = width;
+    framebufferHeight = height;
+    tileCountX = (width + tileSize - 1) / tileSize;
+    tileCountY = (height + tileSize - 1) / tileSize;
+    framebuffer.assign((size_t)width * height * 4, 0);
+    tileBins.resize((size_t)tileCountX * tileCountY);
+}
+
+
+// MARK: - Frame
+void SoftwareRasterizer::render(const DrawRecorder& recorder, simd_float4 clearColor)
+{
+    PROFILE_ZONE("Software Raster");
+    frameRecorder = &recorder;
+    renderCachedPanels(recorder);
+    frameClearColor = clearColor;
+    if (isPartialRedraw) {
+        // Damaged rects are whole tiles (bar the framebuffer's edge), the others keep what the last render left.
+        damageTracker.update(recorder, framebufferWidth, framebufferHeight, clearColor);
+        queuedTiles.clear();
+        for (const DamageRect& rect : damageTracker.rects()) {
+            for (int tileY = rect.y / tileSize; tileY * tileSize < rect.y + rect.height; ++tileY) {
+                for (int tileX = rect.x / tileSize; tileX * tileSize < rect.x + rect.width; ++tileX) queuedTiles.push_back(tileY * tileCountX + tileX);
+            }
+        }
+    } else {
+        queueAllTiles();
+    }
+    if (!queuedTiles.empty()) {
+        setupShapes(recorder, recorder.drawBatchesArr, recorder.drawBatchCount, recorder.viewProjectionMatrix);
+        shadeShapes();
+    }
+    frameRecorder = nullptr;
+}
+
+void SoftwareRasterizer::queueAllTiles()
+{
+    queuedTiles.resize((size_t)tileCountX * tileCountY);
+    std::iota(queuedTiles.begin(), queuedTiles.end(), 0);
+}
+
+void SoftwareRasterizer::renderCachedPanels(const DrawRecorder& recorder)
+{
+    for (std::pair<const DrawRecorder::CachedPanel* const, CachedPanelImage>& entry : cachedPanelImages) entry.second.isDrawn = false;
+
+    const int frameWidth = framebufferWidth;
+    const int frameHeight = framebufferHeight;
+    // Panels render through the framebuffer, the frame's pixels are put aside for partial redraws to start from.
+    std::vector<uint8_t> framePixels;
+    bool isFramebufferSaved = false;
+    std::vector<DrawRecorder::DrawBatch> panelBatches;
+    for (int iBatch = 0; iBatch < recorder.drawBatchCount; ++iBatch) {
+        const DrawRecorder::CachedPanel* panel = recorder.drawBatchesArr[iBatch].panel;
+        if (!panel) continue;
+        CachedPanelImage& cached = cachedPanelImages[panel];
+        cached.isDrawn = true;
+        if (cached.generation == panel->layer.generation) continue;
+
+        PROFILE_ZONE("Raster Cached Panel");
+        const int textureWidth = DrawRecorder::cachedPanelTextureSize(panel->rect.z - panel->rect.x);
+        const int textureHeight = DrawRecorder::cachedPanelTextureSize(panel->rect.w - panel->rect.y);
+        if (!isFramebufferSaved) {
+            framePixels.swap(framebuffer);
+            isFramebufferSaved = true;
+        }
+        setFramebufferSize(textureWidth, textureHeight);
+        frameClearColor = simd_make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+        panelBatches.assign(panel->layer.batches.begin(), panel->layer.batches.end());
+        for (DrawRecorder::DrawBatch& batch : panelBatches) batch.layer = &panel->layer;
+        setupShapes(recorder, panelBatches.data(), (int)panelBatches.size(), DrawRecorder::cachedPanelProjection(*panel));
+        queueAllTiles();
+        shadeShapes();
+
+        cached.image.width = textureWidth;
+        cached.image.height = textureHeight;
+        cached.image.levels.assign(1, (MipLevel){ .width = textureWidth, .height = textureHeight, .offset = 0 });
+        cached.image.pixels = framebuffer;
+        cached.generation = panel->layer.generation;
+    }
+    if (framebufferWidth != frameWidth || framebufferHeight != frameHeight) setFramebufferSize(frameWidth, frameHeight);
+    if (isFramebufferSaved) framebuffer.swap(framePixels);
+
+    for (auto it = cachedPanelImages.begin(); it != cachedPanelImages.end();) {
+        it = it->second.isDrawn ? std::next(it) : cachedPanelImages.erase(it);
+    }
+}
+
+void SoftwareRasterizer::shadeShapes()
+{
+    nextTileIndex.store(0, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        ++jobGeneration;
+        busyWorkerCount = (int)workers.size();
+    }
+    jobStarted.notify_all();
+
+    shadeTiles(0);
+
+    std::unique_lock<std::mutex> lock(jobMutex);
+    jobFinished.wait(lock, [this] { return busyWorkerCount == 0; });
+}
+
+void SoftwareRasterizer::workerLoop(int workerIndex)
+{
+    Profiler::setThreadName("Raster Worker");
+    uint64_t seenGeneration = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobStarted.wait(lock, [this, seenGeneration] { return isShuttingDown || jobGeneration != seenGeneration; });
+            if (isShuttingDown) return;
+            seenGeneration = jobGeneration;
+        }
+
+        shadeTiles(workerIndex);
+
+        std::lock_guard<std::mutex> lock(jobMutex);
+        if (--busyWorkerCount == 0) jobFinished.notify_one();
+    }
+}
+
+void SoftwareRasterizer::shadeTiles(int workerIndex)
+{
+    PROFILE_ZONE("Raster Tiles");
+    SoftwareRasterizerQuad* tilePixels = tileBuffers[workerIndex].data();
+    const int queuedCount = (int)queuedTiles.size();
+    for (int iQueued = nextTileIndex.fetch_add(1, std::memory_order_relaxed); iQueued < queuedCount;
+         iQueued = nextTileIndex.fetch_add(1, std::memory_order_relaxed)) {
+        shadeTile(queuedTiles[iQueued], tilePixels);
+    }
+}
+
+
+// MARK: - Setup and binning
+void SoftwareRasterizer::setupShapes(const DrawRecorder& recorder, const DrawRecorder::DrawBatch* batches, int batchCount, simd_float4x4 viewProjection)
+{
+    PROFILE_ZONE("Raster Setup");
+    shapes.clear();
+    for (std::vector<uint32_t>& bin : tileBins) bin.clear();
+    DrawRecorder::clipRectPixelBounds(recorder.clipRects, viewProjection, framebufferWidth, framebufferHeight, clipBounds);
+    DrawRecorder::clipRectPixelBounds(recorder.clipRects, recorder.projectionMatrix, framebufferWidth, framebufferHeight, screenClipBounds);
+    const DrawRecorder::Layer* boundsLayer = nullptr;
+    bool isBoundsLayerScreenSpace = false;
+
+    for (int iBatch = 0; iBatch < batchCount; ++iBatch) {
+        const DrawRecorder::DrawBatch batch = batches[iBatch];
+        const int endIndex = batch.startIndex + batch.count;
+        // Screen space batches (only ever in the frame, never in a panel) skip the camera.
+        const simd_float4x4 batchProjection = batch.isScreenSpace ? recorder.projectionMatrix : viewProjection;
+        // Layer instances index the layer's own clip rects.
+        if (batch.layer && (batch.layer != boundsLayer || batch.isScreenSpace != isBoundsLayerScreenSpace)) {
+            DrawRecorder::clipRectPixelBounds(batch.layer->clipRects, batchProjection, framebufferWidth, framebufferHeight, layerClipBounds);
+            boundsLayer = batch.layer;
+            isBoundsLayerScreenSpace = batch.isScreenSpace;
+        }
+        const std::vector<simd_float4>& batchBounds = batch.layer ? layerClipBounds : batch.isScreenSpace ? screenClipBounds : clipBounds;
+        switch (batch.type) {
+            case DrawRecorder::drawbatchtype_atlas: {
+                // Transforms are world space, the camera goes on here like in the vertex stage.
+                const AtlasInstanceData* instances = recorder.batchAtlasInstances(batch);
+                const RasterShapeKind kind = batch.panel ? rastershapekind_panel : rastershapekind_atlas;
+                const MipChain* texture = batch.panel ? &cachedPanelImages.at(batch.panel).image : atlasTexture;
+                for (int i = batch.startIndex; i < endIndex; ++i) {
+                    addQuadShape(kind, &instances[i], texture, simd_mul(batchProjection, instances[i].transform), batchBounds[instances[i].clipIndex]);
+                }
+            } break;
+            case DrawRecorder::drawbatchtype_primitive: {
+                const PrimitiveInstanceData* instances = recorder.batchPrimitiveInstances(batch);
+                for (int i = batch.startIndex; i < endIndex; ++i) {
+                    addQuadShape(rastershapekind_primitive, &instances[i], nullptr, simd_mul(batchProjection, instances[i].transform), batchBounds[instances[i].clipIndex]);
+                }
+            } break;
+            case DrawRecorder::drawbatchtype_text: {
+                const TextVertex* vertices = recorder.batchTextVertices(batch);
+                for (int i = batch.startIndex; i + 2 < endIndex; i += 3) {
+                    addTriangleShape(vertices + i, batchProjection);
+                }
+            } break;
+            case DrawRecorder::drawbatchtype_none:
+            case DrawRecorder::drawbatchtype_count: {
+                __builtin_printf("Draw Batch with invalid type %d\n", (int)batch.type);
+                assert(false);
+            } break;
+        }
+    }
+}
+
+void SoftwareRasterizer::addQuadShape(RasterShapeKind kind, const void* source, const MipChain* texture, simd_float4x4 clipTransform, simd_float4 clip)
+{
+    // Quad space -> clip space -> pixels (y down), as one 2D affine transform.
+    const DrawRecorder::QuadPixelMapping mapping = DrawRecorder::quadPixelMapping(clipTransform, framebufferWidth, framebufferHeight);
+    const float a00 = mapping.a00, a01 = mapping.a01, a10 = mapping.a10, a11 = mapping.a11;
+    const float det = a00 * a11 - a01 * a10;
+    if (std::fabs(det) < 1e-12f) return; // degenerate, covers nothing
+
+    RasterShape shape;
+    shape.minX = std::clamp((int)std::floor(mapping.bounds.x), 0, framebufferWidth);
+    shape.minY = std::clamp((int)std::floor(mapping.bounds.y), 0, framebufferHeight);
+    shape.maxX = std::clamp((int)std::ceil(mapping.bounds.z), 0, framebufferWidth);
+    shape.maxY = std::clamp((int)std::ceil(mapping.bounds.w), 0, framebufferHeight);
+    // Pixels whose centre is inside the clip rect.
+    shape.minX = std::max(shape.minX, (int)std::ceil(clip.x - 0.5f));
+    shape.minY = std::max(shape.minY, (int)std::ceil(clip.y - 0.5f));
+    shape.maxX = std::min(shape.maxX, (int)std::ceil(clip.z - 0.5f));
+    shape.maxY = std::min(shape.maxY, (int)std::ceil(clip.w - 0.5f));
+    if (shape.minX >= shape.maxX || shape.minY >= shape.maxY) return; // off screen or clipped out
+
+    const float inverseDet = 1.0f / det;
+    shape.kind = kind;
+    shape.source = source;
+    shape.texture = texture;
+    shape.setup[0] = a11 * inverseDet;
+    shape.setup[1] = -a01 * inverseDet;
+    shape.setup[2] = -a10 * inverseDet;
+    shape.setup[3] = a00 * inverseDet;
+    shape.setup[4] = mapping.tx;
+    shape.setup[5] = mapping.ty;
+    shape.topLeftEdges = 0;
+    shape.clipBounds = clip;
+    shapes.push_back(shape);
+    binShape((uint32_t)shapes.size() - 1);
+}
+
+void SoftwareRasterizer::addTriangleShape(const TextVertex* vertices, simd_float4x4 projection)
+{
+    const float halfWidth = framebufferWidth * 0.5f;
+    const float halfHeight = framebufferHeight * 0.5f;
+    float sx[3], sy[3];
+    for (int iVertex = 0; iVertex < 3; ++iVertex) {
+        const simd_float2 position = vertices[iVertex].position;
+        const simd_float4 clip = simd_mul(projection, simd_make_float4(position.x, position.y, 0.0f, 1.0f));
+        sx[iVertex] = (clip.x + 1.0f) * halfWidth;
+        sy[iVertex] = (1.0f - clip.y) * halfHeight;
+    }
+
+    const float area = (sx[2] - sx[1]) * (sy[0] - sy[1]) - (sy[2] - sy[1]) * (sx[0] - sx[1]);
+    if (std::fabs(area) < 1e-12f) return;
+
+    RasterShape shape;
+    shape.minX = std::clamp((int)std::floor(std::min({ sx[0], sx[1], sx[2] })), 0, framebufferWidth);
+    shape.minY = std::clamp((int)std::floor(std::min({ sy[0], sy[1], sy[2] })), 0, framebufferHeight);
+    shape.maxX = std::clamp((int)std::ceil(std::max({ sx[0], sx[1], sx[2] })), 0, framebufferWidth);
+    shape.maxY = std::clamp((int)std::ceil(std::max({ sy[0], sy[1], sy[2] })), 0, framebufferHeight);
+    if (shape.minX >= shape.maxX || shape.minY >= shape.maxY) return;
+
+    shape.kind = rastershapekind_text;
+    shape.source = vertices;
+    shape.texture = fontTexture;
+    shape.topLeftEdges = 0;
+    // Edge opposite vertex k, divided by the signed area so it's the barycentric weight of k and positive inside
+    // whatever the winding.
+    const float inverseArea = 1.0f / area;
+    for (int k = 0; k < 3; ++k) {
+        const int i = (k + 1) % 3;
+        const int j = (k + 2) % 3;
+        const float a = -(sy[j] - sy[i]) * inverseArea;
+        const float b = (sx[j] - sx[i]) * inverseArea;
+        shape.setup[k * 3 + 0] = a;
+        shape.setup[k * 3 + 1] = b;
+        shape.setup[k * 3 + 2] = -(a * sx[i] + b * sy[i]);
+        // Top-left rule, so pixels on the diagonal shared by a glyph's two triangles are only shaded once.
+        if (a > 0.0f || (a == 0.0f && b > 0.0f)) shape.topLeftEdges |= 1u << k;
+    }
+    shapes.push_back(shape);
+    binShape((uint32_t)shapes.size() - 1);
+}
+
+void SoftwareRasterizer::binShape(uint32_t shapeIndex)
+{
+    const RasterShape& shape = shapes[shapeIndex];
+    const int tileX0 = shape.minX / tileSize, tileX1 = (shape.maxX - 1) / tileSize;
+    const int tileY0 = shape.minY / tileSize, tileY1 = (shape.maxY - 1) / tileSize;
+    for (int tileY = tileY0; tileY <= tileY1; ++tileY) {
+        for (int tileX = tileX0; tileX <= tileX1; ++tileX) {
+            tileBins[(size_t)tileY * tileCountX + tileX].push_back(shapeIndex);
+        }
+    }
+}
+
+
+// MARK: - Shading
+void SoftwareRasterizer::shadeTile(int tileIndex, SoftwareRasterizerQuad* tilePixels)
+{
+    const int tileX = (tileIndex % tileCountX) * tileSize;
+    const int tileY = (tileIndex / tileCountX) * tileSize;
+    const int pixelEndX = std::min(tileX + tileSize, framebufferWidth);
+    const int pixelEndY = std::min(tileY + tileSize, framebufferHeight);
+    const std::vector<uint32_t>& bin = tileBins[tileIndex];
+
+    // Nothing drawn here, straight to the clear color.
+    if (bin.empty()) {
+        const uint8_t clearPixel[4] = {
+            (uint8_t)(std::clamp(frameClearColor.x, 0.0f, 1.0f) * 255.0f + 0.5f),
+            (uint8_t)(std::clamp(frameClearColor.y, 0.0f, 1.0f) * 255.0f + 0.5f),
+            (uint8_t)(std::clamp(frameClearColor.z, 0.0f, 1.0f) * 255.0f + 0.5f),
+            (uint8_t)(std::clamp(frameClearColor.w, 0.0f, 1.0f) * 255.0f + 0.5f),
+        };
+        for (int y = tileY; y < pixelEndY; ++y) {
+            uint8_t* pixel = framebuffer.data() + ((size_t)y * framebufferWidth + tileX) * 4;
+            for (int x = tileX; x < pixelEndX; ++x, pixel += 4) memcpy(pixel, clearPixel, 4);
+        }
+        return;
+    }
+
+    const int quadCount = (tileSize / 2) * (tileSize / 2);
+    const SoftwareRasterizerQuad clearQuad = {
+        splat(frameClearColor.x), splat(frameClearColor.y), splat(frameClearColor.z), splat(frameClearColor.w)
+    };
+    for (int iQuad = 0; iQuad < quadCount; ++iQuad) tilePixels[iQuad] = clearQuad;
+
+    for (const uint32_t shapeIndex : bin) {
+        const RasterShape& shape = shapes[shapeIndex];
+        switch (shape.kind) {
+            case rastershapekind_atlas:
+            case rastershapekind_panel: shadeAtlasQuad(shape, tileX, tileY, tilePixels); break;
+            case rastershapekind_primitive: shadePrimitiveQuad(shape, tileX, tileY, tilePixels); break;
+            case rastershapekind_text: shadeTextTriangle(shape, tileX, tileY, tilePixels); break;
+        }
+    }
+
+    // Resolve to RGBA8, rounding like a unorm store.
+    for (int y = tileY; y < pixelEndY; ++y) {
+        const SoftwareRasterizerQuad* quadRow = tilePixels + ((y - tileY) / 2) * (tileSize / 2);
+        const int laneRow = ((y - tileY) & 1) * 2;
+        uint8_t* pixel = framebuffer.data() + ((size_t)y * framebufferWidth + tileX) * 4;
+        for (int x = tileX; x < pixelEndX; ++x, pixel += 4) {
+            const SoftwareRasterizerQuad& quad = quadRow[(x - tileX) / 2];
+            const int lane = laneRow + ((x - tileX) & 1);
+            pixel[0] = (uint8_t)(std::clamp(quad.r[lane], 0.0f, 1.0f) * 255.0f + 0.5f);
+            pixel[1] = (uint8_t)(std::clamp(quad.g[lane], 0.0f, 1.0f) * 255.0f + 0.5f);
+            pixel[2] = (uint8_t)(std::clamp(quad.b[lane], 0.0f, 1.0f) * 255.0f + 0.5f);
+            pixel[3] = (uint8_t)(std::clamp(quad.a[lane], 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+}
+
+// Visits the 2x2 quads of the tile that the shape's bounds touch. Quads are aligned to even pixels, the tile origin is.
+#define FOR_EACH_TILE_QUAD(shape, tileX, tileY, x, y) \
+    for (int y = (std::max((shape).minY, (tileY)) & ~1); y < std::min((shape).maxY, (tileY) + tileSize); y += 2) \
+        for (int x = (std::max((shape).minX, (tileX)) & ~1); x < std::min((shape).maxX, (tileX) + tileSize); x += 2)
+
+static inline SoftwareRasterizerQuad& tileQuad(SoftwareRasterizerQuad* tilePixels, int tileX, int tileY, int x, int y)
+{
+    return tilePixels[((y - tileY) / 2) * (SoftwareRasterizer::tileSize / 2) + (x - tileX) / 2];
+}
+
+void SoftwareRasterizer::shadeAtlasQuad(const RasterShape& shape, int tileX, int tileY, SoftwareRasterizerQuad* tilePixels)
+{
+    if (!shape.texture) return;
+    const MipChain& texture = *shape.texture;
+    const bool isPanel = shape.kind == rastershapekind_panel;
+    const AtlasInstanceData& instance = *static_cast<const AtlasInstanceData*>(shape.source);
+    const float* s = shape.setup;
+    const simd_float2 uvRange = instance.uvMax - instance.uvMin;
+
+    FOR_EACH_TILE_QUAD(shape, tileX, tileY, x, y) {
+        const RasterFloat4 px = quadCentersX(x);
+        const RasterFloat4 py = quadCentersY(y);
+        const RasterFloat4 dx = px - s[4];
+        const RasterFloat4 dy = py - s[5];
+        const RasterFloat4 localX = s[0] * dx + s[1] * dy;
+        const RasterFloat4 localY = s[2] * dx + s[3] * dy;
+        const RasterInt4 coverage = (localX >= -0.5f) & (localX < 0.5f) & (localY >= -0.5f) & (localY < 0.5f)
+                                  & quadClipCoverage(shape.clipBounds, px, py);
+        if (!anyLane(coverage)) continue;
+
+        // vertex_atlas: mix(uvMin, uvMax, vertex uv), where the quad's vertex uv is (x + 0.5, 0.5 - y).
+        const RasterFloat4 u = instance.uvMin.x + uvRange.x * (localX + 0.5f);
+        const RasterFloat4 v = instance.uvMin.y + uvRange.y * (0.5f - localY);
+        // Panel images have no mips, their sampler is bilinear from level 0 either way.
+        const float lod = isPanel ? -1.0f : quadLod(texture, u, v);
+
+        RasterFloat4 r, g, b, a;
+        for (int lane = 0; lane < 4; ++lane) {
+            // Atlas sampler: nearest mag (no bleeding from neighbouring sprites), linear min and mip.
+            const simd_float4 texel = sampleTexture(texture, u[lane], v[lane], lod, isPanel);
+            r[lane] = texel.x * instance.color.x;
+            g[lane] = texel.y * instance.color.y;
+            b[lane] = texel.z * instance.color.z;
+            a[lane] = texel.w * instance.color.w;
+        }
+        blendQuad(tileQuad(tilePixels, tileX, tileY, x, y), coverage, r, g, b, a, isPanel || DrawRecorder::premultipliedAlpha);
+    }
+}
+
+void SoftwareRasterizer::shadePrimitiveQuad(const RasterShape& shape, int tileX, int tileY, SoftwareRasterizerQuad* tilePixels)
+{
+    const PrimitiveInstanceData& instance = *static_cast<const PrimitiveInstanceData*>(shape.source);
+    const float* s = shape.setup;
+    const simd_float4 params = instance.sdfParams;
+    simd_float4 color = instance.color;
+    if (instance.shapeType == ShapeTypeNone) color = simd_make_float4(1.0f, 0.0f, 1.0f, 1.0f); // magenta shows unset shape types
+
+    FOR_EACH_TILE_QUAD(shape, tileX, tileY, x, y) {
+        const RasterFloat4 px = quadCentersX(x);
+        const RasterFloat4 py = quadCentersY(y);
+        const RasterFloat4 dx = px - s[4];
+        const RasterFloat4 dy = py - s[5];
+        const RasterFloat4 uvX = s[0] * dx + s[1] * dy;
+        const RasterFloat4 uvY = s[2] * dx + s[3] * dy;
+        const RasterInt4 coverage = (uvX >= -0.5f) & (uvX < 0.5f) & (uvY >= -0.5f) & (uvY < 0.5f)
+                                  & quadClipCoverage(shape.clipBounds, px, py);
+        if (!anyLane(coverage)) continue;
+
+        // Same SDFs as fragment_primitive, see it for the reasoning behind each.
+        RasterFloat4 alpha = splat(1.0f);
+        switch (instance.shapeType) {
+            case ShapeTypeRoundedRect: {
+                const float radius = std::min(params.z, std::min(params.x, params.y));
+                const RasterFloat4 dX = abs4(uvX * params.x * 2.0f) - (params.x - radius);
+                const RasterFloat4 dY = abs4(uvY * params.y * 2.0f) - (params.y - radius);
+                const RasterFloat4 dist = length4(max4(dX, splat(0.0f)), max4(dY, splat(0.0f))) - radius;
+                alpha = smoothstep4(0.5f, -0.5f, dist);
+            } break;
+            case ShapeTypeRectLines: {
+                const float thickness = std::max(params.z, 1.0f);
+                const RasterFloat4 dX = abs4(uvX * params.x * 2.0f) - params.x + thickness;
+                const RasterFloat4 dY = abs4(uvY * params.y * 2.0f) - params.y + thickness;
+                const RasterFloat4 dist = length4(max4(dX, splat(0.0f)), max4(dY, splat(0.0f))) + min4(max4(dX, dY), splat(0.0f));
+                alpha = smoothstep4(-0.5f, 0.5f, dist);
+            } break;
+            case ShapeTypeCircle: {
+                const float radius = params.x;
+                const float edge = std::max(params.y, 0.5f);
+                const RasterFloat4 dist = length4(uvX * radius * 2.0f, uvY * radius * 2.0f) - radius;
+                alpha = smoothstep4(edge, -edge, dist);
+            } break;
+            case ShapeTypeCircleLines: {
+                const float radius = params.x;
+                const float edge = std::max(params.y, 0.5f);
+                const float halfThickness = std::max(params.z, 1.0f);
+                const RasterFloat4 dist = length4(uvX * radius * 2.0f, uvY * radius * 2.0f) - radius;
+                alpha = smoothstep4(edge, -edge, abs4(dist + halfThickness) - halfThickness);
+            } break;
+            default: break; // None and Rect are solid
+        }
+
+        if (DrawRecorder::premultipliedAlpha) {
+            blendQuad(tileQuad(tilePixels, tileX, tileY, x, y), coverage, color.x * alpha, color.y * alpha, color.z * alpha, color.w * alpha, true);
+        } else {
+            blendQuad(tileQuad(tilePixels, tileX, tileY, x, y), coverage, splat(color.x), splat(color.y), splat(color.z), color.w * alpha, false);
+        }
+    }
+}
+
+void SoftwareRasterizer::shadeTextTriangle(const RasterShape& shape, int tileX, int tileY, SoftwareRasterizerQuad* tilePixels)
+{
+    if (!fontTexture) return;
+    const TextVertex* vertices = static_cast<const TextVertex*>(shape.source);
+    const float* s = shape.setup;
+    const float distanceRange = frameRecorder->fontAtlas.atlas.distanceRange;
+
+    FOR_EACH_TILE_QUAD(shape, tileX, tileY, x, y) {
+        const RasterFloat4 px = quadCentersX(x);
+        const RasterFloat4 py = quadCentersY(y);
+        const RasterFloat4 w0 = s[0] * px + s[1] * py + s[2];
+        const RasterFloat4 w1 = s[3] * px + s[4] * py + s[5];
+        const RasterFloat4 w2 = s[6] * px + s[7] * py + s[8];
+        const RasterInt4 coverage = ((shape.topLeftEdges & 1u) ? (w0 >= 0.0f) : (w0 > 0.0f))
+                                  & ((shape.topLeftEdges & 2u) ? (w1 >= 0.0f) : (w1 > 0.0f))
+                                  & ((shape.topLeftEdges & 4u) ? (w2 >= 0.0f) : (w2 > 0.0f));
+        if (!anyLane(coverage)) continue;
+
+        const RasterFloat4 u = w0 * vertices[0].uv.x + w1 * vertices[1].uv.x + w2 * vertices[2].uv.x;
+        const RasterFloat4 v = w0 * vertices[0].uv.y + w1 * vertices[1].uv.y + w2 * vertices[2].uv.y;
+        const float lod = quadLod(*fontTexture, u, v);
+
+        // sd for every lane first, helper lanes included, fwidth needs the whole quad.
+        RasterFloat4 sd;
+        for (int lane = 0; lane < 4; ++lane) {
+            const simd_float4 msdf = sampleTexture(*fontTexture, u[lane], v[lane], lod, true);
+            sd[lane] = std::max(std::min(msdf.x, msdf.y), std::min(std::max(msdf.x, msdf.y), msdf.z)); // median3
+        }
+        const RasterFloat4 screenPxRange = max4(abs4(quadDdx(sd)) + abs4(quadDdy(sd)), splat(1e-4f));
+        const RasterFloat4 edgeOffset = screenPxRange / distanceRange;
+        const RasterFloat4 alpha = smoothstep4(0.5f - edgeOffset, 0.5f + edgeOffset, sd);
+
+        const simd_float4 c0 = vertices[0].textColor, c1 = vertices[1].textColor, c2 = vertices[2].textColor;
+        const RasterFloat4 r = w0 * c0.x + w1 * c1.x + w2 * c2.x;
+        const RasterFloat4 g = w0 * c0.y + w1 * c1.y + w2 * c2.y;
+        const RasterFloat4 b = w0 * c0.z + w1 * c1.z + w2 * c2.z;
+        const RasterFloat4 a = w0 * c0.w + w1 * c1.w + w2 * c2.w;
+        if (DrawRecorder::premultipliedAlpha) {
+            blendQuad(tileQuad(tilePixels, tileX, tileY, x, y), coverage, r * alpha, g * alpha, b * alpha, a * alpha, true);
+        } else {
+            blendQuad(tileQuad(tilePixels, tileX, tileY, x, y), coverage, r, g, b, a * alpha, false);
+        }
+    }
+}
@@ -0,0 +1,147 @@
+//
+//  SoftwareRasterizer.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef SoftwareRasterizer_hpp
+#define SoftwareRasterizer_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "DamageTracker.hpp"
+#include "DrawRecorder.hpp"
+#include "TextureMips.hpp"
+
+// 4 lanes = one 2x2 pixel quad, same as a GPU shades fragments, so derivatives (mip selection, fwidth) come from the
+// neighbouring lanes. GCC vector extensions, clang and GCC both take them.
+typedef float RasterFloat4 __attribute__((__vector_size__(16)));
+typedef int32_t RasterInt4 __attribute__((__vector_size__(16)));
+
+// 2x2 pixels of a tile, lane order top-left, top-right, bottom-left, bottom-right.
+struct SoftwareRasterizerQuad {
+    RasterFloat4 r, g, b, a;
+};
+
+// CPU backend for the three shaders: fragment_primitive's SDFs, fragment_atlas's texture sampling and fragment_text's
+// MSDF median / smoothstep, blended the way the pipelines blend. Draws are binned into screen tiles, then tiles are
+// shaded in parallel on a thread pool, 2x2 quads at a time. Output is RGBA8, top row first.
+// Headless golden images and a fallback when there is no GPU, or its throughput as a benchmark.
+class SoftwareRasterizer
+{
+public:
+    static const int tileSize = 64;
+
+    // threadCount 0 uses every hardware thread, the calling thread always shades too.
+    SoftwareRasterizer(int width, int height, int threadCount = 0);
+    ~SoftwareRasterizer();
+
+    void resize(int width, int height);
+    // Textures are borrowed, they have to outlive render(). Atlas texels are expected premultiplied when
+    // DrawRecorder::premultipliedAlpha is on, same as the Metal textures.
+    void setAtlasTexture(const MipChain* texture) { atlasTexture = texture; }
+    void setFontTexture(const MipChain* texture) { fontTexture = texture; }
+
+    // Draws everything recorded since the recorder's last beginFrame, in batch order. Blocks until done.
+    void render(const DrawRecorder& recorder, simd_float4 clearColor);
+    // Partial redraw: render() only shades the tiles damaged since the last render, the rest of the framebuffer is
+    // left as it was. The result is the same as a full render.
+    void setPartialRedraw(bool isEnabled) { isPartialRedraw = isEnabled; damageTracker.invalidate(); }
+    const DamageTracker& damage() const { return damageTracker; } // the last render's, partial redraw only
+
+    int width() const { return framebufferWidth; }
+    int height() const { return framebufferHeight; }
+    int threadCount() const { return (int)workers.size() + 1; }
+    const uint8_t* pixels() const { return framebuffer.data(); }
+
+private:
+    enum RasterShapeKind : uint32_t {
+        rastershapekind_atlas = 0,
+        rastershapekind_primitive,
+        rastershapekind_text,
+        rastershapekind_panel, // atlas instance compositing a cached panel's image
+    };
+
+    // One instance quad or one text triangle, set up in screen space.
+    struct RasterShape {
+        int minX, minY, maxX, maxY; // pixel bounds, max exclusive
+        RasterShapeKind kind;
+        const void* source; // the instance, or the triangle's first vertex, in the frame or a layer
+        const MipChain* texture; // atlas and panel quads
+        // Quads: screen -> quad space affine (2x2 then translation). Text: 3 edge functions (a, b, c), normalised to
+        // give barycentrics directly.
+        float setup[9];
+        uint32_t topLeftEdges; // text only, bit per edge that owns pixels exactly on it
+        simd_float4 clipBounds; // framebuffer pixels, min inclusive / max exclusive, tested at pixel centres
+    };
+
+    int framebufferWidth = 0;
+    int framebufferHeight = 0;
+    int tileCountX = 0;
+    int tileCountY = 0;
+    std::vector<uint8_t> framebuffer;
+
+    const MipChain* atlasTexture = nullptr;
+    const MipChain* fontTexture = nullptr;
+
+    // Per frame, set up by render() before the workers start.
+    const DrawRecorder* frameRecorder = nullptr;
+    simd_float4 frameClearColor = {0.0f, 0.0f, 0.0f, 1.0f};
+    std::vector<RasterShape> shapes;
+    std::vector<simd_float4> clipBounds; // DrawRecorder::clipRects in framebuffer pixels
+    std::vector<simd_float4> screenClipBounds; // same for isScreenSpace batches
+    std::vector<simd_float4> layerClipBounds; // same for the layer being set up
+    std::vector<std::vector<uint32_t>> tileBins;
+    std::vector<int> queuedTiles; // what shadeShapes shades, every tile unless a partial redraw left some undamaged
+
+    // MARK: - Partial Redraw
+    static_assert(DamageTracker::tileSize == tileSize, "damage is tracked per rasterizer tile");
+    bool isPartialRedraw = false;
+    DamageTracker damageTracker;
+    void setFramebufferSize(int width, int height); // resize() without invalidating the damage, for panel images
+    void queueAllTiles();
+
+    // MARK: - Cached Panels
+    // Panel images, rendered at the start of render() by this same rasterizer, resized to the panel's texture, whenever
+    // their layer was rebuilt. One level, like the Metal textures. Dropped when a render doesn't draw the panel.
+    struct CachedPanelImage {
+        MipChain image;
+        uint64_t generation = 0;
+        bool isDrawn = false;
+    };
+    std::map<const DrawRecorder::CachedPanel*, CachedPanelImage> cachedPanelImages;
+    void renderCachedPanels(const DrawRecorder& recorder);
+
+    // MARK: - Thread pool
+    std::vector<std::thread> workers;
+    std::vector<std::vector<SoftwareRasterizerQuad>> tileBuffers; // one per participating thread
+    std::mutex jobMutex;
+    std::condition_variable jobStarted;
+    std::condition_variable jobFinished;
+    uint64_t jobGeneration = 0;
+    int busyWorkerCount = 0;
+    bool isShuttingDown = false;
+    std::atomic<int> nextTileIndex = 0;
+
+    void workerLoop(int workerIndex);
+    void shadeTiles(int workerIndex);
+    void shadeShapes(); // on every thread, blocks until done
+
+    void setupShapes(const DrawRecorder& recorder, const DrawRecorder::DrawBatch* batches, int batchCount, simd_float4x4 viewProjection);
+    void addQuadShape(RasterShapeKind kind, const void* source, const MipChain* texture, simd_float4x4 clipTransform, simd_float4 clip);
+    void addTriangleShape(const TextVertex* vertices, simd_float4x4 projection);
+    void binShape(uint32_t shapeIndex);
+
+    void shadeTile(int tileIndex, SoftwareRasterizerQuad* tilePixels);
+    void shadeAtlasQuad(const RasterShape& shape, int tileX, int tileY, SoftwareRasterizerQuad* tilePixels);
+    void shadePrimitiveQuad(const RasterShape& shape, int tileX, int tileY, SoftwareRasterizerQuad* tilePixels);
+    void shadeTextTriangle(const RasterShape& shape, int tileX, int tileY, SoftwareRasterizerQuad* tilePixels);
+};
+
+#endif /* SoftwareRasterizer_hpp */
@@ -0,0 +1,208 @@
+//
+//  TextureMips.cpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#include "TextureMips.hpp"
+#include "PlatformTypes.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+// NOTE: Bump whenever the filtering or the file layout changes, invalidates every cached chain on disk.
+static const uint32_t mipCacheMagic = 0x4350494d; // "MIPC"
+static const uint32_t mipCacheVersion = 1;
+
+struct MipCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t assetKey;
+    int32_t width;
+    int32_t height;
+    int32_t levelCount;
+    int32_t __padding;
+};
+
+struct LevelRect {
+    int x0, y0, x1, y1; // x1, y1 exclusive
+};
+
+int mipLevelCountForSize(int width, int height)
+{
+    int count = 1;
+    int size = std::max(width, height);
+    while (size > 1) {
+        size >>= 1;
+        ++count;
+    }
+    return count;
+}
+
+static inline simd_uchar4 loadPixel(const uint8_t* src)
+{
+    simd_uchar4 pixel;
+    memcpy(&pixel, src, sizeof(pixel));
+    return pixel;
+}
+
+static inline simd_uchar4 boxFilter(simd_uchar4 a, simd_uchar4 b, simd_uchar4 c, simd_uchar4 d)
+{
+    // Widen so the 4 texel sum can't overflow, +2 to round to nearest.
+    const simd_ushort4 sum = simd_ushort(a) + simd_ushort(b) + simd_ushort(c) + simd_ushort(d) + 2;
+    return simd_uchar(sum >> 2);
+}
+
+static inline LevelRect regionRectForLevel(const TextureRegion& region, int level, int levelWidth, int levelHeight)
+{
+    LevelRect rect;
+    rect.x0 = std::min(region.x >> level, levelWidth - 1);
+    rect.y0 = std::min(region.y >> level, levelHeight - 1);
+    rect.x1 = std::min(std::max(rect.x0 + 1, (region.x + region.width) >> level), levelWidth);
+    rect.y1 = std::min(std::max(rect.y0 + 1, (region.y + region.height) >> level), levelHeight);
+    return rect;
+}
+
+static void downsampleRect(const uint8_t* src, int srcWidth, const LevelRect& srcRect,
+                           uint8_t* dst, int dstWidth, const LevelRect& dstRect)
+{
+    for (int y = dstRect.y0; y < dstRect.y1; ++y) {
+        const int sy0 = std::clamp(y * 2, srcRect.y0, srcRect.y1 - 1);
+        const int sy1 = std::clamp(y * 2 + 1, srcRect.y0, srcRect.y1 - 1);
+        const uint8_t* row0 = src + (size_t)sy0 * srcWidth * 4;
+        const uint8_t* row1 = src + (size_t)sy1 * srcWidth * 4;
+        uint8_t* dstRow = dst + (size_t)y * dstWidth * 4;
+
+        for (int x = dstRect.x0; x < dstRect.x1; ++x) {
+            const int sx0 = std::clamp(x * 2, srcRect.x0, srcRect.x1 - 1);
+            const int sx1 = std::clamp(x * 2 + 1, srcRect.x0, srcRect.x1 - 1);
+            const simd_uchar4 result = boxFilter(loadPixel(row0 + sx0 * 4), loadPixel(row0 + sx1 * 4),
+                                                 loadPixel(row1 + sx0 * 4), loadPixel(row1 + sx1 * 4));
+            memcpy(dstRow + x * 4, &result, sizeof(result));
+        }
+    }
+}
+
+void generateMipChain(const uint8_t* rgbaPixels, int width, int height, const std::vector<TextureRegion>& regions, MipChain& outChain)
+{
+    assert(rgbaPixels);
+    assert(width > 0 && height > 0);
+
+    const int levelCount = mipLevelCountForSize(width, height);
+    outChain.width = width;
+    outChain.height = height;
+    outChain.levels.resize(levelCount);
+
+    size_t totalBytes = 0;
+    for (int iLevel = 0; iLevel < levelCount; ++iLevel) {
+        const int levelWidth = std::max(1, width >> iLevel);
+        const int levelHeight = std::max(1, height >> iLevel);
+        outChain.levels[iLevel] = (MipLevel){ .width = levelWidth, .height = levelHeight, .offset = totalBytes };
+        totalBytes += (size_t)levelWidth * levelHeight * 4;
+    }
+    outChain.pixels.resize(totalBytes);
+    memcpy(outChain.pixels.data(), rgbaPixels, (size_t)width * height * 4);
+
+    for (int iLevel = 1; iLevel < levelCount; ++iLevel) {
+        const MipLevel& srcLevel = outChain.levels[iLevel - 1];
+        const MipLevel& dstLevel = outChain.levels[iLevel];
+        const uint8_t* src = outChain.pixels.data() + srcLevel.offset;
+        uint8_t* dst = outChain.pixels.data() + dstLevel.offset;
+
+        // Whole level first, this covers the gaps between regions.
+        const LevelRect srcFull = { 0, 0, srcLevel.width, srcLevel.height };
+        const LevelRect dstFull = { 0, 0, dstLevel.width, dstLevel.height };
+        downsampleRect(src, srcLevel.width, srcFull, dst, dstLevel.width, dstFull);
+
+        // Then redo every region clamped to its own texels.
+        for (const TextureRegion& region : regions) {
+            const LevelRect srcRect = regionRectForLevel(region, iLevel - 1, srcLevel.width, srcLevel.height);
+            const LevelRect dstRect = regionRectForLevel(region, iLevel, dstLevel.width, dstLevel.height);
+            downsampleRect(src, srcLevel.width, srcRect, dst, dstLevel.width, dstRect);
+        }
+    }
+}
+
+void premultiplyAlpha(uint8_t* rgbaPixels, size_t pixelCount)
+{
+    for (size_t i = 0; i < pixelCount; ++i) {
+        uint8_t* pixel = rgbaPixels + i * 4;
+        const simd_ushort4 color = simd_ushort(loadPixel(pixel));
+        // Exact round(c * a / 255) without a divide.
+        simd_ushort4 result = color * color[3] + 128;
+        result = (result + (result >> 8)) >> 8;
+        result[3] = color[3];
+        const simd_uchar4 packed = simd_uchar(result);
+        memcpy(pixel, &packed, sizeof(packed));
+    }
+}
+
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+bool loadMipChainCache(const std::string& cachePath, uint64_t assetKey, MipChain& outChain)
+{
+    FILE* file = fopen(cachePath.c_str(), "rb");
+    if (!file) return false;
+
+    MipCacheHeader header = {};
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+        && header.magic == mipCacheMagic
+        && header.version == mipCacheVersion
+        && header.assetKey == assetKey
+        && header.width > 0 && header.height > 0
+        && header.levelCount == mipLevelCountForSize(header.width, header.height);
+
+    if (valid) {
+        outChain.width = header.width;
+        outChain.height = header.height;
+        outChain.levels.resize(header.levelCount);
+        size_t totalBytes = 0;
+        for (int iLevel = 0; iLevel < header.levelCount; ++iLevel) {
+            const int levelWidth = std::max(1, header.width >> iLevel);
+            const int levelHeight = std::max(1, header.height >> iLevel);
+            outChain.levels[iLevel] = (MipLevel){ .width = levelWidth, .height = levelHeight, .offset = totalBytes };
+            totalBytes += (size_t)levelWidth * levelHeight * 4;
+        }
+        outChain.pixels.resize(totalBytes);
+        valid = fread(outChain.pixels.data(), 1, totalBytes, file) == totalBytes;
+    }
+
+    fclose(file);
+    return valid;
+}
+
+bool saveMipChainCache(const std::string& cachePath, uint64_t assetKey, const MipChain& chain)
+{
+    // Write to a temp file and rename, so a crash mid write never leaves a truncated cache behind.
+    const std::string tempPath = cachePath + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file) return false;
+
+    const MipCacheHeader header = {
+        .magic = mipCacheMagic,
+        .version = mipCacheVersion,
+        .assetKey = assetKey,
+        .width = chain.width,
+        .height = chain.height,
+        .levelCount = (int32_t)chain.levels.size(),
+        .__padding = 0,
+    };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(chain.pixels.data(), 1, chain.pixels.size(), file) == chain.pixels.size();
+    fclose(file);
+
+    if (written) written = rename(tempPath.c_str(), cachePath.c_str()) == 0;
+    if (!written) remove(tempPath.c_str());
+    return written;
+}
@@ -0,0 +1,54 @@
+//
+//  TextureMips.hpp
+//  Metal Playground macOS CPP
+//
+//  Created by Rayner Tan on 18/10/26.
+//
+
+#ifndef TextureMips_hpp
+#define TextureMips_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Pixel rect of a single sprite / glyph inside an atlas texture.
+// Top-left origin, same as the image rows and the main_atlas.txt entries.
+struct TextureRegion {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+struct MipLevel {
+    int width;
+    int height;
+    size_t offset; // byte offset into MipChain::pixels
+};
+
+// RGBA8 mip chain, all levels packed back to back (level 0 first).
+struct MipChain {
+    int width = 0;
+    int height = 0;
+    std::vector<MipLevel> levels;
+    std::vector<uint8_t> pixels;
+};
+
+int mipLevelCountForSize(int width, int height);
+
+// Box filters the full mip chain from the level 0 RGBA8 pixels.
+// Pixels inside a region only ever sample from the same region of the previous level, so sprites don't bleed into their neighbours.
+void generateMipChain(const uint8_t* rgbaPixels, int width, int height, const std::vector<TextureRegion>& regions, MipChain& outChain);
+
+// In place straight -> premultiplied alpha conversion of RGBA8 pixels.
+void premultiplyAlpha(uint8_t* rgbaPixels, size_t pixelCount);
+
+// FNV-1a, used to key the on disk cache by the source asset contents.
+uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 0xcbf29ce484222325ull);
+
+bool loadMipChainCache(const std::string& cachePath, uint64_t assetKey, MipChain& outChain);
+bool saveMipChainCache(const std::string& cachePath, uint64_t assetKey, const MipChain& chain);
+
+#endif /* TextureMips_hpp */